@@ -0,0 +1,478 @@
+// Ray tracing benchmark over a fixed set of scenes, so that changes to the ray tracer can be
+// measured the same way every time. Every scene is made from a fixed seed, except the stock test
+// scene which is loaded from resources/save_data/test.txt, and is measured for:
+//   - the time it takes to build the ray tracer's scene and the memory that scene holds
+//   - Mrays/s on one thread for camera rays, shadow rays from the camera rays' hits towards the
+//     lights and cosine distributed diffuse rays from the same hits
+//   - the median and 99th percentile tile times of a full render on every thread
+// The results go to stdout as JSON, or to a file with --output.
+//
+// raytracer_bench [--scene <name>] [--threads N] [--width W] [--height H] [--samples S]
+//                 [--output <file>]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arrow.hpp>
+#include <camera.hpp>
+#include <cpu_features.hpp>
+#include <cube.hpp>
+#include <hollow_cylinder.hpp>
+#include <raytracer.hpp>
+#include <raytracer_scene.hpp>
+#include <scenesaver.hpp>
+#include <sphere.hpp>
+
+namespace {
+constexpr float ray_epsilon = 1e-4f;
+
+struct BenchScene {
+    std::vector<std::shared_ptr<GameObject>> objects;
+    Camera camera;
+};
+
+struct BenchResult {
+    std::string name;
+    size_t objects;
+    size_t lights;
+    float build_time;     // Milliseconds, the whole RayTracerScene
+    float bvh_build_time; // Milliseconds, the binary BVH alone
+    size_t memory;        // Bytes
+    uint64_t primary_rays;
+    uint64_t shadow_rays;
+    uint64_t diffuse_rays;
+    float primary_rate; // Mrays/s
+    float shadow_rate;
+    float diffuse_rate;
+    float render_time; // Seconds
+    unsigned int render_threads;
+    float tile_p50; // Milliseconds
+    float tile_p99;
+};
+
+// xorshift32, the scenes must come out the same with every standard library. Calls are kept in
+// statements of their own since the order function arguments are evaluated in is unspecified
+class Random {
+public:
+    explicit Random(uint32_t seed)
+        : state(seed ? seed : 1u) {
+    }
+
+    float next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return static_cast<float>(state >> 8) * (1.0f / 16777216.0f);
+    }
+
+    float range(float lower, float upper) {
+        return lower + (upper - lower) * next();
+    }
+
+    glm::vec3 range(const glm::vec3& lower, const glm::vec3& upper) {
+        float x = range(lower.x, upper.x);
+        float y = range(lower.y, upper.y);
+        float z = range(lower.z, upper.z);
+        return glm::vec3(x, y, z);
+    }
+
+private:
+    uint32_t state;
+};
+
+void lookAt(Camera& camera, const glm::vec3& position, const glm::vec3& target) {
+    camera.pos   = position;
+    camera.front = glm::normalize(target - position);
+}
+
+// Looks at the objects' bounds from the front and a little above
+void frameObjects(BenchScene& scene) {
+    glm::vec3 lower(std::numeric_limits<float>::max());
+    glm::vec3 upper(-std::numeric_limits<float>::max());
+    for (const std::shared_ptr<GameObject>& object : scene.objects) {
+        object->update_bounding_box();
+        lower = glm::min(lower, glm::vec3(object->bbox.xmin, object->bbox.ymin, object->bbox.zmin));
+        upper = glm::max(upper, glm::vec3(object->bbox.xmax, object->bbox.ymax, object->bbox.zmax));
+    }
+    glm::vec3 centre = 0.5f * (lower + upper);
+    float radius     = 0.5f * glm::length(upper - lower);
+    lookAt(scene.camera, centre + radius * glm::vec3(0.0f, 0.6f, 2.2f), centre);
+}
+
+void addLight(BenchScene& scene, const glm::vec3& position, float size) {
+    auto light = std::make_shared<Sphere>(position, glm::vec3(0.0f), glm::vec3(size),
+                                          glm::vec3(1.0f), 32.0f);
+    light->add_light(0.05f, 0.8f, 1.0f, 1.0f, 0.045f, 0.0075f);
+    scene.objects.push_back(light);
+}
+
+bool loadTestScene(BenchScene& scene) {
+    std::ifstream file(RESOURCES_PATH "save_data/test.txt");
+    if (!file) {
+        std::cout << "Could not open " RESOURCES_PATH "save_data/test.txt" << std::endl;
+        return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    scene.objects = SceneSaver::sceneFromString(text.str());
+    frameObjects(scene);
+    return true;
+}
+
+// 100 x 100 unit cubes on a floor, under a row of lights
+bool makeCubeGrid(BenchScene& scene) {
+    Random random(1);
+    for (int x = 0; x < 100; ++x) {
+        for (int z = 0; z < 100; ++z) {
+            glm::vec3 position(1.5f * static_cast<float>(x - 50), 0.0f,
+                               1.5f * static_cast<float>(z - 50));
+            glm::vec3 colour = random.range(glm::vec3(0.2f), glm::vec3(0.9f));
+            scene.objects.push_back(std::make_shared<Cube>(
+                position, glm::vec3(0.0f, random.range(0.0f, 1.5f), 0.0f), glm::vec3(1.0f),
+                colour, 32.0f));
+        }
+    }
+    for (int i = 0; i < 4; ++i) {
+        addLight(scene, glm::vec3(40.0f * static_cast<float>(i) - 60.0f, 20.0f, 0.0f), 0.5f);
+    }
+    lookAt(scene.camera, glm::vec3(0.0f, 40.0f, 110.0f), glm::vec3(0.0f));
+    return true;
+}
+
+// 100k small spheres scattered through a ball, lit from its middle and from outside
+bool makeSphereCloud(BenchScene& scene) {
+    Random random(2);
+    scene.objects.reserve(100000 + 5);
+    while (scene.objects.size() < 100000) {
+        glm::vec3 position = random.range(glm::vec3(-1.0f), glm::vec3(1.0f));
+        if (glm::dot(position, position) > 1.0f) {
+            continue;
+        }
+        glm::vec3 colour = random.range(glm::vec3(0.2f), glm::vec3(0.9f));
+        scene.objects.push_back(std::make_shared<Sphere>(30.0f * position, glm::vec3(0.0f),
+                                                         glm::vec3(random.range(0.1f, 0.3f)),
+                                                         colour, 32.0f));
+    }
+    addLight(scene, glm::vec3(0.0f), 0.5f);
+    for (int i = 0; i < 4; ++i) {
+        float angle = 1.5707964f * static_cast<float>(i);
+        addLight(scene, glm::vec3(45.0f * std::cos(angle), 20.0f, 45.0f * std::sin(angle)), 1.0f);
+    }
+    lookAt(scene.camera, glm::vec3(0.0f, 10.0f, 70.0f), glm::vec3(0.0f));
+    return true;
+}
+
+// Closed room with some furniture and an 8 x 8 grid of lights under the ceiling, for light
+// sampling more than for traversal
+bool makeManyLightRoom(BenchScene& scene) {
+    Random random(3);
+    const glm::vec3 wall_colour(0.8f);
+    auto wall = [&](const glm::vec3& position, const glm::vec3& scale) {
+        scene.objects.push_back(
+            std::make_shared<Cube>(position, glm::vec3(0.0f), scale, wall_colour, 8.0f));
+    };
+    wall(glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(20.0f, 1.0f, 20.0f));  // Floor
+    wall(glm::vec3(0.0f, 10.5f, 0.0f), glm::vec3(20.0f, 1.0f, 20.0f));  // Ceiling
+    wall(glm::vec3(-10.5f, 5.0f, 0.0f), glm::vec3(1.0f, 10.0f, 20.0f)); // Left
+    wall(glm::vec3(10.5f, 5.0f, 0.0f), glm::vec3(1.0f, 10.0f, 20.0f));  // Right
+    wall(glm::vec3(0.0f, 5.0f, -10.5f), glm::vec3(20.0f, 10.0f, 1.0f)); // Back
+    wall(glm::vec3(0.0f, 5.0f, 10.5f), glm::vec3(20.0f, 10.0f, 1.0f));  // Front, behind the camera
+
+    for (int i = 0; i < 40; ++i) {
+        glm::vec3 position =
+            random.range(glm::vec3(-8.0f, 0.0f, -8.0f), glm::vec3(8.0f, 0.0f, 4.0f));
+        glm::vec3 colour = random.range(glm::vec3(0.2f), glm::vec3(0.9f));
+        if (i % 2 == 0) {
+            glm::vec3 scale = random.range(glm::vec3(0.5f), glm::vec3(2.0f, 3.0f, 2.0f));
+            position.y = 0.5f * scale.y;
+            scene.objects.push_back(std::make_shared<Cube>(
+                position, glm::vec3(0.0f, random.range(0.0f, 1.5f), 0.0f), scale, colour, 32.0f));
+        } else {
+            float radius = random.range(0.3f, 1.0f);
+            position.y   = radius;
+            scene.objects.push_back(std::make_shared<Sphere>(position, glm::vec3(0.0f),
+                                                             glm::vec3(radius), colour, 64.0f));
+        }
+    }
+    for (int x = 0; x < 8; ++x) {
+        for (int z = 0; z < 8; ++z) {
+            addLight(scene,
+                     glm::vec3(2.4f * static_cast<float>(x) - 8.4f, 9.5f,
+                               2.4f * static_cast<float>(z) - 8.4f),
+                     0.15f);
+        }
+    }
+    lookAt(scene.camera, glm::vec3(0.0f, 5.0f, 9.5f), glm::vec3(0.0f, 3.0f, 0.0f));
+    return true;
+}
+
+// Field of long, thin arrows and hollow cylinders standing at all angles. Their boxes are mostly
+// empty and overlap a lot, the worst case for the BVH
+bool makeThinGeometry(BenchScene& scene) {
+    Random random(4);
+    for (int i = 0; i < 20000; ++i) {
+        glm::vec3 position =
+            random.range(glm::vec3(-25.0f, 0.0f, -25.0f), glm::vec3(25.0f, 3.0f, 25.0f));
+        glm::vec3 orientation = random.range(glm::vec3(0.0f), glm::vec3(6.2831853f));
+        glm::vec3 colour      = random.range(glm::vec3(0.2f), glm::vec3(0.9f));
+        float thickness       = random.range(0.02f, 0.08f);
+        if (i % 2 == 0) {
+            scene.objects.push_back(std::make_shared<Arrow>(
+                position, orientation, glm::vec3(thickness, thickness, random.range(1.0f, 4.0f)),
+                colour, 32.0f));
+        } else {
+            float radius = random.range(0.2f, 0.6f);
+            scene.objects.push_back(std::make_shared<HollowCylinder>(
+                position, orientation, glm::vec3(radius, radius, random.range(1.0f, 4.0f)),
+                colour, 32.0f));
+        }
+    }
+    addLight(scene, glm::vec3(-20.0f, 15.0f, 10.0f), 0.5f);
+    addLight(scene, glm::vec3(20.0f, 15.0f, -10.0f), 0.5f);
+    lookAt(scene.camera, glm::vec3(0.0f, 12.0f, 40.0f), glm::vec3(0.0f, 0.0f, 0.0f));
+    return true;
+}
+
+struct SceneDefinition {
+    const char* name;
+    bool (*make)(BenchScene& scene);
+};
+
+const std::vector<SceneDefinition>& sceneDefinitions() {
+    static const std::vector<SceneDefinition> definitions = {
+        {"test", loadTestScene},
+        {"cube_grid_10k", makeCubeGrid},
+        {"sphere_cloud_100k", makeSphereCloud},
+        {"many_light_room", makeManyLightRoom},
+        {"thin_geometry", makeThinGeometry},
+    };
+    return definitions;
+}
+
+// Cosine distributed direction around normal
+glm::vec3 diffuseDirection(const glm::vec3& normal, float u1, float u2) {
+    glm::vec3 tangent = std::abs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f)
+                                                    : glm::vec3(1.0f, 0.0f, 0.0f);
+    tangent             = glm::normalize(glm::cross(normal, tangent));
+    glm::vec3 bitangent = glm::cross(normal, tangent);
+    float radius        = std::sqrt(u1);
+    float angle         = 6.2831853f * u2;
+    return glm::normalize(radius * std::cos(angle) * tangent +
+                          radius * std::sin(angle) * bitangent +
+                          std::sqrt(std::max(0.0f, 1.0f - u1)) * normal);
+}
+
+float millionsPerSecond(uint64_t count, float seconds) {
+    return static_cast<float>(count) / std::max(seconds, 1e-6f) * 1e-6f;
+}
+
+float secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Nearest rank percentile, q in [0, 1]
+float percentile(std::vector<float> values, float q) {
+    if (values.empty()) {
+        return 0.0f;
+    }
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(q * static_cast<float>(values.size())));
+    return values[std::min(std::max(rank, size_t(1)), values.size()) - 1];
+}
+
+BenchResult runScene(const SceneDefinition& definition, BenchScene& bench_scene,
+                     const RayTracerSettings& settings) {
+    BenchResult result;
+    result.name = definition.name;
+
+    auto start = std::chrono::steady_clock::now();
+    RayTracerScene scene(bench_scene.objects);
+    result.build_time     = secondsSince(start) * 1000.0f;
+    result.bvh_build_time = scene.bvh.build_stats.build_time;
+    result.objects        = scene.primitives.size();
+    result.lights         = scene.lights.size();
+    result.memory         = scene.memoryUsage();
+
+    // Camera rays through the pixel centres, keeping their hits for the other two kinds
+    CameraFrame frame(bench_scene.camera, settings.width, settings.height);
+    std::vector<HitRecord> hits;
+    hits.reserve(static_cast<size_t>(settings.width) * settings.height);
+    start = std::chrono::steady_clock::now();
+    for (unsigned int y = 0; y < settings.height; ++y) {
+        for (unsigned int x = 0; x < settings.width; ++x) {
+            Ray ray = frame.generateRay(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f);
+            HitRecord hit;
+            if (scene.intersect(ray, ray_epsilon, std::numeric_limits<float>::max(), hit)) {
+                hits.push_back(hit);
+            }
+        }
+    }
+    result.primary_rate = millionsPerSecond(
+        static_cast<uint64_t>(settings.width) * settings.height, secondsSince(start));
+    result.primary_rays = static_cast<uint64_t>(settings.width) * settings.height;
+
+    // One shadow ray per hit, to the lights in turn
+    result.shadow_rays = 0;
+    start              = std::chrono::steady_clock::now();
+    if (!scene.lights.empty()) {
+        for (size_t i = 0; i < hits.size(); ++i) {
+            const HitRecord& hit     = hits[i];
+            const SceneLight& light  = scene.lights[i % scene.lights.size()];
+            glm::vec3 origin         = hit.position + ray_epsilon * hit.normal;
+            glm::vec3 to_light       = light.position - origin;
+            float distance           = glm::length(to_light);
+            if (distance <= ray_epsilon) {
+                continue;
+            }
+            scene.occluded(Ray(origin, to_light / distance), ray_epsilon, distance,
+                           light.primitive_index);
+            result.shadow_rays++;
+        }
+    }
+    result.shadow_rate = millionsPerSecond(result.shadow_rays, secondsSince(start));
+
+    // One diffuse bounce per hit
+    Random random(5);
+    start = std::chrono::steady_clock::now();
+    for (const HitRecord& hit : hits) {
+        float u1            = random.next();
+        float u2            = random.next();
+        glm::vec3 direction = diffuseDirection(hit.normal, u1, u2);
+        HitRecord bounce;
+        scene.intersect(Ray(hit.position + ray_epsilon * hit.normal, direction), ray_epsilon,
+                        std::numeric_limits<float>::max(), bounce);
+    }
+    result.diffuse_rays = hits.size();
+    result.diffuse_rate = millionsPerSecond(result.diffuse_rays, secondsSince(start));
+
+    RayTracer raytracer(settings);
+    raytracer.render(scene, bench_scene.camera);
+    result.render_time    = raytracer.last_render_time;
+    result.render_threads = raytracer.last_num_threads;
+    result.tile_p50       = percentile(raytracer.last_tile_stats.tile_times, 0.5f);
+    result.tile_p99       = percentile(raytracer.last_tile_stats.tile_times, 0.99f);
+    return result;
+}
+
+void writeJSON(std::ostream& out, const std::vector<BenchResult>& results,
+               const RayTracerSettings& settings) {
+    out << "{\n";
+    out << "  \"simd\": \"" << CPU::simdLevelName(CPU::detectSIMDLevel()) << "\",\n";
+    out << "  \"width\": " << settings.width << ",\n";
+    out << "  \"height\": " << settings.height << ",\n";
+    out << "  \"samples_per_pixel\": " << settings.samples_per_pixel << ",\n";
+    out << "  \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        out << "    {\n";
+        out << "      \"name\": \"" << result.name << "\",\n";
+        out << "      \"objects\": " << result.objects << ",\n";
+        out << "      \"lights\": " << result.lights << ",\n";
+        out << "      \"build_ms\": " << result.build_time << ",\n";
+        out << "      \"bvh_build_ms\": " << result.bvh_build_time << ",\n";
+        out << "      \"memory_bytes\": " << result.memory << ",\n";
+        out << "      \"primary_rays\": " << result.primary_rays << ",\n";
+        out << "      \"primary_mrays_per_s\": " << result.primary_rate << ",\n";
+        out << "      \"shadow_rays\": " << result.shadow_rays << ",\n";
+        out << "      \"shadow_mrays_per_s\": " << result.shadow_rate << ",\n";
+        out << "      \"diffuse_rays\": " << result.diffuse_rays << ",\n";
+        out << "      \"diffuse_mrays_per_s\": " << result.diffuse_rate << ",\n";
+        out << "      \"render_s\": " << result.render_time << ",\n";
+        out << "      \"render_threads\": " << result.render_threads << ",\n";
+        out << "      \"tile_ms_p50\": " << result.tile_p50 << ",\n";
+        out << "      \"tile_ms_p99\": " << result.tile_p99 << "\n";
+        out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program
+              << " [--scene <name>] [--threads N] [--width W] [--height H] [--samples S]"
+                 " [--output <file>]\nScenes:";
+    for (const SceneDefinition& definition : sceneDefinitions()) {
+        std::cout << " " << definition.name;
+    }
+    std::cout << std::endl;
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Fixed work per render, adaptive sampling would make it depend on the noise
+    RayTracerSettings settings;
+    settings.width             = 640;
+    settings.height            = 360;
+    settings.samples_per_pixel = 4;
+    settings.adaptive_sampling = false;
+
+    std::string only_scene;
+    std::string output;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--scene") == 0 && has_value) {
+            only_scene = argv[++i];
+        } else if (std::strcmp(argv[i], "--threads") == 0 && has_value) {
+            settings.num_threads = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--width") == 0 && has_value) {
+            settings.width = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--height") == 0 && has_value) {
+            settings.height = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--samples") == 0 && has_value) {
+            settings.samples_per_pixel =
+                static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--output") == 0 && has_value) {
+            output = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (settings.width == 0 || settings.height == 0 || settings.samples_per_pixel == 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    for (const SceneDefinition& definition : sceneDefinitions()) {
+        if (!only_scene.empty() && only_scene != definition.name) {
+            continue;
+        }
+        BenchScene bench_scene;
+        if (!definition.make(bench_scene)) {
+            return 1;
+        }
+        // Progress goes to stderr so stdout is left with the JSON alone
+        std::cerr << "Benchmarking " << definition.name << ", " << bench_scene.objects.size()
+                  << " objects" << std::endl;
+        results.push_back(runScene(definition, bench_scene, settings));
+    }
+    if (results.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (output.empty()) {
+        writeJSON(std::cout, results, settings);
+        return 0;
+    }
+    std::ofstream file(output);
+    writeJSON(file, results, settings);
+    if (!file) {
+        std::cout << "Could not write " << output << std::endl;
+        return 1;
+    }
+    std::cerr << "Results written to " << output << std::endl;
+    return 0;
+}
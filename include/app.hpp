@@ -6,14 +6,20 @@
 #include <arrow.hpp>
 #include <camera.hpp>
 #include <cube.hpp>
+#include <denoiser.hpp>
+#include <distributed_render.hpp>
 #include <gizmo.hpp>
 #include <glfwwindowmanager.hpp>
 #include <hollow_cylinder.hpp>
 #include <math.hpp>
+#include <progressive_renderer.hpp>
+#include <raytracer.hpp>
+#include <render_checkpoint.hpp>
 #include <renderer.hpp>
 #include <scenesaver.hpp>
 #include <skybox.hpp>
 #include <sphere.hpp>
+#include <tiled_image_writer.hpp>
 
 class App {
 public:
@@ -28,6 +34,9 @@ public:
 
     void resetObjectPointers();
 
+    // Makes the offline render trace only region of its frame, an empty region renders all of it
+    void setRayTracerRegion(const ImageRegion& region);
+
 private:
     // Window properties
     int window_x;
@@ -53,6 +62,52 @@ private:
     // Renderer
     Renderer renderer;
 
+    // Ray tracer
+    RayTracer raytracer;
+    bool use_raytracer_camera;
+    SceneAccelerator raytracer_accelerator;
+    CPU::SIMDLevel raytracer_simd_level;
+    BVHBuildSettings raytracer_bvh_build;
+    bool raytracer_write_timing_map;
+    bool raytracer_write_sample_map;
+
+    // Progress of the offline render, saved next to the scene file so it survives a crash
+    RenderCheckpoint render_checkpoint;
+    bool raytracer_checkpoint;
+
+    // Write the offline render tile by tile to save_data/render.pfm instead of keeping it, for
+    // resolutions too big for memory
+    bool raytracer_stream_to_file;
+
+    // Seconds the offline render may take, 0 renders samples_per_pixel instead
+    float raytracer_time_budget;
+
+    // Offline renders split between worker processes started with --render-worker <address>
+    DistributedCoordinator distributed_render;
+    bool raytracer_distributed;
+    char raytracer_distributed_address[128];
+
+    // Part of the offline render's frame to trace on its own, pasted over the last full render or
+    // the viewport. Set by dragging out a rectangle in the viewport once selecting_region is on
+    bool raytracer_use_region;
+    ImageRegion raytracer_region;
+    bool raytracer_region_over_last_render;
+    bool selecting_region;
+    bool dragging_region;
+    glm::vec2 region_drag_start; // Window coordinates
+
+    // Denoising of the offline render
+    Denoiser denoiser;
+    bool raytracer_denoise;
+    Image reference_image; // Some earlier render, usually at a high sample count
+    Image last_render;
+    float last_render_error;   // RMSE to reference_image, -1 without a matching reference
+    float last_denoised_error; // Likewise for the denoised render
+
+    // Ray traced viewport
+    ProgressiveRenderer progressive_renderer;
+    Image viewport_image;
+
     // unsigned int num_lights;
     const unsigned int max_lights;
 
@@ -101,6 +156,29 @@ private:
 
     void renderImGUI();
 
+    void renderRayTracedImage();
+
+    void renderDistributedImage();
+
+    // Writes out a finished offline render, compares it to the reference and denoises it
+    void finishRayTracedImage(Image image, const FeatureBuffers& features,
+                              const ImageRegion& region);
+
+    // What a region render is pasted over, the size of the ray tracer's frame
+    Image regionBackdrop() const;
+
+    // Rectangle between two window positions in the ray tracer's frame
+    ImageRegion windowToFrameRegion(const glm::vec2& corner_a, const glm::vec2& corner_b) const;
+
+    void updateRayTracedViewport();
+
+    // Builds the BVH of the visible objects with every builder and prints their times and costs
+    void compareBVHBuilders();
+
+    // Traces the ray tracer camera's primary rays through every BVH node layout and prints their
+    // node memory and rays per second
+    void compareBVHLayouts();
+
     // Pseudo initialising functions
     void addCube(glm::vec3 pos, glm::vec3 orientation, glm::vec3 scale, glm::vec3 colour,
                  float shininess);
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <aabb.hpp>
+#include <ray.hpp>
+
+// Node of a binary BVH stored in a flat array. The two children of an interior node are always
+// stored next to each other so only the index of the left one is needed.
+struct BVHNode {
+    glm::vec3 bounds_min;
+    unsigned int left_first; // Interior: index of the left child. Leaf: first primitive index
+    glm::vec3 bounds_max;
+    unsigned int count; // Number of primitives in a leaf, 0 for interior nodes
+};
+
+// Binned SAH builds the best trees. LBVH sorts the primitives along a Morton curve through their
+// centroids and cuts the curve into a hierarchy, in linear time and in parallel, for scenes too
+// big to rebuild with SAH while editing
+enum class BVHBuilder { BINNED_SAH, LBVH };
+
+[[nodiscard]] const char* bvhBuilderName(BVHBuilder builder);
+
+struct BVHBuildSettings {
+    BVHBuildSettings();
+
+    BVHBuilder builder;
+    unsigned int num_threads; // LBVH only, 0 uses every hardware thread
+    bool optimize_treelets;   // LBVH only, see BVH::buildLBVH()
+};
+
+struct BVHBuildStats {
+    BVHBuildStats();
+
+    float build_time; // Milliseconds
+    unsigned int num_primitives;
+    unsigned int num_nodes;
+    unsigned int num_leaves;
+    unsigned int max_depth;
+    float sah_cost; // Expected cost of a random ray, in units of one primitive intersection
+    BVHBuilder builder;
+    unsigned int morton_bits; // LBVH only, length of the codes the primitives were sorted by
+};
+
+struct BVHTraversalStats {
+    BVHTraversalStats();
+
+    void add(const BVHTraversalStats& other);
+
+    uint64_t rays;
+    uint64_t nodes_visited; // A packet visiting a node counts once for all of its rays
+    uint64_t primitive_tests;
+    uint64_t packets;          // Ray packets traced as a whole
+    uint64_t packet_fallbacks; // Ray packets too incoherent to be traced as a whole
+};
+
+// Bounding volume hierarchy built with the binned surface area heuristic
+class BVH {
+public:
+    BVH();
+
+    // Binned SAH build
+    void build(const std::vector<AABB>& primitive_bounds);
+
+    // Linear BVH build. The centroids get 30 bit Morton codes, or 63 bit ones past a million
+    // primitives, and are sorted by them with a parallel radix sort. Ranges of the sorted
+    // primitives are then split where their codes first differ, the top levels on the calling
+    // thread and the subtrees below them in parallel, and subtrees small enough are collapsed
+    // into leaves where SAH says it pays. optimize_treelets then rearranges every treelet of up to
+    // 7 subtrees into the topology with the lowest SAH cost, which wins back much of the gap to
+    // the binned build. num_threads 0 uses every hardware thread
+    void buildLBVH(const std::vector<AABB>& primitive_bounds, unsigned int num_threads,
+                   bool optimize_treelets);
+
+    // Either of the above
+    void build(const std::vector<AABB>& primitive_bounds, const BVHBuildSettings& settings);
+
+    // Grows or shrinks the leaves holding the moved primitives to their new bounds, along with
+    // every node on the way up to the root, keeping the tree's topology. Far cheaper than build()
+    // when a few primitives moved, but the tree gets looser the further they move from where it
+    // was built, see getSAHCostGrowth(). Nodes whose bounds changed are appended to changed_nodes
+    // unless it is nullptr
+    void refit(const std::vector<AABB>& primitive_bounds, const std::vector<unsigned int>& moved,
+               std::vector<unsigned int>* changed_nodes = nullptr);
+
+    // SAH cost of the tree as it is now, after any refits
+    [[nodiscard]] float getSAHCost() const;
+
+    // Ratio of the tree's SAH cost now to its cost when built, both measured against the root as
+    // it was built. Refitting grows the root along with everything else when primitives spread
+    // out, measured against the root as it is now the cost could even drop
+    [[nodiscard]] float getSAHCostGrowth() const;
+    [[nodiscard]] unsigned int getNumRefits() const; // Since the last build
+
+    // Closest hit traversal. intersect_leaf(first, count, t_min, t_max) must test the primitives
+    // primitive_indices[first, first + count) of a leaf and, on a hit closer than t_max, shrink
+    // t_max and return true. Handing over whole leaves lets the caller test primitives in batches.
+    template <typename LeafIntersector>
+    bool intersect(const Ray& ray, float t_min, float& t_max, LeafIntersector&& intersect_leaf,
+                   BVHTraversalStats* stats = nullptr) const;
+
+    // Any hit traversal for shadow rays. occluded_leaf(first, count, t_min, t_max) must return
+    // whether any primitive of the leaf is hit within (t_min, t_max). Returns as soon as one leaf
+    // says so, children are visited in whatever order since the closest hit is never needed
+    template <typename LeafOcclusionTest>
+    bool occluded(const Ray& ray, float t_min, float t_max, LeafOcclusionTest&& occluded_leaf,
+                  BVHTraversalStats* stats = nullptr) const;
+
+    std::vector<BVHNode> nodes;
+    std::vector<unsigned int> primitive_indices; // Leaves index into this array
+
+    BVHBuildStats build_stats;
+
+    static constexpr unsigned int max_leaf_size = 8;
+    static constexpr unsigned int num_bins      = 16;
+    static constexpr unsigned int max_depth     = 64; // Also the size of the traversal stack
+
+private:
+    // Fills in the parents, the primitives' leaves and the build stats other than the build time
+    // once the nodes are laid out
+    void finishBuild();
+
+    // Sum over the nodes of their surface area weighted by their cost, the SAH cost before it is
+    // divided by the root's area. Kept up to date by refit() one node at a time
+    double computeWeightedArea() const;
+
+    std::vector<unsigned int> parents;         // Parent of every node, the root's is itself
+    std::vector<unsigned int> primitive_leaves; // Leaf holding every primitive
+    double weighted_area;
+    double built_weighted_area;
+    unsigned int num_refits;
+};
+
+// Slab test of a ray against a node's bounds. Returns the distance the ray enters the box at
+inline bool intersectNodeBounds(const BVHNode& node, const glm::vec3& origin,
+                                const glm::vec3& inv_direction, float t_min, float t_max,
+                                float& t_entry) {
+    glm::vec3 t0      = (node.bounds_min - origin) * inv_direction;
+    glm::vec3 t1      = (node.bounds_max - origin) * inv_direction;
+    glm::vec3 t_small = glm::min(t0, t1);
+    glm::vec3 t_large = glm::max(t0, t1);
+
+    float t_near = glm::max(glm::max(t_small.x, t_small.y), glm::max(t_small.z, t_min));
+    float t_far  = glm::min(glm::min(t_large.x, t_large.y), glm::min(t_large.z, t_max));
+
+    t_entry = t_near;
+    return t_near <= t_far;
+}
+
+template <typename LeafIntersector>
+bool BVH::intersect(const Ray& ray, float t_min, float& t_max, LeafIntersector&& intersect_leaf,
+                    BVHTraversalStats* stats) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    glm::vec3 inv_direction = 1.0f / ray.direction;
+
+    uint64_t nodes_visited   = 0;
+    uint64_t primitive_tests = 0;
+    bool hit                 = false;
+
+    // Pending nodes along with the distance the ray enters them at, so nodes that end up behind
+    // a closer hit can be skipped without being visited
+    float t_entry;
+    unsigned int stack[max_depth];
+    float stack_t[max_depth];
+    unsigned int stack_size = 0;
+
+    if (intersectNodeBounds(nodes[0], ray.origin, inv_direction, t_min, t_max, t_entry)) {
+        stack[stack_size]   = 0;
+        stack_t[stack_size] = t_entry;
+        stack_size++;
+    }
+
+    while (stack_size > 0) {
+        stack_size--;
+        if (stack_t[stack_size] > t_max) {
+            continue;
+        }
+        const BVHNode& node = nodes[stack[stack_size]];
+        nodes_visited++;
+
+        if (node.count > 0) {
+            primitive_tests += node.count;
+            if (intersect_leaf(node.left_first, node.count, t_min, t_max)) {
+                hit = true;
+            }
+            continue;
+        }
+
+        // Visit the closer child first so t_max shrinks as early as possible
+        float t_left, t_right;
+        bool hit_left  = intersectNodeBounds(nodes[node.left_first], ray.origin, inv_direction,
+                                             t_min, t_max, t_left);
+        bool hit_right = intersectNodeBounds(nodes[node.left_first + 1], ray.origin,
+                                             inv_direction, t_min, t_max, t_right);
+
+        if (hit_left && hit_right) {
+            unsigned int near_child = node.left_first;
+            unsigned int far_child  = node.left_first + 1;
+            if (t_right < t_left) {
+                std::swap(near_child, far_child);
+                std::swap(t_left, t_right);
+            }
+            stack[stack_size]   = far_child;
+            stack_t[stack_size] = t_right;
+            stack_size++;
+            stack[stack_size]   = near_child;
+            stack_t[stack_size] = t_left;
+            stack_size++;
+        } else if (hit_left) {
+            stack[stack_size]   = node.left_first;
+            stack_t[stack_size] = t_left;
+            stack_size++;
+        } else if (hit_right) {
+            stack[stack_size]   = node.left_first + 1;
+            stack_t[stack_size] = t_right;
+            stack_size++;
+        }
+    }
+
+    if (stats) {
+        stats->rays++;
+        stats->nodes_visited += nodes_visited;
+        stats->primitive_tests += primitive_tests;
+    }
+
+    return hit;
+}
+
+template <typename LeafOcclusionTest>
+bool BVH::occluded(const Ray& ray, float t_min, float t_max, LeafOcclusionTest&& occluded_leaf,
+                   BVHTraversalStats* stats) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    glm::vec3 inv_direction = 1.0f / ray.direction;
+
+    uint64_t nodes_visited   = 0;
+    uint64_t primitive_tests = 0;
+    bool blocked             = false;
+
+    float t_entry;
+    unsigned int stack[max_depth];
+    unsigned int stack_size = 0;
+
+    if (intersectNodeBounds(nodes[0], ray.origin, inv_direction, t_min, t_max, t_entry)) {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0 && !blocked) {
+        const BVHNode& node = nodes[stack[--stack_size]];
+        nodes_visited++;
+
+        if (node.count > 0) {
+            primitive_tests += node.count;
+            blocked = occluded_leaf(node.left_first, node.count, t_min, t_max);
+            continue;
+        }
+
+        for (unsigned int child = node.left_first; child < node.left_first + 2; ++child) {
+            if (intersectNodeBounds(nodes[child], ray.origin, inv_direction, t_min, t_max,
+                                    t_entry)) {
+                stack[stack_size++] = child;
+            }
+        }
+    }
+
+    if (stats) {
+        stats->rays++;
+        stats->nodes_visited += nodes_visited;
+        stats->primitive_tests += primitive_tests;
+    }
+
+    return blocked;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// Runtime detection of the SIMD instruction sets the ray tracer has kernels for. The kernels are
+// compiled for their instruction set with function attributes instead of global compiler flags, so
+// the same executable runs on any x86-64 machine and picks the widest kernel the CPU supports.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86 1
+#else
+#define CPU_X86 0
+#endif
+
+#if CPU_X86 && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+#else
+// MSVC lets any intrinsic be used without enabling the instruction set for the whole file
+#define TARGET_SSE42
+#define TARGET_AVX2
+#endif
+
+namespace CPU {
+
+// Ordered from narrowest to widest so levels can be compared
+enum class SIMDLevel { SCALAR, SSE42, AVX2 };
+
+// Widest level supported by both the CPU and the operating system. Only queried once
+[[nodiscard]] SIMDLevel detectSIMDLevel();
+
+[[nodiscard]] const char* simdLevelName(SIMDLevel level);
+
+} // namespace CPU
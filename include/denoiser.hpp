@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+
+#include <cpu_features.hpp>
+#include <image.hpp>
+
+// Per pixel averages of what the camera rays hit first, written by the ray tracer next to the
+// colour image. Pixels whose rays all escaped have a white albedo, a zero normal and a zero depth
+struct FeatureBuffers {
+    Image albedo;
+    Image normal;
+    std::vector<float> depth; // Distance along the camera ray, row major
+};
+
+struct DenoiserSettings {
+    DenoiserSettings();
+
+    // Bounds the denoiser clamps the settings to. Past max_iterations the taps are further apart
+    // than any image is wide, and the sigmas are divided by
+    static constexpr unsigned int max_iterations = 10;
+    static constexpr float min_sigma             = 1e-3f;
+
+    unsigned int iterations; // The filter's footprint doubles with every iteration
+    float colour_sigma;      // Halved every iteration, as in Dammertz et al.
+    float normal_sigma;
+    float depth_sigma; // Relative to the depth of the pixel being filtered, per pixel of distance
+    unsigned int num_threads; // 0 uses every hardware thread
+};
+
+// Planar copy of the filter's inputs so that a row of pixels can be loaded straight into SIMD
+// registers. The colour planes hold the irradiance, the colour divided by the albedo, so that the
+// filter never blurs one object's colour into its neighbour's
+struct DenoisePlanes {
+    unsigned int width;
+    unsigned int height;
+
+    std::vector<float> colour[3];
+    std::vector<float> normal[3];
+    std::vector<float> depth;
+};
+
+// Parameters of one à-trous iteration, shared by every span
+struct DenoisePass {
+    unsigned int step; // Distance in pixels between the taps of the 5x5 kernel
+    float inv_colour_sigma2;
+    float inv_normal_sigma;
+    float inv_depth_sigma;
+};
+
+// Filters pixels [x0, x1) of row y, reading the colour from in and writing it to out. The SIMD
+// kernels do not clamp their taps to the image, they must only be given spans where every tap of
+// every pixel lies inside it.
+using DenoiseSpanKernel = void (*)(const DenoisePlanes& planes, const float* const in[3],
+                                   float* const out[3], unsigned int y, unsigned int x0,
+                                   unsigned int x1, const DenoisePass& pass);
+
+// Edge avoiding à-trous wavelet filter (Dammertz et al. 2010). Every iteration is a sparse 5x5
+// B-spline blur whose taps are weighted down where the colour, normal or depth of the neighbour
+// differ from the centre pixel's, so edges between objects stay sharp while the Monte Carlo noise
+// on flat surfaces is averaged away. Runs on the tile scheduler's threads with the widest span
+// kernel the CPU supports.
+class Denoiser {
+public:
+    Denoiser();
+    explicit Denoiser(const DenoiserSettings& settings);
+
+    [[nodiscard]] Image denoise(const Image& colour, const FeatureBuffers& features);
+
+    // Selects the span kernel, clamped to what the CPU supports
+    void setSIMDLevel(CPU::SIMDLevel level);
+    [[nodiscard]] CPU::SIMDLevel getSIMDLevel() const;
+
+    DenoiserSettings settings;
+
+    // Statistics of the last call to denoise()
+    float last_denoise_time; // Seconds
+    unsigned int last_num_threads;
+
+private:
+    CPU::SIMDLevel simd_level;
+    DenoiseSpanKernel span_kernel;
+    unsigned int span_width; // Pixels filtered at once by span_kernel
+};
+
+// Per instruction set instantiations of the span kernel in denoiser_kernels.hpp
+void denoiseSpanScalar(const DenoisePlanes& planes, const float* const in[3], float* const out[3],
+                       unsigned int y, unsigned int x0, unsigned int x1, const DenoisePass& pass);
+void denoiseSpanSSE42(const DenoisePlanes& planes, const float* const in[3], float* const out[3],
+                      unsigned int y, unsigned int x0, unsigned int x1, const DenoisePass& pass);
+void denoiseSpanAVX2(const DenoisePlanes& planes, const float* const in[3], float* const out[3],
+                     unsigned int y, unsigned int x0, unsigned int x1, const DenoisePass& pass);
@@ -0,0 +1,125 @@
+#pragma once
+
+// Body of the denoiser's span kernels, written once against a SIMD float type F (see
+// simd_float_scalar.hpp) and instantiated by one translation unit per instruction set. Only the
+// arithmetic operations, min, max and abs are needed. This header must only be included after the
+// including file has enabled its instruction set, with <algorithm>, <cstdlib> and denoiser.hpp
+// already included before that.
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <denoiser.hpp>
+
+namespace {
+
+// exp(x) for x <= 0, as (1 + x / 256)^256. Only feeds the filter's edge stopping weights, which
+// don't need more than a percent or so of accuracy
+template <typename F>
+F denoiseExp(F x) {
+    F t = max(F::set(0.0f), F::set(1.0f) + x * F::set(1.0f / 256.0f));
+    for (int i = 0; i < 8; ++i) {
+        t = t * t;
+    }
+    return t;
+}
+
+template <typename F>
+void denoiseSpan(const DenoisePlanes& planes, const float* const in[3], float* const out[3],
+                 unsigned int y, unsigned int x0, unsigned int x1, const DenoisePass& pass) {
+    // B3 spline, the separable 5x5 kernel of the à-trous transform
+    static constexpr float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f,
+                                        1.0f / 16.0f};
+
+    const int width  = static_cast<int>(planes.width);
+    const int height = static_cast<int>(planes.height);
+    const int step   = static_cast<int>(pass.step);
+
+    // Rows at the image's border repeat the edge pixels, so do the columns when F is one wide.
+    // Wider kernels are only given spans that never need it
+    size_t tap_rows[5];
+    for (int j = 0; j < 5; ++j) {
+        tap_rows[j] = static_cast<size_t>(
+                          std::clamp(static_cast<int>(y) + (j - 2) * step, 0, height - 1)) *
+                      planes.width;
+    }
+
+    // Depth differences grow with the distance to the tap on slanted surfaces, so they are
+    // compared per pixel of distance
+    float tap_scale[5][5];
+    for (int j = 0; j < 5; ++j) {
+        for (int i = 0; i < 5; ++i) {
+            int distance    = std::max(std::abs(i - 2), std::abs(j - 2)) * step;
+            tap_scale[j][i] = distance > 0 ? 1.0f / static_cast<float>(distance) : 0.0f;
+        }
+    }
+
+    const F zero       = F::set(0.0f);
+    const F one        = F::set(1.0f);
+    const F inv_colour = F::set(pass.inv_colour_sigma2);
+    const F inv_normal = F::set(pass.inv_normal_sigma);
+
+    const size_t row = static_cast<size_t>(y) * planes.width;
+    for (unsigned int x = x0; x + F::width <= x1; x += F::width) {
+        const size_t centre = row + x;
+
+        F r  = F::load(in[0] + centre);
+        F g  = F::load(in[1] + centre);
+        F b  = F::load(in[2] + centre);
+        F nx = F::load(planes.normal[0].data() + centre);
+        F ny = F::load(planes.normal[1].data() + centre);
+        F nz = F::load(planes.normal[2].data() + centre);
+        F z  = F::load(planes.depth.data() + centre);
+
+        // Background pixels have a zero depth, the floor makes any neighbour that hit something
+        // look infinitely far from them
+        F inv_depth = F::set(pass.inv_depth_sigma) / max(z, F::set(1e-3f));
+
+        // The centre pixel always keeps its full weight so the sum of weights is never zero, even
+        // where its averaged normal is far from unit length
+        F sum_w = F::set(kernel[2] * kernel[2]);
+        F sum_r = sum_w * r;
+        F sum_g = sum_w * g;
+        F sum_b = sum_w * b;
+        for (int j = 0; j < 5; ++j) {
+            for (int i = 0; i < 5; ++i) {
+                if (i == 2 && j == 2) {
+                    continue;
+                }
+                int column = std::clamp(static_cast<int>(x) + (i - 2) * step, 0, width - 1);
+                size_t tap = tap_rows[j] + static_cast<size_t>(column);
+
+                F tap_r = F::load(in[0] + tap);
+                F tap_g = F::load(in[1] + tap);
+                F tap_b = F::load(in[2] + tap);
+
+                F dr              = tap_r - r;
+                F dg              = tap_g - g;
+                F db              = tap_b - b;
+                F colour_distance = dr * dr + dg * dg + db * db;
+
+                F normal_distance = max(zero, one - (nx * F::load(planes.normal[0].data() + tap) +
+                                                     ny * F::load(planes.normal[1].data() + tap) +
+                                                     nz * F::load(planes.normal[2].data() + tap)));
+
+                F depth_distance = abs(F::load(planes.depth.data() + tap) - z) * inv_depth *
+                                   F::set(tap_scale[j][i]);
+
+                F weight = F::set(kernel[j] * kernel[i]) *
+                           denoiseExp(zero - (colour_distance * inv_colour +
+                                              normal_distance * inv_normal + depth_distance));
+
+                sum_r = sum_r + weight * tap_r;
+                sum_g = sum_g + weight * tap_g;
+                sum_b = sum_b + weight * tap_b;
+                sum_w = sum_w + weight;
+            }
+        }
+
+        (sum_r / sum_w).storeUnaligned(out[0] + centre);
+        (sum_g / sum_w).storeUnaligned(out[1] + centre);
+        (sum_b / sum_w).storeUnaligned(out[2] + centre);
+    }
+}
+
+} // namespace
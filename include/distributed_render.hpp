@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <camera.hpp>
+#include <gameobject.hpp>
+#include <image.hpp>
+#include <raytracer.hpp>
+
+// Splits offline renders between processes, on this machine or others. The coordinator sends the
+// scene, as the text SceneSaver writes, along with the camera and the settings to every worker
+// that connects, then hands out jobs of one tile and a range of its samples. Workers send back
+// the sums of the tile's pixels, which the coordinator adds up per tile in sample order so the
+// image does not depend on which worker finished first. The jobs of a worker that disconnects,
+// takes longer than job_timeout over a job or stops reading messages for as long go back in the
+// queue for the others. With adaptive sampling every tile goes in a single job whatever
+// samples_per_job says: a range on its own would restart the convergence test and leave gaps in
+// each pixel's sample sequence, so the image would differ from a local render.
+//
+// Addresses are "unix:/path/to/socket" for a Unix domain socket or "host:port" for TCP. Only
+// POSIX systems are supported, elsewhere every call fails with a message.
+struct DistributedSettings {
+    DistributedSettings();
+
+    std::string address;
+    unsigned int samples_per_job; // 0, or adaptive sampling, renders each tile in one job
+    float connect_timeout;        // Seconds to wait for a worker whenever none is connected
+    float job_timeout;            // Seconds a worker may spend on one job, or on taking in one
+                                  // message, before it is dropped
+};
+
+struct DistributedStats {
+    DistributedStats();
+
+    unsigned int workers;      // Connected at some point during the render
+    unsigned int workers_lost; // Disconnected or timed out during the render
+    unsigned int jobs;
+    unsigned int jobs_reassigned;
+    float render_time; // Seconds
+};
+
+class DistributedCoordinator {
+public:
+    DistributedCoordinator();
+    ~DistributedCoordinator();
+
+    DistributedCoordinator(const DistributedCoordinator&)            = delete;
+    DistributedCoordinator& operator=(const DistributedCoordinator&) = delete;
+
+    // Listens on settings.address, unless already listening there. Workers stay connected between
+    // renders
+    bool listen();
+
+    // Renders the visible objects on the connected workers, waiting for workers to connect when
+    // there are none. Returns false if none turned up within connect_timeout or once *cancel is
+    // set. features is filled in if settings.feature_buffers is set and features is not nullptr
+    bool render(const std::vector<std::shared_ptr<GameObject>>& objects, const Camera& camera,
+                const RayTracerSettings& settings, SceneAccelerator accelerator, Image& image,
+                FeatureBuffers* features = nullptr, const std::atomic<bool>* cancel = nullptr);
+
+    // Hangs up on every worker and stops listening
+    void close();
+
+    [[nodiscard]] unsigned int numWorkers() const;
+
+    DistributedSettings settings;
+    DistributedStats last_stats;
+
+private:
+    struct Job {
+        unsigned int tile;
+        unsigned int range; // Index of the sample range within the tile
+        uint32_t first_sample;
+        unsigned int samples;
+    };
+
+    struct Connection {
+        int socket;
+        unsigned int capacity;    // Jobs it works on at once, 0 until its hello arrives
+        uint32_t render_id;       // Render it has the scene of
+        std::vector<char> inbox;  // Bytes received that do not make a whole message yet
+        std::map<uint32_t, float> assigned; // Job ids it is working on, and when they were sent
+    };
+
+    void acceptWorkers();
+    void dropWorker(size_t index, std::deque<uint32_t>& pending);
+
+    int listen_socket;
+    std::string listen_address;
+    std::vector<Connection> connections;
+    uint32_t render_id; // Bumped every render, so late results of an earlier one are ignored
+};
+
+// Connects to the coordinator at address and works on its jobs with num_threads threads, 0 for
+// every hardware thread, until it hangs up. Returns the process exit code
+int runRenderWorker(const std::string& address, unsigned int num_threads);
@@ -22,6 +22,8 @@ public:
 
     static void init();
 
+    static float thickness; // Fraction of the outer radius
+
 private:
     static std::vector<float> unitCircleVertices();
     static std::vector<float> generateVertexPositions();
@@ -32,7 +34,6 @@ private:
     static unsigned int VAO;
 
     static int num_sectors;
-    static float thickness; // Fraction of the outer radius
 };
 
 std::shared_ptr<HollowCylinder> createHollowCylinderFromData(std::string& data);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Rectangle of pixels [x0, x1) x [y0, y1) of an image
+struct ImageRegion {
+    ImageRegion();
+    ImageRegion(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1);
+
+    [[nodiscard]] unsigned int width() const;
+    [[nodiscard]] unsigned int height() const;
+    [[nodiscard]] bool empty() const;
+
+    // The part of the region inside a width x height image
+    [[nodiscard]] ImageRegion clamped(unsigned int width, unsigned int height) const;
+
+    unsigned int x0;
+    unsigned int y0;
+    unsigned int x1; // Exclusive
+    unsigned int y1; // Exclusive
+};
+
+// Linear RGB float image. Row 0 is the top row of the picture.
+class Image {
+public:
+    Image();
+    Image(unsigned int width, unsigned int height);
+
+    glm::vec3& at(unsigned int x, unsigned int y);
+    [[nodiscard]] const glm::vec3& at(unsigned int x, unsigned int y) const;
+
+    // Writes a binary PPM, gamma corrected the same way as screen_fshader.glsl
+    bool writePPM(const std::string& path, float gamma = 2.2f) const;
+
+    // Root mean square difference to another image over every channel, -1 if the sizes differ
+    [[nodiscard]] float rmse(const Image& reference) const;
+
+    // Copies source over this image with its top left corner at (x, y), clipped to this image
+    void paste(const Image& source, unsigned int x, unsigned int y);
+
+    // Nearest neighbour rescale
+    [[nodiscard]] Image resized(unsigned int new_width, unsigned int new_height) const;
+
+    unsigned int width;
+    unsigned int height;
+    std::vector<glm::vec3> pixels;
+};
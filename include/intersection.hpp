@@ -0,0 +1,26 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Exact ray intersection routines for the engine's primitive shapes. All of them work in
+// object space, i.e. with the shape as it is built in the shape's generateVertexPositions()
+// before the model matrix is applied. The ray direction does NOT need to be normalised so that a
+// world space ray transformed by the inverse model matrix keeps the same t parameter.
+// On a hit, t is set to the closest intersection in (t_min, t_max) and normal to the (unnormalised)
+// object space surface normal at that point.
+namespace Intersection {
+
+bool rayUnitCube(const glm::vec3& origin, const glm::vec3& direction, float t_min, float t_max,
+                 float& t, glm::vec3& normal);
+
+bool rayUnitSphere(const glm::vec3& origin, const glm::vec3& direction, float t_min, float t_max,
+                   float& t, glm::vec3& normal);
+
+bool rayHollowCylinder(const glm::vec3& origin, const glm::vec3& direction, float t_min,
+                       float t_max, float inner_radius, float& t, glm::vec3& normal);
+
+bool rayArrow(const glm::vec3& origin, const glm::vec3& direction, float t_min, float t_max,
+              float tail_radius, float tail_height, float head_radius, float head_height, float& t,
+              glm::vec3& normal);
+
+} // namespace Intersection
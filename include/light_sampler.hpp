@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct SceneLight;
+
+// How the ray tracer's next event estimation picks the lights it traces shadow rays to. ALL
+// evaluates every light at every shading point, the others pick light_samples of them at random
+enum class LightSampling { ALL, ALIAS_TABLE, LIGHT_BVH };
+
+[[nodiscard]] const char* lightSamplingName(LightSampling sampling);
+
+struct LightSample {
+    unsigned int light; // Index into RayTracerScene::lights
+    float pdf;          // Probability of picking that light, 0 if nothing could be picked
+};
+
+// Node of the light BVH, laid out like BVHNode. Leaves hold a single light
+struct LightBVHNode {
+    glm::vec3 bounds_min;
+    unsigned int left_first; // Interior: index of the left child. Leaf: index into light_indices
+    glm::vec3 bounds_max;
+    unsigned int count; // 1 for leaves, 0 for interior nodes
+
+    // Sums over the node's lights of their intensity at unit distance, for the ambient and for the
+    // diffuse plus specular terms
+    float ambient_power;
+    float direct_power;
+
+    // Smallest attenuation coefficients of the node's lights, so the node's attenuation at a
+    // distance is never underestimated
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+// Picks lights with a probability proportional to an estimate of their contribution, so the cost
+// of direct lighting at a shading point does not grow with the number of lights. The alias table
+// only knows each light's intensity, the light BVH also accounts for the distance to the lights
+// and for lights lying behind the surface, at the cost of a logarithmic walk down the tree.
+class LightSampler {
+public:
+    LightSampler();
+
+    void build(const std::vector<SceneLight>& lights);
+
+    // u is uniform in [0, 1)
+    [[nodiscard]] LightSample sampleAliasTable(float u) const;
+    [[nodiscard]] LightSample sampleLightBVH(const glm::vec3& position, const glm::vec3& normal,
+                                             float u) const;
+
+    [[nodiscard]] unsigned int numLights() const;
+
+    float build_time; // Milliseconds, both structures
+
+private:
+    struct AliasEntry {
+        float probability; // Of keeping this entry's own light rather than taking the alias
+        unsigned int alias;
+    };
+
+    // Upper bound on the contribution of a node's lights to a point with the given normal
+    [[nodiscard]] float importance(const LightBVHNode& node, const glm::vec3& position,
+                                   const glm::vec3& normal) const;
+
+    std::vector<AliasEntry> alias_table;
+    std::vector<float> light_pdfs; // Probability of every light in the alias table
+
+    std::vector<LightBVHNode> nodes;
+    std::vector<unsigned int> light_indices; // Leaves index into this array
+};
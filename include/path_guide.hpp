@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Incident radiance arriving at a path vertex from one direction, as the path tracer measured it
+struct PathGuideRecord {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 direction; // Towards where the radiance came from
+    float value;         // Luminance of the radiance times the cosine, over the direction's pdf
+};
+
+// Directional distribution learnt in one cell of the guide. Directions are binned over the whole
+// sphere in world space, bins_z equal steps of z by bins_phi of the angle around z, so every bin
+// covers the same solid angle
+struct PathGuideCell {
+    static constexpr unsigned int bins_z   = 16;
+    static constexpr unsigned int bins_phi = 16;
+    static constexpr unsigned int bins     = bins_z * bins_phi;
+
+    bool usable;     // Whether buildDistributions() found enough records to sample from
+    float cdf[bins]; // cdf[bins - 1] is 1
+};
+
+struct PathGuideStats {
+    PathGuideStats();
+
+    unsigned int cells;        // Cells records landed in
+    unsigned int usable_cells; // Of those, the ones sampled from
+    unsigned int capacity;     // Cells the memory budget allows
+    size_t memory;             // Bytes allocated for the cells
+    size_t memory_budget;      // Bytes they may take, at most
+    uint64_t records;
+    uint64_t dropped_records; // Lost because their cell did not fit in the table
+    unsigned int training_passes;
+    float training_time; // Milliseconds
+};
+
+// Path guiding cache learning where incident radiance comes from over the scene, so bounces can be
+// sent towards bright regions rather than only along the cosine lobe. Space is cut into a uniform
+// grid of cubes, and each cube further by the side its surfaces face, and only the cells that
+// records land in are stored, in an open addressing hash table whose size is fixed by the memory
+// budget up front. Once it is full, records for new cells are dropped and counted.
+//
+// Records are summed apart from the distributions sampled from, which only change in
+// buildDistributions(), so paths can keep sampling the last distributions while their own records
+// are being added.
+class PathGuide {
+public:
+    // Cells need this many records before they are sampled from
+    static constexpr unsigned int min_cell_records = 16;
+
+    PathGuide();
+
+    // Empties the guide and lays resolution cubes along the longest side of the box, with as many
+    // cells as fit in memory_budget bytes
+    void reset(const glm::vec3& bounds_min, const glm::vec3& bounds_max, unsigned int resolution,
+               size_t memory_budget);
+
+    // Values are summed in fixed point, so the distributions do not depend on the order records
+    // come in. Which cells get dropped once the table is full does, add them in a fixed order for
+    // that not to depend on the threads
+    void addRecords(const std::vector<PathGuideRecord>& records);
+
+    // Turns the records added so far into the distributions sample() and pdf() use
+    void buildDistributions();
+
+    // Cell holding the point, nullptr if it has no usable distribution
+    [[nodiscard]] const PathGuideCell* find(const glm::vec3& position,
+                                            const glm::vec3& normal) const;
+
+    // Direction drawn from the cell's distribution, u1 and u2 uniform in [0, 1), and its pdf per
+    // unit solid angle
+    [[nodiscard]] static glm::vec3 sample(const PathGuideCell& cell, float u1, float u2);
+    [[nodiscard]] static float pdf(const PathGuideCell& cell, const glm::vec3& direction);
+
+    // Whether any cell can be sampled from
+    [[nodiscard]] bool isTrained() const;
+
+    [[nodiscard]] PathGuideStats getStats() const;
+
+    // Written by whoever trains the guide
+    unsigned int training_passes;
+    float training_time; // Milliseconds
+
+private:
+    // Key of the cell holding the point, never 0
+    [[nodiscard]] uint64_t cellKey(const glm::vec3& position, const glm::vec3& normal) const;
+
+    // Slot of keys holding key, or the empty slot it would go in. -1 if neither is found within
+    // max_probes slots
+    [[nodiscard]] static int64_t findSlot(const std::vector<uint64_t>& keys, uint64_t key);
+
+    // Records summed in one cell since the reset
+    struct CellRecords {
+        unsigned int records;
+        uint64_t weights[PathGuideCell::bins]; // Sums of the records' values per bin, fixed point
+    };
+
+    // Bytes per slot of the tables
+    static constexpr size_t slot_size =
+        2 * sizeof(uint64_t) + sizeof(CellRecords) + sizeof(PathGuideCell);
+
+    // Tables of the same power of two size, indexed by slot. A key of 0 marks an empty slot
+    std::vector<uint64_t> record_keys;
+    std::vector<CellRecords> cell_records;
+    std::vector<uint64_t> cell_keys; // record_keys as of the last buildDistributions()
+    std::vector<PathGuideCell> cells;
+
+    glm::vec3 grid_min;
+    float inv_cell_size;
+
+    size_t memory_budget;
+    unsigned int used_cells;
+    unsigned int usable_cells;
+    uint64_t records;
+    uint64_t dropped_records;
+};
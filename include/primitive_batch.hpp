@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <cpu_features.hpp>
+#include <ray.hpp>
+
+enum class PrimitiveType { CUBE, SPHERE, HOLLOW_CYLINDER, ARROW };
+
+// Dimensions of the object space shapes that are shared by every object of a type
+struct ShapeParameters {
+    float hollow_cylinder_inner_radius;
+    float arrow_tail_radius;
+    float arrow_tail_height;
+    float arrow_head_radius;
+    float arrow_head_height;
+};
+
+// Structure of arrays copy of the primitives' world to object transforms, ordered like the BVH's
+// primitive_indices so that the primitives of a leaf sit next to each other. Leaves are sorted by
+// type, so a run of primitives of the same type can be loaded straight into SIMD registers.
+struct PrimitiveBatches {
+    PrimitiveBatches();
+
+    // order[i] is the primitive stored in slot i
+    void build(const std::vector<unsigned int>& order, const std::vector<PrimitiveType>& types,
+               const std::vector<glm::mat4>& world_to_object);
+
+    // Replaces the transform held in one slot, for primitives that moved since the build
+    void setTransform(unsigned int slot, const glm::mat4& world_to_object);
+
+    // Rows of the 3x4 affine part of each world to object matrix, world_to_object[row * 4 + col][i].
+    // Padded so that a full SIMD register can always be loaded
+    std::vector<float> world_to_object[12];
+    std::vector<PrimitiveType> types;
+
+    ShapeParameters shape;
+
+    static constexpr unsigned int padding = 8;
+};
+
+// Intersects one ray with count consecutive slots, starting at first, that all hold primitives of
+// the given type. t_hit[lane] is set to the closest hit of slot first + lane in (t_min, t_max) or
+// to infinity if there is none. count must not exceed the kernel's width.
+using PrimitiveBatchKernel = void (*)(const PrimitiveBatches& batches, unsigned int first,
+                                      unsigned int count, PrimitiveType type, const Ray& ray,
+                                      float t_min, float t_max, float* t_hit);
+
+// Widest batch kernel supported at the given SIMD level, along with how many primitives it tests at
+// once. Returns nullptr at the scalar level, primitives are then tested one by one
+[[nodiscard]] PrimitiveBatchKernel selectPrimitiveBatchKernel(CPU::SIMDLevel level,
+                                                              unsigned int& width);
+
+// Per instruction set instantiations of the kernel in primitive_batch_kernels.hpp
+void intersectPrimitiveBatchSSE42(const PrimitiveBatches& batches, unsigned int first,
+                                  unsigned int count, PrimitiveType type, const Ray& ray,
+                                  float t_min, float t_max, float* t_hit);
+void intersectPrimitiveBatchAVX2(const PrimitiveBatches& batches, unsigned int first,
+                                 unsigned int count, PrimitiveType type, const Ray& ray,
+                                 float t_min, float t_max, float* t_hit);
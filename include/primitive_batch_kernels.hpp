@@ -0,0 +1,243 @@
+#pragma once
+
+// Body of the primitive batch kernels, written once against a small SIMD float type F and
+// instantiated by one translation unit per instruction set. F must provide:
+//   F::width, F::set(float), F::load(const float*) (unaligned), store(float*) (aligned),
+//   + - * / on F, comparisons returning an all-ones/all-zeros lane mask of type F,
+//   & and | on masks, andNot(a, b) = ~a & b, select(mask, a, b), min, max, sqrt and abs.
+// This header must only be included after the including file has enabled its instruction set,
+// with <limits> and primitive_batch.hpp already included before that.
+
+#include <limits>
+
+#include <primitive_batch.hpp>
+
+namespace {
+
+template <typename F>
+struct Vec3Lanes {
+    F x;
+    F y;
+    F z;
+};
+
+// SIMD version of the ClosestHit helper in intersection.cpp
+template <typename F>
+struct BatchClosestHit {
+    BatchClosestHit(F t_min, F t_max)
+        : t_min(t_min)
+        , t(t_max)
+        , found(F::set(0.0f) > F::set(1.0f)) {}
+
+    void consider(F candidate_t, F valid) {
+        valid = valid & (candidate_t > t_min) & (candidate_t < t);
+        t     = select(valid, candidate_t, t);
+        found = found | valid;
+    }
+
+    F t_min;
+    F t;
+    F found;
+};
+
+template <typename F>
+F batchMiss() {
+    return F::set(std::numeric_limits<float>::infinity());
+}
+
+template <typename F>
+F batchCube(const Vec3Lanes<F>& o, const Vec3Lanes<F>& d, F t_min, F t_max) {
+    // Slab test against [-0.5, 0.5]^3, see Intersection::rayUnitCube
+    F one      = F::set(1.0f);
+    F half     = F::set(0.5f);
+    F neg_half = F::set(-0.5f);
+
+    F inv_x = one / d.x;
+    F inv_y = one / d.y;
+    F inv_z = one / d.z;
+
+    F t0x = (neg_half - o.x) * inv_x;
+    F t1x = (half - o.x) * inv_x;
+    F t0y = (neg_half - o.y) * inv_y;
+    F t1y = (half - o.y) * inv_y;
+    F t0z = (neg_half - o.z) * inv_z;
+    F t1z = (half - o.z) * inv_z;
+
+    F t_near = max(max(min(t0x, t1x), min(t0y, t1y)), min(t0z, t1z));
+    F t_far  = min(min(max(t0x, t1x), max(t0y, t1y)), max(t0z, t1z));
+
+    // If the ray starts inside the cube, the exit point is the visible one
+    F t     = select(t_near > t_min, t_near, t_far);
+    F valid = andNot(t_near > t_far, (t > t_min) & (t < t_max));
+    return select(valid, t, batchMiss<F>());
+}
+
+template <typename F>
+F batchSphere(const Vec3Lanes<F>& o, const Vec3Lanes<F>& d, F t_min, F t_max) {
+    F a = d.x * d.x + d.y * d.y + d.z * d.z;
+    F b = o.x * d.x + o.y * d.y + o.z * d.z;
+    F c = o.x * o.x + o.y * o.y + o.z * o.z - F::set(1.0f);
+
+    F discriminant = b * b - a * c;
+    F root         = sqrt(max(discriminant, F::set(0.0f)));
+
+    F t_near = (F::set(0.0f) - b - root) / a;
+    F t_far  = (root - b) / a;
+
+    F near_valid = (t_near > t_min) & (t_near < t_max);
+    F far_valid  = (t_far > t_min) & (t_far < t_max);
+
+    F valid = (discriminant >= F::set(0.0f)) & (near_valid | far_valid);
+    return select(valid, select(near_valid, t_near, t_far), batchMiss<F>());
+}
+
+// Side of the cylinder x^2 + y^2 = radius^2 between z_min and z_max
+template <typename F>
+void batchCylinderSide(const Vec3Lanes<F>& o, const Vec3Lanes<F>& d, float radius, float z_min,
+                       float z_max, BatchClosestHit<F>& hit) {
+    F a = d.x * d.x + d.y * d.y;
+    F b = o.x * d.x + o.y * d.y;
+    F c = o.x * o.x + o.y * o.y - F::set(radius * radius);
+
+    F discriminant = b * b - a * c;
+    // Rays parallel to the axis never hit the side
+    F valid = (a >= F::set(1e-12f)) & (discriminant >= F::set(0.0f));
+    F root  = sqrt(max(discriminant, F::set(0.0f)));
+
+    F lower  = F::set(z_min);
+    F upper  = F::set(z_max);
+    F t_near = (F::set(0.0f) - b - root) / a;
+    F t_far  = (root - b) / a;
+    F z      = o.z + t_near * d.z;
+    hit.consider(t_near, valid & (z >= lower) & (z <= upper));
+    z = o.z + t_far * d.z;
+    hit.consider(t_far, valid & (z >= lower) & (z <= upper));
+}
+
+// Plane z = z_plane, only where the radial distance squared lies within [r2_min, r2_max]
+template <typename F>
+void batchDisk(const Vec3Lanes<F>& o, const Vec3Lanes<F>& d, float z_plane, float r2_min,
+               float r2_max, BatchClosestHit<F>& hit) {
+    F t  = (F::set(z_plane) - o.z) / d.z;
+    F px = o.x + t * d.x;
+    F py = o.y + t * d.y;
+    F r2 = px * px + py * py;
+
+    F valid = (abs(d.z) >= F::set(1e-12f)) & (r2 >= F::set(r2_min)) & (r2 <= F::set(r2_max));
+    hit.consider(t, valid);
+}
+
+template <typename F>
+F batchHollowCylinder(const Vec3Lanes<F>& o, const Vec3Lanes<F>& d, F t_min, F t_max,
+                      float inner_radius) {
+    BatchClosestHit<F> hit(t_min, t_max);
+
+    batchCylinderSide(o, d, 1.0f, -0.5f, 0.5f, hit);
+    batchCylinderSide(o, d, inner_radius, -0.5f, 0.5f, hit);
+
+    float r2_inner = inner_radius * inner_radius;
+    batchDisk(o, d, 0.5f, r2_inner, 1.0f, hit);
+    batchDisk(o, d, -0.5f, r2_inner, 1.0f, hit);
+
+    return select(hit.found, hit.t, batchMiss<F>());
+}
+
+template <typename F>
+F batchArrow(const Vec3Lanes<F>& o, const Vec3Lanes<F>& d, F t_min, F t_max,
+             const ShapeParameters& shape) {
+    BatchClosestHit<F> hit(t_min, t_max);
+
+    float tail_top = 0.5f * shape.arrow_tail_height;
+    float apex     = tail_top + shape.arrow_head_height;
+
+    batchCylinderSide(o, d, shape.arrow_tail_radius, -tail_top, tail_top, hit);
+    batchDisk(o, d, -tail_top, 0.0f, shape.arrow_tail_radius * shape.arrow_tail_radius, hit);
+    batchDisk(o, d, tail_top, 0.0f, shape.arrow_head_radius * shape.arrow_head_radius, hit);
+
+    // Head: x^2 + y^2 = k^2 (apex - z)^2 for z in [tail_top, apex]
+    float k = shape.arrow_head_radius / shape.arrow_head_height;
+    F k2    = F::set(k * k);
+    F w     = F::set(apex) - o.z;
+    F zero  = F::set(0.0f);
+    F tiny  = F::set(1e-12f);
+
+    F a = d.x * d.x + d.y * d.y - k2 * d.z * d.z;
+    F b = o.x * d.x + o.y * d.y + k2 * w * d.z;
+    F c = o.x * o.x + o.y * o.y - k2 * w * w;
+
+    // The quadratic degenerates to a linear equation for rays parallel to the cone's surface
+    F linear       = abs(a) < tiny;
+    F discriminant = b * b - a * c;
+    F root         = sqrt(max(discriminant, zero));
+
+    F t_first  = select(linear, (zero - c) / (F::set(2.0f) * b), (zero - b - root) / a);
+    F t_second = (root - b) / a;
+
+    F first_valid  = select(linear, abs(b) > tiny, discriminant >= zero);
+    F second_valid = andNot(linear, discriminant >= zero);
+
+    F lower = F::set(tail_top);
+    F upper = F::set(apex);
+    F z     = o.z + t_first * d.z;
+    hit.consider(t_first, first_valid & (z >= lower) & (z <= upper));
+    z = o.z + t_second * d.z;
+    hit.consider(t_second, second_valid & (z >= lower) & (z <= upper));
+
+    return select(hit.found, hit.t, batchMiss<F>());
+}
+
+template <typename F>
+void intersectPrimitiveBatch(const PrimitiveBatches& batches, unsigned int first,
+                             unsigned int count, PrimitiveType type, const Ray& ray, float t_min,
+                             float t_max, float* t_hit) {
+    F m[12];
+    for (int i = 0; i < 12; ++i) {
+        m[i] = F::load(batches.world_to_object[i].data() + first);
+    }
+
+    // Ray in the object space of every primitive. The direction is left unnormalised so t is the
+    // same in both spaces. The sums are grouped like glm's matrix products so that the lanes round
+    // exactly like the scalar routines, and a grazing hit is never culled by one but not the other
+    F wx = F::set(ray.origin.x);
+    F wy = F::set(ray.origin.y);
+    F wz = F::set(ray.origin.z);
+    F vx = F::set(ray.direction.x);
+    F vy = F::set(ray.direction.y);
+    F vz = F::set(ray.direction.z);
+
+    Vec3Lanes<F> o = {(m[0] * wx + m[1] * wy) + (m[2] * wz + m[3]),
+                      (m[4] * wx + m[5] * wy) + (m[6] * wz + m[7]),
+                      (m[8] * wx + m[9] * wy) + (m[10] * wz + m[11])};
+    Vec3Lanes<F> d = {m[0] * vx + m[1] * vy + m[2] * vz, m[4] * vx + m[5] * vy + m[6] * vz,
+                      m[8] * vx + m[9] * vy + m[10] * vz};
+
+    F lower = F::set(t_min);
+    F upper = F::set(t_max);
+
+    F t;
+    switch (type) {
+    case PrimitiveType::CUBE:
+        t = batchCube(o, d, lower, upper);
+        break;
+    case PrimitiveType::SPHERE:
+        t = batchSphere(o, d, lower, upper);
+        break;
+    case PrimitiveType::HOLLOW_CYLINDER:
+        t = batchHollowCylinder(o, d, lower, upper, batches.shape.hollow_cylinder_inner_radius);
+        break;
+    case PrimitiveType::ARROW:
+        t = batchArrow(o, d, lower, upper, batches.shape);
+        break;
+    default:
+        t = batchMiss<F>();
+        break;
+    }
+
+    alignas(32) float lanes[F::width];
+    t.store(lanes);
+    for (unsigned int i = 0; i < count; ++i) {
+        t_hit[i] = lanes[i];
+    }
+}
+
+} // namespace
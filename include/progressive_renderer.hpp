@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <camera.hpp>
+#include <gameobject.hpp>
+#include <image.hpp>
+#include <raytracer.hpp>
+
+// Ray traces the viewport on a background thread, one sample per pixel per pass, and averages
+// every pass traced since the view last changed so the image converges while the camera and the
+// objects stay still. The main loop never waits on the tracer: it calls update() once per frame
+// and picks up the latest finished pass with takeLatestImage().
+//
+// Objects dragged around with the gizmos are not snapshot again every frame: a copy of the traced
+// scene takes their new transforms and its BVHs are refit along the paths from their leaves to
+// the root. Refits loosen the tree, so once its SAH cost has grown past the rebuild threshold a
+// copy is rebuilt on another thread and swapped in when done, without restarting accumulation.
+//
+// While the camera keeps moving a full resolution pass would never finish before the next restart,
+// so passes are traced at a fraction of the resolution instead and upsampled to it, guided by the
+// depth and normal of what the camera rays hit so colours do not bleed across silhouettes. The
+// fraction is adapted for passes to fit in the target frame time. Once the view has been still for
+// a couple of frames accumulation restarts at full resolution.
+class ProgressiveRenderer {
+public:
+    // Coarsest fraction of the resolution moving views are traced at, 1 / max_preview_scale
+    static constexpr unsigned int max_preview_scale = 8;
+
+    ProgressiveRenderer();
+    ~ProgressiveRenderer();
+
+    ProgressiveRenderer(const ProgressiveRenderer&)            = delete;
+    ProgressiveRenderer& operator=(const ProgressiveRenderer&) = delete;
+
+    // Compares the objects, camera and settings with the ones being traced. If anything differs
+    // accumulation restarts, abandoning the pass in flight, and changed objects are refit or the
+    // scene snapshot again on the calling thread. Also swaps in a finished background rebuild.
+    // Starts the background thread on the first call after construction or stop()
+    void update(const std::vector<std::shared_ptr<GameObject>>& objects, const Camera& camera,
+                const RayTracerSettings& settings, SceneAccelerator accelerator,
+                CPU::SIMDLevel simd_level, const BVHBuildSettings& build_settings);
+
+    // Abandons the pass in flight and joins the background thread
+    void stop();
+
+    [[nodiscard]] bool isRunning() const;
+
+    // Moves the average of every pass completed so far into image. Returns false if no pass has
+    // completed since the last call, image is left untouched then
+    bool takeLatestImage(Image& image);
+
+    // Once this many passes have been averaged the thread sleeps until the view changes again,
+    // 0 keeps refining forever
+    void setMaxPasses(unsigned int max_passes);
+    [[nodiscard]] unsigned int getMaxPasses() const;
+
+    [[nodiscard]] unsigned int getNumPasses() const; // Passes averaged into the latest image
+    [[nodiscard]] float getLastPassTime() const;     // Seconds
+
+    // Time passes of a moving view should take, the resolution they are traced at is divided by
+    // up to max_preview_scale to get there. Full resolution refinement starts once the view has
+    // not changed for twice that long. 0 always traces at full resolution
+    void setTargetFrameTime(float seconds);
+    [[nodiscard]] float getTargetFrameTime() const;
+
+    // What the resolution of the latest image was divided by when it was traced, 1 at full
+    // resolution
+    [[nodiscard]] unsigned int getPreviewScale() const;
+
+    // Growth of the traced BVH's SAH cost over refits past which it is rebuilt in the background,
+    // 0 never rebuilds
+    void setRebuildThreshold(float threshold);
+    [[nodiscard]] float getRebuildThreshold() const;
+
+    // State of the traced scene's BVH, for the calling thread only
+    [[nodiscard]] float getSAHCostGrowth() const;
+    [[nodiscard]] unsigned int getNumRefits() const; // Since it was last built
+    [[nodiscard]] unsigned int getNumRebuilds() const;
+    [[nodiscard]] bool isRebuilding() const;
+
+private:
+    void workerLoop();
+
+    // Camera and settings, which restart accumulation when they change, flattened to compare
+    // cheaply
+    std::vector<float> viewState(const Camera& camera, const RayTracerSettings& settings) const;
+
+    // Same for what the scene is made from. object_offsets receives where the values of every
+    // object start, and where they end after the last one
+    std::vector<float> sceneState(const std::vector<std::shared_ptr<GameObject>>& objects,
+                                  SceneAccelerator accelerator, CPU::SIMDLevel simd_level,
+                                  const BVHBuildSettings& build_settings,
+                                  std::vector<size_t>& object_offsets) const;
+
+    // Objects whose values differ between two scene states. Returns false if the states differ
+    // in a way refitting cannot catch up with, like another accelerator or BVH builder or an
+    // object becoming a light
+    bool changedObjects(const std::vector<float>& before, const std::vector<size_t>& before_offsets,
+                        const std::vector<float>& after, const std::vector<size_t>& after_offsets,
+                        std::vector<unsigned int>& changed) const;
+
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    bool running;
+    bool quit;
+
+    // Set to abandon the pass in flight as soon as its current tiles are done
+    std::atomic<bool> cancel_pass;
+
+    // What to trace, written by update() and read by the thread under the mutex. generation is
+    // bumped on every restart so passes traced from an older snapshot can be told apart
+    std::shared_ptr<const RayTracerScene> scene;
+    Camera camera;
+    RayTracerSettings settings;
+    unsigned int generation;
+    unsigned int max_passes;
+
+    // Resolution the current generation is traced at is the output's divided by pass_scale.
+    // preview_scale is the divisor the next moving view is traced at, adapted by the thread after
+    // every preview pass to keep them within target_frame_time
+    unsigned int output_width;
+    unsigned int output_height;
+    unsigned int pass_scale;
+    bool preview;
+    unsigned int preview_scale;
+    float target_frame_time;
+
+    // Latest averaged image, handed to the main loop
+    Image latest_image;
+    bool latest_ready;
+    unsigned int num_passes;
+    float last_pass_time;
+    unsigned int latest_scale;
+
+    // Only touched by the background thread
+    RayTracer raytracer;
+    std::vector<glm::vec3> accumulation; // Sum of every pass of the current generation
+    Image average;
+    Image upsampled; // average at the output resolution, for preview passes
+
+    // Only touched by the calling thread
+    std::vector<float> traced_state;
+    std::vector<float> previous_state; // View state of the previous update()
+    std::chrono::steady_clock::time_point last_view_change;
+    std::vector<float> traced_scene_state;
+    std::vector<size_t> traced_offsets;
+    std::vector<const GameObject*> traced_objects;
+    unsigned int snapshot; // Bumped whenever the scene is made from scratch rather than refit
+
+    // Copy of the traced scene having its acceleration structures rebuilt, with the scene state
+    // and snapshot it was copied at
+    std::future<std::shared_ptr<RayTracerScene>> rebuild;
+    std::vector<float> rebuild_state;
+    unsigned int rebuild_snapshot;
+    float rebuild_threshold;
+    unsigned int num_rebuilds;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <cpu_features.hpp>
+#include <ray.hpp>
+#include <wide_bvh.hpp>
+
+// Wide node with its child boxes quantized to 8 bits per plane, in steps of a power of two from
+// the corner of the node's own box. A 4 wide node fills one 64 byte cache line and an 8 wide node
+// two, against 160 and 288 bytes for WideBVHNode, so large scenes pull far less memory through
+// the caches per ray. Quantized boxes are rounded outwards and only ever enclose the real ones.
+template <unsigned int N>
+struct alignas(64) QuantizedBVHNode {
+    float origin[3];      // Lowest corner of the children's bounds
+    int8_t exponent[3];   // Quantized bounds count steps of 2^exponent from origin
+    uint8_t num_children; // Children always occupy the first num_children lanes
+    uint8_t bounds_min[3][N];
+    uint8_t bounds_max[3][N];
+    unsigned int child[N]; // Interior child: node index. Leaf child: first primitive index
+    uint16_t count[N];     // Number of primitives in a leaf child, 0 for interior children
+};
+
+static_assert(sizeof(QuantizedBVHNode<4>) == 64, "4 wide quantized nodes fill a cache line");
+static_assert(sizeof(QuantizedBVHNode<8>) == 128, "8 wide quantized nodes fill two cache lines");
+
+// Same contract as WideNodeKernel, the child boxes are decompressed on the fly
+template <unsigned int N>
+using QuantizedNodeKernel = unsigned int (*)(const QuantizedBVHNode<N>& node, const WideRay& ray,
+                                             float t_min, float t_max, float* t_entry);
+
+// Wide BVH of quantized nodes, compressed from a WideBVH with the same node indices. The child box
+// test decompresses the boxes in SIMD registers with the same kernels as WideBVH: AVX2 for 8
+// boxes at once, SSE4.2 for 4 and scalar code everywhere else.
+template <unsigned int N>
+class QuantizedBVH {
+public:
+    QuantizedBVH();
+
+    // Leaves the tree empty, and says so, if a leaf holds more primitives than count can, which
+    // only a build cut short by BVH::max_depth could produce
+    void build(const WideBVH<N>& wide_bvh);
+
+    // Quantizes the given nodes of wide_bvh again, after WideBVH::refit changed them
+    void refit(const WideBVH<N>& wide_bvh, const std::vector<unsigned int>& changed_wide_nodes);
+
+    // Same contract as BVH::intersect
+    template <typename LeafIntersector>
+    bool intersect(const Ray& ray, float t_min, float& t_max, LeafIntersector&& intersect_leaf,
+                   BVHTraversalStats* stats = nullptr) const;
+
+    // Same contract as BVH::occluded
+    template <typename LeafOcclusionTest>
+    bool occluded(const Ray& ray, float t_min, float t_max, LeafOcclusionTest&& occluded_leaf,
+                  BVHTraversalStats* stats = nullptr) const;
+
+    // Selects the child box kernel, clamped to what the CPU supports
+    void setSIMDLevel(CPU::SIMDLevel level);
+    [[nodiscard]] CPU::SIMDLevel getSIMDLevel() const;
+
+    std::vector<QuantizedBVHNode<N>> nodes;
+
+    float build_time; // Milliseconds spent quantizing
+
+private:
+    CPU::SIMDLevel simd_level;
+    QuantizedNodeKernel<N> test_children;
+};
+
+template <unsigned int N>
+template <typename LeafIntersector>
+bool QuantizedBVH<N>::intersect(const Ray& ray, float t_min, float& t_max,
+                                LeafIntersector&& intersect_leaf, BVHTraversalStats* stats) const {
+    return intersectWide<N>(nodes, test_children, ray, t_min, t_max, intersect_leaf, stats);
+}
+
+template <unsigned int N>
+template <typename LeafOcclusionTest>
+bool QuantizedBVH<N>::occluded(const Ray& ray, float t_min, float t_max,
+                               LeafOcclusionTest&& occluded_leaf,
+                               BVHTraversalStats* stats) const {
+    return occludedWide<N>(nodes, test_children, ray, t_min, t_max, occluded_leaf, stats);
+}
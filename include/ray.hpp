@@ -0,0 +1,23 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+class Ray {
+public:
+    Ray();
+    Ray(const glm::vec3& origin, const glm::vec3& direction);
+
+    [[nodiscard]] glm::vec3 at(float t) const;
+
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+struct HitRecord {
+    HitRecord();
+
+    float t;
+    glm::vec3 position;
+    glm::vec3 normal; // World space, normalised, facing against the incoming ray
+    int primitive_index;
+};
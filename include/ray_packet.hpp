@@ -0,0 +1,137 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <bvh.hpp>
+#include <cpu_features.hpp>
+#include <ray.hpp>
+
+// Group of rays traced through the BVH together, stored as structure of arrays so one box can be
+// tested against every ray with SIMD instructions. Lanes that are not in the active mask are
+// ignored by every test.
+struct RayPacket {
+    static constexpr unsigned int size = 8;
+
+    RayPacket();
+
+    void setRay(unsigned int lane, const Ray& ray, float t_max);
+
+    // Must be called once every ray has been set. Computes the inverse directions and the interval
+    // bounds of the packet, and decides whether the packet is coherent enough to be traced as one
+    void finalize();
+
+    [[nodiscard]] Ray getRay(unsigned int lane) const;
+
+    alignas(32) float origin[3][size];
+    alignas(32) float direction[3][size];
+    alignas(32) float inv_direction[3][size];
+    alignas(32) float t_max[size];
+
+    unsigned int active; // Bit mask of the lanes holding a ray
+
+    // Bounds of the origins and inverse directions of the active rays, used to cull nodes for the
+    // whole packet with interval arithmetic
+    glm::vec3 origin_min;
+    glm::vec3 origin_max;
+    glm::vec3 inv_direction_min;
+    glm::vec3 inv_direction_max;
+
+    // Every active ray has the same direction signs on every axis. The interval test and the
+    // shared child ordering rely on it, packets that are not coherent are traced one ray at a time
+    bool coherent;
+};
+
+// Conservative test of the whole packet against a node's bounds. False means no active ray with
+// t in [t_min, t_max] can hit the box
+[[nodiscard]] bool packetMayHitBounds(const BVHNode& node, const RayPacket& packet, float t_min);
+
+// Exact slab test of every ray in lane_mask against a node's bounds. Returns the lanes that hit
+// the box within [t_min, t_max[lane]]
+using PacketBoundsKernel = unsigned int (*)(const BVHNode& node, const RayPacket& packet,
+                                            float t_min, unsigned int lane_mask);
+
+// Widest packet bounds kernel supported at the given SIMD level, clamped to what the CPU supports
+[[nodiscard]] PacketBoundsKernel selectPacketBoundsKernel(CPU::SIMDLevel level);
+
+// Traces a coherent packet through the binary BVH, testing its nodes with test_bounds.
+// intersect_lane(lane, primitive_index, t_min, t_max) must test one ray of the packet against one
+// primitive and, on a hit closer than t_max, shrink t_max and return true. With any_hit set a lane
+// is retired as soon as it hits anything, which is all shadow rays need.
+template <typename LaneIntersector>
+void intersectPacket(const BVH& bvh, RayPacket& packet, float t_min, bool any_hit,
+                     PacketBoundsKernel test_bounds, LaneIntersector&& intersect_lane,
+                     BVHTraversalStats* stats = nullptr) {
+    if (bvh.nodes.empty() || packet.active == 0) {
+        return;
+    }
+
+    uint64_t nodes_visited   = 0;
+    uint64_t primitive_tests = 0;
+    unsigned int num_rays    = 0;
+    for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+        num_rays += (packet.active >> lane) & 1u;
+    }
+
+    // Direction signs are shared, any active ray can decide which child is the near one
+    unsigned int first_lane = 0;
+    while ((packet.active & (1u << first_lane)) == 0) {
+        first_lane++;
+    }
+    glm::vec3 order_direction(packet.direction[0][first_lane], packet.direction[1][first_lane],
+                              packet.direction[2][first_lane]);
+
+    unsigned int stack[BVH::max_depth + 1];
+    unsigned int stack_size = 0;
+    stack[stack_size++]     = 0;
+
+    while (stack_size > 0 && packet.active != 0) {
+        const BVHNode& node = bvh.nodes[stack[--stack_size]];
+
+        // Cheap rejection of the whole packet first, then the exact per ray test
+        if (!packetMayHitBounds(node, packet, t_min)) {
+            continue;
+        }
+        unsigned int mask = test_bounds(node, packet, t_min, packet.active);
+        nodes_visited++;
+        if (mask == 0) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (unsigned int i = 0; i < node.count; ++i) {
+                unsigned int primitive = bvh.primitive_indices[node.left_first + i];
+                for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+                    if ((mask & packet.active & (1u << lane)) == 0) {
+                        continue;
+                    }
+                    primitive_tests++;
+                    if (intersect_lane(lane, primitive, t_min, packet.t_max[lane]) && any_hit) {
+                        packet.active &= ~(1u << lane);
+                    }
+                }
+            }
+            continue;
+        }
+
+        const BVHNode& left  = bvh.nodes[node.left_first];
+        const BVHNode& right = bvh.nodes[node.left_first + 1];
+        glm::vec3 separation = (right.bounds_min + right.bounds_max) -
+                               (left.bounds_min + left.bounds_max);
+
+        // Push the far child first so the near one is visited next
+        if (glm::dot(separation, order_direction) < 0.0f) {
+            stack[stack_size++] = node.left_first;
+            stack[stack_size++] = node.left_first + 1;
+        } else {
+            stack[stack_size++] = node.left_first + 1;
+            stack[stack_size++] = node.left_first;
+        }
+    }
+
+    if (stats) {
+        stats->rays += num_rays;
+        stats->packets++;
+        stats->nodes_visited += nodes_visited;
+        stats->primitive_tests += primitive_tests;
+    }
+}
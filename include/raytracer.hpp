@@ -0,0 +1,375 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include <camera.hpp>
+#include <denoiser.hpp>
+#include <image.hpp>
+#include <path_guide.hpp>
+#include <ray.hpp>
+#include <raytracer_scene.hpp>
+#include <sampler.hpp>
+#include <tile_scheduler.hpp>
+
+class RenderCheckpoint;
+class TiledImageWriter;
+
+// Pinhole camera set up to match the perspective projection used by the raster renderer so that
+// the ray traced image lines up with the viewport
+class CameraFrame {
+public:
+    CameraFrame(const Camera& camera, unsigned int image_width, unsigned int image_height);
+
+    // x and y are continuous pixel coordinates with (0, 0) being the top left of the image
+    [[nodiscard]] Ray generateRay(float x, float y) const;
+
+    glm::vec3 origin;
+    glm::vec3 front;
+    glm::vec3 horizontal; // Half extent of the image plane along the camera's right
+    glm::vec3 vertical;   // Half extent of the image plane along the camera's up
+    float inv_width;
+    float inv_height;
+};
+
+struct RayTracerSettings {
+    RayTracerSettings();
+
+    unsigned int width;
+    unsigned int height;
+    unsigned int samples_per_pixel;
+    unsigned int max_depth;
+    unsigned int num_threads; // 0 uses every hardware thread
+    unsigned int tile_size; // Width and height of the tiles handed out to the worker threads
+
+    // Trace the camera rays, and the shadow rays from their first hits, in packets of
+    // RayPacket::size rays covering a small block of pixels instead of one at a time
+    bool packet_primary_rays;
+    bool packet_shadow_rays;
+
+    // Stop sampling a pixel once the standard error of its mean luminance, relative to that mean,
+    // drops below adaptive_threshold. Every pixel takes at least adaptive_min_samples, then more in
+    // batches of the same size up to samples_per_pixel
+    bool adaptive_sampling;
+    float adaptive_threshold;
+    unsigned int adaptive_min_samples;
+
+    // Also average the albedo, normal and depth of what the camera rays hit first into
+    // last_features, for the denoiser
+    bool feature_buffers;
+
+    // Next event estimation traces shadow rays to light_samples lights picked with light_sampling
+    // at every shading point. Scenes with no more lights than that evaluate all of them
+    LightSampling light_sampling;
+    unsigned int light_samples;
+
+    // Trace the paths of a tile breadth first, one bounce of all of them at a time, sorting the
+    // rays by direction and origin before every traversal and the hits by primitive before
+    // shading. The packet settings only apply to the depth first path tracer
+    bool wavefront;
+
+    // Before the first pass, trace guiding_training_passes passes of one sample per pixel to learn
+    // where the light reaching every part of the scene comes from, then send guiding_fraction of
+    // the diffuse bounces where the guide has learnt enough towards it. The guide's grid has
+    // guiding_resolution cells along the scene's longest side and takes at most guiding_memory
+    // megabytes. Only the depth first path tracer guides its bounces, and renderTileSums() only
+    // with a guide an earlier render trained
+    bool path_guiding;
+    unsigned int guiding_training_passes;
+    float guiding_fraction;
+    unsigned int guiding_resolution;
+    unsigned int guiding_memory;
+
+    // Random numbers are looked up by pixel, sample and dimension, so images only depend on these
+    // and not on the tiles or threads
+    SamplerType sampler;
+    uint32_t sampler_seed;
+
+    glm::vec3 background; // Radiance of rays escaping the scene
+};
+
+// Time spent in every stage of the wavefront integrator, summed over the worker threads, and the
+// number of rays traced by the stages that trace any
+struct WavefrontStats {
+    WavefrontStats();
+
+    void add(const WavefrontStats& other);
+
+    uint64_t extension_rays; // Camera rays and bounces
+    uint64_t shadow_rays;
+
+    // Milliseconds
+    float generate_time;
+    float sort_time; // Both the extension and the shadow rays
+    float extend_time;
+    float shade_time;
+    float shadow_time;
+};
+
+// What a time budgeted render achieved. The noise estimates come from the spread of every pixel's
+// samples, so they are only as good as adaptive sampling's error estimates
+struct RenderBudgetStats {
+    RenderBudgetStats();
+
+    // Writes the stats as one "name value" pair per line, to keep alongside the image
+    bool write(const std::string& path) const;
+
+    float budget; // Seconds
+    unsigned int passes;
+    unsigned int min_samples; // Per pixel
+    unsigned int max_samples;
+    float average_samples;
+    float mean_relative_error; // Standard error of each pixel's luminance relative to its mean
+    float estimated_rmse;      // Root mean square of the standard errors, in luminance
+};
+
+// Per pixel running sums of some of the samples of a tile, row major within the tile. The sums of
+// a tile's disjoint sample ranges add up to the sums of all of them
+struct TileSums {
+    std::vector<glm::vec3> sums;
+    std::vector<unsigned int> sample_counts;
+    std::vector<glm::vec3> albedo_sums; // Empty unless feature_buffers is set
+    std::vector<glm::vec3> normal_sums;
+    std::vector<float> depth_sums;
+};
+
+// CPU path tracer rendering a RayTracerScene on all cores. Direct lighting uses the same
+// Blinn-Phong point light terms as fshader.glsl with ray traced shadows, from every light or from
+// a few sampled ones, indirect lighting is gathered with cosine weighted diffuse bounces, partly
+// sent where a PathGuide learnt the light comes from when path_guiding is set.
+class RayTracer {
+public:
+    RayTracer();
+    explicit RayTracer(const RayTracerSettings& settings);
+
+    // pass selects the samples used, pass * samples_per_pixel onwards in every pixel, so the images
+    // of passes with different indices can be averaged together. Once *cancel is set, tiles that
+    // have not been started are left black and the call returns early.
+    //
+    // With a checkpoint, tiles it already holds for this exact render are copied from it instead
+    // of being traced, and every finished tile is added to it and saved to disk every
+    // save_interval seconds and when cancelled. A checkpoint of any other render is reset first
+    Image render(const RayTracerScene& scene, const Camera& camera, unsigned int pass = 0,
+                 const std::atomic<bool>* cancel = nullptr,
+                 RenderCheckpoint* checkpoint = nullptr);
+
+    // Renders only region of the settings.width x settings.height frame, at full resolution. The
+    // image, last_sample_counts and last_features cover just the region, so rays, memory and time
+    // scale with its area, and every pixel comes out the same as it would in render(). Path
+    // guiding is the exception to the scaling, the guide is still trained over the whole frame
+    Image renderRegion(const RayTracerScene& scene, const Camera& camera,
+                       const ImageRegion& region, unsigned int pass = 0,
+                       const std::atomic<bool>* cancel = nullptr);
+
+    // Renders like render() but hands every finished tile to writer, opened at the frame's size
+    // and with features if feature_buffers is set, rather than keeping the image. Memory only
+    // grows with the tiles in flight, not with the resolution. last_sample_counts and
+    // last_features are left empty
+    bool renderToFile(const RayTracerScene& scene, const Camera& camera, TiledImageWriter& writer,
+                      unsigned int pass = 0, const std::atomic<bool>* cancel = nullptr);
+
+    // Renders for budget seconds rather than to a sample count. Every pixel first gets
+    // adaptive_min_samples, one sample per pixel per pass over the image, then every pass adds a
+    // batch of adaptive_min_samples to the pixels that gain the most from it: those whose relative
+    // error divided by the square root of their sample count is above the image's mean. Once the
+    // deadline passes no more tiles are started, and the image is the average of the samples each
+    // pixel got. The passes up to adaptive_min_samples always finish once started, so the sample
+    // counts are uniform until refinement starts, and the first one is always started so no pixel
+    // is left without samples. A run may overshoot the budget by one such pass.
+    // samples_per_pixel and adaptive_threshold are ignored
+    Image renderWithBudget(const RayTracerScene& scene, const Camera& camera, float budget,
+                           const std::atomic<bool>* cancel = nullptr);
+
+    // Pieces of render() for splitting an image up between processes. renderTileSums() takes
+    // samples [first_sample, first_sample + samples) of every pixel of one of the tiles render()
+    // would use, stopping early in pixels that adaptive sampling deems converged. It can be called
+    // from several threads at once. resolveTileSums() writes the average of a tile's sums the way
+    // render() does, so a tile rendered in one range comes out exactly the same
+    [[nodiscard]] TileSums renderTileSums(const RayTracerScene& scene, const Camera& camera,
+                                          const Tile& tile, uint32_t first_sample,
+                                          unsigned int samples, BVHTraversalStats& stats) const;
+    void resolveTileSums(const Tile& tile, const TileSums& sums, Image& image,
+                         std::vector<unsigned int>& sample_counts,
+                         FeatureBuffers* features) const;
+
+    RayTracerSettings settings;
+
+    // Statistics of the last call to render()
+    float last_render_time; // Seconds
+    unsigned int last_num_threads;
+    BVHTraversalStats last_traversal_stats;
+    TileSchedulerStats last_tile_stats;
+    std::vector<unsigned int> last_sample_counts; // Samples taken per pixel, row major
+    float last_average_samples;
+    FeatureBuffers last_features; // Only written with settings.feature_buffers set
+    WavefrontStats last_wavefront_stats; // Only written with settings.wavefront set
+    unsigned int last_resumed_tiles;     // Copied from the checkpoint rather than traced
+    RenderBudgetStats last_budget_stats; // Passes is 0 unless the last render was budgeted
+    ImageRegion last_region;             // Part of the frame the last image covers
+
+    // Trained by the first pass of the last render with settings.path_guiding set
+    PathGuide path_guide;
+
+    // Heat map of last_sample_counts, blue for no samples and red for samples_per_pixel, or for
+    // the most any pixel got after renderWithBudget()
+    [[nodiscard]] Image sampleCountMap() const;
+
+private:
+    // Offset of secondary rays off the surface they start on, and start of every ray's interval
+    static constexpr float ray_epsilon = 1e-4f;
+
+    // Dimensions of a path's samples: the position in the pixel first, then bounceDimensions() for
+    // every bounce holding its direction, its Russian roulette decision and its light picks
+    static constexpr unsigned int pixel_dimensions = 2;
+    static constexpr unsigned int bounce_direction = 0; // Within a bounce's dimensions
+    static constexpr unsigned int bounce_roulette  = 2;
+    static constexpr unsigned int bounce_lights    = 3;
+
+    // What the camera ray of a path hit first
+    struct FirstHit {
+        glm::vec3 albedo;
+        glm::vec3 normal;
+        float depth;
+    };
+
+    // Running sums of the samples taken in one pixel of a tile
+    struct PixelEstimate {
+        PixelEstimate();
+
+        void addSample(const glm::vec3& colour);
+        void addFeatures(const FirstHit& first_hit);
+
+        // Standard error of the mean luminance, and the same relative to the mean
+        [[nodiscard]] float standardError() const;
+        [[nodiscard]] float relativeError() const;
+
+        glm::vec3 sum;
+        float luminance_sum;
+        float luminance_sum_sq;
+        unsigned int samples;
+        bool converged;
+
+        // Feature sums, over the same samples
+        glm::vec3 albedo_sum;
+        glm::vec3 normal_sum;
+        float depth_sum;
+    };
+
+    // First hit of a path that was found as part of a packet, along with whether each light is
+    // visible from it when the shadow rays were traced as a packet too
+    struct PrimaryHit {
+        bool found;
+        HitRecord hit;
+        const unsigned char* light_visible; // One entry per light, nullptr to trace shadow rays
+    };
+
+    // Blinn-Phong terms of one light at a hit, depending on whether the light turns out to be
+    // visible. Lights behind the surface need no shadow ray, only their ambient term counts
+    struct LightTerms {
+        glm::vec3 lit;
+        glm::vec3 shadowed;
+        bool needs_shadow_ray;
+        Ray shadow_ray;
+        float shadow_distance;
+        int light_primitive; // Skipped by the shadow ray
+    };
+
+    // Vertex of a training path, waiting for the radiance gathered by the rest of the path
+    struct GuideVertex {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec3 direction;
+        glm::vec3 radiance;   // Gathered before the bounce
+        glm::vec3 throughput; // After the bounce
+        float cosine_over_pdf;
+    };
+
+    // render() and renderRegion(), tiles are laid out over region and checkpoint is only
+    // supported for the whole frame
+    Image renderTiles(const RayTracerScene& scene, const Camera& camera, const ImageRegion& region,
+                      unsigned int pass, const std::atomic<bool>* cancel,
+                      RenderCheckpoint* checkpoint);
+
+    // Takes up to max_samples samples of every pixel of the tile starting at sample index
+    // first_sample, fewer in pixels adaptive sampling stops early. Returns the tile's pixel
+    // estimates, row major
+    std::vector<PixelEstimate> renderTile(const RayTracerScene& scene, const CameraFrame& frame,
+                                          const Tile& tile, uint32_t first_sample,
+                                          unsigned int max_samples, BVHTraversalStats& stats,
+                                          WavefrontStats& wavefront_stats) const;
+
+    // Averages the estimates of a tile into the image, the sample counts and the feature buffers
+    void resolveTile(const Tile& tile, const std::vector<PixelEstimate>& estimates, Image& image,
+                     std::vector<unsigned int>& sample_counts, FeatureBuffers* features) const;
+
+    // Copies the sums of a tile between its estimates and the checkpoint
+    static void storeTile(const Tile& tile, const std::vector<PixelEstimate>& estimates,
+                          RenderCheckpoint& checkpoint);
+    static std::vector<PixelEstimate> restoreTile(const Tile& tile,
+                                                  const RenderCheckpoint& checkpoint);
+
+    // Adds samples with whichever integrator the settings select
+    void addTileSamples(const RayTracerScene& scene, const CameraFrame& frame, const Tile& tile,
+                        unsigned int samples, std::vector<PixelEstimate>& estimates,
+                        uint32_t first_sample, BVHTraversalStats& stats,
+                        WavefrontStats& wavefront_stats) const;
+
+    // Adds samples more samples to every pixel of the tile that has not converged. estimates is
+    // indexed like the tile's pixels, row major. A pixel's next sample index is first_sample plus
+    // the samples it already has
+    void sampleTile(const RayTracerScene& scene, const CameraFrame& frame, const Tile& tile,
+                    unsigned int samples, std::vector<PixelEstimate>& estimates,
+                    uint32_t first_sample, BVHTraversalStats& stats) const;
+
+    void sampleTilePackets(const RayTracerScene& scene, const CameraFrame& frame,
+                           const Tile& tile, unsigned int samples,
+                           std::vector<PixelEstimate>& estimates, uint32_t first_sample,
+                           BVHTraversalStats& stats) const;
+
+    // Same samples as sampleTile(), traced by the wavefront integrator (raytracer_wavefront.cpp)
+    void sampleTileWavefront(const RayTracerScene& scene, const CameraFrame& frame,
+                             const Tile& tile, unsigned int samples,
+                             std::vector<PixelEstimate>& estimates, uint32_t first_sample,
+                             BVHTraversalStats& stats, WavefrontStats& wavefront_stats) const;
+
+    // Resets path_guide and trains it on the whole frame, with samples of their own. Region
+    // renders train on the whole frame too, for their pixels to match render()'s
+    void trainPathGuide(const RayTracerScene& scene, const CameraFrame& frame,
+                        unsigned int num_threads, const std::atomic<bool>* cancel);
+
+    [[nodiscard]] PixelSampler pixelSampler(unsigned int x, unsigned int y,
+                                            uint32_t sample_index) const;
+
+    // Even, so every bounce's direction starts a pair of dimensions
+    [[nodiscard]] unsigned int bounceDimensions() const;
+
+    // Adds what every bounce of the path saw to guide_records when given
+    glm::vec3 tracePath(const RayTracerScene& scene, Ray ray, const PixelSampler& sampler,
+                        BVHTraversalStats& stats, const PrimaryHit* primary = nullptr,
+                        FirstHit* first_hit = nullptr,
+                        std::vector<PathGuideRecord>* guide_records = nullptr) const;
+
+    // Whether directLighting() picks lights at random rather than evaluating all of them
+    [[nodiscard]] bool samplesLights(const RayTracerScene& scene) const;
+
+    glm::vec3 directLighting(const RayTracerScene& scene, const HitRecord& hit,
+                             const glm::vec3& view_dir, const PixelSampler& sampler,
+                             unsigned int first_dimension, BVHTraversalStats& stats,
+                             const unsigned char* light_visible = nullptr) const;
+
+    // Blinn-Phong terms of one light, shadowed unless light_visible says otherwise
+    glm::vec3 lightContribution(const RayTracerScene& scene, const HitRecord& hit,
+                                const glm::vec3& view_dir, unsigned int light_index,
+                                BVHTraversalStats& stats,
+                                const unsigned char* light_visible) const;
+
+    LightTerms lightTerms(const RayTracerScene& scene, const HitRecord& hit,
+                          const glm::vec3& view_dir, unsigned int light_index) const;
+
+    // Cosine weighted direction on the hemisphere around normal. The pdf cancels the cosine term
+    // of the rendering equation so a diffuse bounce only multiplies the throughput by the albedo
+    static glm::vec3 sampleCosineHemisphere(const glm::vec3& normal, float u1, float u2);
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <aabb.hpp>
+#include <bvh.hpp>
+#include <gameobject.hpp>
+#include <light_sampler.hpp>
+#include <primitive_batch.hpp>
+#include <quantized_bvh.hpp>
+#include <ray.hpp>
+#include <ray_packet.hpp>
+#include <wide_bvh.hpp>
+
+// Structure used to find the primitives a ray hits. LINEAR_SCAN tests every primitive and is kept
+// around to compare against. The quantized ones are the wide BVHs with compressed nodes
+enum class SceneAccelerator { LINEAR_SCAN, BVH2, BVH4, BVH8, BVH4_QUANTIZED, BVH8_QUANTIZED };
+
+[[nodiscard]] const char* sceneAcceleratorName(SceneAccelerator accelerator);
+
+// Bottom level of the scene: the geometry every object of a shape class shares. Shapes are
+// analytic and defined once in object space, so an object only adds its transform on top of its
+// shape and the scene's memory grows with the number of objects, however detailed the shapes.
+struct SceneShape {
+    PrimitiveType type;
+    AABB object_bounds; // Same box the GameObject's bounding box is made from
+};
+
+// Copy of everything the ray tracer needs from a GameObject, an instance of its shape. The ray
+// tracer works on this snapshot instead of the GameObjects themselves so that it never touches
+// OpenGL state and so that the editor can keep modifying objects while a frame is being traced.
+// The top level BVH is built over the instances' world bounds, which are worked out from the
+// shape's bounds and the transform, so moving an instance only ever changes the top level.
+struct ScenePrimitive {
+    PrimitiveType type;
+
+    glm::mat4 object_to_world;
+    glm::mat4 world_to_object; // Its transposed upper 3x3 takes normals to world space
+
+    glm::vec3 colour;
+    float shininess;
+
+    int light_index; // Index into RayTracerScene::lights, -1 if the object is not a light
+};
+
+// Object space bounds shared by every instance of a shape
+[[nodiscard]] const SceneShape& sceneShape(PrimitiveType type);
+
+// World space box around a shape's bounds once transformed
+[[nodiscard]] AABB instanceBounds(const SceneShape& shape, const glm::mat4& object_to_world);
+
+struct SceneLight {
+    glm::vec3 position;
+    glm::vec3 colour;
+
+    float ambient;
+    float diffuse;
+    float specular;
+    float constant;
+    float linear;
+    float quadratic;
+
+    int primitive_index; // Primitive the light is attached to
+};
+
+class RayTracerScene {
+public:
+    RayTracerScene();
+    explicit RayTracerScene(const std::vector<std::shared_ptr<GameObject>>& objects,
+                            const BVHBuildSettings& build_settings = BVHBuildSettings());
+
+    // Builds the binary BVH over the primitives' world bounds, collapses it into the wide BVHs
+    // and lays the primitives out in leaf order for batched intersection. Must be called again
+    // whenever primitives are added, or moved other than through refitObjects()
+    void buildAccelerationStructures();
+
+    // Takes the changed objects' transforms, materials and lights again and refits the
+    // acceleration structures around the ones that moved instead of rebuilding them. objects must
+    // be the list the scene was made from, changed indexes into it. Returns false without
+    // touching the scene if any of them was hidden, shown or made a light since, the scene has to
+    // be made again then. Each refit loosens the tree a little, see BVH::getSAHCostGrowth()
+    bool refitObjects(const std::vector<std::shared_ptr<GameObject>>& objects,
+                      const std::vector<unsigned int>& changed);
+
+    // Selects the box test, packet and primitive batch kernels, clamped to what the CPU supports
+    void setSIMDLevel(CPU::SIMDLevel level);
+    [[nodiscard]] CPU::SIMDLevel getSIMDLevel() const;
+
+    // Closest hit along the ray within (t_min, t_max). Primitive skip_primitive is ignored, used to
+    // stop a light's own body from shadowing it
+    bool intersect(const Ray& ray, float t_min, float t_max, HitRecord& hit,
+                   int skip_primitive = -1, BVHTraversalStats* stats = nullptr) const;
+
+    // Whether any primitive other than skip_primitive is hit within (t_min, t_max). Stops at the
+    // first one found, for shadow rays and anything else that only needs a yes or no
+    bool occluded(const Ray& ray, float t_min, float t_max, int skip_primitive = -1,
+                  BVHTraversalStats* stats = nullptr) const;
+
+    // Closest hits of every active ray of the packet within (t_min, t_max[lane]). Returns the
+    // lanes that hit something, hits[lane] is only written for those. Coherent packets walk the
+    // binary BVH together whatever the accelerator, the others fall back to intersect() per ray
+    unsigned int intersectPacket(RayPacket& packet, float t_min, HitRecord* hits,
+                                 BVHTraversalStats* stats = nullptr) const;
+
+    // Lanes of the packet blocked by any primitive other than skip_primitive within
+    // (t_min, t_max[lane])
+    unsigned int occludedPacket(RayPacket& packet, float t_min, int skip_primitive = -1,
+                                BVHTraversalStats* stats = nullptr) const;
+
+    // Bytes held by the instances, the BVHs and the batches, all that grows with the objects
+    [[nodiscard]] size_t memoryUsage() const;
+
+    std::vector<ScenePrimitive> primitives; // Instances, each referring to its shape by type
+    std::vector<SceneLight> lights;
+    LightSampler light_sampler; // Built over lights along with the scene
+
+    // Acceleration structures over the primitives' bounding boxes, accelerator selects the one
+    // used for tracing. The binary BVH is built as build_settings say, the wide ones from it and
+    // the quantized ones from the wide ones. An empty quantized BVH falls back to its wide BVH
+    BVH bvh;
+    WideBVH<4> bvh4;
+    WideBVH<8> bvh8;
+    QuantizedBVH<4> quantized_bvh4;
+    QuantizedBVH<8> quantized_bvh8;
+    SceneAccelerator accelerator;
+    BVHBuildSettings build_settings;
+
+    // Transforms of the primitives in BVH leaf order, leaves sorted by primitive type
+    PrimitiveBatches batches;
+
+private:
+    // Fills in the position and world space normal of a hit once the closest one is known
+    void finishHit(const Ray& ray, const glm::vec3& object_normal, HitRecord& hit) const;
+
+    // Closest hit among the primitives in batch slots [first, first + count). Runs of primitives of
+    // the same type are culled with the batch kernel, the candidates it leaves are confirmed with
+    // the exact scalar routine closest first
+    bool intersectSlots(const Ray& ray, unsigned int first, unsigned int count, float t_min,
+                        float& t_max, int skip_primitive, int& primitive_index,
+                        glm::vec3& object_normal) const;
+
+    // Whether any primitive in batch slots [first, first + count) is hit within (t_min, t_max)
+    bool occludedSlots(const Ray& ray, unsigned int first, unsigned int count, float t_min,
+                       float t_max, int skip_primitive) const;
+
+    bool intersectPrimitive(const ScenePrimitive& primitive, const Ray& ray, float t_min,
+                            float t_max, float& t, glm::vec3& normal) const;
+
+    CPU::SIMDLevel simd_level;
+    PrimitiveBatchKernel batch_kernel;
+    unsigned int batch_width;
+    PacketBoundsKernel packet_kernel;
+
+    // Kept from the last build for refitObjects()
+    std::vector<int> object_primitives;        // Primitive made from every object, -1 if none was
+    std::vector<AABB> primitive_bounds;        // Bounds the BVH was built or refit over
+    std::vector<unsigned int> primitive_slots; // Batch slot of every primitive
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <camera.hpp>
+#include <raytracer.hpp>
+
+// Progress of a RayTracer::render() call, kept on disk so a long render can pick up where it left
+// off after a crash. Progress is saved per finished tile: the running sums and sample count of
+// each of its pixels, which is all the tile's pixels need to be written exactly as if they had
+// just been rendered. Samples only depend on the pixel, the sample index and the sampler seed, so
+// the tiles rendered after resuming come out the same as they would have the first time.
+//
+// Binary layout, native byte order:
+//   header:  magic "RTCK", version, fingerprint (64 bit), width, height, tile_size, pass,
+//            samples_per_pixel, sampler, sampler_seed, has_features, num_tiles (32 bit each)
+//   tiles:   num_tiles bytes, 1 for every tile that is done
+//   pixels:  for every done tile in tile order, its pixels row major: sum (3 floats), samples
+//            (32 bit), then albedo sum (3 floats), normal sum (3 floats) and depth sum (float)
+//            if has_features
+class RenderCheckpoint {
+public:
+    RenderCheckpoint();
+    RenderCheckpoint(const std::string& path, float save_interval);
+
+    // Identifies the image a render produces: the scene, the camera, pass and every setting that
+    // changes the image. The integrator and packet settings are included, they only agree up to
+    // float rounding. The tile size is compared separately and the thread count is left out as it
+    // never changes the image
+    [[nodiscard]] static uint64_t fingerprint(const RayTracerScene& scene, const Camera& camera,
+                                              const RayTracerSettings& settings,
+                                              unsigned int pass);
+
+    // Whether the progress saved here belongs to a render with this fingerprint and layout
+    [[nodiscard]] bool matches(uint64_t render_fingerprint,
+                               const RayTracerSettings& settings) const;
+
+    // Forgets every tile and sizes the buffers for a new render
+    void reset(uint64_t render_fingerprint, const RayTracerSettings& settings, unsigned int pass);
+
+    // Replaces the file at path atomically, so a crash while saving leaves the previous save
+    bool save() const;
+
+    // Returns false without touching the checkpoint if there is no valid file at path
+    bool load();
+
+    // Deletes the file, once the render it was saving has finished
+    void remove() const;
+
+    [[nodiscard]] unsigned int numTilesDone() const;
+
+    std::string path;
+    float save_interval; // Seconds between saves while rendering
+
+    uint64_t render_fingerprint;
+    unsigned int width;
+    unsigned int height;
+    unsigned int tile_size;
+    unsigned int pass;
+    unsigned int samples_per_pixel;
+    SamplerType sampler;
+    uint32_t sampler_seed; // The sampler's whole state, along with pass and the sample counts
+    bool has_features;
+
+    std::vector<unsigned char> tiles_done; // Indexed like TileScheduler's tiles
+
+    // Per pixel running sums, row major. Only meaningful inside done tiles
+    std::vector<glm::vec3> sums;
+    std::vector<unsigned int> sample_counts;
+    std::vector<glm::vec3> albedo_sums; // Empty unless has_features
+    std::vector<glm::vec3> normal_sums;
+    std::vector<float> depth_sums;
+
+private:
+    // Sizes the buffers for width, height, tile_size and has_features, with no tile done
+    void allocate();
+};
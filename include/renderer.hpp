@@ -3,6 +3,7 @@
 #include <camera.hpp>
 #include <cube.hpp>
 #include <gizmo.hpp>
+#include <image.hpp>
 #include <shader.hpp>
 #include <skybox.hpp>
 #include <texture_utility.hpp>
@@ -33,9 +34,19 @@ public:
 
     void setNumLights(unsigned int num_lights);
 
+    // Copies a linear RGB image into the screen texture. Ignored unless the image is the size of
+    // the window, a pass traced before a resize is simply dropped
+    void uploadScreenImage(const Image& image);
+
+    // Linear RGB copy of the screen texture, the last frame drawn at the window's size
+    [[nodiscard]] Image readScreenImage() const;
+
     bool draw_normals;
     bool use_pcf;
 
+    // Skip the raster passes and only draw whatever was last uploaded with uploadScreenImage()
+    bool raytraced_viewport;
+
 private:
     void initShaders();
     void initSkyboxes();
@@ -89,6 +100,9 @@ private:
     unsigned int multisample_texture;
     unsigned int screen_texture;
 
+    // Ray traced image flipped to OpenGL's bottom up row order before being uploaded
+    std::vector<glm::vec3> screen_upload;
+
     // Skybox
     // Texture image file names for skybox faces
     std::string active_skybox_texture_name;
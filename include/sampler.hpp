@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+// Where the ray tracer's random numbers come from. Every type is a pure function of the pixel,
+// the sample index, the dimension and a seed, so an image comes out the same whatever order its
+// tiles are rendered in and however many threads render them.
+//   RANDOM:     hashed white noise, the baseline to compare against
+//   SOBOL:      Owen scrambled Sobol points (Burley 2020), decorrelated between pixels by shuffling
+//               the sample index and scrambling with per pixel seeds
+//   BLUE_NOISE: the same scrambled Sobol points in every pixel, offset by a blue noise mask so the
+//               remaining error between neighbouring pixels is spread out as blue noise
+enum class SamplerType { RANDOM, SOBOL, BLUE_NOISE };
+
+[[nodiscard]] const char* samplerTypeName(SamplerType type);
+
+// Samples of one pixel's sample. Dimensions are padded in pairs: 2D Sobol points are only well
+// stratified between the two dimensions of the same pair (2k, 2k + 1), so anything sampled as a
+// point on a square, such as a pixel position or a direction, should start at an even dimension.
+class PixelSampler {
+public:
+    PixelSampler(SamplerType type, unsigned int pixel_x, unsigned int pixel_y,
+                 uint32_t sample_index, uint32_t seed);
+
+    // In [0, 1)
+    [[nodiscard]] float get(unsigned int dimension) const;
+
+private:
+    SamplerType type;
+    unsigned int pixel_x;
+    unsigned int pixel_y;
+    uint32_t sample_index;
+    uint32_t sequence_seed; // Shared by every pixel
+    uint32_t pixel_seed;
+};
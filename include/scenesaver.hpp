@@ -11,4 +11,10 @@ namespace SceneSaver {
 void saveScene(const App& app);
 
 void loadScene(App& app);
+
+// The text saveScene() writes, one line per object
+std::string sceneToString(const std::vector<std::shared_ptr<GameObject>>& objects);
+
+// Objects described by text in the format of sceneToString(), lines of unknown objects are skipped
+std::vector<std::shared_ptr<GameObject>> sceneFromString(const std::string& data);
 } // namespace SceneSaver
@@ -0,0 +1,79 @@
+#pragma once
+
+// AVX2 implementation of the SIMD float type that the kernel templates are written
+// against, see primitive_batch_kernels.hpp. Must only be included once the including file has
+// enabled AVX2 for the functions that follow, with <immintrin.h> included before that.
+
+namespace {
+struct FloatAVX {
+    static constexpr unsigned int width = 8;
+
+    FloatAVX() = default;
+    FloatAVX(__m256 v)
+        : v(v) {}
+
+    static FloatAVX set(float value) {
+        return _mm256_set1_ps(value);
+    }
+    static FloatAVX load(const float* data) {
+        return _mm256_loadu_ps(data);
+    }
+    void store(float* data) const { // data must be aligned to the vector size
+        _mm256_store_ps(data, v);
+    }
+    void storeUnaligned(float* data) const {
+        _mm256_storeu_ps(data, v);
+    }
+
+    __m256 v;
+};
+
+inline FloatAVX operator+(FloatAVX a, FloatAVX b) {
+    return _mm256_add_ps(a.v, b.v);
+}
+inline FloatAVX operator-(FloatAVX a, FloatAVX b) {
+    return _mm256_sub_ps(a.v, b.v);
+}
+inline FloatAVX operator*(FloatAVX a, FloatAVX b) {
+    return _mm256_mul_ps(a.v, b.v);
+}
+inline FloatAVX operator/(FloatAVX a, FloatAVX b) {
+    return _mm256_div_ps(a.v, b.v);
+}
+inline FloatAVX operator<(FloatAVX a, FloatAVX b) {
+    return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ);
+}
+inline FloatAVX operator<=(FloatAVX a, FloatAVX b) {
+    return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ);
+}
+inline FloatAVX operator>(FloatAVX a, FloatAVX b) {
+    return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ);
+}
+inline FloatAVX operator>=(FloatAVX a, FloatAVX b) {
+    return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ);
+}
+inline FloatAVX operator&(FloatAVX a, FloatAVX b) {
+    return _mm256_and_ps(a.v, b.v);
+}
+inline FloatAVX operator|(FloatAVX a, FloatAVX b) {
+    return _mm256_or_ps(a.v, b.v);
+}
+inline FloatAVX andNot(FloatAVX a, FloatAVX b) {
+    return _mm256_andnot_ps(a.v, b.v);
+}
+inline FloatAVX select(FloatAVX mask, FloatAVX a, FloatAVX b) {
+    return _mm256_blendv_ps(b.v, a.v, mask.v);
+}
+inline FloatAVX min(FloatAVX a, FloatAVX b) {
+    return _mm256_min_ps(a.v, b.v);
+}
+inline FloatAVX max(FloatAVX a, FloatAVX b) {
+    return _mm256_max_ps(a.v, b.v);
+}
+inline FloatAVX sqrt(FloatAVX a) {
+    return _mm256_sqrt_ps(a.v);
+}
+inline FloatAVX abs(FloatAVX a) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v);
+}
+} // namespace
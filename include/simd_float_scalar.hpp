@@ -0,0 +1,58 @@
+#pragma once
+
+// One lane version of the SIMD float type, used for the scalar fallback of kernels that only need
+// arithmetic (no comparison masks), and for the pixels at the edges of an image where the
+// neighbours a kernel reads have to be clamped one at a time.
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+struct FloatScalar {
+    static constexpr unsigned int width = 1;
+
+    FloatScalar() = default;
+    FloatScalar(float v)
+        : v(v) {}
+
+    static FloatScalar set(float value) {
+        return value;
+    }
+    static FloatScalar load(const float* data) {
+        return *data;
+    }
+    void store(float* data) const {
+        *data = v;
+    }
+    void storeUnaligned(float* data) const {
+        *data = v;
+    }
+
+    float v;
+};
+
+inline FloatScalar operator+(FloatScalar a, FloatScalar b) {
+    return a.v + b.v;
+}
+inline FloatScalar operator-(FloatScalar a, FloatScalar b) {
+    return a.v - b.v;
+}
+inline FloatScalar operator*(FloatScalar a, FloatScalar b) {
+    return a.v * b.v;
+}
+inline FloatScalar operator/(FloatScalar a, FloatScalar b) {
+    return a.v / b.v;
+}
+inline FloatScalar min(FloatScalar a, FloatScalar b) {
+    return std::min(a.v, b.v);
+}
+inline FloatScalar max(FloatScalar a, FloatScalar b) {
+    return std::max(a.v, b.v);
+}
+inline FloatScalar sqrt(FloatScalar a) {
+    return std::sqrt(a.v);
+}
+inline FloatScalar abs(FloatScalar a) {
+    return std::abs(a.v);
+}
+} // namespace
@@ -0,0 +1,79 @@
+#pragma once
+
+// SSE4.2 implementation of the SIMD float type that the kernel templates are written
+// against, see primitive_batch_kernels.hpp. Must only be included once the including file has
+// enabled SSE4.2 for the functions that follow, with <immintrin.h> included before that.
+
+namespace {
+struct FloatSSE {
+    static constexpr unsigned int width = 4;
+
+    FloatSSE() = default;
+    FloatSSE(__m128 v)
+        : v(v) {}
+
+    static FloatSSE set(float value) {
+        return _mm_set1_ps(value);
+    }
+    static FloatSSE load(const float* data) {
+        return _mm_loadu_ps(data);
+    }
+    void store(float* data) const { // data must be aligned to the vector size
+        _mm_store_ps(data, v);
+    }
+    void storeUnaligned(float* data) const {
+        _mm_storeu_ps(data, v);
+    }
+
+    __m128 v;
+};
+
+inline FloatSSE operator+(FloatSSE a, FloatSSE b) {
+    return _mm_add_ps(a.v, b.v);
+}
+inline FloatSSE operator-(FloatSSE a, FloatSSE b) {
+    return _mm_sub_ps(a.v, b.v);
+}
+inline FloatSSE operator*(FloatSSE a, FloatSSE b) {
+    return _mm_mul_ps(a.v, b.v);
+}
+inline FloatSSE operator/(FloatSSE a, FloatSSE b) {
+    return _mm_div_ps(a.v, b.v);
+}
+inline FloatSSE operator<(FloatSSE a, FloatSSE b) {
+    return _mm_cmplt_ps(a.v, b.v);
+}
+inline FloatSSE operator<=(FloatSSE a, FloatSSE b) {
+    return _mm_cmple_ps(a.v, b.v);
+}
+inline FloatSSE operator>(FloatSSE a, FloatSSE b) {
+    return _mm_cmpgt_ps(a.v, b.v);
+}
+inline FloatSSE operator>=(FloatSSE a, FloatSSE b) {
+    return _mm_cmpge_ps(a.v, b.v);
+}
+inline FloatSSE operator&(FloatSSE a, FloatSSE b) {
+    return _mm_and_ps(a.v, b.v);
+}
+inline FloatSSE operator|(FloatSSE a, FloatSSE b) {
+    return _mm_or_ps(a.v, b.v);
+}
+inline FloatSSE andNot(FloatSSE a, FloatSSE b) {
+    return _mm_andnot_ps(a.v, b.v);
+}
+inline FloatSSE select(FloatSSE mask, FloatSSE a, FloatSSE b) {
+    return _mm_blendv_ps(b.v, a.v, mask.v);
+}
+inline FloatSSE min(FloatSSE a, FloatSSE b) {
+    return _mm_min_ps(a.v, b.v);
+}
+inline FloatSSE max(FloatSSE a, FloatSSE b) {
+    return _mm_max_ps(a.v, b.v);
+}
+inline FloatSSE sqrt(FloatSSE a) {
+    return _mm_sqrt_ps(a.v);
+}
+inline FloatSSE abs(FloatSSE a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+}
+} // namespace
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <image.hpp>
+
+struct Tile {
+    unsigned int index;
+    unsigned int x0;
+    unsigned int y0;
+    unsigned int x1; // Exclusive
+    unsigned int y1; // Exclusive
+};
+
+struct TileSchedulerStats {
+    TileSchedulerStats();
+
+    // Heat map of tile_times at the given resolution, blue for the fastest tile and red for the
+    // slowest one
+    [[nodiscard]] Image timingMap(unsigned int width, unsigned int height) const;
+
+    unsigned int tile_size;
+    unsigned int tiles_x;
+    unsigned int tiles_y;
+
+    std::vector<float> tile_times;          // Milliseconds, indexed by tile index
+    std::vector<unsigned int> tile_workers; // Worker that rendered each tile
+    std::vector<float> worker_busy_times;   // Milliseconds spent rendering per worker
+    unsigned int steals;
+};
+
+// Splits an image into square tiles and renders them on several threads. Every worker starts with
+// its own contiguous block of tiles in a deque and takes work from the front of it. Once a worker
+// runs out it steals half of the tiles left at the back of another worker's deque, so expensive
+// regions of the image end up being shared between every thread until the very last tile.
+class TileScheduler {
+public:
+    TileScheduler(unsigned int image_width, unsigned int image_height, unsigned int tile_size,
+                  unsigned int num_workers);
+
+    // Calls render_tile(tile, worker_index) once for every tile. The calling thread is used as
+    // worker 0 and returns once every tile has been rendered.
+    void run(const std::function<void(const Tile&, unsigned int)>& render_tile);
+
+    [[nodiscard]] const std::vector<Tile>& getTiles() const;
+
+    TileSchedulerStats stats;
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<unsigned int> tiles;
+    };
+
+    void workerLoop(unsigned int worker_index,
+                    const std::function<void(const Tile&, unsigned int)>& render_tile);
+
+    bool popLocal(unsigned int worker_index, unsigned int& tile_index);
+    // Takes one tile to render and moves half the rest of the first non-empty queue into the
+    // worker's own. Returns false if every other queue was empty when looked at
+    bool steal(unsigned int worker_index, unsigned int& tile_index);
+
+    unsigned int num_workers;
+    std::vector<Tile> tiles;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::atomic<unsigned int> tiles_left; // Not yet taken by any worker
+    std::mutex stats_mutex;
+};
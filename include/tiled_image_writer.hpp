@@ -0,0 +1,75 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include <denoiser.hpp>
+#include <image.hpp>
+#include <tile_scheduler.hpp>
+
+// Writes an image tile by tile straight into its files, for resolutions too big to keep in memory.
+// Every file is a PFM created at its full size up front, so a tile's rows go to fixed offsets and
+// can be written in any order, and no more than the tiles being written is ever held in memory.
+//
+// The colour goes to path, along with path's ".albedo.pfm", ".normal.pfm" and ".depth.pfm"
+// siblings when the features are written too. PFM rows run from the bottom of the picture up and
+// are in the machine's byte order, which the header records. The index at path + ".tiles" lists
+// the files and then every tile as it is written, so a render that was cut short still says which
+// parts of the files hold pixels. A tile is only listed once its rows have been flushed to every
+// file:
+//   image <width> <height> <file>
+//   aov <name> <file>
+//   tile <x0> <y0> <x1> <y1>
+class TiledImageWriter {
+public:
+    TiledImageWriter();
+    ~TiledImageWriter();
+
+    TiledImageWriter(const TiledImageWriter&)            = delete;
+    TiledImageWriter& operator=(const TiledImageWriter&) = delete;
+
+    // Creates the files as black images, replacing any that exist
+    bool open(const std::string& path, unsigned int width, unsigned int height, bool features);
+
+    // colour, and features if the writer was opened with them, hold the tile's pixels alone, row
+    // major. Safe to call from several threads at once. Returns false, without listing the tile in
+    // the index, if any file could not be written
+    bool writeTile(const Tile& tile, const Image& colour, const FeatureBuffers* features);
+
+    // Flushes and closes every file, returns false if any write failed along the way
+    bool close();
+
+    [[nodiscard]] bool isOpen() const;
+    [[nodiscard]] unsigned int getWidth() const;
+    [[nodiscard]] unsigned int getHeight() const;
+    [[nodiscard]] bool hasFeatures() const;
+    [[nodiscard]] unsigned int numTilesWritten() const;
+
+private:
+    // One PFM of 1 or 3 floats per pixel
+    struct Channel {
+        std::fstream file;
+        unsigned int components;
+        std::streamoff header_size;
+    };
+
+    bool openChannel(Channel& channel, const std::string& channel_path, unsigned int components);
+
+    // rows holds the tile's rows top to bottom, components floats per pixel
+    void writeRows(Channel& channel, const Tile& tile, const float* rows);
+
+    unsigned int width;
+    unsigned int height;
+    bool features;
+    bool opened;
+    bool failed; // A write went wrong, reported by close()
+    unsigned int tiles_written;
+
+    std::mutex mutex; // Guards the files, tiles arrive from every render thread
+    Channel colour;
+    Channel albedo;
+    Channel normal;
+    Channel depth;
+    std::ofstream index;
+};
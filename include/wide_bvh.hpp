@@ -0,0 +1,256 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <bvh.hpp>
+#include <cpu_features.hpp>
+#include <ray.hpp>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Node with up to N children whose bounds are stored as structure of arrays, so that the ray can
+// be tested against every child box with one sequence of SIMD instructions. Children always occupy
+// the first num_children lanes.
+template <unsigned int N>
+struct alignas(32) WideBVHNode {
+    float bounds_min[3][N]; // bounds_min[axis][child]
+    float bounds_max[3][N];
+    unsigned int child[N]; // Interior child: node index. Leaf child: first primitive index
+    unsigned int count[N]; // Number of primitives in a leaf child, 0 for interior children
+    unsigned int num_children;
+};
+
+// Ray in the form the child box tests want it, with every component in its own lane-broadcastable
+// float
+struct WideRay {
+    explicit WideRay(const Ray& ray);
+
+    float origin[3];
+    float inv_direction[3];
+};
+
+// Tests the ray against every child box of a node. Writes the entry distance of each child to
+// t_entry and returns a bit mask of the children hit within [t_min, t_max]
+template <unsigned int N>
+using WideNodeKernel = unsigned int (*)(const WideBVHNode<N>& node, const WideRay& ray,
+                                        float t_min, float t_max, float* t_entry);
+
+// BVH with 4 or 8 children per node, collapsed from a binary BVH. The child box test is picked at
+// runtime from the kernels the CPU supports: AVX2 tests 8 boxes per instruction, SSE4.2 tests 4
+// (two halves for 8 wide nodes) and the scalar kernel is used everywhere else.
+template <unsigned int N>
+class WideBVH {
+public:
+    static_assert(N == 4 || N == 8, "Wide BVH nodes hold 4 or 8 children");
+
+    WideBVH();
+
+    void build(const BVH& binary_bvh);
+
+    // Copies the bounds of the binary nodes a refit changed into the lanes they were collapsed
+    // into. binary_bvh must be the tree this one was built from, refit since. changed_wide_nodes,
+    // if given, receives the wide nodes touched, possibly more than once
+    void refit(const BVH& binary_bvh, const std::vector<unsigned int>& changed_nodes,
+               std::vector<unsigned int>* changed_wide_nodes = nullptr);
+
+    // Same contract as BVH::intersect
+    template <typename LeafIntersector>
+    bool intersect(const Ray& ray, float t_min, float& t_max, LeafIntersector&& intersect_leaf,
+                   BVHTraversalStats* stats = nullptr) const;
+
+    // Same contract as BVH::occluded
+    template <typename LeafOcclusionTest>
+    bool occluded(const Ray& ray, float t_min, float t_max, LeafOcclusionTest&& occluded_leaf,
+                  BVHTraversalStats* stats = nullptr) const;
+
+    // Selects the child box kernel, clamped to what the CPU supports
+    void setSIMDLevel(CPU::SIMDLevel level);
+    [[nodiscard]] CPU::SIMDLevel getSIMDLevel() const;
+
+    std::vector<WideBVHNode<N>> nodes;
+    std::vector<unsigned int> primitive_indices; // Same order as the binary BVH's
+
+    BVHBuildStats build_stats;
+
+    // Every level of the binary BVH pushes at most N - 1 siblings
+    static constexpr unsigned int max_stack_size = BVH::max_depth * (N - 1) + 1;
+
+private:
+    CPU::SIMDLevel simd_level;
+    WideNodeKernel<N> test_children;
+
+    // Lane wide_index * N + lane holding every binary node, no_lane for the interior nodes that
+    // were opened up while collapsing
+    std::vector<unsigned int> binary_lanes;
+    static constexpr unsigned int no_lane = ~0u;
+};
+
+// Index of the lowest set bit of a child mask, which must not be 0. Scanning the bits one by one
+// instead mispredicts a branch per lane, which was a large part of the traversal time
+inline unsigned int lowestLane(unsigned int mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned int>(index);
+#else
+    return static_cast<unsigned int>(__builtin_ctz(mask));
+#endif
+}
+
+// Closest hit traversal shared by every wide layout. Node is any node type with N lanes of child
+// and count, test_children any callable with the WideNodeKernel signature for it
+template <unsigned int N, typename Node, typename Kernel, typename LeafIntersector>
+bool intersectWide(const std::vector<Node>& nodes, Kernel test_children, const Ray& ray,
+                   float t_min, float& t_max, LeafIntersector&& intersect_leaf,
+                   BVHTraversalStats* stats) {
+    constexpr unsigned int max_stack_size = WideBVH<N>::max_stack_size;
+    if (nodes.empty()) {
+        return false;
+    }
+
+    WideRay wide_ray(ray);
+
+    uint64_t nodes_visited   = 0;
+    uint64_t primitive_tests = 0;
+    bool hit                 = false;
+
+    unsigned int stack[max_stack_size];
+    float stack_t[max_stack_size];
+    unsigned int stack_size = 0;
+
+    stack[stack_size]   = 0;
+    stack_t[stack_size] = t_min;
+    stack_size++;
+
+    alignas(32) float t_entry[N];
+    unsigned int interior[N];
+
+    while (stack_size > 0) {
+        stack_size--;
+        if (stack_t[stack_size] > t_max) {
+            continue;
+        }
+        const Node& node = nodes[stack[stack_size]];
+        nodes_visited++;
+
+        unsigned int mask = test_children(node, wide_ray, t_min, t_max, t_entry);
+
+        // Leaves are intersected straight away so t_max shrinks before anything is pushed,
+        // interior children are kept to be sorted by distance
+        unsigned int num_interior = 0;
+        while (mask != 0) {
+            unsigned int lane = lowestLane(mask);
+            mask &= mask - 1;
+
+            if (node.count[lane] > 0) {
+                primitive_tests += node.count[lane];
+                if (intersect_leaf(node.child[lane], node.count[lane], t_min, t_max)) {
+                    hit = true;
+                }
+            } else {
+                interior[num_interior++] = lane;
+            }
+        }
+
+        // Push the furthest child first so the closest one is popped next. Insertion sort, there
+        // are never more than N entries
+        for (unsigned int i = 1; i < num_interior; ++i) {
+            unsigned int lane = interior[i];
+            unsigned int j    = i;
+            while (j > 0 && t_entry[interior[j - 1]] < t_entry[lane]) {
+                interior[j] = interior[j - 1];
+                j--;
+            }
+            interior[j] = lane;
+        }
+        for (unsigned int i = 0; i < num_interior; ++i) {
+            stack[stack_size]   = node.child[interior[i]];
+            stack_t[stack_size] = t_entry[interior[i]];
+            stack_size++;
+        }
+    }
+
+    if (stats) {
+        stats->rays++;
+        stats->nodes_visited += nodes_visited;
+        stats->primitive_tests += primitive_tests;
+    }
+
+    return hit;
+}
+
+// Any hit traversal shared by every wide layout, same requirements as intersectWide()
+template <unsigned int N, typename Node, typename Kernel, typename LeafOcclusionTest>
+bool occludedWide(const std::vector<Node>& nodes, Kernel test_children, const Ray& ray,
+                  float t_min, float t_max, LeafOcclusionTest&& occluded_leaf,
+                  BVHTraversalStats* stats) {
+    constexpr unsigned int max_stack_size = WideBVH<N>::max_stack_size;
+    if (nodes.empty()) {
+        return false;
+    }
+
+    WideRay wide_ray(ray);
+
+    uint64_t nodes_visited   = 0;
+    uint64_t primitive_tests = 0;
+    bool blocked             = false;
+
+    unsigned int stack[max_stack_size];
+    unsigned int stack_size = 0;
+    stack[stack_size++]     = 0;
+
+    alignas(32) float t_entry[N];
+
+    while (stack_size > 0 && !blocked) {
+        const Node& node = nodes[stack[--stack_size]];
+        nodes_visited++;
+
+        unsigned int mask = test_children(node, wide_ray, t_min, t_max, t_entry);
+
+        // Leaves first, any of them may end the query before the interior children are pushed
+        unsigned int interior = 0;
+        while (mask != 0 && !blocked) {
+            unsigned int lane = lowestLane(mask);
+            mask &= mask - 1;
+
+            if (node.count[lane] > 0) {
+                primitive_tests += node.count[lane];
+                blocked = occluded_leaf(node.child[lane], node.count[lane], t_min, t_max);
+            } else {
+                interior |= 1u << lane;
+            }
+        }
+
+        for (unsigned int lane = 0; lane < N && !blocked; ++lane) {
+            if (interior & (1u << lane)) {
+                stack[stack_size++] = node.child[lane];
+            }
+        }
+    }
+
+    if (stats) {
+        stats->rays++;
+        stats->nodes_visited += nodes_visited;
+        stats->primitive_tests += primitive_tests;
+    }
+
+    return blocked;
+}
+
+template <unsigned int N>
+template <typename LeafIntersector>
+bool WideBVH<N>::intersect(const Ray& ray, float t_min, float& t_max,
+                           LeafIntersector&& intersect_leaf, BVHTraversalStats* stats) const {
+    return intersectWide<N>(nodes, test_children, ray, t_min, t_max, intersect_leaf, stats);
+}
+
+template <unsigned int N>
+template <typename LeafOcclusionTest>
+bool WideBVH<N>::occluded(const Ray& ray, float t_min, float t_max,
+                          LeafOcclusionTest&& occluded_leaf, BVHTraversalStats* stats) const {
+    return occludedWide<N>(nodes, test_children, ray, t_min, t_max, occluded_leaf, stats);
+}
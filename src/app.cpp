@@ -1,5 +1,9 @@
 #include <app.hpp>
 
+#include <chrono>
+#include <cstdio>
+#include <limits>
+
 App::App(int window_x, int window_y)
     : renderer(window_x, window_y, 16)
     , max_lights(16) {
@@ -22,6 +26,32 @@ App::App(int window_x, int window_y)
     // Camera
     active_camera = &engine_camera;
 
+    // Ray tracer
+    use_raytracer_camera       = false;
+    raytracer_accelerator      = SceneAccelerator::BVH8;
+    raytracer_simd_level       = CPU::detectSIMDLevel();
+    raytracer_write_timing_map = false;
+    raytracer_write_sample_map = false;
+    raytracer_checkpoint       = false;
+    raytracer_stream_to_file   = false;
+    raytracer_time_budget      = 0.0f;
+    raytracer_distributed      = false;
+    raytracer_denoise          = false;
+    last_render_error          = -1.0f;
+    last_denoised_error        = -1.0f;
+
+    // Next to the scene file SceneSaver writes
+    render_checkpoint = RenderCheckpoint(RESOURCES_PATH "save_data/test.checkpoint", 60.0f);
+    std::snprintf(raytracer_distributed_address, sizeof(raytracer_distributed_address), "%s",
+                  distributed_render.settings.address.c_str());
+
+    // Region of interest
+    raytracer_use_region              = false;
+    raytracer_region_over_last_render = true;
+    selecting_region                  = false;
+    dragging_region                   = false;
+    region_drag_start                 = glm::vec2(0.0f);
+
     // Shaders
     num_lights = 0;
 
@@ -218,7 +248,10 @@ void App::runActions() {
             float mouse_yoffset = event_manager->events.front().mouse_ypos - last_mouse_ypos;
             last_mouse_xpos += mouse_xoffset;
             last_mouse_ypos += mouse_yoffset;
-            processMouseMovement(last_mouse_xpos, last_mouse_ypos);
+            // Leave the objects and gizmos alone while a region is being picked
+            if (!selecting_region) {
+                processMouseMovement(last_mouse_xpos, last_mouse_ypos);
+            }
             break;
         }
         case Action::ZOOM:
@@ -229,6 +262,13 @@ void App::runActions() {
             // Once a click has been registered, i.e. left mouse button has been released:
             using_gizmo   = false;
             mouse_pressed = false;
+            if (dragging_region) {
+                raytracer_region = windowToFrameRegion(region_drag_start,
+                                                       glm::vec2(last_mouse_xpos, last_mouse_ypos));
+                selecting_region = false;
+                dragging_region  = false;
+                break;
+            }
             if (mouseover_object) {
                 selected_object  = mouseover_object;
                 mouseover_object = nullptr;
@@ -236,6 +276,10 @@ void App::runActions() {
             break;
         case Action::L_BUTTON_PRESSED:
             mouse_pressed = true;
+            if (selecting_region && !dragging_region && !ImGui::GetIO().WantCaptureMouse) {
+                region_drag_start = glm::vec2(last_mouse_xpos, last_mouse_ypos);
+                dragging_region   = true;
+            }
             break;
         case Action::R_CLICK:
             std::cout << "Right click registered" << std::endl;
@@ -299,6 +343,8 @@ void App::render() {
     // Let ImGUI know we're working on a new frame
     window_manager->newImGuiFrame();
 
+    updateRayTracedViewport();
+
     // Render scene
     renderer.render(RenderContext{game_objects, mouseover_object, selected_object, active_camera,
                                   gizmos, mouseover_gizmo, active_gizmo_type});
@@ -576,6 +622,701 @@ void App::renderImGUI() {
     ImGui::Checkbox("Use PCF", &renderer.use_pcf);
 
     ImGui::End();
+
+    ImGui::SetNextWindowPos(ImVec2(window_x - (window_x * 0.15f), window_y * 0.3f));
+    ImGui::SetNextWindowSize(ImVec2(window_x * 0.15f, window_y * 0.4f));
+    ImGui::Begin("Ray Tracer");
+
+    ImGui::Text("Control the ray tracer camera");
+    if (ImGui::Checkbox("Use ray tracer camera", &use_raytracer_camera)) {
+        active_camera = use_raytracer_camera ? &raytracer_camera : &engine_camera;
+    }
+
+    ImGui::Separator();
+    ImGui::Separator();
+
+    ImGui::SetNextItemWidth(120.f);
+    ImGui::InputScalar("Image width", ImGuiDataType_U32, &raytracer.settings.width);
+    ImGui::SetNextItemWidth(120.f);
+    ImGui::InputScalar("Image height", ImGuiDataType_U32, &raytracer.settings.height);
+    ImGui::SetNextItemWidth(120.f);
+    ImGui::InputScalar("Samples per pixel", ImGuiDataType_U32,
+                       &raytracer.settings.samples_per_pixel);
+    ImGui::SetNextItemWidth(120.f);
+    ImGui::InputScalar("Max bounces", ImGuiDataType_U32, &raytracer.settings.max_depth);
+    ImGui::SetNextItemWidth(120.f);
+    ImGui::InputScalar("Threads (0 = all)", ImGuiDataType_U32, &raytracer.settings.num_threads);
+    ImGui::SetNextItemWidth(120.f);
+    ImGui::InputScalar("Tile size", ImGuiDataType_U32, &raytracer.settings.tile_size);
+    ImGui::SetNextItemWidth(120.f);
+    if (ImGui::BeginCombo("Accelerator", sceneAcceleratorName(raytracer_accelerator))) {
+        for (SceneAccelerator accelerator :
+             {SceneAccelerator::LINEAR_SCAN, SceneAccelerator::BVH2, SceneAccelerator::BVH4,
+              SceneAccelerator::BVH8, SceneAccelerator::BVH4_QUANTIZED,
+              SceneAccelerator::BVH8_QUANTIZED}) {
+            bool is_selected = (raytracer_accelerator == accelerator);
+            if (ImGui::Selectable(sceneAcceleratorName(accelerator), is_selected)) {
+                raytracer_accelerator = accelerator;
+            }
+        }
+        ImGui::EndCombo();
+    }
+    ImGui::SetNextItemWidth(120.f);
+    if (ImGui::BeginCombo("BVH builder", bvhBuilderName(raytracer_bvh_build.builder))) {
+        for (BVHBuilder builder : {BVHBuilder::BINNED_SAH, BVHBuilder::LBVH}) {
+            bool is_selected = (raytracer_bvh_build.builder == builder);
+            if (ImGui::Selectable(bvhBuilderName(builder), is_selected)) {
+                raytracer_bvh_build.builder = builder;
+            }
+        }
+        ImGui::EndCombo();
+    }
+    if (raytracer_bvh_build.builder == BVHBuilder::LBVH) {
+        ImGui::Checkbox("Optimize treelets", &raytracer_bvh_build.optimize_treelets);
+    }
+    if (ImGui::Button("Compare BVH builders")) {
+        compareBVHBuilders();
+    }
+    if (ImGui::Button("Compare BVH node layouts")) {
+        compareBVHLayouts();
+    }
+    ImGui::Checkbox("Wavefront integrator", &raytracer.settings.wavefront);
+    if (!raytracer.settings.wavefront) {
+        ImGui::Checkbox("Primary ray packets", &raytracer.settings.packet_primary_rays);
+        ImGui::Checkbox("Shadow ray packets", &raytracer.settings.packet_shadow_rays);
+        ImGui::Checkbox("Path guiding", &raytracer.settings.path_guiding);
+    }
+    if (raytracer.settings.path_guiding && !raytracer.settings.wavefront) {
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputScalar("Guide training passes", ImGuiDataType_U32,
+                           &raytracer.settings.guiding_training_passes);
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::SliderFloat("Guided bounces", &raytracer.settings.guiding_fraction, 0.0f, 0.95f);
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputScalar("Guide resolution", ImGuiDataType_U32,
+                           &raytracer.settings.guiding_resolution);
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputScalar("Guide memory (MB)", ImGuiDataType_U32,
+                           &raytracer.settings.guiding_memory);
+        raytracer.settings.guiding_resolution = std::max(raytracer.settings.guiding_resolution, 1u);
+    }
+    // Only levels the CPU supports are offered, the widest one is picked by default
+    ImGui::SetNextItemWidth(120.f);
+    if (ImGui::BeginCombo("SIMD kernels", CPU::simdLevelName(raytracer_simd_level))) {
+        for (CPU::SIMDLevel level :
+             {CPU::SIMDLevel::SCALAR, CPU::SIMDLevel::SSE42, CPU::SIMDLevel::AVX2}) {
+            if (level > CPU::detectSIMDLevel()) {
+                continue;
+            }
+            bool is_selected = (raytracer_simd_level == level);
+            if (ImGui::Selectable(CPU::simdLevelName(level), is_selected)) {
+                raytracer_simd_level = level;
+            }
+        }
+        ImGui::EndCombo();
+    }
+    ImGui::SetNextItemWidth(120.f);
+    if (ImGui::BeginCombo("Light sampling",
+                          lightSamplingName(raytracer.settings.light_sampling))) {
+        for (LightSampling sampling :
+             {LightSampling::ALL, LightSampling::ALIAS_TABLE, LightSampling::LIGHT_BVH}) {
+            bool is_selected = (raytracer.settings.light_sampling == sampling);
+            if (ImGui::Selectable(lightSamplingName(sampling), is_selected)) {
+                raytracer.settings.light_sampling = sampling;
+            }
+        }
+        ImGui::EndCombo();
+    }
+    if (raytracer.settings.light_sampling != LightSampling::ALL) {
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputScalar("Lights per shading point", ImGuiDataType_U32,
+                           &raytracer.settings.light_samples);
+        raytracer.settings.light_samples = std::max(raytracer.settings.light_samples, 1u);
+    }
+    ImGui::SetNextItemWidth(120.f);
+    if (ImGui::BeginCombo("Sampler", samplerTypeName(raytracer.settings.sampler))) {
+        for (SamplerType type :
+             {SamplerType::RANDOM, SamplerType::SOBOL, SamplerType::BLUE_NOISE}) {
+            bool is_selected = (raytracer.settings.sampler == type);
+            if (ImGui::Selectable(samplerTypeName(type), is_selected)) {
+                raytracer.settings.sampler = type;
+            }
+        }
+        ImGui::EndCombo();
+    }
+    ImGui::SetNextItemWidth(120.f);
+    ImGui::InputScalar("Sampler seed", ImGuiDataType_U32, &raytracer.settings.sampler_seed);
+    ImGui::Checkbox("Adaptive sampling", &raytracer.settings.adaptive_sampling);
+    if (raytracer.settings.adaptive_sampling) {
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputFloat("Error threshold", &raytracer.settings.adaptive_threshold, 0.005f, 0.05f,
+                          "%.3f");
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputScalar("Samples per batch", ImGuiDataType_U32,
+                           &raytracer.settings.adaptive_min_samples);
+        ImGui::Checkbox("Write sample count map", &raytracer_write_sample_map);
+    }
+    ImGui::Checkbox("Write tile timing map", &raytracer_write_timing_map);
+    ImGui::Checkbox("Region of interest", &raytracer_use_region);
+    if (raytracer_use_region) {
+        if (ImGui::Button(selecting_region ? "Drag out a rectangle in the viewport"
+                                           : "Select region in viewport")) {
+            selecting_region = !selecting_region;
+            dragging_region  = false;
+        }
+        unsigned int corners[4] = {raytracer_region.x0, raytracer_region.y0, raytracer_region.x1,
+                                   raytracer_region.y1};
+        ImGui::SetNextItemWidth(240.f);
+        if (ImGui::InputScalarN("Region (x0 y0 x1 y1)", ImGuiDataType_U32, corners, 4)) {
+            raytracer_region = ImageRegion(corners[0], corners[1], corners[2], corners[3]);
+        }
+        ImGui::Checkbox("Composite over last render", &raytracer_region_over_last_render);
+    }
+    // Region renders are plain local renders of the crop
+    const bool full_frame = !raytracer_use_region;
+    if (full_frame) {
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputFloat("Time budget (s, 0 = off)", &raytracer_time_budget, 1.0f, 10.0f, "%.1f");
+        raytracer_time_budget = std::max(raytracer_time_budget, 0.0f);
+    }
+    // Budgeted renders refine the whole image pass after pass, there are no finished tiles to save
+    const bool fixed_samples = full_frame && raytracer_time_budget == 0.0f;
+    if (fixed_samples) {
+        ImGui::Checkbox("Distributed", &raytracer_distributed);
+    }
+    if (raytracer_distributed && fixed_samples) {
+        ImGui::SetNextItemWidth(200.f);
+        ImGui::InputText("Listen address", raytracer_distributed_address,
+                         sizeof(raytracer_distributed_address));
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputScalar("Samples per job (0 = all)", ImGuiDataType_U32,
+                           &distributed_render.settings.samples_per_job);
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputFloat("Worker timeout (s)", &distributed_render.settings.job_timeout, 10.0f,
+                          60.0f, "%.0f");
+        ImGui::Text("Workers connected: %u", distributed_render.numWorkers());
+        if (raytracer.settings.path_guiding) {
+            ImGui::Text("Path guiding is not supported by distributed renders");
+        }
+    }
+    const bool local_render = fixed_samples && !raytracer_distributed;
+    if (local_render) {
+        ImGui::Checkbox("Stream to tiled PFM", &raytracer_stream_to_file);
+    }
+    // The checkpoint only follows local renders of samples_per_pixel kept in memory
+    const bool checkpoint_render = local_render && !raytracer_stream_to_file;
+    if (checkpoint_render) {
+        ImGui::Checkbox("Checkpoint to disk", &raytracer_checkpoint);
+    }
+    if (raytracer_checkpoint && checkpoint_render) {
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputFloat("Checkpoint interval (s)", &render_checkpoint.save_interval, 10.0f,
+                          60.0f, "%.0f");
+    }
+    ImGui::Checkbox("Denoise", &raytracer_denoise);
+    if (raytracer_denoise) {
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputScalar("Denoiser iterations", ImGuiDataType_U32,
+                           &denoiser.settings.iterations);
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputFloat("Colour sigma", &denoiser.settings.colour_sigma, 0.05f, 0.5f, "%.2f");
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputFloat("Normal sigma", &denoiser.settings.normal_sigma, 0.01f, 0.1f, "%.2f");
+        ImGui::SetNextItemWidth(120.f);
+        ImGui::InputFloat("Depth sigma", &denoiser.settings.depth_sigma, 0.01f, 0.1f, "%.2f");
+
+        denoiser.settings.iterations =
+            std::min(denoiser.settings.iterations, DenoiserSettings::max_iterations);
+        for (float* sigma : {&denoiser.settings.colour_sigma, &denoiser.settings.normal_sigma,
+                             &denoiser.settings.depth_sigma}) {
+            *sigma = std::max(*sigma, DenoiserSettings::min_sigma);
+        }
+    }
+
+    ImGui::Separator();
+    ImGui::Separator();
+
+    ImGui::Checkbox("Ray traced viewport", &renderer.raytraced_viewport);
+    unsigned int max_passes = progressive_renderer.getMaxPasses();
+    ImGui::SetNextItemWidth(120.f);
+    if (ImGui::InputScalar("Max passes (0 = no limit)", ImGuiDataType_U32, &max_passes)) {
+        progressive_renderer.setMaxPasses(max_passes);
+    }
+    float target_frame_time = progressive_renderer.getTargetFrameTime() * 1000.0f;
+    ImGui::SetNextItemWidth(120.f);
+    if (ImGui::InputFloat("Target frame time in ms while moving (0 = full res)",
+                          &target_frame_time, 5.0f, 20.0f, "%.0f")) {
+        progressive_renderer.setTargetFrameTime(std::max(target_frame_time, 0.0f) / 1000.0f);
+    }
+    if (renderer.raytraced_viewport) {
+        ImGui::Text("Viewport passes: %u (%.0fms per pass)", progressive_renderer.getNumPasses(),
+                    progressive_renderer.getLastPassTime() * 1000.0f);
+        if (progressive_renderer.getPreviewScale() > 1) {
+            ImGui::Text("Previewing at 1/%u resolution", progressive_renderer.getPreviewScale());
+        }
+        ImGui::Text("BVH refits: %u, SAH cost x%.2f%s", progressive_renderer.getNumRefits(),
+                    progressive_renderer.getSAHCostGrowth(),
+                    progressive_renderer.isRebuilding() ? ", rebuilding" : "");
+    }
+    float rebuild_threshold = progressive_renderer.getRebuildThreshold();
+    ImGui::SetNextItemWidth(120.f);
+    if (ImGui::InputFloat("Rebuild at SAH cost x (0 = never)", &rebuild_threshold, 0.1f, 0.5f,
+                          "%.2f")) {
+        progressive_renderer.setRebuildThreshold(std::max(rebuild_threshold, 0.0f));
+    }
+
+    ImGui::Separator();
+    ImGui::Separator();
+
+    if (ImGui::Button("Render Image")) {
+        renderRayTracedImage();
+    }
+    ImGui::Text("Last render: %.2fs on %u threads", raytracer.last_render_time,
+                raytracer.last_num_threads);
+    if (raytracer.last_traversal_stats.rays > 0) {
+        float rays = static_cast<float>(raytracer.last_traversal_stats.rays);
+        ImGui::Text("Nodes per ray: %.2f", raytracer.last_traversal_stats.nodes_visited / rays);
+        ImGui::Text("Primitive tests per ray: %.2f",
+                    raytracer.last_traversal_stats.primitive_tests / rays);
+        ImGui::Text("Tiles stolen: %u", raytracer.last_tile_stats.steals);
+        ImGui::Text("Average samples per pixel: %.2f", raytracer.last_average_samples);
+        ImGui::Text("Mrays/s: %.2f", rays / std::max(raytracer.last_render_time, 1e-6f) * 1e-6f);
+        const WavefrontStats& wavefront = raytracer.last_wavefront_stats;
+        if (wavefront.extension_rays > 0) {
+            // Per thread, the stage times are summed over the workers
+            ImGui::Text("Extend: %.2f Mrays/s per thread",
+                        wavefront.extension_rays / std::max(wavefront.extend_time, 1e-3f) * 1e-3f);
+            ImGui::Text("Shadow: %.2f Mrays/s per thread",
+                        wavefront.shadow_rays / std::max(wavefront.shadow_time, 1e-3f) * 1e-3f);
+            ImGui::Text("Sort %.0fms, shade %.0fms", wavefront.sort_time, wavefront.shade_time);
+        }
+        if (raytracer.settings.path_guiding) {
+            PathGuideStats guide = raytracer.path_guide.getStats();
+            ImGui::Text("Path guide: %u cells, %.1f of %.1f MB", guide.cells,
+                        guide.memory / (1024.0f * 1024.0f),
+                        guide.memory_budget / (1024.0f * 1024.0f));
+        }
+        ImGui::Text("Packets: %llu (%llu traced per ray)",
+                    static_cast<unsigned long long>(raytracer.last_traversal_stats.packets),
+                    static_cast<unsigned long long>(
+                        raytracer.last_traversal_stats.packet_fallbacks));
+    }
+    if (raytracer_denoise) {
+        ImGui::Text("Denoised in %.0fms on %u threads", denoiser.last_denoise_time * 1000.0f,
+                    denoiser.last_num_threads);
+    }
+    if (ImGui::Button("Use last render as reference")) {
+        reference_image = last_render;
+    }
+    if (last_render_error >= 0.0f) {
+        ImGui::Text("RMSE to reference: %.4f", last_render_error);
+    }
+    if (last_denoised_error >= 0.0f) {
+        ImGui::Text("Denoised RMSE to reference: %.4f", last_denoised_error);
+    }
+
+    ImGui::End();
+
+    // Outline of the region of interest, or of the one being dragged out
+    ImDrawList* draw_list = ImGui::GetForegroundDrawList();
+    if (dragging_region) {
+        draw_list->AddRect(ImVec2(region_drag_start.x, region_drag_start.y),
+                           ImVec2(last_mouse_xpos, last_mouse_ypos), IM_COL32(255, 200, 0, 255));
+    } else if (raytracer_use_region && raytracer.settings.width > 0 &&
+               raytracer.settings.height > 0) {
+        float scale_x = static_cast<float>(window_x) / raytracer.settings.width;
+        float scale_y = static_cast<float>(window_y) / raytracer.settings.height;
+        draw_list->AddRect(ImVec2(raytracer_region.x0 * scale_x, raytracer_region.y0 * scale_y),
+                           ImVec2(raytracer_region.x1 * scale_x, raytracer_region.y1 * scale_y),
+                           IM_COL32(255, 200, 0, 255));
+    }
+}
+
+void App::renderRayTracedImage() {
+    if (raytracer.settings.width == 0 || raytracer.settings.height == 0 ||
+        raytracer.settings.tile_size == 0) {
+        std::cout << "Ray tracer image size must be non zero" << std::endl;
+        return;
+    }
+    const ImageRegion region =
+        raytracer_region.clamped(raytracer.settings.width, raytracer.settings.height);
+    if (raytracer_use_region && region.empty()) {
+        std::cout << "Region of interest is outside the ray tracer image" << std::endl;
+        return;
+    }
+    if (!raytracer_use_region && raytracer_distributed && raytracer_time_budget == 0.0f) {
+        renderDistributedImage();
+        return;
+    }
+
+    // Snapshot the scene so the ray tracer never has to touch the GameObjects or OpenGL
+    RayTracerScene scene(game_objects, raytracer_bvh_build);
+    scene.accelerator = raytracer_accelerator;
+    scene.setSIMDLevel(raytracer_simd_level);
+
+    const BVHBuildStats& build_stats = scene.bvh.build_stats;
+    std::cout << bvhBuilderName(build_stats.builder) << " BVH built in "
+              << build_stats.build_time << "ms: " << build_stats.num_nodes
+              << " nodes, " << build_stats.num_leaves << " leaves, depth "
+              << build_stats.max_depth << ", SAH cost " << build_stats.sah_cost
+              << " (linear scan " << build_stats.num_primitives << ")" << std::endl;
+    auto print_wide_stats = [](const char* name, const BVHBuildStats& wide_stats) {
+        std::cout << name << " collapsed in " << wide_stats.build_time << "ms: "
+                  << wide_stats.num_nodes << " nodes, depth " << wide_stats.max_depth
+                  << ", SAH cost " << wide_stats.sah_cost << std::endl;
+    };
+    print_wide_stats("BVH4", scene.bvh4.build_stats);
+    print_wide_stats("BVH8", scene.bvh8.build_stats);
+    std::cout << "Quantized in " << scene.quantized_bvh4.build_time << "ms (BVH4) and "
+              << scene.quantized_bvh8.build_time << "ms (BVH8)" << std::endl;
+    if (!scene.primitives.empty()) {
+        size_t scene_bytes = scene.memoryUsage();
+        std::cout << scene.primitives.size() << " instances in " << scene_bytes / 1024 << "KB, "
+                  << scene_bytes / scene.primitives.size() << " bytes each" << std::endl;
+    }
+    std::cout << scene.lights.size() << " lights, "
+              << lightSamplingName(raytracer.settings.light_sampling) << " built in "
+              << scene.light_sampler.build_time << "ms" << std::endl;
+
+    // The denoiser needs to know what the camera rays hit
+    raytracer.settings.feature_buffers = raytracer_denoise;
+    const bool budgeted   = !raytracer_use_region && raytracer_time_budget > 0.0f;
+    const bool streamed   = !raytracer_use_region && raytracer_stream_to_file && !budgeted;
+    const bool checkpoint =
+        !raytracer_use_region && raytracer_checkpoint && !budgeted && !streamed;
+    if (checkpoint) {
+        // Picks up a render that was interrupted, render() starts over if it was of another view
+        render_checkpoint.load();
+    }
+    Image image;
+    if (raytracer_use_region) {
+        image = raytracer.renderRegion(scene, raytracer_camera, region);
+    } else if (budgeted) {
+        image = raytracer.renderWithBudget(scene, raytracer_camera, raytracer_time_budget);
+    } else if (streamed) {
+        TiledImageWriter writer;
+        if (!writer.open(RESOURCES_PATH "save_data/render.pfm", raytracer.settings.width,
+                         raytracer.settings.height, raytracer.settings.feature_buffers)) {
+            return;
+        }
+        bool rendered = raytracer.renderToFile(scene, raytracer_camera, writer);
+        if (!writer.close() || !rendered) {
+            return;
+        }
+        std::cout << "Wrote " << writer.numTilesWritten()
+                  << " tiles to " RESOURCES_PATH "save_data/render.pfm" << std::endl;
+    } else {
+        image = raytracer.render(scene, raytracer_camera, 0, nullptr,
+                                 checkpoint ? &render_checkpoint : nullptr);
+    }
+    if (budgeted) {
+        const RenderBudgetStats& budget_stats = raytracer.last_budget_stats;
+        std::cout << "Time budget " << budget_stats.budget << "s: " << budget_stats.passes
+                  << " passes, " << budget_stats.min_samples << " to " << budget_stats.max_samples
+                  << " samples per pixel, estimated relative error "
+                  << budget_stats.mean_relative_error << ", estimated RMSE "
+                  << budget_stats.estimated_rmse << std::endl;
+        budget_stats.write(RESOURCES_PATH "save_data/render_stats.txt");
+    }
+    if (checkpoint) {
+        render_checkpoint.remove();
+        if (raytracer.last_resumed_tiles > 0) {
+            std::cout << "Resumed " << raytracer.last_resumed_tiles << " of "
+                      << raytracer.last_tile_stats.tile_times.size()
+                      << " tiles from the checkpoint" << std::endl;
+        }
+    }
+
+    const BVHTraversalStats& stats = raytracer.last_traversal_stats;
+    const ImageRegion& rendered_region = raytracer.last_region;
+    std::cout << "Ray traced " << rendered_region.width() << "x" << rendered_region.height()
+              << " image in " << raytracer.last_render_time << "s using "
+              << raytracer.last_num_threads << " threads, " << raytracer.last_average_samples
+              << " samples per pixel on average" << std::endl;
+    if (stats.rays > 0) {
+        std::cout << sceneAcceleratorName(scene.accelerator) << " ("
+                  << CPU::simdLevelName(scene.getSIMDLevel()) << "): " << stats.rays
+                  << " rays, "
+                  << static_cast<double>(stats.nodes_visited) / stats.rays << " nodes and "
+                  << static_cast<double>(stats.primitive_tests) / stats.rays
+                  << " primitive tests per ray" << std::endl;
+        std::cout << stats.rays / std::max(raytracer.last_render_time, 1e-6f) * 1e-6f
+                  << " Mrays/s overall" << std::endl;
+        if (stats.packets + stats.packet_fallbacks > 0) {
+            std::cout << stats.packets << " ray packets traced, " << stats.packet_fallbacks
+                      << " too incoherent and traced per ray" << std::endl;
+        }
+    }
+
+    // Stage times are summed over the worker threads, so these rates are per thread
+    const WavefrontStats& wavefront = raytracer.last_wavefront_stats;
+    if (wavefront.extension_rays > 0) {
+        std::cout << "Wavefront: generate " << wavefront.generate_time << "ms, sort "
+                  << wavefront.sort_time << "ms, extend " << wavefront.extension_rays
+                  << " rays in " << wavefront.extend_time << "ms ("
+                  << wavefront.extension_rays / std::max(wavefront.extend_time, 1e-3f) * 1e-3f
+                  << " Mrays/s), shade " << wavefront.shade_time << "ms, shadow "
+                  << wavefront.shadow_rays << " rays in " << wavefront.shadow_time << "ms ("
+                  << wavefront.shadow_rays / std::max(wavefront.shadow_time, 1e-3f) * 1e-3f
+                  << " Mrays/s)" << std::endl;
+    }
+
+    if (raytracer.settings.path_guiding) {
+        PathGuideStats guide = raytracer.path_guide.getStats();
+        std::cout << "Path guide: " << guide.training_passes << " training passes in "
+                  << guide.training_time << "ms, " << guide.records << " records, "
+                  << guide.dropped_records << " dropped, " << guide.usable_cells << " of "
+                  << guide.cells << " cells usable, " << guide.memory / (1024.0 * 1024.0)
+                  << " MB of " << guide.memory_budget / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+
+    // How evenly the tiles were shared out between the threads
+    const TileSchedulerStats& tile_stats = raytracer.last_tile_stats;
+    if (!tile_stats.tile_times.empty()) {
+        float slowest_tile = *std::max_element(tile_stats.tile_times.begin(),
+                                               tile_stats.tile_times.end());
+        float least_busy   = *std::min_element(tile_stats.worker_busy_times.begin(),
+                                               tile_stats.worker_busy_times.end());
+        float most_busy    = *std::max_element(tile_stats.worker_busy_times.begin(),
+                                               tile_stats.worker_busy_times.end());
+        std::cout << tile_stats.tile_times.size() << " tiles of " << tile_stats.tile_size
+                  << "px, slowest " << slowest_tile << "ms, " << tile_stats.steals
+                  << " steals, busiest thread " << most_busy << "ms, least busy " << least_busy
+                  << "ms" << std::endl;
+    }
+
+    if (raytracer_write_timing_map) {
+        tile_stats.timingMap(rendered_region.width(), rendered_region.height())
+            .writePPM(RESOURCES_PATH "save_data/render_tile_times.ppm", 1.0f);
+    }
+
+    // A streamed render is only on disk, there is nothing left to look at
+    if (streamed) {
+        return;
+    }
+
+    if (raytracer_write_sample_map && raytracer.settings.adaptive_sampling) {
+        raytracer.sampleCountMap().writePPM(RESOURCES_PATH "save_data/render_sample_counts.ppm",
+                                            1.0f);
+    }
+
+    finishRayTracedImage(std::move(image), raytracer.last_features, rendered_region);
+}
+
+void App::renderDistributedImage() {
+    raytracer.settings.feature_buffers  = raytracer_denoise;
+    distributed_render.settings.address = raytracer_distributed_address;
+    if (raytracer.settings.path_guiding) {
+        std::cout << "Path guiding is not supported by distributed renders, rendering without it"
+                  << std::endl;
+    }
+
+    Image image;
+    FeatureBuffers features;
+    if (!distributed_render.render(game_objects, raytracer_camera, raytracer.settings,
+                                   raytracer_accelerator, image, &features)) {
+        return;
+    }
+
+    const DistributedStats& stats = distributed_render.last_stats;
+    std::cout << "Rendered " << image.width << "x" << image.height << " image in "
+              << stats.render_time << "s on " << stats.workers << " workers, " << stats.jobs
+              << " jobs";
+    if (stats.workers_lost > 0) {
+        std::cout << ", " << stats.workers_lost << " workers lost and " << stats.jobs_reassigned
+                  << " of their jobs reassigned";
+    }
+    std::cout << std::endl;
+
+    const ImageRegion region(0, 0, image.width, image.height);
+    finishRayTracedImage(std::move(image), features, region);
+}
+
+void App::finishRayTracedImage(Image image, const FeatureBuffers& features,
+                               const ImageRegion& region) {
+    Image denoised;
+    if (raytracer_denoise) {
+        denoiser.setSIMDLevel(raytracer_simd_level);
+        denoised = denoiser.denoise(image, features);
+        std::cout << "Denoised in " << denoiser.last_denoise_time * 1000.0f << "ms using "
+                  << denoiser.last_num_threads << " threads ("
+                  << CPU::simdLevelName(denoiser.getSIMDLevel()) << ")" << std::endl;
+    }
+
+    // A region is shown in context, pasted over a backdrop the size of the whole frame
+    if (region.width() != raytracer.settings.width ||
+        region.height() != raytracer.settings.height) {
+        image.writePPM(RESOURCES_PATH "save_data/render_region.ppm");
+
+        Image backdrop = regionBackdrop();
+        if (raytracer_denoise) {
+            Image denoised_backdrop = backdrop;
+            denoised_backdrop.paste(denoised, region.x0, region.y0);
+            denoised = std::move(denoised_backdrop);
+        }
+        backdrop.paste(image, region.x0, region.y0);
+        image = std::move(backdrop);
+    }
+
+    image.writePPM(RESOURCES_PATH "save_data/render.ppm");
+
+    last_render_error   = image.rmse(reference_image);
+    last_denoised_error = -1.0f;
+    if (last_render_error >= 0.0f) {
+        std::cout << "RMSE to the reference image: " << last_render_error << std::endl;
+    }
+
+    if (raytracer_denoise) {
+        denoised.writePPM(RESOURCES_PATH "save_data/render_denoised.ppm");
+
+        last_denoised_error = denoised.rmse(reference_image);
+        if (last_denoised_error >= 0.0f) {
+            std::cout << "Denoised RMSE to the reference image: " << last_denoised_error
+                      << std::endl;
+        }
+    }
+
+    last_render = std::move(image);
+}
+
+Image App::regionBackdrop() const {
+    const unsigned int width  = raytracer.settings.width;
+    const unsigned int height = raytracer.settings.height;
+    if (raytracer_region_over_last_render) {
+        if (last_render.width == width && last_render.height == height) {
+            return last_render;
+        }
+        std::cout << "No earlier render of this size, compositing over the viewport" << std::endl;
+    }
+    // Whatever the viewport shows, raster or ray traced, stretched to the render's size
+    return renderer.readScreenImage().resized(width, height);
+}
+
+ImageRegion App::windowToFrameRegion(const glm::vec2& corner_a, const glm::vec2& corner_b) const {
+    const glm::vec2 scale(static_cast<float>(raytracer.settings.width) / std::max(window_x, 1),
+                          static_cast<float>(raytracer.settings.height) / std::max(window_y, 1));
+    glm::vec2 low  = glm::max(glm::min(corner_a, corner_b) * scale, glm::vec2(0.0f));
+    glm::vec2 high = glm::max(glm::max(corner_a, corner_b) * scale, glm::vec2(0.0f));
+    return ImageRegion(static_cast<unsigned int>(low.x), static_cast<unsigned int>(low.y),
+                       static_cast<unsigned int>(std::ceil(high.x)),
+                       static_cast<unsigned int>(std::ceil(high.y)))
+        .clamped(raytracer.settings.width, raytracer.settings.height);
+}
+
+void App::setRayTracerRegion(const ImageRegion& region) {
+    raytracer_region     = region;
+    raytracer_use_region = !region.empty();
+}
+
+void App::updateRayTracedViewport() {
+    if (!renderer.raytraced_viewport) {
+        // Free up the cores as soon as the raster view is back
+        progressive_renderer.stop();
+        return;
+    }
+
+    // Trace what the viewport shows, at the window's resolution so the image fills the screen
+    // texture. The other settings are shared with the offline render
+    RayTracerSettings settings = raytracer.settings;
+    settings.width             = static_cast<unsigned int>(std::max(window_x, 1));
+    settings.height            = static_cast<unsigned int>(std::max(window_y, 1));
+    settings.tile_size         = std::max(settings.tile_size, 1u);
+
+    progressive_renderer.update(game_objects, *active_camera, settings, raytracer_accelerator,
+                                raytracer_simd_level, raytracer_bvh_build);
+    if (progressive_renderer.takeLatestImage(viewport_image)) {
+        renderer.uploadScreenImage(viewport_image);
+    }
+}
+
+void App::compareBVHBuilders() {
+    RayTracerScene scene(game_objects, raytracer_bvh_build);
+    std::vector<AABB> bounds;
+    bounds.reserve(scene.primitives.size());
+    for (const ScenePrimitive& primitive : scene.primitives) {
+        bounds.push_back(instanceBounds(sceneShape(primitive.type), primitive.object_to_world));
+    }
+
+    BVHBuildSettings builds[3];
+    builds[0].builder           = BVHBuilder::BINNED_SAH;
+    builds[1].builder           = BVHBuilder::LBVH;
+    builds[1].optimize_treelets = false;
+    builds[2].builder           = BVHBuilder::LBVH;
+    builds[2].optimize_treelets = true;
+
+    std::cout << "BVH builders over " << bounds.size() << " objects:" << std::endl;
+    for (const BVHBuildSettings& build : builds) {
+        BVH bvh;
+        bvh.build(bounds, build);
+        const BVHBuildStats& stats = bvh.build_stats;
+        std::cout << "  " << bvhBuilderName(build.builder);
+        if (build.builder == BVHBuilder::LBVH) {
+            std::cout << " (" << stats.morton_bits << " bit codes"
+                      << (build.optimize_treelets ? ", treelets" : "") << ")";
+        }
+        std::cout << ": " << stats.build_time << "ms, SAH cost " << stats.sah_cost << ", "
+                  << stats.num_nodes << " nodes, depth " << stats.max_depth << std::endl;
+    }
+}
+
+void App::compareBVHLayouts() {
+    RayTracerScene scene(game_objects, raytracer_bvh_build);
+    scene.setSIMDLevel(raytracer_simd_level);
+    const unsigned int width  = std::max(raytracer.settings.width, 1u);
+    const unsigned int height = std::max(raytracer.settings.height, 1u);
+    CameraFrame frame(raytracer_camera, width, height);
+
+    std::cout << "BVH node layouts over " << scene.primitives.size() << " objects, "
+              << width * height << " primary rays on one thread ("
+              << CPU::simdLevelName(scene.getSIMDLevel()) << "):" << std::endl;
+    for (SceneAccelerator accelerator :
+         {SceneAccelerator::BVH2, SceneAccelerator::BVH4, SceneAccelerator::BVH4_QUANTIZED,
+          SceneAccelerator::BVH8, SceneAccelerator::BVH8_QUANTIZED}) {
+        size_t node_bytes = 0;
+        switch (accelerator) {
+        case SceneAccelerator::BVH2:
+            node_bytes = scene.bvh.nodes.size() * sizeof(BVHNode);
+            break;
+        case SceneAccelerator::BVH4:
+            node_bytes = scene.bvh4.nodes.size() * sizeof(WideBVHNode<4>);
+            break;
+        case SceneAccelerator::BVH8:
+            node_bytes = scene.bvh8.nodes.size() * sizeof(WideBVHNode<8>);
+            break;
+        case SceneAccelerator::BVH4_QUANTIZED:
+            node_bytes = scene.quantized_bvh4.nodes.size() * sizeof(QuantizedBVHNode<4>);
+            break;
+        case SceneAccelerator::BVH8_QUANTIZED:
+            node_bytes = scene.quantized_bvh8.nodes.size() * sizeof(QuantizedBVHNode<8>);
+            break;
+        default:
+            break;
+        }
+
+        scene.accelerator = accelerator;
+        BVHTraversalStats stats;
+        unsigned int hits = 0;
+        auto start        = std::chrono::steady_clock::now();
+        for (unsigned int y = 0; y < height; ++y) {
+            for (unsigned int x = 0; x < width; ++x) {
+                Ray ray = frame.generateRay(static_cast<float>(x) + 0.5f,
+                                            static_cast<float>(y) + 0.5f);
+                HitRecord hit;
+                if (scene.intersect(ray, 1e-4f, std::numeric_limits<float>::max(), hit, -1,
+                                    &stats)) {
+                    hits++;
+                }
+            }
+        }
+        float seconds =
+            std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "  " << sceneAcceleratorName(accelerator) << ": " << node_bytes / 1024
+                  << "KB of nodes, " << stats.rays / std::max(seconds, 1e-6f) * 1e-6f
+                  << " Mrays/s, "
+                  << static_cast<double>(stats.nodes_visited) / std::max<uint64_t>(stats.rays, 1)
+                  << " nodes per ray, " << hits << " hits" << std::endl;
+    }
 }
 
 void App::addCube(glm::vec3 pos, glm::vec3 orientation, glm::vec3 scale, glm::vec3 colour,
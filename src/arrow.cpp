@@ -60,16 +60,17 @@ void Arrow::draw(Shader& shader) {
 }
 
 void Arrow::update_bounding_box() {
+    // The arrow head is the widest part, its base has a radius of head_radius
     float radius                    = std::max(Arrow::head_radius, Arrow::tail_radius);
     std::vector<glm::vec3> vertices = {
-        glm::vec3(-0.5f * radius, -0.5f * radius, -0.5f * tail_height),
-        glm::vec3(0.5f * radius, -0.5f * radius, -0.5f * tail_height),
-        glm::vec3(-0.5f * radius, 0.5f * radius, -0.5f * tail_height),
-        glm::vec3(0.5f * radius, 0.5f * radius, -0.5f * tail_height),
-        glm::vec3(-0.5f * radius, -0.5f * radius, head_height + 0.5f * tail_height),
-        glm::vec3(0.5f * radius, -0.5f * radius, head_height + 0.5f * tail_height),
-        glm::vec3(-0.5f * radius, 0.5f * radius, head_height + 0.5f * tail_height),
-        glm::vec3(0.5f * radius, 0.5f * radius, head_height + 0.5f * tail_height)};
+        glm::vec3(-radius, -radius, -0.5f * tail_height),
+        glm::vec3(radius, -radius, -0.5f * tail_height),
+        glm::vec3(-radius, radius, -0.5f * tail_height),
+        glm::vec3(radius, radius, -0.5f * tail_height),
+        glm::vec3(-radius, -radius, head_height + 0.5f * tail_height),
+        glm::vec3(radius, -radius, head_height + 0.5f * tail_height),
+        glm::vec3(-radius, radius, head_height + 0.5f * tail_height),
+        glm::vec3(radius, radius, head_height + 0.5f * tail_height)};
 
     for (glm::vec3& vertex : vertices) {
         glm::mat4 model(1.0f);
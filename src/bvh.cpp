@@ -0,0 +1,396 @@
+#include <bvh.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <numeric>
+
+namespace {
+struct Bounds {
+    Bounds()
+        : min(std::numeric_limits<float>::max())
+        , max(-std::numeric_limits<float>::max()) {}
+
+    void grow(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void grow(const Bounds& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    [[nodiscard]] float area() const {
+        glm::vec3 extent = max - min;
+        if (extent.x < 0.0f) {
+            // Never grown, empty box
+            return 0.0f;
+        }
+        return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct Bin {
+    Bounds bounds;
+    unsigned int count = 0;
+};
+
+// Range of primitive_indices that still needs to be turned into a subtree rooted at node_index
+struct BuildTask {
+    unsigned int node_index;
+    unsigned int first;
+    unsigned int count;
+    unsigned int depth;
+};
+
+float nodeArea(const BVHNode& node) {
+    glm::vec3 extent = node.bounds_max - node.bounds_min;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+// Interior nodes cost one traversal step, leaves one intersection per primitive
+float nodeCost(const BVHNode& node) {
+    return node.count > 0 ? static_cast<float>(node.count) : 1.0f;
+}
+} // namespace
+
+const char* bvhBuilderName(BVHBuilder builder) {
+    switch (builder) {
+    case BVHBuilder::BINNED_SAH:
+        return "Binned SAH";
+    case BVHBuilder::LBVH:
+        return "LBVH";
+    }
+    return "Unknown";
+}
+
+BVHBuildSettings::BVHBuildSettings()
+    : builder(BVHBuilder::BINNED_SAH)
+    , num_threads(0)
+    , optimize_treelets(true) {}
+
+BVHBuildStats::BVHBuildStats()
+    : build_time(0.0f)
+    , num_primitives(0)
+    , num_nodes(0)
+    , num_leaves(0)
+    , max_depth(0)
+    , sah_cost(0.0f)
+    , builder(BVHBuilder::BINNED_SAH)
+    , morton_bits(0) {}
+
+BVHTraversalStats::BVHTraversalStats()
+    : rays(0)
+    , nodes_visited(0)
+    , primitive_tests(0)
+    , packets(0)
+    , packet_fallbacks(0) {}
+
+void BVHTraversalStats::add(const BVHTraversalStats& other) {
+    rays += other.rays;
+    nodes_visited += other.nodes_visited;
+    primitive_tests += other.primitive_tests;
+    packets += other.packets;
+    packet_fallbacks += other.packet_fallbacks;
+}
+
+BVH::BVH()
+    : weighted_area(0.0)
+    , built_weighted_area(0.0)
+    , num_refits(0) {}
+
+void BVH::build(const std::vector<AABB>& primitive_bounds) {
+    auto start = std::chrono::steady_clock::now();
+
+    const unsigned int n = static_cast<unsigned int>(primitive_bounds.size());
+
+    nodes.clear();
+    parents.clear();
+    primitive_indices.resize(n);
+    std::iota(primitive_indices.begin(), primitive_indices.end(), 0);
+    primitive_leaves.assign(n, 0);
+
+    build_stats                = BVHBuildStats();
+    build_stats.num_primitives = n;
+    weighted_area              = 0.0;
+    built_weighted_area        = 0.0;
+    num_refits                 = 0;
+
+    if (n == 0) {
+        return;
+    }
+
+    // Boxes and centroids in a more convenient form for the binning
+    std::vector<Bounds> boxes(n);
+    std::vector<glm::vec3> centroids(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        const AABB& bbox = primitive_bounds[i];
+        boxes[i].min     = glm::vec3(bbox.xmin, bbox.ymin, bbox.zmin);
+        boxes[i].max     = glm::vec3(bbox.xmax, bbox.ymax, bbox.zmax);
+        centroids[i]     = 0.5f * (boxes[i].min + boxes[i].max);
+    }
+
+    nodes.reserve(2 * static_cast<size_t>(n));
+    nodes.push_back(BVHNode());
+
+    // Explicit stack rather than recursion so degenerate inputs cannot overflow the call stack
+    std::vector<BuildTask> tasks;
+    tasks.push_back({0, 0, n, 0});
+
+    while (!tasks.empty()) {
+        BuildTask task = tasks.back();
+        tasks.pop_back();
+
+        // Bounds of the primitives and of their centroids
+        Bounds node_bounds;
+        Bounds centroid_bounds;
+        for (unsigned int i = task.first; i < task.first + task.count; ++i) {
+            node_bounds.grow(boxes[primitive_indices[i]]);
+            centroid_bounds.grow(centroids[primitive_indices[i]]);
+        }
+
+        nodes[task.node_index].bounds_min = node_bounds.min;
+        nodes[task.node_index].bounds_max = node_bounds.max;
+
+        auto make_leaf = [&]() {
+            nodes[task.node_index].left_first = task.first;
+            nodes[task.node_index].count      = task.count;
+        };
+
+        if (task.count == 1 || task.depth + 1 >= max_depth) {
+            make_leaf();
+            continue;
+        }
+
+        // Find the cheapest split plane among the bin boundaries of every axis
+        float leaf_cost         = node_bounds.area() * task.count;
+        float best_cost         = std::numeric_limits<float>::max();
+        int best_axis           = -1;
+        unsigned int best_split = 0;
+
+        glm::vec3 centroid_extent = centroid_bounds.max - centroid_bounds.min;
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (centroid_extent[axis] <= 0.0f) {
+                continue;
+            }
+
+            Bin bins[num_bins];
+            float scale = num_bins / centroid_extent[axis];
+
+            for (unsigned int i = task.first; i < task.first + task.count; ++i) {
+                unsigned int primitive = primitive_indices[i];
+                unsigned int bin       = std::min(
+                    num_bins - 1, static_cast<unsigned int>(
+                                      (centroids[primitive][axis] - centroid_bounds.min[axis]) *
+                                      scale));
+                bins[bin].count++;
+                bins[bin].bounds.grow(boxes[primitive]);
+            }
+
+            // Sweep from the right to get the cost of everything right of each plane, then from
+            // the left to combine it with the left side
+            float right_area[num_bins - 1];
+            unsigned int right_count[num_bins - 1];
+            Bounds right_bounds;
+            unsigned int running_count = 0;
+            for (unsigned int i = num_bins - 1; i > 0; --i) {
+                right_bounds.grow(bins[i].bounds);
+                running_count += bins[i].count;
+                right_area[i - 1]  = right_bounds.area();
+                right_count[i - 1] = running_count;
+            }
+
+            Bounds left_bounds;
+            running_count = 0;
+            for (unsigned int i = 0; i < num_bins - 1; ++i) {
+                left_bounds.grow(bins[i].bounds);
+                running_count += bins[i].count;
+
+                if (running_count == 0 || right_count[i] == 0) {
+                    continue;
+                }
+                float cost = left_bounds.area() * running_count + right_area[i] * right_count[i];
+                if (cost < best_cost) {
+                    best_cost  = cost;
+                    best_axis  = axis;
+                    best_split = i;
+                }
+            }
+        }
+
+        // Splitting costs one extra node traversal on top of the children's intersections
+        float split_cost = node_bounds.area() + best_cost;
+
+        unsigned int middle;
+        if (best_axis == -1) {
+            // All centroids fall in the same spot, binning cannot separate them
+            if (task.count <= max_leaf_size) {
+                make_leaf();
+                continue;
+            }
+            middle = task.first + task.count / 2;
+        } else {
+            if (task.count <= max_leaf_size && leaf_cost <= split_cost) {
+                make_leaf();
+                continue;
+            }
+
+            float scale = num_bins / centroid_extent[best_axis];
+            auto it     = std::partition(
+                primitive_indices.begin() + task.first,
+                primitive_indices.begin() + task.first + task.count, [&](unsigned int primitive) {
+                    unsigned int bin = std::min(
+                        num_bins - 1,
+                        static_cast<unsigned int>(
+                            (centroids[primitive][best_axis] - centroid_bounds.min[best_axis]) *
+                            scale));
+                    return bin <= best_split;
+                });
+            middle = static_cast<unsigned int>(it - primitive_indices.begin());
+        }
+
+        // Children are allocated next to each other
+        unsigned int left_child           = static_cast<unsigned int>(nodes.size());
+        nodes[task.node_index].left_first = left_child;
+        nodes[task.node_index].count      = 0;
+        nodes.push_back(BVHNode());
+        nodes.push_back(BVHNode());
+
+        tasks.push_back({left_child + 1, middle, task.first + task.count - middle, task.depth + 1});
+        tasks.push_back({left_child, task.first, middle - task.first, task.depth + 1});
+    }
+
+    finishBuild();
+    build_stats.build_time =
+        std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BVH::build(const std::vector<AABB>& primitive_bounds, const BVHBuildSettings& settings) {
+    switch (settings.builder) {
+    case BVHBuilder::BINNED_SAH:
+        build(primitive_bounds);
+        break;
+    case BVHBuilder::LBVH:
+        buildLBVH(primitive_bounds, settings.num_threads, settings.optimize_treelets);
+        break;
+    }
+}
+
+void BVH::finishBuild() {
+    build_stats.num_nodes  = static_cast<unsigned int>(nodes.size());
+    build_stats.num_leaves = 0;
+    build_stats.max_depth  = 0;
+    parents.assign(nodes.size(), 0);
+
+    // Children do not always come after their parent once treelets are rearranged, walk the tree
+    std::vector<std::pair<unsigned int, unsigned int>> stack; // Node and its depth
+    stack.push_back({0, 0});
+    while (!stack.empty()) {
+        unsigned int node_index = stack.back().first;
+        unsigned int depth      = stack.back().second;
+        stack.pop_back();
+
+        const BVHNode& node   = nodes[node_index];
+        build_stats.max_depth = std::max(build_stats.max_depth, depth);
+        if (node.count > 0) {
+            build_stats.num_leaves++;
+            for (unsigned int i = node.left_first; i < node.left_first + node.count; ++i) {
+                primitive_leaves[primitive_indices[i]] = node_index;
+            }
+            continue;
+        }
+        for (unsigned int child = node.left_first; child < node.left_first + 2; ++child) {
+            parents[child] = node_index;
+            stack.push_back({child, depth + 1});
+        }
+    }
+
+    weighted_area        = computeWeightedArea();
+    built_weighted_area  = weighted_area;
+    build_stats.sah_cost = getSAHCost();
+}
+
+void BVH::refit(const std::vector<AABB>& primitive_bounds, const std::vector<unsigned int>& moved,
+                std::vector<unsigned int>* changed_nodes) {
+    if (nodes.empty()) {
+        return;
+    }
+    num_refits++;
+
+    for (unsigned int primitive : moved) {
+        unsigned int node_index = primitive_leaves[primitive];
+        while (true) {
+            BVHNode& node = nodes[node_index];
+
+            Bounds bounds;
+            if (node.count > 0) {
+                for (unsigned int i = node.left_first; i < node.left_first + node.count; ++i) {
+                    const AABB& bbox = primitive_bounds[primitive_indices[i]];
+                    bounds.grow(glm::vec3(bbox.xmin, bbox.ymin, bbox.zmin));
+                    bounds.grow(glm::vec3(bbox.xmax, bbox.ymax, bbox.zmax));
+                }
+            } else {
+                for (unsigned int child = node.left_first; child < node.left_first + 2; ++child) {
+                    bounds.grow(nodes[child].bounds_min);
+                    bounds.grow(nodes[child].bounds_max);
+                }
+            }
+
+            // The nodes above only depend on this one's bounds, if they stayed the same so did
+            // theirs. Also stops a second primitive of the same leaf from walking the path again
+            if (bounds.min == node.bounds_min && bounds.max == node.bounds_max) {
+                break;
+            }
+
+            float old_area  = nodeArea(node);
+            node.bounds_min = bounds.min;
+            node.bounds_max = bounds.max;
+            weighted_area += static_cast<double>(nodeArea(node) - old_area) * nodeCost(node);
+            if (changed_nodes) {
+                changed_nodes->push_back(node_index);
+            }
+
+            if (node_index == 0) {
+                break;
+            }
+            node_index = parents[node_index];
+        }
+    }
+}
+
+float BVH::getSAHCost() const {
+    // Probability of a random ray hitting a node is proportional to its surface area relative to
+    // the root
+    if (nodes.empty()) {
+        return 0.0f;
+    }
+    float root_area = nodeArea(nodes[0]);
+    if (root_area <= 0.0f) {
+        return static_cast<float>(primitive_indices.size());
+    }
+    return static_cast<float>(weighted_area / root_area);
+}
+
+float BVH::getSAHCostGrowth() const {
+    if (built_weighted_area <= 0.0) {
+        return 1.0f;
+    }
+    return static_cast<float>(weighted_area / built_weighted_area);
+}
+
+unsigned int BVH::getNumRefits() const {
+    return num_refits;
+}
+
+double BVH::computeWeightedArea() const {
+    double area = 0.0;
+    for (const BVHNode& node : nodes) {
+        area += static_cast<double>(nodeArea(node)) * nodeCost(node);
+    }
+    return area;
+}
@@ -0,0 +1,557 @@
+#include <bvh.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+// Subtrees of at most this many primitives are built by a single thread
+constexpr unsigned int min_subtree_size = 1024;
+
+// Leaves of a treelet rearranged at once, 2^7 subsets keep the search cheap
+constexpr unsigned int max_treelet_leaves = 7;
+
+// What the treelet optimization needs to know about every node besides its bounds
+struct NodeInfo {
+    float cost;          // SAH cost of the subtree, not divided by the root's area
+    unsigned int height; // Levels below the node, 0 for leaves
+    unsigned int depth;  // Levels above the node, as the tree was before any treelet above moved
+};
+
+float nodeArea(const BVHNode& node) {
+    glm::vec3 extent = node.bounds_max - node.bounds_min;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+void growNode(BVHNode& node, const glm::vec3& min, const glm::vec3& max) {
+    node.bounds_min = glm::min(node.bounds_min, min);
+    node.bounds_max = glm::max(node.bounds_max, max);
+}
+
+void clearBounds(BVHNode& node) {
+    node.bounds_min = glm::vec3(std::numeric_limits<float>::max());
+    node.bounds_max = glm::vec3(-std::numeric_limits<float>::max());
+}
+
+// Runs body(thread, first, last) on num_threads threads, each given its own slice of [0, count)
+template <typename Body>
+void parallelFor(unsigned int num_threads, size_t count, Body&& body) {
+    if (num_threads <= 1) {
+        body(0u, size_t(0), count);
+        return;
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (unsigned int thread = 0; thread < num_threads; ++thread) {
+        size_t first = count * thread / num_threads;
+        size_t last  = count * (thread + 1) / num_threads;
+        threads.emplace_back([&body, thread, first, last]() { body(thread, first, last); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Spreads the low 21 bits of x out to every third bit
+uint64_t spreadBits(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+// Number of leading bits a and b have in common, a and b must differ
+unsigned int commonPrefix(uint64_t a, uint64_t b) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, a ^ b);
+    return 63u - static_cast<unsigned int>(index);
+#else
+    return static_cast<unsigned int>(__builtin_clzll(a ^ b));
+#endif
+}
+
+// Least significant digit radix sort of the keys, carrying values along. Every pass counts the
+// digits of each thread's slice, then each thread scatters its slice to the offsets the counts
+// add up to, which keeps the sort stable
+void radixSort(std::vector<uint64_t>& keys, std::vector<unsigned int>& values, unsigned int bits,
+               unsigned int num_threads) {
+    const size_t n = keys.size();
+    std::vector<uint64_t> keys_out(n);
+    std::vector<unsigned int> values_out(n);
+    std::vector<size_t> counts(static_cast<size_t>(num_threads) * 256);
+
+    for (unsigned int shift = 0; shift < bits; shift += 8) {
+        std::fill(counts.begin(), counts.end(), 0);
+        parallelFor(num_threads, n, [&](unsigned int thread, size_t first, size_t last) {
+            size_t* thread_counts = &counts[static_cast<size_t>(thread) * 256];
+            for (size_t i = first; i < last; ++i) {
+                thread_counts[(keys[i] >> shift) & 0xff]++;
+            }
+        });
+
+        // Digit by digit, thread by thread, so equal digits keep their order
+        size_t offset = 0;
+        for (unsigned int digit = 0; digit < 256; ++digit) {
+            for (unsigned int thread = 0; thread < num_threads; ++thread) {
+                size_t count = counts[static_cast<size_t>(thread) * 256 + digit];
+                counts[static_cast<size_t>(thread) * 256 + digit] = offset;
+                offset += count;
+            }
+        }
+
+        parallelFor(num_threads, n, [&](unsigned int thread, size_t first, size_t last) {
+            size_t* thread_offsets = &counts[static_cast<size_t>(thread) * 256];
+            for (size_t i = first; i < last; ++i) {
+                size_t destination      = thread_offsets[(keys[i] >> shift) & 0xff]++;
+                keys_out[destination]   = keys[i];
+                values_out[destination] = values[i];
+            }
+        });
+
+        keys.swap(keys_out);
+        values.swap(values_out);
+    }
+}
+
+// Splits the sorted primitives [first, first + count) and its subranges at the highest bit where
+// their codes differ. Nodes are written to their own array so that several subtrees can be built
+// at once, children are allocated next to each other as in BVH::build()
+class LBVHSubtreeBuilder {
+public:
+    LBVHSubtreeBuilder(const std::vector<uint64_t>& codes,
+                       const std::vector<unsigned int>& primitive_indices,
+                       const std::vector<AABB>& primitive_bounds)
+        : codes(codes)
+        , primitive_indices(primitive_indices)
+        , primitive_bounds(primitive_bounds) {}
+
+    // Index of the last primitive of the left half of [first, first + count)
+    unsigned int findSplit(unsigned int first, unsigned int count) const {
+        unsigned int last = first + count - 1;
+        if (codes[first] == codes[last]) {
+            // Same code all along, any split is as good
+            return first + (count - 1) / 2;
+        }
+
+        // Binary search for the last primitive that shares more than the range's common prefix
+        // with the first one
+        uint64_t first_code = codes[first];
+        unsigned int prefix = commonPrefix(first_code, codes[last]);
+        unsigned int split  = first;
+        unsigned int step   = last - first;
+        do {
+            step                   = (step + 1) / 2;
+            unsigned int candidate = split + step;
+            if (candidate < last && (codes[candidate] == first_code ||
+                                     commonPrefix(first_code, codes[candidate]) > prefix)) {
+                split = candidate;
+            }
+        } while (step > 1);
+        return split;
+    }
+
+    // Builds the subtree into nodes[node_index], with its root at the given depth, and fills in
+    // the info of every node
+    void build(std::vector<BVHNode>& nodes, std::vector<NodeInfo>& info, unsigned int node_index,
+               unsigned int first, unsigned int count, unsigned int depth) const {
+        auto make_leaf = [&]() {
+            BVHNode& node   = nodes[node_index];
+            node.left_first = first;
+            node.count      = count;
+            clearBounds(node);
+            for (unsigned int i = first; i < first + count; ++i) {
+                const AABB& bbox = primitive_bounds[primitive_indices[i]];
+                growNode(node, glm::vec3(bbox.xmin, bbox.ymin, bbox.zmin),
+                         glm::vec3(bbox.xmax, bbox.ymax, bbox.zmax));
+            }
+            info[node_index] = {nodeArea(node) * static_cast<float>(count), 0, depth};
+        };
+
+        if (count == 1 || depth + 1 >= BVH::max_depth) {
+            make_leaf();
+            return;
+        }
+
+        unsigned int split      = findSplit(first, count);
+        unsigned int left_child = static_cast<unsigned int>(nodes.size());
+        nodes.resize(nodes.size() + 2);
+        info.resize(info.size() + 2);
+
+        build(nodes, info, left_child, first, split + 1 - first, depth + 1);
+        build(nodes, info, left_child + 1, split + 1, first + count - split - 1, depth + 1);
+        const NodeInfo& left  = info[left_child];
+        const NodeInfo& right = info[left_child + 1];
+
+        BVHNode& node   = nodes[node_index];
+        node.left_first = left_child;
+        node.count      = 0;
+        node.bounds_min = glm::min(nodes[left_child].bounds_min, nodes[left_child + 1].bounds_min);
+        node.bounds_max = glm::max(nodes[left_child].bounds_max, nodes[left_child + 1].bounds_max);
+
+        // Every primitive ends up in a leaf of its own, small subtrees are cheaper as one leaf
+        float area       = nodeArea(node);
+        float split_cost = area + left.cost + right.cost;
+        if (count <= BVH::max_leaf_size && area * static_cast<float>(count) <= split_cost) {
+            // The children and everything below them were the last nodes allocated
+            nodes.resize(left_child);
+            info.resize(left_child);
+            make_leaf();
+            return;
+        }
+        info[node_index] = {split_cost, 1 + std::max(left.height, right.height), depth};
+    }
+
+private:
+    const std::vector<uint64_t>& codes;
+    const std::vector<unsigned int>& primitive_indices;
+    const std::vector<AABB>& primitive_bounds;
+};
+
+// Rearranges the treelet rooted at an interior node into the topology of its leaves with the
+// lowest SAH cost (Karras and Aila, "Fast parallel construction of high-quality bounding volume
+// hierarchies"). The treelet grows from the root's two children by opening up its largest interior
+// leaf until it has max_treelet_leaves, every leaf being a whole subtree that is left as it is. The
+// treelet's interior nodes hand their pairs of child slots over to the new topology, so nothing
+// outside of the treelet moves. Topologies that would take a leaf past BVH::max_depth, which
+// the traversal stack is sized for, are turned down
+void optimizeTreelet(std::vector<BVHNode>& nodes, std::vector<NodeInfo>& info, unsigned int root) {
+    unsigned int leaves[max_treelet_leaves];
+    unsigned int pairs[max_treelet_leaves - 1]; // First slot of each interior node's children
+    unsigned int num_leaves = 2;
+    unsigned int num_pairs  = 1;
+    leaves[0]               = nodes[root].left_first;
+    leaves[1]               = nodes[root].left_first + 1;
+    pairs[0]                = nodes[root].left_first;
+
+    while (num_leaves < max_treelet_leaves) {
+        int largest        = -1;
+        float largest_area = -1.0f;
+        for (unsigned int i = 0; i < num_leaves; ++i) {
+            const BVHNode& leaf = nodes[leaves[i]];
+            if (leaf.count == 0 && nodeArea(leaf) > largest_area) {
+                largest      = static_cast<int>(i);
+                largest_area = nodeArea(leaf);
+            }
+        }
+        if (largest == -1) {
+            break;
+        }
+        unsigned int opened  = leaves[largest];
+        pairs[num_pairs++]   = nodes[opened].left_first;
+        leaves[largest]      = nodes[opened].left_first;
+        leaves[num_leaves++] = nodes[opened].left_first + 1;
+    }
+    if (num_leaves < 3) {
+        // Two leaves only go together one way
+        return;
+    }
+
+    // Cheapest way to put together every subset of the leaves
+    const unsigned int num_subsets = 1u << num_leaves;
+    BVHNode subset_bounds[1u << max_treelet_leaves];
+    float subset_cost[1u << max_treelet_leaves];
+    unsigned int subset_height[1u << max_treelet_leaves];
+    unsigned int subset_split[1u << max_treelet_leaves];
+
+    BVHNode leaf_nodes[max_treelet_leaves];
+    NodeInfo leaf_info[max_treelet_leaves];
+    for (unsigned int i = 0; i < num_leaves; ++i) {
+        leaf_nodes[i] = nodes[leaves[i]];
+        leaf_info[i]  = info[leaves[i]];
+    }
+
+    for (unsigned int subset = 1; subset < num_subsets; ++subset) {
+        BVHNode& bounds = subset_bounds[subset];
+        clearBounds(bounds);
+        for (unsigned int i = 0; i < num_leaves; ++i) {
+            if (subset & (1u << i)) {
+                growNode(bounds, leaf_nodes[i].bounds_min, leaf_nodes[i].bounds_max);
+            }
+        }
+
+        if ((subset & (subset - 1)) == 0) {
+            unsigned int leaf = 0;
+            while ((subset & (1u << leaf)) == 0) {
+                leaf++;
+            }
+            subset_cost[subset]   = leaf_info[leaf].cost;
+            subset_height[subset] = leaf_info[leaf].height;
+            continue;
+        }
+
+        // Subsets only ever split into smaller ones, which come first. Keeping the lowest leaf on
+        // the left visits every split once
+        unsigned int lowest = subset & (~subset + 1);
+        float best_cost     = std::numeric_limits<float>::max();
+        unsigned int best   = 0;
+        for (unsigned int left = (subset - 1) & subset; left != 0; left = (left - 1) & subset) {
+            if ((left & lowest) == 0) {
+                continue;
+            }
+            float cost = subset_cost[left] + subset_cost[subset ^ left];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best      = left;
+            }
+        }
+        subset_cost[subset]   = nodeArea(bounds) + best_cost;
+        subset_split[subset]  = best;
+        subset_height[subset] = 1 + std::max(subset_height[best], subset_height[subset ^ best]);
+    }
+
+    const unsigned int all = num_subsets - 1;
+    if (subset_cost[all] >= info[root].cost * 0.9999f ||
+        info[root].depth + subset_height[all] >= BVH::max_depth) {
+        return;
+    }
+
+    // Lay the new topology out, the root keeps its slot and its pair
+    struct Placement {
+        unsigned int subset;
+        unsigned int slot;
+        unsigned int depth;
+    };
+    Placement stack[2 * max_treelet_leaves];
+    unsigned int stack_size = 0;
+    unsigned int next_pair  = 0;
+    stack[stack_size++]     = {all, root, info[root].depth};
+
+    while (stack_size > 0) {
+        Placement placement = stack[--stack_size];
+        unsigned int subset = placement.subset;
+
+        if ((subset & (subset - 1)) == 0) {
+            unsigned int leaf = 0;
+            while ((subset & (1u << leaf)) == 0) {
+                leaf++;
+            }
+            nodes[placement.slot] = leaf_nodes[leaf];
+            info[placement.slot]  = leaf_info[leaf];
+            continue;
+        }
+
+        unsigned int pair    = pairs[next_pair++];
+        BVHNode& node        = nodes[placement.slot];
+        node.bounds_min      = subset_bounds[subset].bounds_min;
+        node.bounds_max      = subset_bounds[subset].bounds_max;
+        node.left_first      = pair;
+        node.count           = 0;
+        info[placement.slot] = {subset_cost[subset], subset_height[subset], placement.depth};
+
+        stack[stack_size++] = {subset_split[subset], pair, placement.depth + 1};
+        stack[stack_size++] = {subset ^ subset_split[subset], pair + 1, placement.depth + 1};
+    }
+}
+
+// Optimizes the treelet of every interior node, children before their parents. Children are
+// always stored after their parent and optimizing a treelet only moves nodes below its root, so
+// going through the nodes backwards keeps that order
+void optimizeTreelets(std::vector<BVHNode>& nodes, std::vector<NodeInfo>& info) {
+    for (size_t node_index = nodes.size(); node_index-- > 0;) {
+        if (nodes[node_index].count == 0) {
+            optimizeTreelet(nodes, info, static_cast<unsigned int>(node_index));
+        }
+    }
+}
+
+// Range of the sorted primitives the top levels left for a subtree
+struct SubtreeTask {
+    unsigned int node_index;
+    unsigned int first;
+    unsigned int count;
+    unsigned int depth;
+};
+} // namespace
+
+void BVH::buildLBVH(const std::vector<AABB>& primitive_bounds, unsigned int num_threads,
+                    bool optimize_treelets) {
+    auto start = std::chrono::steady_clock::now();
+
+    const unsigned int n = static_cast<unsigned int>(primitive_bounds.size());
+
+    nodes.clear();
+    parents.clear();
+    primitive_indices.resize(n);
+    primitive_leaves.assign(n, 0);
+
+    build_stats                = BVHBuildStats();
+    build_stats.num_primitives = n;
+    build_stats.builder        = BVHBuilder::LBVH;
+    weighted_area              = 0.0;
+    built_weighted_area        = 0.0;
+    num_refits                 = 0;
+
+    if (n == 0) {
+        return;
+    }
+
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::max(1u, std::min(num_threads, n / min_subtree_size));
+
+    // Centroids and the box around them, which the codes are quantized in
+    std::vector<glm::vec3> centroids(n);
+    std::vector<BVHNode> thread_bounds(num_threads);
+    parallelFor(num_threads, n, [&](unsigned int thread, size_t first, size_t last) {
+        BVHNode& bounds = thread_bounds[thread];
+        clearBounds(bounds);
+        for (size_t i = first; i < last; ++i) {
+            const AABB& bbox = primitive_bounds[i];
+            centroids[i]     = 0.5f * glm::vec3(bbox.xmin + bbox.xmax, bbox.ymin + bbox.ymax,
+                                                bbox.zmin + bbox.zmax);
+            growNode(bounds, centroids[i], centroids[i]);
+        }
+    });
+    BVHNode centroid_bounds;
+    clearBounds(centroid_bounds);
+    for (const BVHNode& bounds : thread_bounds) {
+        growNode(centroid_bounds, bounds.bounds_min, bounds.bounds_max);
+    }
+
+    // 10 bits per axis give about a billion cells, past a million primitives too many of them
+    // would share one, so the codes grow to 21 bits per axis
+    const unsigned int bits_per_axis = n > (1u << 20) ? 21 : 10;
+    build_stats.morton_bits          = 3 * bits_per_axis;
+
+    const float cells = static_cast<float>((1u << bits_per_axis) - 1);
+    glm::vec3 extent  = centroid_bounds.bounds_max - centroid_bounds.bounds_min;
+    glm::vec3 scale   = glm::vec3(0.0f);
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] > 0.0f) {
+            scale[axis] = cells / extent[axis];
+        }
+    }
+
+    std::vector<uint64_t> codes(n);
+    parallelFor(num_threads, n, [&](unsigned int, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            glm::vec3 cell = glm::clamp((centroids[i] - centroid_bounds.bounds_min) * scale,
+                                        glm::vec3(0.0f), glm::vec3(cells));
+            codes[i]       = spreadBits(static_cast<uint64_t>(cell.x)) << 2 |
+                       spreadBits(static_cast<uint64_t>(cell.y)) << 1 |
+                       spreadBits(static_cast<uint64_t>(cell.z));
+            primitive_indices[i] = static_cast<unsigned int>(i);
+        }
+    });
+
+    radixSort(codes, primitive_indices, build_stats.morton_bits, num_threads);
+
+    // Top levels on this thread until the ranges are small enough to share out. The subtrees end
+    // up in the leaves of the top levels, which are all interior nodes
+    LBVHSubtreeBuilder builder(codes, primitive_indices, primitive_bounds);
+    const unsigned int subtree_size = std::max(min_subtree_size, n / (num_threads * 16));
+
+    nodes.push_back(BVHNode());
+    std::vector<unsigned int> top_depths(1, 0);
+    std::vector<SubtreeTask> subtrees;
+    std::vector<SubtreeTask> tasks;
+    tasks.push_back({0, 0, n, 0});
+    while (!tasks.empty()) {
+        SubtreeTask task = tasks.back();
+        tasks.pop_back();
+
+        if (task.count <= subtree_size || task.depth + 1 >= max_depth) {
+            subtrees.push_back(task);
+            continue;
+        }
+
+        unsigned int split      = builder.findSplit(task.first, task.count);
+        unsigned int left_child = static_cast<unsigned int>(nodes.size());
+        nodes[task.node_index].left_first = left_child;
+        nodes[task.node_index].count      = 0;
+        nodes.push_back(BVHNode());
+        nodes.push_back(BVHNode());
+        top_depths.push_back(task.depth + 1);
+        top_depths.push_back(task.depth + 1);
+
+        tasks.push_back({left_child + 1, split + 1, task.first + task.count - split - 1,
+                         task.depth + 1});
+        tasks.push_back({left_child, task.first, split + 1 - task.first, task.depth + 1});
+    }
+    const unsigned int num_top_nodes = static_cast<unsigned int>(nodes.size());
+
+    // Subtrees in parallel, largest first so no thread is left with a big one at the end
+    std::sort(subtrees.begin(), subtrees.end(),
+              [](const SubtreeTask& a, const SubtreeTask& b) { return a.count > b.count; });
+    std::vector<std::vector<BVHNode>> subtree_nodes(subtrees.size());
+    std::vector<std::vector<NodeInfo>> subtree_info(subtrees.size());
+    std::atomic<size_t> next_subtree(0);
+    parallelFor(num_threads, num_threads, [&](unsigned int, size_t, size_t) {
+        for (size_t i = next_subtree++; i < subtrees.size(); i = next_subtree++) {
+            const SubtreeTask& task = subtrees[i];
+            subtree_nodes[i].reserve(2 * static_cast<size_t>(task.count));
+            subtree_nodes[i].resize(1);
+            subtree_info[i].resize(1);
+            builder.build(subtree_nodes[i], subtree_info[i], 0, task.first, task.count,
+                          task.depth);
+            if (optimize_treelets) {
+                optimizeTreelets(subtree_nodes[i], subtree_info[i]);
+            }
+        }
+    });
+
+    // Append the subtrees, their roots taking the place the top levels left for them
+    std::vector<unsigned int> offsets(subtrees.size());
+    size_t total = num_top_nodes;
+    for (size_t i = 0; i < subtrees.size(); ++i) {
+        offsets[i] = static_cast<unsigned int>(total);
+        total += subtree_nodes[i].size() - 1;
+    }
+    nodes.resize(total);
+    std::vector<NodeInfo> info(total);
+
+    parallelFor(num_threads, subtrees.size(), [&](unsigned int, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            for (size_t local = 0; local < subtree_nodes[i].size(); ++local) {
+                BVHNode node = subtree_nodes[i][local];
+                if (node.count == 0) {
+                    node.left_first = offsets[i] + node.left_first - 1;
+                }
+                size_t global = local == 0 ? subtrees[i].node_index : offsets[i] + local - 1;
+                nodes[global] = node;
+                info[global]  = subtree_info[i][local];
+            }
+            std::vector<BVHNode>().swap(subtree_nodes[i]);
+            std::vector<NodeInfo>().swap(subtree_info[i]);
+        }
+    });
+
+    // Top levels bottom up, their children always come after them
+    std::vector<bool> subtree_roots(num_top_nodes, false);
+    for (const SubtreeTask& task : subtrees) {
+        subtree_roots[task.node_index] = true;
+    }
+    for (unsigned int node_index = num_top_nodes; node_index-- > 0;) {
+        if (subtree_roots[node_index]) {
+            continue;
+        }
+        BVHNode& node              = nodes[node_index];
+        const BVHNode& left        = nodes[node.left_first];
+        const BVHNode& right       = nodes[node.left_first + 1];
+        const NodeInfo& left_info  = info[node.left_first];
+        const NodeInfo& right_info = info[node.left_first + 1];
+        node.bounds_min            = glm::min(left.bounds_min, right.bounds_min);
+        node.bounds_max            = glm::max(left.bounds_max, right.bounds_max);
+        info[node_index]           = {nodeArea(node) + left_info.cost + right_info.cost,
+                                      1 + std::max(left_info.height, right_info.height),
+                                      top_depths[node_index]};
+        if (optimize_treelets) {
+            optimizeTreelet(nodes, info, node_index);
+        }
+    }
+
+    finishBuild();
+    build_stats.build_time =
+        std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,71 @@
+#include <cpu_features.hpp>
+
+#if CPU_X86 && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace {
+CPU::SIMDLevel querySIMDLevel() {
+#if CPU_X86 && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse42   = (info[2] & (1 << 20)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx     = (info[2] & (1 << 28)) != 0;
+
+    // The OS has to save the upper halves of the ymm registers on context switches
+    bool ymm_enabled = osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+
+    bool avx2 = false;
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    if (avx2 && ymm_enabled) {
+        return CPU::SIMDLevel::AVX2;
+    }
+    if (sse42) {
+        return CPU::SIMDLevel::SSE42;
+    }
+    return CPU::SIMDLevel::SCALAR;
+#elif CPU_X86 && (defined(__GNUC__) || defined(__clang__))
+    // Also checks that the OS has enabled the ymm registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return CPU::SIMDLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return CPU::SIMDLevel::SSE42;
+    }
+    return CPU::SIMDLevel::SCALAR;
+#else
+    return CPU::SIMDLevel::SCALAR;
+#endif
+}
+} // namespace
+
+namespace CPU {
+
+SIMDLevel detectSIMDLevel() {
+    static const SIMDLevel level = querySIMDLevel();
+    return level;
+}
+
+const char* simdLevelName(SIMDLevel level) {
+    switch (level) {
+    case SIMDLevel::SCALAR:
+        return "Scalar";
+    case SIMDLevel::SSE42:
+        return "SSE4.2";
+    case SIMDLevel::AVX2:
+        return "AVX2";
+    }
+    return "Unknown";
+}
+
+} // namespace CPU
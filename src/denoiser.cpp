@@ -0,0 +1,164 @@
+#include <denoiser.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <tile_scheduler.hpp>
+
+#include <simd_float_scalar.hpp>
+
+#include <denoiser_kernels.hpp>
+
+namespace {
+// Rows of the image handed to the worker threads at once, in tiles of this size
+constexpr unsigned int denoise_tile_size = 64;
+
+// Albedo channels below this are treated as this when dividing the colour by the albedo
+constexpr float min_albedo = 1e-3f;
+} // namespace
+
+DenoiserSettings::DenoiserSettings() {
+    iterations   = 5;
+    colour_sigma = 0.6f;
+    normal_sigma = 0.1f;
+    depth_sigma  = 0.1f;
+    num_threads  = 0;
+}
+
+void denoiseSpanScalar(const DenoisePlanes& planes, const float* const in[3], float* const out[3],
+                       unsigned int y, unsigned int x0, unsigned int x1, const DenoisePass& pass) {
+    denoiseSpan<FloatScalar>(planes, in, out, y, x0, x1, pass);
+}
+
+Denoiser::Denoiser()
+    : last_denoise_time(0.0f)
+    , last_num_threads(0) {
+    setSIMDLevel(CPU::detectSIMDLevel());
+}
+
+Denoiser::Denoiser(const DenoiserSettings& settings)
+    : settings(settings)
+    , last_denoise_time(0.0f)
+    , last_num_threads(0) {
+    setSIMDLevel(CPU::detectSIMDLevel());
+}
+
+void Denoiser::setSIMDLevel(CPU::SIMDLevel level) {
+    simd_level  = std::min(level, CPU::detectSIMDLevel());
+    span_kernel = denoiseSpanScalar;
+    span_width  = 1;
+#if CPU_X86
+    if (simd_level >= CPU::SIMDLevel::AVX2) {
+        span_kernel = denoiseSpanAVX2;
+        span_width  = 8;
+    } else if (simd_level >= CPU::SIMDLevel::SSE42) {
+        span_kernel = denoiseSpanSSE42;
+        span_width  = 4;
+    }
+#endif
+}
+
+CPU::SIMDLevel Denoiser::getSIMDLevel() const {
+    return simd_level;
+}
+
+Image Denoiser::denoise(const Image& colour, const FeatureBuffers& features) {
+    auto start = std::chrono::steady_clock::now();
+
+    const unsigned int width  = colour.width;
+    const unsigned int height = colour.height;
+    const size_t num_pixels   = colour.pixels.size();
+    if (features.albedo.pixels.size() != num_pixels ||
+        features.normal.pixels.size() != num_pixels || features.depth.size() != num_pixels) {
+        std::cout << "Feature buffers do not match the image, skipping the denoiser" << std::endl;
+        return colour;
+    }
+
+    // Split into planes, dividing the albedo out of the colour
+    DenoisePlanes planes;
+    planes.width  = width;
+    planes.height = height;
+    for (int c = 0; c < 3; ++c) {
+        planes.colour[c].resize(num_pixels);
+        planes.normal[c].resize(num_pixels);
+    }
+    planes.depth = features.depth;
+    for (size_t i = 0; i < num_pixels; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            planes.colour[c][i] =
+                colour.pixels[i][c] / std::max(features.albedo.pixels[i][c], min_albedo);
+            planes.normal[c][i] = features.normal.pixels[i][c];
+        }
+    }
+
+    unsigned int num_threads = settings.num_threads;
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Ping pong between the colour planes and a scratch copy
+    std::vector<float> scratch[3];
+    for (std::vector<float>& plane : scratch) {
+        plane.resize(num_pixels);
+    }
+    float* in[3]  = {planes.colour[0].data(), planes.colour[1].data(), planes.colour[2].data()};
+    float* out[3] = {scratch[0].data(), scratch[1].data(), scratch[2].data()};
+
+    const unsigned int iterations =
+        std::min(settings.iterations, DenoiserSettings::max_iterations);
+    const float colour_sigma = std::max(settings.colour_sigma, DenoiserSettings::min_sigma);
+    const float normal_sigma = std::max(settings.normal_sigma, DenoiserSettings::min_sigma);
+    const float depth_sigma  = std::max(settings.depth_sigma, DenoiserSettings::min_sigma);
+
+    for (unsigned int iteration = 0; iteration < iterations; ++iteration) {
+        DenoisePass pass;
+        pass.step = 1u << iteration;
+        // Colour sigma halves every iteration, so its inverse square quadruples
+        pass.inv_colour_sigma2 =
+            static_cast<float>(1u << (2 * iteration)) / (colour_sigma * colour_sigma);
+        pass.inv_normal_sigma = 1.0f / normal_sigma;
+        pass.inv_depth_sigma  = 1.0f / depth_sigma;
+
+        // Columns whose taps all lie inside the image go to the SIMD kernel, the rest are clamped
+        // one pixel at a time
+        const unsigned int reach        = 2 * pass.step;
+        const unsigned int inside_begin = std::min(reach, width);
+        const unsigned int inside_end   = width > reach ? width - reach : 0;
+
+        const float* const pass_in[3] = {in[0], in[1], in[2]};
+        float* const pass_out[3]      = {out[0], out[1], out[2]};
+
+        TileScheduler scheduler(width, height, denoise_tile_size, num_threads);
+        scheduler.run([&](const Tile& tile, unsigned int) {
+            unsigned int begin = std::clamp(inside_begin, tile.x0, tile.x1);
+            unsigned int end   = std::clamp(inside_end, begin, tile.x1);
+            end -= (end - begin) % span_width;
+
+            for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+                denoiseSpanScalar(planes, pass_in, pass_out, y, tile.x0, begin, pass);
+                span_kernel(planes, pass_in, pass_out, y, begin, end, pass);
+                denoiseSpanScalar(planes, pass_in, pass_out, y, end, tile.x1, pass);
+            }
+        });
+
+        std::swap(in, out);
+    }
+
+    // Put the albedo back
+    Image result(width, height);
+    for (size_t i = 0; i < num_pixels; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            result.pixels[i][c] =
+                in[c][i] * std::max(features.albedo.pixels[i][c], min_albedo);
+        }
+    }
+
+    last_denoise_time =
+        std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    last_num_threads = num_threads;
+
+    return result;
+}
@@ -0,0 +1,32 @@
+#include <denoiser.hpp>
+
+#if CPU_X86
+
+#include <algorithm>
+#include <cstdlib>
+#include <immintrin.h>
+
+// Everything below is compiled for AVX2, only called once the CPU is known to support it
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+#include <simd_float_avx2.hpp>
+
+#include <denoiser_kernels.hpp>
+
+void denoiseSpanAVX2(const DenoisePlanes& planes, const float* const in[3], float* const out[3],
+                     unsigned int y, unsigned int x0, unsigned int x1, const DenoisePass& pass) {
+    denoiseSpan<FloatAVX>(planes, in, out, y, x0, x1, pass);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
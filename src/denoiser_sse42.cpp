@@ -0,0 +1,32 @@
+#include <denoiser.hpp>
+
+#if CPU_X86
+
+#include <algorithm>
+#include <cstdlib>
+#include <immintrin.h>
+
+// Everything below is compiled for SSE4.2, only called once the CPU is known to support it
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#endif
+
+#include <simd_float_sse42.hpp>
+
+#include <denoiser_kernels.hpp>
+
+void denoiseSpanSSE42(const DenoisePlanes& planes, const float* const in[3], float* const out[3],
+                      unsigned int y, unsigned int x0, unsigned int x1, const DenoisePass& pass) {
+    denoiseSpan<FloatSSE>(planes, in, out, y, x0, x1, pass);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
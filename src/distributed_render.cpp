@@ -0,0 +1,943 @@
+#include <distributed_render.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <scenesaver.hpp>
+#include <tile_scheduler.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DISTRIBUTED_RENDER_SUPPORTED 1
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#else
+#define DISTRIBUTED_RENDER_SUPPORTED 0
+#endif
+
+namespace {
+// Bumped whenever a message changes, both ends must also share their byte order
+constexpr uint32_t protocol_version = 1;
+
+// Anything bigger is taken as a corrupt stream
+constexpr uint32_t max_message_size = 1u << 30;
+
+constexpr unsigned int max_worker_capacity = 256;
+
+// Every message starts with its type and the size of what follows, both 32 bit
+enum class MessageType : uint32_t {
+    HELLO  = 1, // Worker: protocol version, number of jobs it works on at once
+    SCENE  = 2, // Coordinator: render id, settings, camera, accelerator, scene text
+    JOB    = 3, // Coordinator: render id, job id, tile, first sample, samples
+    RESULT = 4, // Worker: render id, job id, the tile's sums
+};
+
+constexpr size_t message_header_size = 2 * sizeof(uint32_t);
+
+class MessageWriter {
+public:
+    explicit MessageWriter(MessageType type)
+        : bytes(message_header_size, 0) {
+        uint32_t value = static_cast<uint32_t>(type);
+        std::memcpy(bytes.data(), &value, sizeof(value));
+    }
+
+    template <typename T> void put(const T& value) {
+        const char* data = reinterpret_cast<const char*>(&value);
+        bytes.insert(bytes.end(), data, data + sizeof(T));
+    }
+
+    template <typename T> void putArray(const std::vector<T>& values) {
+        const char* data = reinterpret_cast<const char*>(values.data());
+        bytes.insert(bytes.end(), data, data + values.size() * sizeof(T));
+    }
+
+    void putString(const std::string& value) {
+        put(static_cast<uint32_t>(value.size()));
+        bytes.insert(bytes.end(), value.begin(), value.end());
+    }
+
+    // The whole message, header included
+    const std::vector<char>& finish() {
+        uint32_t size = static_cast<uint32_t>(bytes.size() - message_header_size);
+        std::memcpy(bytes.data() + sizeof(uint32_t), &size, sizeof(size));
+        return bytes;
+    }
+
+private:
+    std::vector<char> bytes;
+};
+
+class MessageReader {
+public:
+    MessageReader(const char* data, size_t size)
+        : data(data)
+        , remaining(size) {}
+
+    template <typename T> bool get(T& value) {
+        if (remaining < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        remaining -= sizeof(T);
+        return true;
+    }
+
+    template <typename T> bool getArray(std::vector<T>& values, size_t count) {
+        if (remaining / sizeof(T) < count) {
+            return false;
+        }
+        values.resize(count);
+        std::memcpy(values.data(), data, count * sizeof(T));
+        data += count * sizeof(T);
+        remaining -= count * sizeof(T);
+        return true;
+    }
+
+    bool getString(std::string& value) {
+        uint32_t size = 0;
+        if (!get(size) || remaining < size) {
+            return false;
+        }
+        value.assign(data, size);
+        data += size;
+        remaining -= size;
+        return true;
+    }
+
+private:
+    const char* data;
+    size_t remaining;
+};
+
+// Everything the workers need to set up a RayTracer the same way as the coordinator's. The
+// thread count is the worker's own business
+void putSettings(MessageWriter& message, const RayTracerSettings& settings) {
+    message.put(settings.width);
+    message.put(settings.height);
+    message.put(settings.samples_per_pixel);
+    message.put(settings.max_depth);
+    message.put(settings.tile_size);
+    message.put(static_cast<uint32_t>(settings.packet_primary_rays));
+    message.put(static_cast<uint32_t>(settings.packet_shadow_rays));
+    message.put(static_cast<uint32_t>(settings.adaptive_sampling));
+    message.put(settings.adaptive_threshold);
+    message.put(settings.adaptive_min_samples);
+    message.put(static_cast<uint32_t>(settings.feature_buffers));
+    message.put(static_cast<uint32_t>(settings.light_sampling));
+    message.put(settings.light_samples);
+    message.put(static_cast<uint32_t>(settings.wavefront));
+    message.put(static_cast<uint32_t>(settings.sampler));
+    message.put(settings.sampler_seed);
+    message.put(settings.background);
+}
+
+bool getSettings(MessageReader& message, RayTracerSettings& settings) {
+    uint32_t packet_primary_rays = 0;
+    uint32_t packet_shadow_rays  = 0;
+    uint32_t adaptive_sampling   = 0;
+    uint32_t feature_buffers     = 0;
+    uint32_t light_sampling      = 0;
+    uint32_t wavefront           = 0;
+    uint32_t sampler             = 0;
+    bool ok = message.get(settings.width) && message.get(settings.height) &&
+              message.get(settings.samples_per_pixel) && message.get(settings.max_depth) &&
+              message.get(settings.tile_size) && message.get(packet_primary_rays) &&
+              message.get(packet_shadow_rays) && message.get(adaptive_sampling) &&
+              message.get(settings.adaptive_threshold) &&
+              message.get(settings.adaptive_min_samples) && message.get(feature_buffers) &&
+              message.get(light_sampling) && message.get(settings.light_samples) &&
+              message.get(wavefront) && message.get(sampler) &&
+              message.get(settings.sampler_seed) && message.get(settings.background);
+    settings.packet_primary_rays = packet_primary_rays != 0;
+    settings.packet_shadow_rays  = packet_shadow_rays != 0;
+    settings.adaptive_sampling   = adaptive_sampling != 0;
+    settings.feature_buffers     = feature_buffers != 0;
+    settings.light_sampling      = static_cast<LightSampling>(light_sampling);
+    settings.wavefront           = wavefront != 0;
+    settings.sampler             = static_cast<SamplerType>(sampler);
+    return ok;
+}
+
+void putTileSums(MessageWriter& message, const TileSums& sums) {
+    message.put(static_cast<uint32_t>(sums.sums.size()));
+    message.put(static_cast<uint32_t>(!sums.albedo_sums.empty()));
+    message.putArray(sums.sums);
+    message.putArray(sums.sample_counts);
+    message.putArray(sums.albedo_sums);
+    message.putArray(sums.normal_sums);
+    message.putArray(sums.depth_sums);
+}
+
+bool getTileSums(MessageReader& message, size_t num_pixels, bool with_features, TileSums& sums) {
+    uint32_t count        = 0;
+    uint32_t has_features = 0;
+    if (!message.get(count) || !message.get(has_features) || count != num_pixels ||
+        (has_features != 0) != with_features) {
+        return false;
+    }
+    size_t feature_count = with_features ? num_pixels : 0;
+    return message.getArray(sums.sums, num_pixels) &&
+           message.getArray(sums.sample_counts, num_pixels) &&
+           message.getArray(sums.albedo_sums, feature_count) &&
+           message.getArray(sums.normal_sums, feature_count) &&
+           message.getArray(sums.depth_sums, feature_count);
+}
+
+// Adds the sums of a later sample range of the same tile
+void mergeTileSums(TileSums& into, TileSums&& from) {
+    if (into.sums.empty()) {
+        into = std::move(from);
+        return;
+    }
+    for (size_t i = 0; i < into.sums.size(); ++i) {
+        into.sums[i] += from.sums[i];
+        into.sample_counts[i] += from.sample_counts[i];
+    }
+    for (size_t i = 0; i < into.albedo_sums.size(); ++i) {
+        into.albedo_sums[i] += from.albedo_sums[i];
+        into.normal_sums[i] += from.normal_sums[i];
+        into.depth_sums[i] += from.depth_sums[i];
+    }
+}
+
+#if DISTRIBUTED_RENDER_SUPPORTED
+void closeSocket(int socket) {
+    ::close(socket);
+}
+
+// Gives up once timeout seconds have passed without every byte being sent, so a peer that stopped
+// reading with its socket still open cannot hold the sender up once its buffers fill. A negative
+// timeout waits for as long as it takes
+bool sendAll(int socket, const std::vector<char>& bytes, float timeout = -1.0f) {
+    int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL; // A worker hanging up must not kill the coordinator
+#endif
+    auto start  = std::chrono::steady_clock::now();
+    size_t sent = 0;
+    while (sent < bytes.size()) {
+        ssize_t result = ::send(socket, bytes.data() + sent, bytes.size() - sent, flags);
+        if (result > 0) {
+            sent += static_cast<size_t>(result);
+            continue;
+        }
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return false;
+        }
+
+        // The socket's buffer is full, wait for the peer to read some of it
+        int wait = -1;
+        if (timeout >= 0.0f) {
+            std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+            float left                           = timeout - elapsed.count();
+            if (left <= 0.0f) {
+                std::cout << "Timed out sending to a render process" << std::endl;
+                return false;
+            }
+            wait = static_cast<int>(std::ceil(left * 1000.0f));
+        }
+        pollfd poll_fd = {socket, POLLOUT, 0};
+        if (::poll(&poll_fd, 1, wait) < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool receiveAll(int socket, char* data, size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        ssize_t result = ::recv(socket, data + received, size - received, 0);
+        if (result <= 0) {
+            return false;
+        }
+        received += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+// Splits "host:port" at the last colon. An empty host means every interface when listening
+bool splitHostPort(const std::string& address, std::string& host, std::string& port) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size()) {
+        std::cout << "Expected unix:/path or host:port, got " << address << std::endl;
+        return false;
+    }
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    return true;
+}
+
+bool isUnixAddress(const std::string& address, sockaddr_un& unix_address) {
+    const std::string prefix = "unix:";
+    if (address.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    std::memset(&unix_address, 0, sizeof(unix_address));
+    unix_address.sun_family = AF_UNIX;
+    std::strncpy(unix_address.sun_path, address.c_str() + prefix.size(),
+                 sizeof(unix_address.sun_path) - 1);
+    return true;
+}
+
+int openListenSocket(const std::string& address) {
+    sockaddr_un unix_address;
+    if (isUnixAddress(address, unix_address)) {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        ::unlink(unix_address.sun_path); // Left behind by an earlier coordinator
+        if (fd < 0 ||
+            ::bind(fd, reinterpret_cast<sockaddr*>(&unix_address), sizeof(unix_address)) != 0 ||
+            ::listen(fd, SOMAXCONN) != 0) {
+            std::cout << "Unable to listen on " << address << ": " << std::strerror(errno)
+                      << std::endl;
+            if (fd >= 0) {
+                closeSocket(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    std::string host;
+    std::string port;
+    if (!splitHostPort(address, host, port)) {
+        return -1;
+    }
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+    addrinfo* results = nullptr;
+    if (::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results) != 0) {
+        std::cout << "Unable to resolve " << address << std::endl;
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo* result = results; result && fd < 0; result = result->ai_next) {
+        fd = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int reuse = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (::bind(fd, result->ai_addr, result->ai_addrlen) != 0 ||
+            ::listen(fd, SOMAXCONN) != 0) {
+            closeSocket(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(results);
+
+    if (fd < 0) {
+        std::cout << "Unable to listen on " << address << ": " << std::strerror(errno)
+                  << std::endl;
+    }
+    return fd;
+}
+
+int connectSocket(const std::string& address) {
+    sockaddr_un unix_address;
+    if (isUnixAddress(address, unix_address)) {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&unix_address),
+                                sizeof(unix_address)) != 0) {
+            std::cout << "Unable to connect to " << address << ": " << std::strerror(errno)
+                      << std::endl;
+            if (fd >= 0) {
+                closeSocket(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    std::string host;
+    std::string port;
+    if (!splitHostPort(address, host, port)) {
+        return -1;
+    }
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    if (::getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints,
+                      &results) != 0) {
+        std::cout << "Unable to resolve " << address << std::endl;
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo* result = results; result && fd < 0; result = result->ai_next) {
+        fd = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (fd >= 0 && ::connect(fd, result->ai_addr, result->ai_addrlen) != 0) {
+            closeSocket(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(results);
+
+    if (fd < 0) {
+        std::cout << "Unable to connect to " << address << ": " << std::strerror(errno)
+                  << std::endl;
+        return -1;
+    }
+    // Jobs are small and latency bound
+    int no_delay = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    return fd;
+}
+#endif
+
+float secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+DistributedSettings::DistributedSettings()
+    : address("127.0.0.1:5555")
+    , samples_per_job(0)
+    , connect_timeout(30.0f)
+    , job_timeout(600.0f) {}
+
+DistributedStats::DistributedStats()
+    : workers(0)
+    , workers_lost(0)
+    , jobs(0)
+    , jobs_reassigned(0)
+    , render_time(0.0f) {}
+
+DistributedCoordinator::DistributedCoordinator()
+    : listen_socket(-1)
+    , render_id(0) {}
+
+DistributedCoordinator::~DistributedCoordinator() {
+    close();
+}
+
+bool DistributedCoordinator::listen() {
+#if DISTRIBUTED_RENDER_SUPPORTED
+    if (listen_socket >= 0 && listen_address == settings.address) {
+        return true;
+    }
+    close();
+
+    listen_socket = openListenSocket(settings.address);
+    if (listen_socket < 0) {
+        return false;
+    }
+    listen_address = settings.address;
+    std::cout << "Waiting for render workers on " << listen_address << std::endl;
+    return true;
+#else
+    std::cout << "Distributed rendering is not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+bool DistributedCoordinator::render(const std::vector<std::shared_ptr<GameObject>>& objects,
+                                    const Camera& camera, const RayTracerSettings& settings,
+                                    SceneAccelerator accelerator, Image& image,
+                                    FeatureBuffers* features,
+                                    const std::atomic<bool>* cancel) {
+#if DISTRIBUTED_RENDER_SUPPORTED
+    auto start = std::chrono::steady_clock::now();
+    last_stats = DistributedStats();
+    if (!listen()) {
+        return false;
+    }
+    render_id++;
+
+    // The same scene message goes to every worker, including ones joining part way through
+    std::vector<std::shared_ptr<GameObject>> visible_objects;
+    for (const std::shared_ptr<GameObject>& object : objects) {
+        if (object->visible) {
+            visible_objects.push_back(object);
+        }
+    }
+    MessageWriter scene_writer(MessageType::SCENE);
+    scene_writer.put(render_id);
+    putSettings(scene_writer, settings);
+    scene_writer.put(camera.pos);
+    scene_writer.put(camera.front);
+    scene_writer.put(camera.up);
+    scene_writer.put(camera.fov);
+    scene_writer.put(static_cast<uint32_t>(accelerator));
+    scene_writer.putString(SceneSaver::sceneToString(visible_objects));
+    const std::vector<char> scene_message = scene_writer.finish();
+
+    // Every tile's samples split into ranges of samples_per_job. Adaptive sampling decides when a
+    // pixel has converged from all of its samples, so each tile then goes in one job
+    const std::vector<Tile> tiles =
+        TileScheduler(settings.width, settings.height, settings.tile_size, 1).getTiles();
+    const unsigned int samples   = settings.samples_per_pixel;
+    const unsigned int per_job   = this->settings.samples_per_job == 0 || settings.adaptive_sampling
+                                       ? std::max(samples, 1u)
+                                       : this->settings.samples_per_job;
+    const unsigned int per_tile  = std::max(1u, (samples + per_job - 1) / per_job);
+    std::vector<Job> jobs;
+    for (const Tile& tile : tiles) {
+        for (unsigned int range = 0; range < per_tile; ++range) {
+            uint32_t first = range * per_job;
+            jobs.push_back({tile.index, range, first, std::min(per_job, samples - first)});
+        }
+    }
+    std::deque<uint32_t> pending;
+    for (uint32_t id = 0; id < jobs.size(); ++id) {
+        pending.push_back(id);
+    }
+
+    // Ranges are merged in order, those arriving early wait in ranges_waiting
+    std::vector<TileSums> merged(tiles.size());
+    std::vector<unsigned int> next_range(tiles.size(), 0);
+    std::vector<std::map<unsigned int, TileSums>> ranges_waiting(tiles.size());
+    size_t jobs_done = 0;
+
+    for (Connection& connection : connections) {
+        if (connection.capacity > 0) {
+            connection.render_id = render_id;
+            connection.assigned.clear();
+            connection.inbox.clear();
+            last_stats.workers++;
+        }
+    }
+    // Workers that were idle get the scene below, a failed send drops them like any other
+    std::vector<size_t> lost;
+    for (size_t i = 0; i < connections.size(); ++i) {
+        if (connections[i].capacity > 0 &&
+            !sendAll(connections[i].socket, scene_message, this->settings.job_timeout)) {
+            lost.push_back(i);
+        }
+    }
+    auto drop_lost = [&]() {
+        std::sort(lost.begin(), lost.end());
+        lost.erase(std::unique(lost.begin(), lost.end()), lost.end());
+        for (size_t i = lost.size(); i-- > 0;) {
+            last_stats.jobs_reassigned +=
+                static_cast<unsigned int>(connections[lost[i]].assigned.size());
+            dropWorker(lost[i], pending);
+            last_stats.workers_lost++;
+        }
+        lost.clear();
+    };
+    drop_lost();
+
+    float idle_since = 0.0f; // Last time there was a worker
+    while (jobs_done < jobs.size()) {
+        if (cancel && cancel->load(std::memory_order_relaxed)) {
+            std::cout << "Distributed render cancelled" << std::endl;
+            return false;
+        }
+        const float now = secondsSince(start);
+
+        // Keep every worker busy with as many jobs as it has threads
+        for (size_t i = 0; i < connections.size(); ++i) {
+            Connection& connection = connections[i];
+            if (connection.capacity == 0 || connection.render_id != render_id) {
+                continue;
+            }
+            while (connection.assigned.size() < connection.capacity && !pending.empty()) {
+                uint32_t id = pending.front();
+                pending.pop_front();
+                connection.assigned[id] = now;
+
+                const Job& job = jobs[id];
+                MessageWriter job_writer(MessageType::JOB);
+                job_writer.put(render_id);
+                job_writer.put(id);
+                job_writer.put(static_cast<uint32_t>(job.tile));
+                job_writer.put(job.first_sample);
+                job_writer.put(static_cast<uint32_t>(job.samples));
+                if (!sendAll(connection.socket, job_writer.finish(), this->settings.job_timeout)) {
+                    lost.push_back(i);
+                    break;
+                }
+            }
+        }
+        drop_lost();
+
+        if (connections.empty()) {
+            if (now - idle_since > this->settings.connect_timeout) {
+                std::cout << "No render worker connected to " << listen_address << " for "
+                          << this->settings.connect_timeout << "s, giving up" << std::endl;
+                return false;
+            }
+        } else {
+            idle_since = now;
+        }
+
+        std::vector<pollfd> poll_fds;
+        poll_fds.push_back({listen_socket, POLLIN, 0});
+        for (const Connection& connection : connections) {
+            poll_fds.push_back({connection.socket, POLLIN, 0});
+        }
+        if (::poll(poll_fds.data(), poll_fds.size(), 100) < 0) {
+            continue;
+        }
+
+        for (size_t i = 0; i < connections.size(); ++i) {
+            if ((poll_fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+                continue;
+            }
+            Connection& connection = connections[i];
+            char buffer[65536];
+            ssize_t received = ::recv(connection.socket, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                lost.push_back(i);
+                continue;
+            }
+            connection.inbox.insert(connection.inbox.end(), buffer, buffer + received);
+
+            // Handle every whole message received so far
+            size_t offset = 0;
+            while (connection.inbox.size() - offset >= message_header_size) {
+                uint32_t type = 0;
+                uint32_t size = 0;
+                std::memcpy(&type, connection.inbox.data() + offset, sizeof(type));
+                std::memcpy(&size, connection.inbox.data() + offset + sizeof(type), sizeof(size));
+                if (size > max_message_size) {
+                    lost.push_back(i);
+                    break;
+                }
+                if (connection.inbox.size() - offset - message_header_size < size) {
+                    break;
+                }
+                MessageReader message(connection.inbox.data() + offset + message_header_size,
+                                      size);
+                offset += message_header_size + size;
+
+                if (type == static_cast<uint32_t>(MessageType::HELLO)) {
+                    uint32_t version  = 0;
+                    uint32_t capacity = 0;
+                    if (!message.get(version) || !message.get(capacity) ||
+                        version != protocol_version) {
+                        std::cout << "Render worker speaks another protocol version"
+                                  << std::endl;
+                        lost.push_back(i);
+                        break;
+                    }
+                    connection.capacity  = std::clamp(capacity, 1u, max_worker_capacity);
+                    connection.render_id = render_id;
+                    last_stats.workers++;
+                    if (!sendAll(connection.socket, scene_message, this->settings.job_timeout)) {
+                        lost.push_back(i);
+                        break;
+                    }
+                } else if (type == static_cast<uint32_t>(MessageType::RESULT)) {
+                    uint32_t result_render = 0;
+                    uint32_t id            = 0;
+                    if (!message.get(result_render) || !message.get(id)) {
+                        lost.push_back(i);
+                        break;
+                    }
+                    // Results of an earlier render, or of a job taken back, are dropped
+                    if (result_render != render_id || connection.assigned.count(id) == 0) {
+                        continue;
+                    }
+                    const Job& job   = jobs[id];
+                    const Tile& tile = tiles[job.tile];
+                    size_t num_pixels =
+                        static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+                    TileSums sums;
+                    if (!getTileSums(message, num_pixels, settings.feature_buffers, sums)) {
+                        lost.push_back(i);
+                        break;
+                    }
+                    connection.assigned.erase(id);
+                    jobs_done++;
+
+                    std::map<unsigned int, TileSums>& waiting = ranges_waiting[job.tile];
+                    waiting[job.range] = std::move(sums);
+                    while (!waiting.empty() && waiting.begin()->first == next_range[job.tile]) {
+                        mergeTileSums(merged[job.tile], std::move(waiting.begin()->second));
+                        waiting.erase(waiting.begin());
+                        next_range[job.tile]++;
+                    }
+                } else {
+                    lost.push_back(i);
+                    break;
+                }
+            }
+            connection.inbox.erase(connection.inbox.begin(),
+                                   connection.inbox.begin() +
+                                       std::min(offset, connection.inbox.size()));
+        }
+
+        // A worker sitting on a job for too long has most likely hung
+        for (size_t i = 0; i < connections.size(); ++i) {
+            for (const auto& [id, sent] : connections[i].assigned) {
+                if (secondsSince(start) - sent > this->settings.job_timeout) {
+                    std::cout << "Render worker timed out on job " << id << std::endl;
+                    lost.push_back(i);
+                    break;
+                }
+            }
+        }
+        drop_lost();
+
+        if (poll_fds[0].revents & POLLIN) {
+            acceptWorkers();
+        }
+    }
+
+    image = Image(settings.width, settings.height);
+    std::vector<unsigned int> sample_counts(image.pixels.size(), 0);
+    FeatureBuffers* resolved_features = nullptr;
+    if (features && settings.feature_buffers) {
+        features->albedo = Image(settings.width, settings.height);
+        features->normal = Image(settings.width, settings.height);
+        features->depth.assign(image.pixels.size(), 0.0f);
+        resolved_features = features;
+    }
+    RayTracer resolver(settings);
+    for (const Tile& tile : tiles) {
+        resolver.resolveTileSums(tile, merged[tile.index], image, sample_counts,
+                                 resolved_features);
+    }
+
+    last_stats.jobs        = static_cast<unsigned int>(jobs.size());
+    last_stats.render_time = secondsSince(start);
+    return true;
+#else
+    (void)objects;
+    (void)camera;
+    (void)settings;
+    (void)accelerator;
+    (void)image;
+    (void)features;
+    (void)cancel;
+    std::cout << "Distributed rendering is not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+void DistributedCoordinator::close() {
+#if DISTRIBUTED_RENDER_SUPPORTED
+    for (const Connection& connection : connections) {
+        closeSocket(connection.socket);
+    }
+    connections.clear();
+    if (listen_socket >= 0) {
+        closeSocket(listen_socket);
+        listen_socket = -1;
+    }
+    sockaddr_un unix_address;
+    if (isUnixAddress(listen_address, unix_address)) {
+        ::unlink(unix_address.sun_path);
+    }
+    listen_address.clear();
+#endif
+}
+
+unsigned int DistributedCoordinator::numWorkers() const {
+    return static_cast<unsigned int>(connections.size());
+}
+
+void DistributedCoordinator::acceptWorkers() {
+#if DISTRIBUTED_RENDER_SUPPORTED
+    int fd = ::accept(listen_socket, nullptr, nullptr);
+    if (fd < 0) {
+        return;
+    }
+    int no_delay = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    // Gets the scene once its hello arrives
+    Connection connection;
+    connection.socket    = fd;
+    connection.capacity  = 0;
+    connection.render_id = 0;
+    connections.push_back(std::move(connection));
+#endif
+}
+
+void DistributedCoordinator::dropWorker(size_t index, std::deque<uint32_t>& pending) {
+    Connection& connection = connections[index];
+    // Taken back jobs go first, they are the ones holding up their tiles
+    for (auto it = connection.assigned.rbegin(); it != connection.assigned.rend(); ++it) {
+        pending.push_front(it->first);
+    }
+#if DISTRIBUTED_RENDER_SUPPORTED
+    closeSocket(connection.socket);
+#endif
+    connections.erase(connections.begin() + static_cast<std::ptrdiff_t>(index));
+    std::cout << "Lost a render worker, " << connections.size() << " left" << std::endl;
+}
+
+int runRenderWorker(const std::string& address, unsigned int num_threads) {
+#if DISTRIBUTED_RENDER_SUPPORTED
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    int socket = connectSocket(address);
+    if (socket < 0) {
+        return 1;
+    }
+
+    MessageWriter hello(MessageType::HELLO);
+    hello.put(protocol_version);
+    hello.put(static_cast<uint32_t>(num_threads));
+    if (!sendAll(socket, hello.finish())) {
+        closeSocket(socket);
+        return 1;
+    }
+    std::cout << "Connected to " << address << " with " << num_threads << " threads"
+              << std::endl;
+
+    // Scene of the coordinator's latest render, replaced whenever a new one starts
+    struct WorkerScene {
+        uint32_t render_id;
+        RayTracer raytracer;
+        RayTracerScene scene;
+        Camera camera;
+        std::vector<Tile> tiles;
+    };
+    struct WorkerJob {
+        uint32_t render_id;
+        uint32_t id;
+        uint32_t tile;
+        uint32_t first_sample;
+        uint32_t samples;
+    };
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::shared_ptr<const WorkerScene> current;
+    std::deque<WorkerJob> jobs;
+    bool quit = false;
+    std::mutex send_mutex;
+
+    auto render_jobs = [&]() {
+        for (;;) {
+            WorkerJob job;
+            std::shared_ptr<const WorkerScene> scene;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&]() { return quit || !jobs.empty(); });
+                if (quit) {
+                    return;
+                }
+                job = jobs.front();
+                jobs.pop_front();
+                scene = current;
+            }
+            if (!scene || scene->render_id != job.render_id || job.tile >= scene->tiles.size()) {
+                continue;
+            }
+
+            BVHTraversalStats stats;
+            TileSums sums = scene->raytracer.renderTileSums(
+                scene->scene, scene->camera, scene->tiles[job.tile], job.first_sample,
+                job.samples, stats);
+
+            MessageWriter result(MessageType::RESULT);
+            result.put(job.render_id);
+            result.put(job.id);
+            putTileSums(result, sums);
+            std::lock_guard<std::mutex> lock(send_mutex);
+            sendAll(socket, result.finish()); // A failure shows up as the connection closing
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(render_jobs);
+    }
+
+    std::vector<char> payload;
+    for (;;) {
+        char header[message_header_size];
+        if (!receiveAll(socket, header, sizeof(header))) {
+            break;
+        }
+        uint32_t type = 0;
+        uint32_t size = 0;
+        std::memcpy(&type, header, sizeof(type));
+        std::memcpy(&size, header + sizeof(type), sizeof(size));
+        if (size > max_message_size) {
+            std::cout << "Corrupt message from the coordinator" << std::endl;
+            break;
+        }
+        payload.resize(size);
+        if (!receiveAll(socket, payload.data(), size)) {
+            break;
+        }
+        MessageReader message(payload.data(), size);
+
+        if (type == static_cast<uint32_t>(MessageType::SCENE)) {
+            auto scene = std::make_shared<WorkerScene>();
+            RayTracerSettings settings;
+            uint32_t accelerator = 0;
+            std::string scene_text;
+            if (!message.get(scene->render_id) || !getSettings(message, settings) ||
+                !message.get(scene->camera.pos) || !message.get(scene->camera.front) ||
+                !message.get(scene->camera.up) || !message.get(scene->camera.fov) ||
+                !message.get(accelerator) || !message.getString(scene_text)) {
+                std::cout << "Corrupt scene from the coordinator" << std::endl;
+                break;
+            }
+            std::vector<std::shared_ptr<GameObject>> objects =
+                SceneSaver::sceneFromString(scene_text);
+            scene->scene             = RayTracerScene(objects);
+            scene->scene.accelerator = static_cast<SceneAccelerator>(accelerator);
+            scene->raytracer         = RayTracer(settings);
+            scene->tiles =
+                TileScheduler(settings.width, settings.height, settings.tile_size, 1).getTiles();
+            std::cout << "Rendering " << objects.size() << " objects at " << settings.width << "x"
+                      << settings.height << std::endl;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            current = std::move(scene);
+            jobs.clear();
+        } else if (type == static_cast<uint32_t>(MessageType::JOB)) {
+            WorkerJob job;
+            if (!message.get(job.render_id) || !message.get(job.id) || !message.get(job.tile) ||
+                !message.get(job.first_sample) || !message.get(job.samples)) {
+                std::cout << "Corrupt job from the coordinator" << std::endl;
+                break;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+            condition.notify_one();
+        } else {
+            std::cout << "Unexpected message from the coordinator" << std::endl;
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    condition.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    closeSocket(socket);
+    std::cout << "Coordinator hung up" << std::endl;
+    return 0;
+#else
+    (void)address;
+    (void)num_threads;
+    std::cout << "Distributed rendering is not supported on this platform" << std::endl;
+    return 1;
+#endif
+}
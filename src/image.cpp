@@ -0,0 +1,119 @@
+#include <image.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+ImageRegion::ImageRegion()
+    : ImageRegion(0, 0, 0, 0) {}
+
+ImageRegion::ImageRegion(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+    : x0(x0)
+    , y0(y0)
+    , x1(x1)
+    , y1(y1) {}
+
+unsigned int ImageRegion::width() const {
+    return x1 > x0 ? x1 - x0 : 0;
+}
+
+unsigned int ImageRegion::height() const {
+    return y1 > y0 ? y1 - y0 : 0;
+}
+
+bool ImageRegion::empty() const {
+    return width() == 0 || height() == 0;
+}
+
+ImageRegion ImageRegion::clamped(unsigned int width, unsigned int height) const {
+    return ImageRegion(std::min(x0, width), std::min(y0, height), std::min(x1, width),
+                       std::min(y1, height));
+}
+
+Image::Image()
+    : width(0)
+    , height(0) {}
+
+Image::Image(unsigned int width, unsigned int height)
+    : width(width)
+    , height(height)
+    , pixels(static_cast<size_t>(width) * height, glm::vec3(0.0f)) {}
+
+glm::vec3& Image::at(unsigned int x, unsigned int y) {
+    return pixels[static_cast<size_t>(y) * width + x];
+}
+
+const glm::vec3& Image::at(unsigned int x, unsigned int y) const {
+    return pixels[static_cast<size_t>(y) * width + x];
+}
+
+bool Image::writePPM(const std::string& path, float gamma) const {
+    std::ofstream outfile(path, std::ios::binary);
+    if (!outfile.is_open()) {
+        std::cout << "Unable to open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    outfile << "P6\n" << width << " " << height << "\n255\n";
+
+    std::vector<unsigned char> row(static_cast<size_t>(width) * 3);
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            const glm::vec3& pixel = at(x, y);
+            for (int c = 0; c < 3; ++c) {
+                float value = std::pow(std::clamp(pixel[c], 0.0f, 1.0f), 1.0f / gamma);
+                row[3 * x + c] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+            }
+        }
+        outfile.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+
+    return outfile.good();
+}
+
+float Image::rmse(const Image& reference) const {
+    if (reference.width != width || reference.height != height) {
+        return -1.0f;
+    }
+    if (pixels.empty()) {
+        return 0.0f;
+    }
+
+    double sum = 0.0;
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        glm::vec3 difference = pixels[i] - reference.pixels[i];
+        sum += glm::dot(difference, difference);
+    }
+    return static_cast<float>(std::sqrt(sum / (3.0 * pixels.size())));
+}
+
+void Image::paste(const Image& source, unsigned int x, unsigned int y) {
+    if (x >= width || y >= height) {
+        return;
+    }
+    const unsigned int copy_width  = std::min(source.width, width - x);
+    const unsigned int copy_height = std::min(source.height, height - y);
+    for (unsigned int row = 0; row < copy_height; ++row) {
+        auto source_row = source.pixels.begin() + static_cast<size_t>(row) * source.width;
+        std::copy(source_row, source_row + copy_width,
+                  pixels.begin() + static_cast<size_t>(y + row) * width + x);
+    }
+}
+
+Image Image::resized(unsigned int new_width, unsigned int new_height) const {
+    Image image(new_width, new_height);
+    if (pixels.empty()) {
+        return image;
+    }
+    for (unsigned int y = 0; y < new_height; ++y) {
+        unsigned int source_y =
+            static_cast<unsigned int>(static_cast<size_t>(y) * height / new_height);
+        for (unsigned int x = 0; x < new_width; ++x) {
+            unsigned int source_x =
+                static_cast<unsigned int>(static_cast<size_t>(x) * width / new_width);
+            image.at(x, y) = at(source_x, source_y);
+        }
+    }
+    return image;
+}
@@ -0,0 +1,218 @@
+#include <intersection.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Keeps track of the closest valid root found so far while testing the several surfaces that make
+// up a shape
+struct ClosestHit {
+    ClosestHit(float t_min, float t_max)
+        : t_min(t_min)
+        , t(t_max)
+        , found(false)
+        , normal(0.0f) {}
+
+    void consider(float candidate_t, const glm::vec3& candidate_normal) {
+        if (candidate_t > t_min && candidate_t < t) {
+            t      = candidate_t;
+            normal = candidate_normal;
+            found  = true;
+        }
+    }
+
+    float t_min;
+    float t;
+    bool found;
+    glm::vec3 normal;
+};
+
+// Intersect the infinite cylinder x^2 + y^2 = radius^2 around the z axis and only keep roots
+// where z lies within [z_min, z_max]. sign is +1 for normals pointing away from the axis and -1
+// for normals pointing towards it (inside of a tube)
+void cylinderSide(const glm::vec3& origin, const glm::vec3& direction, float radius, float z_min,
+                  float z_max, float sign, ClosestHit& hit) {
+    float a = direction.x * direction.x + direction.y * direction.y;
+    if (a < 1e-12f) {
+        // Ray parallel to the axis never hits the side
+        return;
+    }
+    float b = origin.x * direction.x + origin.y * direction.y;
+    float c = origin.x * origin.x + origin.y * origin.y - radius * radius;
+
+    float discriminant = b * b - a * c;
+    if (discriminant < 0.0f) {
+        return;
+    }
+    float root = std::sqrt(discriminant);
+
+    for (float t : {(-b - root) / a, (-b + root) / a}) {
+        float z = origin.z + t * direction.z;
+        if (z < z_min || z > z_max) {
+            continue;
+        }
+        glm::vec3 p = origin + t * direction;
+        hit.consider(t, sign * glm::vec3(p.x, p.y, 0.0f));
+    }
+}
+
+// Intersect the plane z = z_plane and only keep the hit if the radial distance squared lies
+// within [r2_min, r2_max]
+void disk(const glm::vec3& origin, const glm::vec3& direction, float z_plane, float r2_min,
+          float r2_max, const glm::vec3& normal, ClosestHit& hit) {
+    if (std::abs(direction.z) < 1e-12f) {
+        return;
+    }
+    float t     = (z_plane - origin.z) / direction.z;
+    glm::vec3 p = origin + t * direction;
+    float r2    = p.x * p.x + p.y * p.y;
+    if (r2 >= r2_min && r2 <= r2_max) {
+        hit.consider(t, normal);
+    }
+}
+} // namespace
+
+namespace Intersection {
+
+bool rayUnitCube(const glm::vec3& origin, const glm::vec3& direction, float t_min, float t_max,
+                 float& t, glm::vec3& normal) {
+    // Slab test against [-0.5, 0.5]^3, same idea as Math::rayBoundingBoxIntersection
+    glm::vec3 inv_direction = 1.0f / direction;
+    glm::vec3 t0            = (glm::vec3(-0.5f) - origin) * inv_direction;
+    glm::vec3 t1            = (glm::vec3(0.5f) - origin) * inv_direction;
+    glm::vec3 t_small       = glm::min(t0, t1);
+    glm::vec3 t_large       = glm::max(t0, t1);
+
+    float t_near = std::max(std::max(t_small.x, t_small.y), t_small.z);
+    float t_far  = std::min(std::min(t_large.x, t_large.y), t_large.z);
+
+    if (t_near > t_far) {
+        return false;
+    }
+
+    // If the ray starts inside the cube, the exit point is the visible one
+    float t_hit = t_near > t_min ? t_near : t_far;
+    if (t_hit <= t_min || t_hit >= t_max) {
+        return false;
+    }
+
+    // The face hit is the one along the axis where the point is furthest from the centre
+    glm::vec3 p     = origin + t_hit * direction;
+    glm::vec3 abs_p = glm::abs(p);
+    if (abs_p.x >= abs_p.y && abs_p.x >= abs_p.z) {
+        normal = glm::vec3(p.x > 0.0f ? 1.0f : -1.0f, 0.0f, 0.0f);
+    } else if (abs_p.y >= abs_p.z) {
+        normal = glm::vec3(0.0f, p.y > 0.0f ? 1.0f : -1.0f, 0.0f);
+    } else {
+        normal = glm::vec3(0.0f, 0.0f, p.z > 0.0f ? 1.0f : -1.0f);
+    }
+    t = t_hit;
+    return true;
+}
+
+bool rayUnitSphere(const glm::vec3& origin, const glm::vec3& direction, float t_min, float t_max,
+                   float& t, glm::vec3& normal) {
+    float a = glm::dot(direction, direction);
+    float b = glm::dot(origin, direction);
+    float c = glm::dot(origin, origin) - 1.0f;
+
+    float discriminant = b * b - a * c;
+    if (discriminant < 0.0f) {
+        return false;
+    }
+    float root = std::sqrt(discriminant);
+
+    float t_hit = (-b - root) / a;
+    if (t_hit <= t_min || t_hit >= t_max) {
+        t_hit = (-b + root) / a;
+        if (t_hit <= t_min || t_hit >= t_max) {
+            return false;
+        }
+    }
+
+    t      = t_hit;
+    normal = origin + t_hit * direction;
+    return true;
+}
+
+bool rayHollowCylinder(const glm::vec3& origin, const glm::vec3& direction, float t_min,
+                       float t_max, float inner_radius, float& t, glm::vec3& normal) {
+    // Tube of outer radius 1 and height 1 centred on the origin, see
+    // HollowCylinder::generateVertexPositions
+    ClosestHit hit(t_min, t_max);
+
+    cylinderSide(origin, direction, 1.0f, -0.5f, 0.5f, 1.0f, hit);
+    cylinderSide(origin, direction, inner_radius, -0.5f, 0.5f, -1.0f, hit);
+
+    float r2_inner = inner_radius * inner_radius;
+    disk(origin, direction, 0.5f, r2_inner, 1.0f, glm::vec3(0.0f, 0.0f, 1.0f), hit);
+    disk(origin, direction, -0.5f, r2_inner, 1.0f, glm::vec3(0.0f, 0.0f, -1.0f), hit);
+
+    if (!hit.found) {
+        return false;
+    }
+    t      = hit.t;
+    normal = hit.normal;
+    return true;
+}
+
+bool rayArrow(const glm::vec3& origin, const glm::vec3& direction, float t_min, float t_max,
+              float tail_radius, float tail_height, float head_radius, float head_height, float& t,
+              glm::vec3& normal) {
+    // Cylindrical tail centred on the origin with a cone on top, see
+    // Arrow::generateVertexPositions
+    ClosestHit hit(t_min, t_max);
+
+    float tail_top = 0.5f * tail_height;
+    float apex     = tail_top + head_height;
+
+    // Tail and the disk closing off its base
+    cylinderSide(origin, direction, tail_radius, -tail_top, tail_top, 1.0f, hit);
+    disk(origin, direction, -tail_top, 0.0f, tail_radius * tail_radius,
+         glm::vec3(0.0f, 0.0f, -1.0f), hit);
+
+    // Disk at the base of the head
+    disk(origin, direction, tail_top, 0.0f, head_radius * head_radius,
+         glm::vec3(0.0f, 0.0f, -1.0f), hit);
+
+    // Head: x^2 + y^2 = k^2 (apex - z)^2 for z in [tail_top, apex]
+    float k  = head_radius / head_height;
+    float k2 = k * k;
+    float w  = apex - origin.z;
+
+    float a = direction.x * direction.x + direction.y * direction.y -
+              k2 * direction.z * direction.z;
+    float b = origin.x * direction.x + origin.y * direction.y + k2 * w * direction.z;
+    float c = origin.x * origin.x + origin.y * origin.y - k2 * w * w;
+
+    float roots[2];
+    int num_roots = 0;
+    if (std::abs(a) < 1e-12f) {
+        if (std::abs(b) > 1e-12f) {
+            roots[num_roots++] = -c / (2.0f * b);
+        }
+    } else {
+        float discriminant = b * b - a * c;
+        if (discriminant >= 0.0f) {
+            float root         = std::sqrt(discriminant);
+            roots[num_roots++] = (-b - root) / a;
+            roots[num_roots++] = (-b + root) / a;
+        }
+    }
+    for (int i = 0; i < num_roots; ++i) {
+        glm::vec3 p = origin + roots[i] * direction;
+        if (p.z < tail_top || p.z > apex) {
+            continue;
+        }
+        hit.consider(roots[i], glm::vec3(p.x, p.y, k2 * (apex - p.z)));
+    }
+
+    if (!hit.found) {
+        return false;
+    }
+    t      = hit.t;
+    normal = hit.normal;
+    return true;
+}
+
+} // namespace Intersection
@@ -0,0 +1,233 @@
+#include <light_sampler.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <numeric>
+
+#include <raytracer_scene.hpp>
+
+namespace {
+// Largest float below 1, where u is clamped to after being rescaled
+constexpr float one_minus_epsilon = 0x1.fffffep-1f;
+
+float luminance(const glm::vec3& colour) {
+    return glm::dot(colour, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+struct LightBuildTask {
+    unsigned int node;
+    unsigned int begin;
+    unsigned int end;
+};
+} // namespace
+
+const char* lightSamplingName(LightSampling sampling) {
+    switch (sampling) {
+    case LightSampling::ALL:
+        return "All lights";
+    case LightSampling::ALIAS_TABLE:
+        return "Alias table";
+    case LightSampling::LIGHT_BVH:
+        return "Light BVH";
+    }
+    return "Unknown";
+}
+
+LightSampler::LightSampler()
+    : build_time(0.0f) {}
+
+void LightSampler::build(const std::vector<SceneLight>& lights) {
+    auto start = std::chrono::steady_clock::now();
+
+    const unsigned int n = static_cast<unsigned int>(lights.size());
+    alias_table.clear();
+    light_pdfs.clear();
+    nodes.clear();
+    light_indices.resize(n);
+    std::iota(light_indices.begin(), light_indices.end(), 0);
+
+    if (n == 0) {
+        build_time = 0.0f;
+        return;
+    }
+
+    // Alias table over the intensity of every light at unit distance (Vose's method)
+    std::vector<float> weights(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        const SceneLight& light = lights[i];
+        float strength          = light.ambient + light.diffuse + light.specular;
+        float attenuation       = light.constant + light.linear + light.quadratic;
+        weights[i] = luminance(light.colour) * strength / std::max(attenuation, 1e-6f);
+    }
+    float total_weight = std::accumulate(weights.begin(), weights.end(), 0.0f);
+
+    if (total_weight > 0.0f) {
+        alias_table.resize(n);
+        light_pdfs.resize(n);
+
+        std::vector<float> scaled(n);
+        std::vector<unsigned int> small;
+        std::vector<unsigned int> large;
+        for (unsigned int i = 0; i < n; ++i) {
+            light_pdfs[i] = weights[i] / total_weight;
+            scaled[i]     = light_pdfs[i] * static_cast<float>(n);
+            (scaled[i] < 1.0f ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            unsigned int less = small.back();
+            unsigned int more = large.back();
+            small.pop_back();
+            large.pop_back();
+
+            alias_table[less] = {scaled[less], more};
+            scaled[more]      = (scaled[more] + scaled[less]) - 1.0f;
+            (scaled[more] < 1.0f ? small : large).push_back(more);
+        }
+        // Whatever is left is 1 up to rounding
+        for (unsigned int i : small) {
+            alias_table[i] = {1.0f, i};
+        }
+        for (unsigned int i : large) {
+            alias_table[i] = {1.0f, i};
+        }
+    }
+
+    // Light BVH, split at the median light along the longest axis of the node's bounds
+    nodes.reserve(2 * static_cast<size_t>(n) - 1);
+    nodes.push_back(LightBVHNode());
+
+    std::vector<LightBuildTask> tasks;
+    tasks.push_back({0, 0, n});
+    while (!tasks.empty()) {
+        LightBuildTask task = tasks.back();
+        tasks.pop_back();
+
+        glm::vec3 bounds_min(std::numeric_limits<float>::max());
+        glm::vec3 bounds_max(-std::numeric_limits<float>::max());
+        for (unsigned int i = task.begin; i < task.end; ++i) {
+            bounds_min = glm::min(bounds_min, lights[light_indices[i]].position);
+            bounds_max = glm::max(bounds_max, lights[light_indices[i]].position);
+        }
+        nodes[task.node].bounds_min = bounds_min;
+        nodes[task.node].bounds_max = bounds_max;
+
+        if (task.end - task.begin == 1) {
+            nodes[task.node].left_first = task.begin;
+            nodes[task.node].count      = 1;
+            continue;
+        }
+
+        glm::vec3 extent = bounds_max - bounds_min;
+        int axis         = extent.y > extent.x ? 1 : 0;
+        axis             = extent.z > extent[axis] ? 2 : axis;
+
+        unsigned int middle = (task.begin + task.end) / 2;
+        std::nth_element(light_indices.begin() + task.begin, light_indices.begin() + middle,
+                         light_indices.begin() + task.end,
+                         [&lights, axis](unsigned int a, unsigned int b) {
+                             return lights[a].position[axis] < lights[b].position[axis];
+                         });
+
+        unsigned int left           = static_cast<unsigned int>(nodes.size());
+        nodes[task.node].left_first = left;
+        nodes[task.node].count      = 0;
+        nodes.push_back(LightBVHNode());
+        nodes.push_back(LightBVHNode());
+        tasks.push_back({left, task.begin, middle});
+        tasks.push_back({left + 1, middle, task.end});
+    }
+
+    // Children always come after their parent, so going backwards sums them up before the parent
+    for (size_t i = nodes.size(); i-- > 0;) {
+        LightBVHNode& node = nodes[i];
+        if (node.count > 0) {
+            const SceneLight& light = lights[light_indices[node.left_first]];
+            float intensity         = luminance(light.colour);
+            node.ambient_power      = intensity * light.ambient;
+            node.direct_power       = intensity * (light.diffuse + light.specular);
+            node.constant           = light.constant;
+            node.linear             = light.linear;
+            node.quadratic          = light.quadratic;
+        } else {
+            const LightBVHNode& left  = nodes[node.left_first];
+            const LightBVHNode& right = nodes[node.left_first + 1];
+            node.ambient_power        = left.ambient_power + right.ambient_power;
+            node.direct_power         = left.direct_power + right.direct_power;
+            node.constant             = std::min(left.constant, right.constant);
+            node.linear               = std::min(left.linear, right.linear);
+            node.quadratic            = std::min(left.quadratic, right.quadratic);
+        }
+    }
+
+    build_time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                          start)
+                     .count();
+}
+
+LightSample LightSampler::sampleAliasTable(float u) const {
+    if (alias_table.empty()) {
+        return {0, 0.0f};
+    }
+
+    // The integer part of u * n picks an entry, the fraction decides between it and its alias
+    const unsigned int n = static_cast<unsigned int>(alias_table.size());
+    float scaled         = u * static_cast<float>(n);
+    unsigned int entry   = std::min(static_cast<unsigned int>(scaled), n - 1);
+    unsigned int light =
+        scaled - static_cast<float>(entry) < alias_table[entry].probability
+            ? entry
+            : alias_table[entry].alias;
+    return {light, light_pdfs[light]};
+}
+
+LightSample LightSampler::sampleLightBVH(const glm::vec3& position, const glm::vec3& normal,
+                                         float u) const {
+    if (nodes.empty()) {
+        return {0, 0.0f};
+    }
+
+    // Walk down picking a child with probability proportional to its importance, reusing what is
+    // left of u at every level
+    unsigned int index = 0;
+    float pdf          = 1.0f;
+    while (nodes[index].count == 0) {
+        unsigned int left      = nodes[index].left_first;
+        float left_importance  = importance(nodes[left], position, normal);
+        float right_importance = importance(nodes[left + 1], position, normal);
+        float total            = left_importance + right_importance;
+        if (total <= 0.0f) {
+            return {0, 0.0f};
+        }
+
+        float p_left  = left_importance / total;
+        bool go_left  = u < p_left;
+        float p_child = go_left ? p_left : 1.0f - p_left;
+        u             = std::min((go_left ? u : u - p_left) / p_child, one_minus_epsilon);
+        index         = go_left ? left : left + 1;
+
+        pdf *= p_child;
+    }
+
+    return {light_indices[nodes[index].left_first], pdf};
+}
+
+unsigned int LightSampler::numLights() const {
+    return static_cast<unsigned int>(light_indices.size());
+}
+
+float LightSampler::importance(const LightBVHNode& node, const glm::vec3& position,
+                               const glm::vec3& normal) const {
+    glm::vec3 centre = 0.5f * (node.bounds_min + node.bounds_max);
+    glm::vec3 half   = 0.5f * (node.bounds_max - node.bounds_min);
+
+    // Closest any light of the node can be
+    float dist = glm::length(glm::max(glm::abs(position - centre) - half, glm::vec3(0.0f)));
+    float attenuation =
+        1.0f / std::max(node.constant + node.linear * dist + node.quadratic * dist * dist, 1e-6f);
+
+    // Lights entirely below the surface only add their ambient term
+    bool in_front = glm::dot(normal, centre - position) + glm::dot(glm::abs(normal), half) > 0.0f;
+
+    return attenuation * (node.ambient_power + (in_front ? node.direct_power : 0.0f));
+}
@@ -1,11 +1,46 @@
 #include <app.hpp>
+#include <distributed_render.hpp>
 
-int main() {
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+int main(int argc, char* argv[]) {
+
+    // main --render-worker <address> [--threads N] renders jobs for another instance's
+    // distributed renders instead of opening the editor
+    if (argc >= 3 && std::strcmp(argv[1], "--render-worker") == 0) {
+        unsigned int num_threads = 0;
+        if (argc >= 5 && std::strcmp(argv[3], "--threads") == 0) {
+            num_threads = static_cast<unsigned int>(std::strtoul(argv[4], nullptr, 10));
+        } else if (argc != 3) {
+            std::cout << "Usage: " << argv[0] << " --render-worker <address> [--threads N]"
+                      << std::endl;
+            return 1;
+        }
+        return runRenderWorker(argv[2], num_threads);
+    }
+
+    // main --region x0 y0 x1 y1 starts with the offline render limited to that rectangle of its
+    // frame, in pixels with x1 and y1 exclusive
+    ImageRegion region;
+    if (argc >= 2 && std::strcmp(argv[1], "--region") == 0) {
+        if (argc != 6) {
+            std::cout << "Usage: " << argv[0] << " --region x0 y0 x1 y1" << std::endl;
+            return 1;
+        }
+        unsigned int corners[4];
+        for (int i = 0; i < 4; ++i) {
+            corners[i] = static_cast<unsigned int>(std::strtoul(argv[i + 2], nullptr, 10));
+        }
+        region = ImageRegion(corners[0], corners[1], corners[2], corners[3]);
+    }
 
     int window_width  = 1900;
     int window_height = 1080;
 
     App app(window_width, window_height);
+    app.setRayTracerRegion(region);
     app.run();
 
     return 0;
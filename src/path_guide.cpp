@@ -0,0 +1,269 @@
+#include <path_guide.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr float pi = 3.14159265f;
+
+// Largest float below 1, where u is clamped to after being rescaled
+constexpr float one_minus_epsilon = 0x1.fffffep-1f;
+
+// Record values are summed in steps of 1 / fixed_point_scale, up to max_record_value each
+constexpr float fixed_point_scale = 65536.0f;
+constexpr float max_record_value  = 1e9f;
+
+// Slots looked at before a lookup gives up
+constexpr unsigned int max_probes = 32;
+
+// Bits per grid coordinate in a cell key
+constexpr unsigned int coordinate_bits = 20;
+constexpr uint64_t max_coordinate      = (uint64_t(1) << coordinate_bits) - 1;
+
+uint64_t mixBits(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+unsigned int directionBin(const glm::vec3& direction) {
+    float z   = std::min(std::max(direction.z, -1.0f), 1.0f);
+    float phi = std::atan2(direction.y, direction.x);
+    if (phi < 0.0f) {
+        phi += 2.0f * pi;
+    }
+    unsigned int bin_z   = std::min(PathGuideCell::bins_z - 1,
+                                    static_cast<unsigned int>((z + 1.0f) * 0.5f *
+                                                              PathGuideCell::bins_z));
+    unsigned int bin_phi = std::min(PathGuideCell::bins_phi - 1,
+                                    static_cast<unsigned int>(phi / (2.0f * pi) *
+                                                              PathGuideCell::bins_phi));
+    return bin_z * PathGuideCell::bins_phi + bin_phi;
+}
+} // namespace
+
+PathGuideStats::PathGuideStats()
+    : cells(0)
+    , usable_cells(0)
+    , capacity(0)
+    , memory(0)
+    , memory_budget(0)
+    , records(0)
+    , dropped_records(0)
+    , training_passes(0)
+    , training_time(0.0f) {}
+
+PathGuide::PathGuide()
+    : training_passes(0)
+    , training_time(0.0f)
+    , grid_min(0.0f)
+    , inv_cell_size(0.0f)
+    , memory_budget(0)
+    , used_cells(0)
+    , usable_cells(0)
+    , records(0)
+    , dropped_records(0) {}
+
+void PathGuide::reset(const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+                      unsigned int resolution, size_t budget) {
+    // Largest power of two number of cells within the budget
+    size_t capacity = 0;
+    if (budget >= slot_size) {
+        capacity = 1;
+        while (capacity * 2 * slot_size <= budget) {
+            capacity *= 2;
+        }
+    }
+    if (cells.size() != capacity) {
+        record_keys  = std::vector<uint64_t>(capacity);
+        cell_records = std::vector<CellRecords>(capacity);
+        cell_keys    = std::vector<uint64_t>(capacity);
+        cells        = std::vector<PathGuideCell>(capacity);
+    } else {
+        std::fill(record_keys.begin(), record_keys.end(), 0);
+        std::fill(cell_records.begin(), cell_records.end(), CellRecords());
+        std::fill(cell_keys.begin(), cell_keys.end(), 0);
+        std::fill(cells.begin(), cells.end(), PathGuideCell());
+    }
+
+    glm::vec3 extent = bounds_max - bounds_min;
+    float longest    = std::max(extent.x, std::max(extent.y, extent.z));
+    grid_min         = bounds_min;
+    inv_cell_size    = longest > 0.0f ? std::max(resolution, 1u) / longest : 0.0f;
+
+    memory_budget   = budget;
+    used_cells      = 0;
+    usable_cells    = 0;
+    records         = 0;
+    dropped_records = 0;
+    training_passes = 0;
+    training_time   = 0.0f;
+}
+
+void PathGuide::addRecords(const std::vector<PathGuideRecord>& new_records) {
+    for (const PathGuideRecord& record : new_records) {
+        if (!std::isfinite(record.value) || record.value < 0.0f) {
+            continue;
+        }
+        uint64_t key = cellKey(record.position, record.normal);
+        int64_t slot = findSlot(record_keys, key);
+        if (slot < 0) {
+            dropped_records++;
+            continue;
+        }
+        if (record_keys[slot] == 0) {
+            record_keys[slot] = key;
+            used_cells++;
+        }
+        CellRecords& cell = cell_records[slot];
+        cell.weights[directionBin(record.direction)] +=
+            static_cast<uint64_t>(std::min(record.value, max_record_value) * fixed_point_scale +
+                                  0.5f);
+        cell.records++;
+        records++;
+    }
+}
+
+void PathGuide::buildDistributions() {
+    usable_cells = 0;
+    cell_keys    = record_keys;
+    for (size_t slot = 0; slot < cells.size(); ++slot) {
+        if (cell_keys[slot] == 0) {
+            continue;
+        }
+        const CellRecords& records_in_cell = cell_records[slot];
+        PathGuideCell& cell                = cells[slot];
+
+        uint64_t total = 0;
+        for (uint64_t weight : records_in_cell.weights) {
+            total += weight;
+        }
+        cell.usable = records_in_cell.records >= min_cell_records && total > 0;
+        if (!cell.usable) {
+            continue;
+        }
+
+        // Each bin shares some of its weight with its neighbours, few records per bin are noisy
+        auto weight = [&](unsigned int bin_z, unsigned int bin_phi) {
+            return static_cast<float>(
+                records_in_cell.weights[bin_z * PathGuideCell::bins_phi + bin_phi]);
+        };
+        float smoothed[PathGuideCell::bins];
+        for (unsigned int z = 0; z < PathGuideCell::bins_z; ++z) {
+            for (unsigned int phi = 0; phi < PathGuideCell::bins_phi; ++phi) {
+                unsigned int left  = (phi + PathGuideCell::bins_phi - 1) % PathGuideCell::bins_phi;
+                unsigned int right = (phi + 1) % PathGuideCell::bins_phi;
+                unsigned int below = z > 0 ? z - 1 : z;
+                unsigned int above = z + 1 < PathGuideCell::bins_z ? z + 1 : z;
+                smoothed[z * PathGuideCell::bins_phi + phi] =
+                    0.5f * weight(z, phi) + 0.125f * (weight(z, left) + weight(z, right) +
+                                                      weight(below, phi) + weight(above, phi));
+            }
+        }
+        float smoothed_total = 0.0f;
+        for (float weight : smoothed) {
+            smoothed_total += weight;
+        }
+
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < PathGuideCell::bins; ++i) {
+            sum += smoothed[i] / smoothed_total;
+            cell.cdf[i] = sum;
+        }
+        cell.cdf[PathGuideCell::bins - 1] = 1.0f;
+        usable_cells++;
+    }
+}
+
+const PathGuideCell* PathGuide::find(const glm::vec3& position, const glm::vec3& normal) const {
+    if (usable_cells == 0) {
+        return nullptr;
+    }
+    uint64_t key = cellKey(position, normal);
+    int64_t slot = findSlot(cell_keys, key);
+    if (slot < 0 || cell_keys[slot] != key || !cells[slot].usable) {
+        return nullptr;
+    }
+    return &cells[slot];
+}
+
+glm::vec3 PathGuide::sample(const PathGuideCell& cell, float u1, float u2) {
+    unsigned int bin = static_cast<unsigned int>(
+        std::upper_bound(cell.cdf, cell.cdf + PathGuideCell::bins - 1, u1) - cell.cdf);
+    float previous = bin > 0 ? cell.cdf[bin - 1] : 0.0f;
+    float u        = std::min((u1 - previous) / (cell.cdf[bin] - previous), one_minus_epsilon);
+
+    unsigned int bin_z   = bin / PathGuideCell::bins_phi;
+    unsigned int bin_phi = bin % PathGuideCell::bins_phi;
+    float z   = -1.0f + 2.0f * (static_cast<float>(bin_z) + u) / PathGuideCell::bins_z;
+    float phi = 2.0f * pi * (static_cast<float>(bin_phi) + u2) / PathGuideCell::bins_phi;
+    float r   = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+float PathGuide::pdf(const PathGuideCell& cell, const glm::vec3& direction) {
+    unsigned int bin = directionBin(direction);
+    float previous   = bin > 0 ? cell.cdf[bin - 1] : 0.0f;
+    // Every bin covers 4 pi / bins steradians
+    return (cell.cdf[bin] - previous) * PathGuideCell::bins / (4.0f * pi);
+}
+
+bool PathGuide::isTrained() const {
+    return usable_cells > 0;
+}
+
+PathGuideStats PathGuide::getStats() const {
+    PathGuideStats stats;
+    stats.cells           = used_cells;
+    stats.usable_cells    = usable_cells;
+    stats.capacity        = static_cast<unsigned int>(cells.size());
+    stats.memory          = cells.size() * slot_size;
+    stats.memory_budget   = memory_budget;
+    stats.records         = records;
+    stats.dropped_records = dropped_records;
+    stats.training_passes = training_passes;
+    stats.training_time   = training_time;
+    return stats;
+}
+
+uint64_t PathGuide::cellKey(const glm::vec3& position, const glm::vec3& normal) const {
+    glm::vec3 grid = (position - grid_min) * inv_cell_size;
+    uint64_t coordinates[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        float c = std::min(std::max(grid[axis], 0.0f), static_cast<float>(max_coordinate));
+        coordinates[axis] = static_cast<uint64_t>(c);
+    }
+
+    // Surfaces facing different ways through the same cube see different hemispheres
+    glm::vec3 magnitude = glm::abs(normal);
+    int axis            = 2;
+    if (magnitude.x >= magnitude.y && magnitude.x >= magnitude.z) {
+        axis = 0;
+    } else if (magnitude.y >= magnitude.z) {
+        axis = 1;
+    }
+    uint64_t side = static_cast<uint64_t>(axis) * 2 + (normal[axis] < 0.0f ? 1 : 0);
+
+    uint64_t key = (coordinates[0] << (2 * coordinate_bits)) | (coordinates[1] << coordinate_bits) |
+                   coordinates[2];
+    return ((key << 3) | side) + 1;
+}
+
+int64_t PathGuide::findSlot(const std::vector<uint64_t>& keys, uint64_t key) {
+    if (keys.empty()) {
+        return -1;
+    }
+    const uint64_t mask = keys.size() - 1;
+    uint64_t slot       = mixBits(key) & mask;
+    for (unsigned int probe = 0; probe < max_probes; ++probe) {
+        uint64_t key_in_slot = keys[slot];
+        if (key_in_slot == key || key_in_slot == 0) {
+            return static_cast<int64_t>(slot);
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
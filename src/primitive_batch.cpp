@@ -0,0 +1,48 @@
+#include <primitive_batch.hpp>
+
+PrimitiveBatches::PrimitiveBatches()
+    : shape({0.0f, 0.0f, 0.0f, 0.0f, 0.0f}) {}
+
+void PrimitiveBatches::build(const std::vector<unsigned int>& order,
+                             const std::vector<PrimitiveType>& types,
+                             const std::vector<glm::mat4>& world_to_object) {
+    const size_t n = order.size();
+
+    // Slots past the end hold zero matrices, a full register loaded from the last batch reads
+    // them instead of running off the array
+    for (std::vector<float>& row : this->world_to_object) {
+        row.assign(n + padding, 0.0f);
+    }
+    this->types.resize(n);
+
+    for (size_t slot = 0; slot < n; ++slot) {
+        unsigned int primitive = order[slot];
+        this->types[slot]      = types[primitive];
+        setTransform(static_cast<unsigned int>(slot), world_to_object[primitive]);
+    }
+}
+
+void PrimitiveBatches::setTransform(unsigned int slot, const glm::mat4& world_to_object) {
+    // glm matrices are column major, m[col][row]
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            this->world_to_object[row * 4 + col][slot] = world_to_object[col][row];
+        }
+    }
+}
+
+PrimitiveBatchKernel selectPrimitiveBatchKernel(CPU::SIMDLevel level, unsigned int& width) {
+#if CPU_X86
+    if (level >= CPU::SIMDLevel::AVX2) {
+        width = 8;
+        return intersectPrimitiveBatchAVX2;
+    }
+    if (level >= CPU::SIMDLevel::SSE42) {
+        width = 4;
+        return intersectPrimitiveBatchSSE42;
+    }
+#endif
+    (void)level;
+    width = 1;
+    return nullptr;
+}
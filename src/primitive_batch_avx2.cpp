@@ -0,0 +1,32 @@
+#include <primitive_batch.hpp>
+
+#if CPU_X86
+
+#include <immintrin.h>
+#include <limits>
+
+// Everything below is compiled for AVX2, only called once the CPU is known to support it
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+#include <simd_float_avx2.hpp>
+
+#include <primitive_batch_kernels.hpp>
+
+void intersectPrimitiveBatchAVX2(const PrimitiveBatches& batches, unsigned int first,
+                                  unsigned int count, PrimitiveType type, const Ray& ray,
+                                  float t_min, float t_max, float* t_hit) {
+    intersectPrimitiveBatch<FloatAVX>(batches, first, count, type, ray, t_min, t_max, t_hit);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
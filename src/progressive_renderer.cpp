@@ -0,0 +1,589 @@
+#include <progressive_renderer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <tile_scheduler.hpp>
+
+namespace {
+// Side of the blocks of output pixels upsampled by each thread
+constexpr unsigned int upsample_tile_size = 64;
+
+// Distance from the plane of the surface an output pixel lies on, in pixel footprints at its
+// depth, past which a low resolution pixel no longer counts as the same surface. Camera rays are
+// jittered within their pixel, so anything closer than a footprint or so cannot be told apart
+constexpr float upsample_plane_tolerance = 2.0f;
+
+// Bilinear interpolation of colour up to out's size, with every low resolution pixel weighed down
+// by how far its first hit lies from the plane of the one the output pixel lies in, and by how
+// much their normals differ, a joint bilateral upsampling guided by the low resolution features
+// alone. Surfaces are interpolated smoothly while their silhouettes stay sharp. frame is the
+// camera's at the low resolution. Without features it is plain bilinear
+void upsampleEdgeAware(const Image& colour, const FeatureBuffers& features,
+                       const CameraFrame& frame, unsigned int num_threads, Image& out) {
+    const unsigned int width  = colour.width;
+    const unsigned int height = colour.height;
+    const size_t num_pixels   = colour.pixels.size();
+    const bool guided         = features.depth.size() == num_pixels &&
+                        features.normal.pixels.size() == num_pixels;
+
+    // Output pixels sample the 2x2 low resolution pixels around them and lie in one of those, so
+    // the weights between every low resolution pixel and its 3x3 neighbours are all that is needed
+    std::vector<float> similarity(num_pixels * 9, 1.0f);
+    if (guided) {
+        // First hits through the pixel centres, with their unit normals
+        std::vector<glm::vec3> positions(num_pixels);
+        std::vector<glm::vec3> normals(num_pixels);
+        for (unsigned int y = 0; y < height; ++y) {
+            for (unsigned int x = 0; x < width; ++x) {
+                size_t i     = static_cast<size_t>(y) * width + x;
+                positions[i] = frame.generateRay(x + 0.5f, y + 0.5f).at(features.depth[i]);
+                float length = glm::length(features.normal.pixels[i]);
+                normals[i]   = length > 0.0f ? features.normal.pixels[i] / length : glm::vec3(0.0f);
+            }
+        }
+        // Size of a pixel at a distance of 1
+        const float footprint = 2.0f * glm::length(frame.vertical) * frame.inv_height;
+
+        for (unsigned int y = 0; y < height; ++y) {
+            for (unsigned int x = 0; x < width; ++x) {
+                size_t centre      = static_cast<size_t>(y) * width + x;
+                float centre_depth = features.depth[centre];
+                for (int k = 0; k < 9; ++k) {
+                    int tap_x = static_cast<int>(x) + k % 3 - 1;
+                    int tap_y = static_cast<int>(y) + k / 3 - 1;
+                    if (tap_x < 0 || tap_y < 0 || tap_x >= static_cast<int>(width) ||
+                        tap_y >= static_cast<int>(height)) {
+                        continue;
+                    }
+                    size_t tap    = static_cast<size_t>(tap_y) * width + tap_x;
+                    float depth   = features.depth[tap];
+                    float& weight = similarity[centre * 9 + k];
+                    if (depth <= 0.0f || centre_depth <= 0.0f) {
+                        // Rays that escaped only blend with each other
+                        weight = depth <= 0.0f && centre_depth <= 0.0f ? 1.0f : 0.0f;
+                        continue;
+                    }
+                    glm::vec3 offset = positions[tap] - positions[centre];
+                    float distance   = std::abs(glm::dot(normals[centre], offset));
+                    float tolerance  = upsample_plane_tolerance * footprint * centre_depth;
+                    float cosine     = std::max(0.0f, glm::dot(normals[tap], normals[centre]));
+                    cosine *= cosine;
+                    weight = std::max(0.0f, 1.0f - distance / tolerance) * cosine * cosine;
+                }
+            }
+        }
+    }
+
+    // Low resolution pixels to the left of and holding every output column, and how far between
+    // the left one and the next the column lies. Same for the rows
+    struct Taps {
+        unsigned int first;
+        unsigned int centre;
+        float fraction;
+    };
+    auto taps = [](unsigned int size, unsigned int out_size) {
+        std::vector<Taps> result(out_size);
+        const float scale = static_cast<float>(size) / static_cast<float>(out_size);
+        for (unsigned int i = 0; i < out_size; ++i) {
+            float source  = std::max((static_cast<float>(i) + 0.5f) * scale - 0.5f, 0.0f);
+            float first   = std::min(std::floor(source), static_cast<float>(size - 1));
+            result[i]     = {static_cast<unsigned int>(first),
+                             std::min(static_cast<unsigned int>((i + 0.5f) * scale), size - 1),
+                             std::min(source - first, 1.0f)};
+        }
+        return result;
+    };
+    const std::vector<Taps> columns = taps(width, out.width);
+    const std::vector<Taps> rows    = taps(height, out.height);
+
+    TileScheduler scheduler(out.width, out.height, upsample_tile_size, num_threads);
+    scheduler.run([&](const Tile& tile, unsigned int) {
+        for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+            const Taps& row       = rows[y];
+            const unsigned int y0 = row.first;
+            const unsigned int y1 = std::min(y0 + 1, height - 1);
+            for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+                const Taps& column    = columns[x];
+                const unsigned int x0 = column.first;
+                const unsigned int x1 = std::min(x0 + 1, width - 1);
+                size_t centre         = static_cast<size_t>(row.centre) * width + column.centre;
+                const float* weights  = &similarity[centre * 9];
+
+                glm::vec3 sum(0.0f);
+                float total = 0.0f;
+                auto add    = [&](unsigned int tap_x, unsigned int tap_y, float bilinear) {
+                    int k = (static_cast<int>(tap_y) - static_cast<int>(row.centre) + 1) * 3 +
+                            static_cast<int>(tap_x) - static_cast<int>(column.centre) + 1;
+                    float weight = bilinear * weights[k];
+                    sum += weight * colour.pixels[static_cast<size_t>(tap_y) * width + tap_x];
+                    total += weight;
+                };
+                add(x0, y0, (1.0f - column.fraction) * (1.0f - row.fraction));
+                add(x1, y0, column.fraction * (1.0f - row.fraction));
+                add(x0, y1, (1.0f - column.fraction) * row.fraction);
+                add(x1, y1, column.fraction * row.fraction);
+                out.at(x, y) = total > 1e-4f ? sum / total : colour.pixels[centre];
+            }
+        }
+    });
+}
+} // namespace
+
+ProgressiveRenderer::ProgressiveRenderer()
+    : running(false)
+    , quit(false)
+    , cancel_pass(false)
+    , generation(0)
+    , max_passes(1024)
+    , output_width(0)
+    , output_height(0)
+    , pass_scale(1)
+    , preview(false)
+    , preview_scale(4)
+    , target_frame_time(1.0f / 30.0f)
+    , latest_ready(false)
+    , num_passes(0)
+    , last_pass_time(0.0f)
+    , latest_scale(1)
+    , snapshot(0)
+    , rebuild_snapshot(0)
+    , rebuild_threshold(1.5f)
+    , num_rebuilds(0) {}
+
+ProgressiveRenderer::~ProgressiveRenderer() {
+    stop();
+}
+
+void ProgressiveRenderer::update(const std::vector<std::shared_ptr<GameObject>>& objects,
+                                 const Camera& camera, const RayTracerSettings& settings,
+                                 SceneAccelerator accelerator, CPU::SIMDLevel simd_level,
+                                 const BVHBuildSettings& build_settings) {
+    std::vector<float> state = viewState(camera, settings);
+    std::vector<size_t> offsets;
+    std::vector<float> scene_state =
+        sceneState(objects, accelerator, simd_level, build_settings, offsets);
+    std::vector<const GameObject*> object_pointers;
+    object_pointers.reserve(objects.size());
+    for (const std::shared_ptr<GameObject>& object : objects) {
+        object_pointers.push_back(object.get());
+    }
+
+    // The view counts as moving until it has been still for a couple of frames, mouse events do
+    // not come in every frame
+    auto now = std::chrono::steady_clock::now();
+    if (state != previous_state) {
+        previous_state   = state;
+        last_view_change = now;
+    }
+    float frame_time;
+    unsigned int scale;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        frame_time = target_frame_time;
+        scale      = preview_scale;
+    }
+    bool moving = frame_time > 0.0f &&
+                  std::chrono::duration<float>(now - last_view_change).count() < 2.0f * frame_time;
+
+    // A preview of a view that stopped moving restarts at full resolution
+    bool restart = !running || state != traced_state || (preview && !moving);
+    std::shared_ptr<RayTracerScene> next_scene;
+
+    if (!running || scene_state != traced_scene_state || object_pointers != traced_objects) {
+        restart = true;
+
+        // Only the objects that changed are taken again, into a copy since the background thread
+        // may still be tracing the scene. When objects were added, removed, hidden or shown the
+        // scene is made from scratch
+        std::vector<unsigned int> changed;
+        if (scene && object_pointers == traced_objects &&
+            changedObjects(traced_scene_state, traced_offsets, scene_state, offsets, changed)) {
+            next_scene = std::make_shared<RayTracerScene>(*scene);
+            if (!next_scene->refitObjects(objects, changed)) {
+                next_scene.reset();
+            }
+        }
+
+        // Snapshot here, the GameObjects must not be read from the background thread
+        if (!next_scene) {
+            next_scene              = std::make_shared<RayTracerScene>(objects, build_settings);
+            next_scene->accelerator = accelerator;
+            next_scene->setSIMDLevel(simd_level);
+            snapshot++;
+        }
+
+        traced_scene_state = std::move(scene_state);
+        traced_offsets     = std::move(offsets);
+        traced_objects     = std::move(object_pointers);
+    }
+
+    if (rebuild.valid() && rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        std::shared_ptr<RayTracerScene> rebuilt = rebuild.get();
+        num_rebuilds++;
+
+        // Objects moved while it was being built are refit into it too. It is thrown away if the
+        // scene was made from scratch in the meantime
+        std::vector<unsigned int> changed;
+        if (rebuild_snapshot == snapshot &&
+            changedObjects(rebuild_state, traced_offsets, traced_scene_state, traced_offsets,
+                           changed) &&
+            rebuilt->refitObjects(objects, changed)) {
+            next_scene = std::move(rebuilt);
+        }
+    }
+
+    const RayTracerScene* traced = next_scene ? next_scene.get() : scene.get();
+    if (!rebuild.valid() && rebuild_threshold > 0.0f && traced &&
+        traced->bvh.getSAHCostGrowth() > rebuild_threshold) {
+        rebuild_state    = traced_scene_state;
+        rebuild_snapshot = snapshot;
+        rebuild          = std::async(
+            std::launch::async,
+            [](std::shared_ptr<RayTracerScene> copy) {
+                copy->buildAccelerationStructures();
+                return copy;
+            },
+            std::make_shared<RayTracerScene>(*traced));
+    }
+
+    if (next_scene || restart) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (next_scene) {
+            // A rebuild alone traces the same picture, accumulation carries on
+            this->scene = std::move(next_scene);
+        }
+        if (restart) {
+            traced_state   = std::move(state);
+            this->camera   = camera;
+            this->settings = settings;
+            // Every pass adds one sample per pixel, too few for a variance estimate
+            this->settings.samples_per_pixel = 1;
+            this->settings.adaptive_sampling = false;
+            output_width                     = settings.width;
+            output_height                    = settings.height;
+            pass_scale                       = 1;
+            if (moving) {
+                // Guiding would be trained again every frame, the upsampling needs the features
+                unsigned int half              = scale / 2;
+                pass_scale                     = scale;
+                this->settings.width           = std::max(1u, (settings.width + half) / scale);
+                this->settings.height          = std::max(1u, (settings.height + half) / scale);
+                this->settings.path_guiding    = false;
+                this->settings.feature_buffers = true;
+            }
+            // A preview in flight is let finish and shown while the next one is traced, the view
+            // would never catch up if every pass was abandoned. The cancel is only ever set here,
+            // the pass in flight may still be one an earlier update() abandoned
+            bool keep_preview = preview && moving;
+            generation++;
+            num_passes   = 0;
+            latest_ready = latest_ready && keep_preview;
+            if (!keep_preview) {
+                cancel_pass = true;
+            }
+            preview = moving;
+        }
+    }
+
+    if (!running) {
+        quit    = false;
+        running = true;
+        thread  = std::thread(&ProgressiveRenderer::workerLoop, this);
+    }
+    condition.notify_one();
+}
+
+void ProgressiveRenderer::stop() {
+    if (!running) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit        = true;
+        cancel_pass = true;
+    }
+    condition.notify_one();
+    thread.join();
+    running = false;
+
+    // The next update() takes a fresh snapshot whatever changed in between
+    traced_state.clear();
+    traced_scene_state.clear();
+    traced_offsets.clear();
+    traced_objects.clear();
+}
+
+bool ProgressiveRenderer::isRunning() const {
+    return running;
+}
+
+bool ProgressiveRenderer::takeLatestImage(Image& image) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!latest_ready) {
+        return false;
+    }
+    // Swapping hands the old buffer back to the background thread to be reused
+    std::swap(image, latest_image);
+    latest_ready = false;
+    return true;
+}
+
+void ProgressiveRenderer::setMaxPasses(unsigned int max_passes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->max_passes = max_passes;
+    }
+    condition.notify_one();
+}
+
+unsigned int ProgressiveRenderer::getMaxPasses() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return max_passes;
+}
+
+unsigned int ProgressiveRenderer::getNumPasses() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_passes;
+}
+
+float ProgressiveRenderer::getLastPassTime() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return last_pass_time;
+}
+
+void ProgressiveRenderer::setTargetFrameTime(float seconds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    target_frame_time = std::max(seconds, 0.0f);
+}
+
+float ProgressiveRenderer::getTargetFrameTime() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return target_frame_time;
+}
+
+unsigned int ProgressiveRenderer::getPreviewScale() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return latest_scale;
+}
+
+void ProgressiveRenderer::setRebuildThreshold(float threshold) {
+    rebuild_threshold = threshold;
+}
+
+float ProgressiveRenderer::getRebuildThreshold() const {
+    return rebuild_threshold;
+}
+
+float ProgressiveRenderer::getSAHCostGrowth() const {
+    return scene ? scene->bvh.getSAHCostGrowth() : 1.0f;
+}
+
+unsigned int ProgressiveRenderer::getNumRefits() const {
+    return scene ? scene->bvh.getNumRefits() : 0;
+}
+
+unsigned int ProgressiveRenderer::getNumRebuilds() const {
+    return num_rebuilds;
+}
+
+bool ProgressiveRenderer::isRebuilding() const {
+    return rebuild.valid();
+}
+
+void ProgressiveRenderer::workerLoop() {
+    unsigned int traced_generation = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [this] {
+            return quit || (scene && (max_passes == 0 || num_passes < max_passes));
+        });
+        if (quit) {
+            return;
+        }
+
+        // Take a copy of the work so the main thread can restart while the pass is traced
+        std::shared_ptr<const RayTracerScene> pass_scene = scene;
+        Camera pass_camera                               = camera;
+        raytracer.settings                               = settings;
+        unsigned int pass                                = num_passes;
+        unsigned int pass_generation                     = generation;
+        bool pass_preview                                = preview;
+        unsigned int scale                               = pass_scale;
+        unsigned int width                               = output_width;
+        unsigned int height                              = output_height;
+        cancel_pass                                      = false;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+
+        const size_t num_pixels = static_cast<size_t>(raytracer.settings.width) *
+                                  raytracer.settings.height;
+        if (pass_generation != traced_generation || accumulation.size() != num_pixels) {
+            traced_generation = pass_generation;
+            accumulation.assign(num_pixels, glm::vec3(0.0f));
+        }
+
+        Image image = raytracer.render(*pass_scene, pass_camera, pass, &cancel_pass);
+
+        if (cancel_pass) {
+            // Restarted or stopped part way through, the image is incomplete
+            lock.lock();
+            continue;
+        }
+
+        if (average.width != image.width || average.height != image.height) {
+            average = Image(image.width, image.height);
+        }
+        float inv_passes = 1.0f / static_cast<float>(pass + 1);
+        for (size_t i = 0; i < num_pixels; ++i) {
+            accumulation[i] += image.pixels[i];
+            average.pixels[i] = accumulation[i] * inv_passes;
+        }
+
+        Image* result = &average;
+        if (scale > 1) {
+            if (upsampled.width != width || upsampled.height != height) {
+                upsampled = Image(width, height);
+            }
+            upsampleEdgeAware(average, raytracer.last_features,
+                              CameraFrame(pass_camera, image.width, image.height),
+                              raytracer.last_num_threads, upsampled);
+            result = &upsampled;
+        }
+        float pass_time =
+            std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        if (pass_preview && target_frame_time > 0.0f) {
+            // Every step divides the number of pixels by 4
+            if (pass_time > target_frame_time && preview_scale < max_preview_scale) {
+                preview_scale *= 2;
+            } else if (pass_time * 4.0f < 0.75f * target_frame_time && preview_scale > 1) {
+                preview_scale /= 2;
+            }
+        }
+        if (pass_generation != generation) {
+            // A preview of where the view was a frame ago still beats the last image shown
+            if (pass_preview && preview) {
+                std::swap(latest_image, *result);
+                latest_ready   = true;
+                last_pass_time = pass_time;
+                latest_scale   = scale;
+            }
+            continue;
+        }
+        std::swap(latest_image, *result);
+        latest_ready   = true;
+        num_passes     = pass + 1;
+        last_pass_time = pass_time;
+        latest_scale   = scale;
+    }
+}
+
+std::vector<float> ProgressiveRenderer::viewState(const Camera& camera,
+                                                  const RayTracerSettings& settings) const {
+    std::vector<float> state;
+    state.reserve(32);
+
+    auto push = [&state](const glm::vec3& v) {
+        state.push_back(v.x);
+        state.push_back(v.y);
+        state.push_back(v.z);
+    };
+
+    push(camera.pos);
+    push(camera.front);
+    push(camera.up);
+    state.push_back(camera.fov);
+
+    state.push_back(static_cast<float>(settings.width));
+    state.push_back(static_cast<float>(settings.height));
+    state.push_back(static_cast<float>(settings.max_depth));
+    state.push_back(static_cast<float>(settings.num_threads));
+    state.push_back(static_cast<float>(settings.tile_size));
+    state.push_back(settings.packet_primary_rays ? 1.0f : 0.0f);
+    state.push_back(settings.packet_shadow_rays ? 1.0f : 0.0f);
+    state.push_back(settings.wavefront ? 1.0f : 0.0f);
+    state.push_back(static_cast<float>(settings.light_sampling));
+    state.push_back(static_cast<float>(settings.light_samples));
+    state.push_back(settings.path_guiding ? 1.0f : 0.0f);
+    state.push_back(static_cast<float>(settings.guiding_training_passes));
+    state.push_back(settings.guiding_fraction);
+    state.push_back(static_cast<float>(settings.guiding_resolution));
+    state.push_back(static_cast<float>(settings.guiding_memory));
+    state.push_back(static_cast<float>(settings.sampler));
+    // In halves, floats only hold 24 bit integers exactly
+    state.push_back(static_cast<float>(settings.sampler_seed & 0xffffu));
+    state.push_back(static_cast<float>(settings.sampler_seed >> 16));
+    push(settings.background);
+    return state;
+}
+
+std::vector<float> ProgressiveRenderer::sceneState(
+    const std::vector<std::shared_ptr<GameObject>>& objects, SceneAccelerator accelerator,
+    CPU::SIMDLevel simd_level, const BVHBuildSettings& build_settings,
+    std::vector<size_t>& object_offsets) const {
+    std::vector<float> state;
+    state.reserve(5 + objects.size() * 22);
+    object_offsets.clear();
+    object_offsets.reserve(objects.size() + 1);
+
+    auto push = [&state](const glm::vec3& v) {
+        state.push_back(v.x);
+        state.push_back(v.y);
+        state.push_back(v.z);
+    };
+
+    state.push_back(static_cast<float>(accelerator));
+    state.push_back(static_cast<float>(simd_level));
+    state.push_back(static_cast<float>(build_settings.builder));
+    state.push_back(static_cast<float>(build_settings.num_threads));
+    state.push_back(build_settings.optimize_treelets ? 1.0f : 0.0f);
+
+    for (const std::shared_ptr<GameObject>& object : objects) {
+        object_offsets.push_back(state.size());
+        state.push_back(object->visible ? 1.0f : 0.0f);
+        push(object->pos);
+        push(object->orientation);
+        push(object->scale);
+        push(object->colour);
+        state.push_back(object->shininess);
+        if (object->light) {
+            state.push_back(object->light->ambient);
+            state.push_back(object->light->diffuse);
+            state.push_back(object->light->specular);
+            state.push_back(object->light->constant);
+            state.push_back(object->light->linear);
+            state.push_back(object->light->quadratic);
+        } else {
+            state.push_back(-1.0f);
+        }
+    }
+    object_offsets.push_back(state.size());
+    return state;
+}
+
+bool ProgressiveRenderer::changedObjects(const std::vector<float>& before,
+                                         const std::vector<size_t>& before_offsets,
+                                         const std::vector<float>& after,
+                                         const std::vector<size_t>& after_offsets,
+                                         std::vector<unsigned int>& changed) const {
+    changed.clear();
+    if (before_offsets != after_offsets || before.empty() || after.empty()) {
+        return false;
+    }
+    // Accelerator, SIMD level and BVH build settings come first
+    if (!std::equal(before.begin(), before.begin() + before_offsets[0], after.begin())) {
+        return false;
+    }
+    for (size_t i = 0; i + 1 < after_offsets.size(); ++i) {
+        if (!std::equal(before.begin() + after_offsets[i], before.begin() + after_offsets[i + 1],
+                        after.begin() + after_offsets[i])) {
+            changed.push_back(static_cast<unsigned int>(i));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,293 @@
+#include <quantized_bvh.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+constexpr int min_exponent = -126;
+constexpr int max_exponent = 127;
+
+// 2^exponent, built straight from the float's bits
+float exponentScale(int exponent) {
+    uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+// Quantizes the wide node's child boxes outwards onto a grid fitted to their union. Returns false
+// if a leaf child holds more primitives than the quantized node can count
+template <unsigned int N>
+bool quantizeNode(const WideBVHNode<N>& wide, QuantizedBVHNode<N>& node) {
+    node.num_children = static_cast<uint8_t>(wide.num_children);
+
+    for (int axis = 0; axis < 3; ++axis) {
+        float lowest  = std::numeric_limits<float>::max();
+        float highest = -std::numeric_limits<float>::max();
+        for (unsigned int lane = 0; lane < wide.num_children; ++lane) {
+            lowest  = std::min(lowest, wide.bounds_min[axis][lane]);
+            highest = std::max(highest, wide.bounds_max[axis][lane]);
+        }
+        if (wide.num_children == 0) {
+            lowest  = 0.0f;
+            highest = 0.0f;
+        }
+
+        // Smallest power of two step that gets from the lowest to the highest plane in 255 steps
+        int exponent = min_exponent;
+        if (highest > lowest) {
+            std::frexp((highest - lowest) / 255.0f, &exponent);
+            exponent = std::min(std::max(exponent, min_exponent), max_exponent);
+            while (exponent < max_exponent &&
+                   lowest + 255.0f * exponentScale(exponent) < highest) {
+                exponent++;
+            }
+        }
+        float scale = exponentScale(exponent);
+
+        node.origin[axis]   = lowest;
+        node.exponent[axis] = static_cast<int8_t>(exponent);
+
+        for (unsigned int lane = 0; lane < N; ++lane) {
+            if (lane >= wide.num_children) {
+                // Unused lanes are masked out by every kernel
+                node.bounds_min[axis][lane] = 0;
+                node.bounds_max[axis][lane] = 0;
+                continue;
+            }
+
+            // Rounding outwards, then stepping further out wherever the float maths fell short
+            float lower = std::floor((wide.bounds_min[axis][lane] - lowest) / scale);
+            float upper = std::ceil((wide.bounds_max[axis][lane] - lowest) / scale);
+            lower       = std::min(std::max(lower, 0.0f), 255.0f);
+            upper       = std::min(std::max(upper, 0.0f), 255.0f);
+            while (lower > 0.0f && lowest + lower * scale > wide.bounds_min[axis][lane]) {
+                lower -= 1.0f;
+            }
+            while (upper < 255.0f && lowest + upper * scale < wide.bounds_max[axis][lane]) {
+                upper += 1.0f;
+            }
+            node.bounds_min[axis][lane] = static_cast<uint8_t>(lower);
+            node.bounds_max[axis][lane] = static_cast<uint8_t>(upper);
+        }
+    }
+
+    for (unsigned int lane = 0; lane < N; ++lane) {
+        if (wide.count[lane] > std::numeric_limits<uint16_t>::max()) {
+            return false;
+        }
+        node.child[lane] = wide.child[lane];
+        node.count[lane] = static_cast<uint16_t>(wide.count[lane]);
+    }
+    return true;
+}
+
+template <unsigned int N>
+unsigned int laneMask(const QuantizedBVHNode<N>& node) {
+    return (1u << node.num_children) - 1u;
+}
+
+// Every kernel works out a plane as (quantized * scale + (origin - ray origin)) * inv_direction,
+// the same sequence of operations whatever the width
+template <unsigned int N>
+unsigned int testChildrenScalar(const QuantizedBVHNode<N>& node, const WideRay& ray, float t_min,
+                                float t_max, float* t_entry) {
+    float scale[3];
+    float offset[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        scale[axis]  = exponentScale(node.exponent[axis]);
+        offset[axis] = node.origin[axis] - ray.origin[axis];
+    }
+
+    unsigned int mask = 0;
+    for (unsigned int lane = 0; lane < node.num_children; ++lane) {
+        float t_near = t_min;
+        float t_far  = t_max;
+        for (int axis = 0; axis < 3; ++axis) {
+            float lower = static_cast<float>(node.bounds_min[axis][lane]);
+            float upper = static_cast<float>(node.bounds_max[axis][lane]);
+            float t0    = (lower * scale[axis] + offset[axis]) * ray.inv_direction[axis];
+            float t1    = (upper * scale[axis] + offset[axis]) * ray.inv_direction[axis];
+            t_near      = std::max(t_near, std::min(t0, t1));
+            t_far       = std::min(t_far, std::max(t0, t1));
+        }
+        t_entry[lane] = t_near;
+        if (t_near <= t_far) {
+            mask |= 1u << lane;
+        }
+    }
+    return mask;
+}
+
+#if CPU_X86
+// Widens 4 quantized planes to floats and turns them into ray distances
+TARGET_SSE42 inline __m128 planeDistancesSSE42(const uint8_t* planes, __m128 scale, __m128 offset,
+                                               __m128 inv_direction) {
+    int packed;
+    std::memcpy(&packed, planes, sizeof(packed));
+    __m128 quantized = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+    return _mm_mul_ps(_mm_add_ps(_mm_mul_ps(quantized, scale), offset), inv_direction);
+}
+
+// 4 boxes per instruction, 8 wide nodes are tested in two halves
+template <unsigned int N>
+TARGET_SSE42 unsigned int testChildrenSSE42(const QuantizedBVHNode<N>& node, const WideRay& ray,
+                                            float t_min, float t_max, float* t_entry) {
+    __m128 scale_x  = _mm_set1_ps(exponentScale(node.exponent[0]));
+    __m128 scale_y  = _mm_set1_ps(exponentScale(node.exponent[1]));
+    __m128 scale_z  = _mm_set1_ps(exponentScale(node.exponent[2]));
+    __m128 offset_x = _mm_set1_ps(node.origin[0] - ray.origin[0]);
+    __m128 offset_y = _mm_set1_ps(node.origin[1] - ray.origin[1]);
+    __m128 offset_z = _mm_set1_ps(node.origin[2] - ray.origin[2]);
+    __m128 inv_x    = _mm_set1_ps(ray.inv_direction[0]);
+    __m128 inv_y    = _mm_set1_ps(ray.inv_direction[1]);
+    __m128 inv_z    = _mm_set1_ps(ray.inv_direction[2]);
+    __m128 lower    = _mm_set1_ps(t_min);
+    __m128 upper    = _mm_set1_ps(t_max);
+
+    unsigned int mask = 0;
+    for (unsigned int base = 0; base < N; base += 4) {
+        __m128 tx0 = planeDistancesSSE42(&node.bounds_min[0][base], scale_x, offset_x, inv_x);
+        __m128 tx1 = planeDistancesSSE42(&node.bounds_max[0][base], scale_x, offset_x, inv_x);
+        __m128 ty0 = planeDistancesSSE42(&node.bounds_min[1][base], scale_y, offset_y, inv_y);
+        __m128 ty1 = planeDistancesSSE42(&node.bounds_max[1][base], scale_y, offset_y, inv_y);
+        __m128 tz0 = planeDistancesSSE42(&node.bounds_min[2][base], scale_z, offset_z, inv_z);
+        __m128 tz1 = planeDistancesSSE42(&node.bounds_max[2][base], scale_z, offset_z, inv_z);
+
+        __m128 t_near = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+                                   _mm_max_ps(_mm_min_ps(tz0, tz1), lower));
+        __m128 t_far  = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+                                   _mm_min_ps(_mm_max_ps(tz0, tz1), upper));
+
+        _mm_store_ps(t_entry + base, t_near);
+        mask |= static_cast<unsigned int>(_mm_movemask_ps(_mm_cmple_ps(t_near, t_far))) << base;
+    }
+    return mask & laneMask(node);
+}
+
+// Widens 8 quantized planes to floats and turns them into ray distances
+TARGET_AVX2 inline __m256 planeDistancesAVX2(const uint8_t* planes, __m256 scale, __m256 offset,
+                                             __m256 inv_direction) {
+    __m128i packed   = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(planes));
+    __m256 quantized = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(packed));
+    return _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(quantized, scale), offset), inv_direction);
+}
+
+TARGET_AVX2 unsigned int testChildrenAVX2(const QuantizedBVHNode<8>& node, const WideRay& ray,
+                                          float t_min, float t_max, float* t_entry) {
+    __m256 scale_x  = _mm256_set1_ps(exponentScale(node.exponent[0]));
+    __m256 scale_y  = _mm256_set1_ps(exponentScale(node.exponent[1]));
+    __m256 scale_z  = _mm256_set1_ps(exponentScale(node.exponent[2]));
+    __m256 offset_x = _mm256_set1_ps(node.origin[0] - ray.origin[0]);
+    __m256 offset_y = _mm256_set1_ps(node.origin[1] - ray.origin[1]);
+    __m256 offset_z = _mm256_set1_ps(node.origin[2] - ray.origin[2]);
+    __m256 inv_x    = _mm256_set1_ps(ray.inv_direction[0]);
+    __m256 inv_y    = _mm256_set1_ps(ray.inv_direction[1]);
+    __m256 inv_z    = _mm256_set1_ps(ray.inv_direction[2]);
+
+    __m256 tx0 = planeDistancesAVX2(node.bounds_min[0], scale_x, offset_x, inv_x);
+    __m256 tx1 = planeDistancesAVX2(node.bounds_max[0], scale_x, offset_x, inv_x);
+    __m256 ty0 = planeDistancesAVX2(node.bounds_min[1], scale_y, offset_y, inv_y);
+    __m256 ty1 = planeDistancesAVX2(node.bounds_max[1], scale_y, offset_y, inv_y);
+    __m256 tz0 = planeDistancesAVX2(node.bounds_min[2], scale_z, offset_z, inv_z);
+    __m256 tz1 = planeDistancesAVX2(node.bounds_max[2], scale_z, offset_z, inv_z);
+
+    __m256 t_near =
+        _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+                      _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_set1_ps(t_min)));
+    __m256 t_far =
+        _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)),
+                      _mm256_min_ps(_mm256_max_ps(tz0, tz1), _mm256_set1_ps(t_max)));
+
+    _mm256_store_ps(t_entry, t_near);
+    unsigned int mask = static_cast<unsigned int>(
+        _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ)));
+    return mask & laneMask(node);
+}
+#endif
+
+template <unsigned int N>
+QuantizedNodeKernel<N> selectKernel(CPU::SIMDLevel level);
+
+template <>
+QuantizedNodeKernel<4> selectKernel<4>(CPU::SIMDLevel level) {
+#if CPU_X86
+    if (level >= CPU::SIMDLevel::SSE42) {
+        return testChildrenSSE42<4>;
+    }
+#endif
+    (void)level;
+    return testChildrenScalar<4>;
+}
+
+template <>
+QuantizedNodeKernel<8> selectKernel<8>(CPU::SIMDLevel level) {
+#if CPU_X86
+    if (level >= CPU::SIMDLevel::AVX2) {
+        return testChildrenAVX2;
+    }
+    if (level >= CPU::SIMDLevel::SSE42) {
+        return testChildrenSSE42<8>;
+    }
+#endif
+    (void)level;
+    return testChildrenScalar<8>;
+}
+} // namespace
+
+template <unsigned int N>
+QuantizedBVH<N>::QuantizedBVH()
+    : build_time(0.0f) {
+    setSIMDLevel(CPU::detectSIMDLevel());
+}
+
+template <unsigned int N>
+void QuantizedBVH<N>::setSIMDLevel(CPU::SIMDLevel level) {
+    simd_level    = std::min(level, CPU::detectSIMDLevel());
+    test_children = selectKernel<N>(simd_level);
+}
+
+template <unsigned int N>
+CPU::SIMDLevel QuantizedBVH<N>::getSIMDLevel() const {
+    return simd_level;
+}
+
+template <unsigned int N>
+void QuantizedBVH<N>::build(const WideBVH<N>& wide_bvh) {
+    auto start = std::chrono::steady_clock::now();
+
+    nodes.resize(wide_bvh.nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!quantizeNode(wide_bvh.nodes[i], nodes[i])) {
+            std::cout << "BVH leaf too large to quantize, the quantized BVH" << N
+                      << " is left empty" << std::endl;
+            nodes.clear();
+            break;
+        }
+    }
+
+    build_time =
+        std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <unsigned int N>
+void QuantizedBVH<N>::refit(const WideBVH<N>& wide_bvh,
+                            const std::vector<unsigned int>& changed_wide_nodes) {
+    if (nodes.size() != wide_bvh.nodes.size()) {
+        return;
+    }
+    for (unsigned int index : changed_wide_nodes) {
+        quantizeNode(wide_bvh.nodes[index], nodes[index]);
+    }
+}
+
+template class QuantizedBVH<4>;
+template class QuantizedBVH<8>;
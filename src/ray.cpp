@@ -0,0 +1,19 @@
+#include <ray.hpp>
+
+Ray::Ray()
+    : origin(0.0f)
+    , direction(0.0f, 0.0f, -1.0f) {}
+
+Ray::Ray(const glm::vec3& origin, const glm::vec3& direction)
+    : origin(origin)
+    , direction(direction) {}
+
+glm::vec3 Ray::at(float t) const {
+    return origin + t * direction;
+}
+
+HitRecord::HitRecord()
+    : t(0.0f)
+    , position(0.0f)
+    , normal(0.0f)
+    , primitive_index(-1) {}
@@ -0,0 +1,199 @@
+#include <ray_packet.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <cpu_features.hpp>
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+// Product of the intervals [a_min, a_max] and [b_min, b_max]
+void intervalMultiply(float a_min, float a_max, float b_min, float b_max, float& out_min,
+                      float& out_max) {
+    float p0 = a_min * b_min;
+    float p1 = a_min * b_max;
+    float p2 = a_max * b_min;
+    float p3 = a_max * b_max;
+    out_min  = std::min(std::min(p0, p1), std::min(p2, p3));
+    out_max  = std::max(std::max(p0, p1), std::max(p2, p3));
+}
+
+unsigned int intersectPacketBoundsScalar(const BVHNode& node, const RayPacket& packet,
+                                         float t_min, unsigned int lane_mask) {
+    unsigned int mask = 0;
+    for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+        if ((lane_mask & (1u << lane)) == 0) {
+            continue;
+        }
+        float t_near = t_min;
+        float t_far  = packet.t_max[lane];
+        for (int axis = 0; axis < 3; ++axis) {
+            float t0 = (node.bounds_min[axis] - packet.origin[axis][lane]) *
+                       packet.inv_direction[axis][lane];
+            float t1 = (node.bounds_max[axis] - packet.origin[axis][lane]) *
+                       packet.inv_direction[axis][lane];
+            t_near = std::max(t_near, std::min(t0, t1));
+            t_far  = std::min(t_far, std::max(t0, t1));
+        }
+        if (t_near <= t_far) {
+            mask |= 1u << lane;
+        }
+    }
+    return mask;
+}
+
+#if CPU_X86
+TARGET_SSE42 unsigned int intersectPacketBoundsSSE42(const BVHNode& node, const RayPacket& packet,
+                                                     float t_min, unsigned int lane_mask) {
+    unsigned int mask = 0;
+    for (unsigned int base = 0; base < RayPacket::size; base += 4) {
+        __m128 t_near = _mm_set1_ps(t_min);
+        __m128 t_far  = _mm_load_ps(packet.t_max + base);
+        for (int axis = 0; axis < 3; ++axis) {
+            __m128 origin = _mm_load_ps(packet.origin[axis] + base);
+            __m128 inv    = _mm_load_ps(packet.inv_direction[axis] + base);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bounds_min[axis]), origin), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bounds_max[axis]), origin), inv);
+            t_near    = _mm_max_ps(t_near, _mm_min_ps(t0, t1));
+            t_far     = _mm_min_ps(t_far, _mm_max_ps(t0, t1));
+        }
+        mask |= static_cast<unsigned int>(_mm_movemask_ps(_mm_cmple_ps(t_near, t_far))) << base;
+    }
+    return mask & lane_mask;
+}
+
+TARGET_AVX2 unsigned int intersectPacketBoundsAVX2(const BVHNode& node, const RayPacket& packet,
+                                                   float t_min, unsigned int lane_mask) {
+    __m256 t_near = _mm256_set1_ps(t_min);
+    __m256 t_far  = _mm256_load_ps(packet.t_max);
+    for (int axis = 0; axis < 3; ++axis) {
+        __m256 origin = _mm256_load_ps(packet.origin[axis]);
+        __m256 inv    = _mm256_load_ps(packet.inv_direction[axis]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds_min[axis]), origin), inv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds_max[axis]), origin), inv);
+        t_near    = _mm256_max_ps(t_near, _mm256_min_ps(t0, t1));
+        t_far     = _mm256_min_ps(t_far, _mm256_max_ps(t0, t1));
+    }
+    unsigned int mask = static_cast<unsigned int>(
+        _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ)));
+    return mask & lane_mask;
+}
+#endif
+
+} // namespace
+
+RayPacket::RayPacket()
+    : active(0)
+    , origin_min(0.0f)
+    , origin_max(0.0f)
+    , inv_direction_min(0.0f)
+    , inv_direction_max(0.0f)
+    , coherent(false) {
+    // Inactive lanes still go through the SIMD tests, keep them finite
+    for (int axis = 0; axis < 3; ++axis) {
+        for (unsigned int lane = 0; lane < size; ++lane) {
+            origin[axis][lane]        = 0.0f;
+            direction[axis][lane]     = 1.0f;
+            inv_direction[axis][lane] = 1.0f;
+        }
+    }
+    for (unsigned int lane = 0; lane < size; ++lane) {
+        t_max[lane] = 0.0f;
+    }
+}
+
+void RayPacket::setRay(unsigned int lane, const Ray& ray, float t_max) {
+    for (int axis = 0; axis < 3; ++axis) {
+        origin[axis][lane]    = ray.origin[axis];
+        direction[axis][lane] = ray.direction[axis];
+    }
+    this->t_max[lane] = t_max;
+    active |= 1u << lane;
+}
+
+void RayPacket::finalize() {
+    origin_min        = glm::vec3(std::numeric_limits<float>::max());
+    origin_max        = glm::vec3(-std::numeric_limits<float>::max());
+    inv_direction_min = glm::vec3(std::numeric_limits<float>::max());
+    inv_direction_max = glm::vec3(-std::numeric_limits<float>::max());
+    coherent          = active != 0;
+
+    for (unsigned int lane = 0; lane < size; ++lane) {
+        if ((active & (1u << lane)) == 0) {
+            continue;
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            float inv                 = 1.0f / direction[axis][lane];
+            inv_direction[axis][lane] = inv;
+
+            origin_min[axis]        = std::min(origin_min[axis], origin[axis][lane]);
+            origin_max[axis]        = std::max(origin_max[axis], origin[axis][lane]);
+            inv_direction_min[axis] = std::min(inv_direction_min[axis], inv);
+            inv_direction_max[axis] = std::max(inv_direction_max[axis], inv);
+
+            // Rays parallel to a slab would turn the interval products into NaNs
+            if (!std::isfinite(inv)) {
+                coherent = false;
+            }
+        }
+    }
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (inv_direction_min[axis] < 0.0f && inv_direction_max[axis] > 0.0f) {
+            coherent = false;
+        }
+    }
+}
+
+Ray RayPacket::getRay(unsigned int lane) const {
+    return Ray(glm::vec3(origin[0][lane], origin[1][lane], origin[2][lane]),
+               glm::vec3(direction[0][lane], direction[1][lane], direction[2][lane]));
+}
+
+bool packetMayHitBounds(const BVHNode& node, const RayPacket& packet, float t_min) {
+    // Interval of the entry and exit distances of every ray along each axis. The largest entry
+    // lower bound and the smallest exit upper bound bracket the distances of every single ray
+    float t_near = t_min;
+    float t_far  = -std::numeric_limits<float>::max();
+    for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+        if (packet.active & (1u << lane)) {
+            t_far = std::max(t_far, packet.t_max[lane]);
+        }
+    }
+
+    for (int axis = 0; axis < 3; ++axis) {
+        // Coherent packets share direction signs, so every ray enters through the same slab
+        bool positive = packet.inv_direction_min[axis] >= 0.0f;
+        float entry   = positive ? node.bounds_min[axis] : node.bounds_max[axis];
+        float exit    = positive ? node.bounds_max[axis] : node.bounds_min[axis];
+
+        float near_min, near_max, far_min, far_max;
+        intervalMultiply(entry - packet.origin_max[axis], entry - packet.origin_min[axis],
+                         packet.inv_direction_min[axis], packet.inv_direction_max[axis],
+                         near_min, near_max);
+        intervalMultiply(exit - packet.origin_max[axis], exit - packet.origin_min[axis],
+                         packet.inv_direction_min[axis], packet.inv_direction_max[axis],
+                         far_min, far_max);
+
+        t_near = std::max(t_near, near_min);
+        t_far  = std::min(t_far, far_max);
+    }
+    return t_near <= t_far;
+}
+
+PacketBoundsKernel selectPacketBoundsKernel(CPU::SIMDLevel level) {
+    level = std::min(level, CPU::detectSIMDLevel());
+#if CPU_X86
+    if (level >= CPU::SIMDLevel::AVX2) {
+        return intersectPacketBoundsAVX2;
+    }
+    if (level >= CPU::SIMDLevel::SSE42) {
+        return intersectPacketBoundsSSE42;
+    }
+#endif
+    return intersectPacketBoundsScalar;
+}
@@ -0,0 +1,1221 @@
+#include <raytracer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#include <render_checkpoint.hpp>
+#include <tiled_image_writer.hpp>
+
+namespace {
+constexpr float pi = 3.14159265f;
+
+// Pixel block covered by one ray packet
+constexpr unsigned int packet_block_width  = 4;
+constexpr unsigned int packet_block_height = RayPacket::size / packet_block_width;
+
+// Relative errors are measured against at least this luminance. Otherwise black pixels, where any
+// noise at all is a huge relative error, would never converge
+constexpr float min_error_luminance = 0.05f;
+
+// Added to the sampler seed for the samples that train the path guide, so they are not the same
+// as the first pass's
+constexpr uint32_t guide_training_seed = 0x9e3779b9u;
+
+float luminance(const glm::vec3& colour) {
+    return glm::dot(colour, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+} // namespace
+
+CameraFrame::CameraFrame(const Camera& camera, unsigned int image_width,
+                         unsigned int image_height) {
+    float aspect      = static_cast<float>(image_width) / static_cast<float>(image_height);
+    float half_height = std::tan(glm::radians(camera.fov) * 0.5f);
+
+    glm::vec3 right = glm::normalize(glm::cross(camera.front, camera.up));
+    glm::vec3 up    = glm::cross(right, glm::normalize(camera.front));
+
+    origin     = camera.pos;
+    front      = glm::normalize(camera.front);
+    horizontal = right * half_height * aspect;
+    vertical   = up * half_height;
+    inv_width  = 1.0f / static_cast<float>(image_width);
+    inv_height = 1.0f / static_cast<float>(image_height);
+}
+
+Ray CameraFrame::generateRay(float x, float y) const {
+    float ndc_x = 2.0f * x * inv_width - 1.0f;
+    float ndc_y = 1.0f - 2.0f * y * inv_height;
+
+    return Ray(origin, glm::normalize(front + ndc_x * horizontal + ndc_y * vertical));
+}
+
+RayTracerSettings::RayTracerSettings() {
+    width               = 960;
+    height              = 540;
+    samples_per_pixel   = 16;
+    max_depth           = 4;
+    num_threads         = 0;
+    tile_size           = 32;
+    packet_primary_rays = true;
+    packet_shadow_rays  = true;
+
+    adaptive_sampling    = true;
+    adaptive_threshold   = 0.01f;
+    adaptive_min_samples = 8;
+
+    feature_buffers = false;
+
+    light_sampling = LightSampling::LIGHT_BVH;
+    light_samples  = 1;
+
+    wavefront = false;
+
+    path_guiding            = false;
+    guiding_training_passes = 4;
+    guiding_fraction        = 0.5f;
+    guiding_resolution      = 16;
+    guiding_memory          = 32;
+
+    sampler      = SamplerType::SOBOL;
+    sampler_seed = 0;
+
+    background = glm::vec3(0.2f, 0.3f, 0.3f); // Same as the raster clear colour
+}
+
+WavefrontStats::WavefrontStats()
+    : extension_rays(0)
+    , shadow_rays(0)
+    , generate_time(0.0f)
+    , sort_time(0.0f)
+    , extend_time(0.0f)
+    , shade_time(0.0f)
+    , shadow_time(0.0f) {}
+
+void WavefrontStats::add(const WavefrontStats& other) {
+    extension_rays += other.extension_rays;
+    shadow_rays += other.shadow_rays;
+    generate_time += other.generate_time;
+    sort_time += other.sort_time;
+    extend_time += other.extend_time;
+    shade_time += other.shade_time;
+    shadow_time += other.shadow_time;
+}
+
+RenderBudgetStats::RenderBudgetStats()
+    : budget(0.0f)
+    , passes(0)
+    , min_samples(0)
+    , max_samples(0)
+    , average_samples(0.0f)
+    , mean_relative_error(0.0f)
+    , estimated_rmse(0.0f) {}
+
+bool RenderBudgetStats::write(const std::string& path) const {
+    std::ofstream outfile(path);
+    if (!outfile.is_open()) {
+        std::cout << "Unable to open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    outfile << "budget_seconds " << budget << "\n";
+    outfile << "passes " << passes << "\n";
+    outfile << "min_samples " << min_samples << "\n";
+    outfile << "max_samples " << max_samples << "\n";
+    outfile << "average_samples " << average_samples << "\n";
+    outfile << "mean_relative_error " << mean_relative_error << "\n";
+    outfile << "estimated_rmse " << estimated_rmse << "\n";
+
+    return outfile.good();
+}
+
+RayTracer::PixelEstimate::PixelEstimate()
+    : sum(0.0f)
+    , luminance_sum(0.0f)
+    , luminance_sum_sq(0.0f)
+    , samples(0)
+    , converged(false)
+    , albedo_sum(0.0f)
+    , normal_sum(0.0f)
+    , depth_sum(0.0f) {}
+
+void RayTracer::PixelEstimate::addSample(const glm::vec3& colour) {
+    float l = luminance(colour);
+    sum += colour;
+    luminance_sum += l;
+    luminance_sum_sq += l * l;
+    samples++;
+}
+
+void RayTracer::PixelEstimate::addFeatures(const FirstHit& first_hit) {
+    albedo_sum += first_hit.albedo;
+    normal_sum += first_hit.normal;
+    depth_sum += first_hit.depth;
+}
+
+float RayTracer::PixelEstimate::standardError() const {
+    if (samples < 2) {
+        return std::numeric_limits<float>::max();
+    }
+    float n        = static_cast<float>(samples);
+    float mean     = luminance_sum / n;
+    float variance = std::max(0.0f, (luminance_sum_sq - luminance_sum * mean) / (n - 1.0f));
+    return std::sqrt(variance / n);
+}
+
+float RayTracer::PixelEstimate::relativeError() const {
+    if (samples < 2) {
+        return std::numeric_limits<float>::max();
+    }
+    float mean = luminance_sum / static_cast<float>(samples);
+    return standardError() / std::max(mean, min_error_luminance);
+}
+
+RayTracer::RayTracer()
+    : last_render_time(0.0f)
+    , last_num_threads(0)
+    , last_average_samples(0.0f)
+    , last_resumed_tiles(0) {}
+
+RayTracer::RayTracer(const RayTracerSettings& settings)
+    : settings(settings)
+    , last_render_time(0.0f)
+    , last_num_threads(0)
+    , last_average_samples(0.0f)
+    , last_resumed_tiles(0) {}
+
+Image RayTracer::render(const RayTracerScene& scene, const Camera& camera, unsigned int pass,
+                        const std::atomic<bool>* cancel, RenderCheckpoint* checkpoint) {
+    return renderTiles(scene, camera, ImageRegion(0, 0, settings.width, settings.height), pass,
+                       cancel, checkpoint);
+}
+
+Image RayTracer::renderRegion(const RayTracerScene& scene, const Camera& camera,
+                              const ImageRegion& region, unsigned int pass,
+                              const std::atomic<bool>* cancel) {
+    return renderTiles(scene, camera, region.clamped(settings.width, settings.height), pass,
+                       cancel, nullptr);
+}
+
+Image RayTracer::renderTiles(const RayTracerScene& scene, const Camera& camera,
+                             const ImageRegion& region, unsigned int pass,
+                             const std::atomic<bool>* cancel, RenderCheckpoint* checkpoint) {
+    auto start = std::chrono::steady_clock::now();
+
+    Image image(region.width(), region.height());
+    CameraFrame frame(camera, settings.width, settings.height);
+    last_region = region;
+
+    unsigned int num_threads = settings.num_threads;
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    last_traversal_stats = BVHTraversalStats();
+    std::vector<BVHTraversalStats> worker_stats(num_threads);
+    std::vector<WavefrontStats> worker_wavefront_stats(num_threads);
+    last_sample_counts.assign(image.pixels.size(), 0);
+    FeatureBuffers* features = nullptr;
+    if (settings.feature_buffers) {
+        last_features.albedo = Image(image.width, image.height);
+        last_features.normal = Image(image.width, image.height);
+        last_features.depth.assign(image.pixels.size(), 0.0f);
+        features = &last_features;
+    }
+
+    if (settings.path_guiding && pass == 0) {
+        trainPathGuide(scene, frame, num_threads, cancel);
+    }
+
+    last_resumed_tiles = 0;
+    last_budget_stats  = RenderBudgetStats();
+    if (checkpoint) {
+        uint64_t fingerprint = RenderCheckpoint::fingerprint(scene, camera, settings, pass);
+        if (!checkpoint->matches(fingerprint, settings)) {
+            checkpoint->reset(fingerprint, settings, pass);
+        }
+    }
+    // Guards the checkpoint, workers add their tiles to it while another one may be saving it
+    std::mutex checkpoint_mutex;
+    auto last_save = std::chrono::steady_clock::now();
+
+    TileScheduler scheduler(image.width, image.height, settings.tile_size, num_threads);
+    if (checkpoint) {
+        // Resumed tiles are resolved up front so the workers only see the ones left to trace
+        for (const Tile& tile : scheduler.getTiles()) {
+            if (checkpoint->tiles_done[tile.index]) {
+                resolveTile(tile, restoreTile(tile, *checkpoint), image, last_sample_counts,
+                            features);
+                last_resumed_tiles++;
+            }
+        }
+    }
+    scheduler.run([&](const Tile& tile, unsigned int worker) {
+        if (cancel && cancel->load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (checkpoint && checkpoint->tiles_done[tile.index]) {
+            return;
+        }
+        // Tiles are laid out over the region, the camera rays go through the frame's pixels
+        const Tile frame_tile = {tile.index, tile.x0 + region.x0, tile.y0 + region.y0,
+                                 tile.x1 + region.x0, tile.y1 + region.y0};
+        // Every pass takes the next samples_per_pixel samples of each pixel's sequence
+        std::vector<PixelEstimate> estimates =
+            renderTile(scene, frame, frame_tile, pass * std::max(settings.samples_per_pixel, 1u),
+                       settings.samples_per_pixel, worker_stats[worker],
+                       worker_wavefront_stats[worker]);
+        resolveTile(tile, estimates, image, last_sample_counts, features);
+
+        if (checkpoint) {
+            std::lock_guard<std::mutex> lock(checkpoint_mutex);
+            storeTile(tile, estimates, *checkpoint);
+            checkpoint->tiles_done[tile.index] = 1;
+
+            auto now = std::chrono::steady_clock::now();
+            if (std::chrono::duration<float>(now - last_save).count() >=
+                checkpoint->save_interval) {
+                checkpoint->save();
+                last_save = now;
+            }
+        }
+    });
+    if (checkpoint && cancel && cancel->load()) {
+        checkpoint->save();
+    }
+
+    for (const BVHTraversalStats& stats : worker_stats) {
+        last_traversal_stats.add(stats);
+    }
+    last_wavefront_stats = WavefrontStats();
+    for (const WavefrontStats& stats : worker_wavefront_stats) {
+        last_wavefront_stats.add(stats);
+    }
+    last_tile_stats = scheduler.stats;
+
+    unsigned long long total_samples = 0;
+    for (unsigned int samples : last_sample_counts) {
+        total_samples += samples;
+    }
+    last_average_samples =
+        image.pixels.empty() ? 0.0f
+                             : static_cast<float>(total_samples) / image.pixels.size();
+
+    last_render_time =
+        std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    last_num_threads = num_threads;
+
+    return image;
+}
+
+bool RayTracer::renderToFile(const RayTracerScene& scene, const Camera& camera,
+                             TiledImageWriter& writer, unsigned int pass,
+                             const std::atomic<bool>* cancel) {
+    if (!writer.isOpen() || writer.getWidth() != settings.width ||
+        writer.getHeight() != settings.height || writer.hasFeatures() != settings.feature_buffers) {
+        std::cout << "The image writer does not match the ray tracer's settings" << std::endl;
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    CameraFrame frame(camera, settings.width, settings.height);
+    last_region = ImageRegion(0, 0, settings.width, settings.height);
+
+    unsigned int num_threads = settings.num_threads;
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<BVHTraversalStats> worker_stats(num_threads);
+    std::vector<WavefrontStats> worker_wavefront_stats(num_threads);
+    std::vector<unsigned long long> worker_samples(num_threads, 0);
+    std::atomic<bool> failed(false);
+
+    if (settings.path_guiding && pass == 0) {
+        trainPathGuide(scene, frame, num_threads, cancel);
+    }
+
+    TileScheduler scheduler(settings.width, settings.height, settings.tile_size, num_threads);
+    scheduler.run([&](const Tile& tile, unsigned int worker) {
+        if ((cancel && cancel->load(std::memory_order_relaxed)) || failed.load()) {
+            return;
+        }
+        std::vector<PixelEstimate> estimates =
+            renderTile(scene, frame, tile, pass * std::max(settings.samples_per_pixel, 1u),
+                       settings.samples_per_pixel, worker_stats[worker],
+                       worker_wavefront_stats[worker]);
+
+        // Resolved into buffers the size of the tile, freed as soon as they are written
+        const Tile local_tile = {tile.index, 0, 0, tile.x1 - tile.x0, tile.y1 - tile.y0};
+        Image colour(local_tile.x1, local_tile.y1);
+        std::vector<unsigned int> sample_counts(colour.pixels.size(), 0);
+        FeatureBuffers features;
+        if (settings.feature_buffers) {
+            features.albedo = Image(colour.width, colour.height);
+            features.normal = Image(colour.width, colour.height);
+            features.depth.assign(colour.pixels.size(), 0.0f);
+        }
+        resolveTile(local_tile, estimates, colour, sample_counts,
+                    settings.feature_buffers ? &features : nullptr);
+        for (unsigned int samples : sample_counts) {
+            worker_samples[worker] += samples;
+        }
+
+        if (!writer.writeTile(tile, colour, settings.feature_buffers ? &features : nullptr)) {
+            failed = true;
+        }
+    });
+
+    last_traversal_stats = BVHTraversalStats();
+    for (const BVHTraversalStats& stats : worker_stats) {
+        last_traversal_stats.add(stats);
+    }
+    last_wavefront_stats = WavefrontStats();
+    for (const WavefrontStats& stats : worker_wavefront_stats) {
+        last_wavefront_stats.add(stats);
+    }
+    last_tile_stats = scheduler.stats;
+    last_sample_counts.clear();
+    last_features      = FeatureBuffers();
+    last_resumed_tiles = 0;
+    last_budget_stats  = RenderBudgetStats();
+
+    unsigned long long total_samples = 0;
+    for (unsigned long long samples : worker_samples) {
+        total_samples += samples;
+    }
+    const size_t num_pixels = static_cast<size_t>(settings.width) * settings.height;
+    last_average_samples =
+        num_pixels == 0 ? 0.0f : static_cast<float>(total_samples) / num_pixels;
+
+    last_render_time =
+        std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    last_num_threads = num_threads;
+
+    return !failed.load();
+}
+
+Image RayTracer::renderWithBudget(const RayTracerScene& scene, const Camera& camera, float budget,
+                                  const std::atomic<bool>* cancel) {
+    auto start    = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<float>(std::max(budget, 0.0f)));
+
+    Image image(settings.width, settings.height);
+    CameraFrame frame(camera, settings.width, settings.height);
+    last_region = ImageRegion(0, 0, settings.width, settings.height);
+
+    unsigned int num_threads = settings.num_threads;
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<BVHTraversalStats> worker_stats(num_threads);
+    std::vector<WavefrontStats> worker_wavefront_stats(num_threads);
+
+    // Training counts against the budget
+    if (settings.path_guiding) {
+        trainPathGuide(scene, frame, num_threads, cancel);
+    }
+
+    // Estimates outlive the passes, every pass carries on each pixel's sequence where the
+    // previous one left it
+    std::vector<Tile> tiles =
+        TileScheduler(settings.width, settings.height, settings.tile_size, 1).getTiles();
+    std::vector<std::vector<PixelEstimate>> tile_estimates(tiles.size());
+    for (const Tile& tile : tiles) {
+        tile_estimates[tile.index].resize(static_cast<size_t>(tile.x1 - tile.x0) *
+                                          (tile.y1 - tile.y0));
+    }
+
+    auto out_of_time = [&]() {
+        return (cancel && cancel->load(std::memory_order_relaxed)) ||
+               std::chrono::steady_clock::now() >= deadline;
+    };
+
+    const unsigned int min_samples = std::max(2u, settings.adaptive_min_samples);
+    last_tile_stats                = TileSchedulerStats();
+    last_budget_stats              = RenderBudgetStats();
+    last_budget_stats.budget       = budget;
+
+    // How much another batch would reduce a pixel's squared relative error, the variance of the
+    // mean drops by variance / n^2 per extra sample
+    auto priority = [](const PixelEstimate& estimate) {
+        return estimate.relativeError() / std::sqrt(static_cast<float>(estimate.samples));
+    };
+
+    for (unsigned int pass = 0;; ++pass) {
+        // The first min_samples passes take one sample of every pixel, the rest refine the
+        // pixels whose priority is above the mean
+        const bool refining = pass >= min_samples;
+        if (refining) {
+            double priority_sum = 0.0;
+            size_t count        = 0;
+            for (const std::vector<PixelEstimate>& estimates : tile_estimates) {
+                for (const PixelEstimate& estimate : estimates) {
+                    priority_sum += priority(estimate);
+                    count++;
+                }
+            }
+            const float mean_priority =
+                count > 0 ? static_cast<float>(priority_sum / count) : 0.0f;
+
+            bool any_active = false;
+            for (std::vector<PixelEstimate>& estimates : tile_estimates) {
+                for (PixelEstimate& estimate : estimates) {
+                    float pixel_priority = priority(estimate);
+                    estimate.converged   = pixel_priority <= 0.0f || pixel_priority < mean_priority;
+                    any_active |= !estimate.converged;
+                }
+            }
+            // Only happens once every pixel has no noise left at all
+            if (!any_active) {
+                break;
+            }
+        }
+        if (pass > 0 && out_of_time()) {
+            break;
+        }
+
+        TileScheduler scheduler(settings.width, settings.height, settings.tile_size, num_threads);
+        // Once started, the passes taking every pixel to min_samples finish whatever the time, so
+        // the sample counts stay uniform across the image until refinement starts
+        scheduler.run([&](const Tile& tile, unsigned int worker) {
+            bool stop = refining ? out_of_time()
+                                 : pass > 0 && cancel && cancel->load(std::memory_order_relaxed);
+            if (stop) {
+                return;
+            }
+            addTileSamples(scene, frame, tile, refining ? min_samples : 1,
+                           tile_estimates[tile.index], 0, worker_stats[worker],
+                           worker_wavefront_stats[worker]);
+        });
+        last_budget_stats.passes++;
+
+        // Tile times and busy times add up over the passes
+        if (last_tile_stats.tile_times.empty()) {
+            last_tile_stats = scheduler.stats;
+        } else {
+            for (size_t i = 0; i < tiles.size(); ++i) {
+                last_tile_stats.tile_times[i] += scheduler.stats.tile_times[i];
+            }
+            for (unsigned int i = 0; i < num_threads; ++i) {
+                last_tile_stats.worker_busy_times[i] += scheduler.stats.worker_busy_times[i];
+            }
+            last_tile_stats.steals += scheduler.stats.steals;
+        }
+    }
+
+    last_sample_counts.assign(image.pixels.size(), 0);
+    FeatureBuffers* features = nullptr;
+    if (settings.feature_buffers) {
+        last_features.albedo = Image(settings.width, settings.height);
+        last_features.normal = Image(settings.width, settings.height);
+        last_features.depth.assign(image.pixels.size(), 0.0f);
+        features = &last_features;
+    }
+
+    RenderBudgetStats& budget_stats = last_budget_stats;
+    budget_stats.min_samples        = std::numeric_limits<unsigned int>::max();
+    double relative_error_sum       = 0.0;
+    double variance_sum             = 0.0;
+    for (const Tile& tile : tiles) {
+        const std::vector<PixelEstimate>& estimates = tile_estimates[tile.index];
+        resolveTile(tile, estimates, image, last_sample_counts, features);
+        for (const PixelEstimate& estimate : estimates) {
+            budget_stats.min_samples = std::min(budget_stats.min_samples, estimate.samples);
+            budget_stats.max_samples = std::max(budget_stats.max_samples, estimate.samples);
+            // Pixels with a single sample have no error estimate, count them as fully wrong
+            float standard_error = estimate.samples > 1 ? estimate.standardError() : 1.0f;
+            relative_error_sum += estimate.samples > 1 ? estimate.relativeError() : 1.0f;
+            variance_sum += standard_error * standard_error;
+        }
+    }
+    const size_t num_pixels = image.pixels.size();
+    if (num_pixels == 0) {
+        budget_stats.min_samples = 0;
+    }
+
+    last_traversal_stats = BVHTraversalStats();
+    for (const BVHTraversalStats& stats : worker_stats) {
+        last_traversal_stats.add(stats);
+    }
+    last_wavefront_stats = WavefrontStats();
+    for (const WavefrontStats& stats : worker_wavefront_stats) {
+        last_wavefront_stats.add(stats);
+    }
+
+    unsigned long long total_samples = 0;
+    for (unsigned int samples : last_sample_counts) {
+        total_samples += samples;
+    }
+    last_average_samples =
+        num_pixels == 0 ? 0.0f : static_cast<float>(total_samples) / num_pixels;
+    last_resumed_tiles = 0;
+
+    budget_stats.average_samples = last_average_samples;
+    budget_stats.mean_relative_error =
+        num_pixels == 0 ? 0.0f : static_cast<float>(relative_error_sum / num_pixels);
+    budget_stats.estimated_rmse =
+        num_pixels == 0 ? 0.0f : static_cast<float>(std::sqrt(variance_sum / num_pixels));
+
+    last_render_time =
+        std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    last_num_threads = num_threads;
+
+    return image;
+}
+
+TileSums RayTracer::renderTileSums(const RayTracerScene& scene, const Camera& camera,
+                                  const Tile& tile, uint32_t first_sample, unsigned int samples,
+                                  BVHTraversalStats& stats) const {
+    CameraFrame frame(camera, settings.width, settings.height);
+    WavefrontStats wavefront_stats;
+    std::vector<PixelEstimate> estimates =
+        renderTile(scene, frame, tile, first_sample, samples, stats, wavefront_stats);
+
+    TileSums tile_sums;
+    tile_sums.sums.reserve(estimates.size());
+    tile_sums.sample_counts.reserve(estimates.size());
+    for (const PixelEstimate& estimate : estimates) {
+        tile_sums.sums.push_back(estimate.sum);
+        tile_sums.sample_counts.push_back(estimate.samples);
+        if (settings.feature_buffers) {
+            tile_sums.albedo_sums.push_back(estimate.albedo_sum);
+            tile_sums.normal_sums.push_back(estimate.normal_sum);
+            tile_sums.depth_sums.push_back(estimate.depth_sum);
+        }
+    }
+    return tile_sums;
+}
+
+void RayTracer::resolveTileSums(const Tile& tile, const TileSums& sums, Image& image,
+                                std::vector<unsigned int>& sample_counts,
+                                FeatureBuffers* features) const {
+    std::vector<PixelEstimate> estimates(sums.sums.size());
+    const bool has_features = !sums.albedo_sums.empty();
+    for (size_t i = 0; i < estimates.size(); ++i) {
+        estimates[i].sum     = sums.sums[i];
+        estimates[i].samples = sums.sample_counts[i];
+        if (has_features) {
+            estimates[i].albedo_sum = sums.albedo_sums[i];
+            estimates[i].normal_sum = sums.normal_sums[i];
+            estimates[i].depth_sum  = sums.depth_sums[i];
+        }
+    }
+    resolveTile(tile, estimates, image, sample_counts, features);
+}
+
+Image RayTracer::sampleCountMap() const {
+    Image image(last_region.width(), last_region.height());
+    if (last_sample_counts.size() != image.pixels.size()) {
+        return image;
+    }
+
+    // samples_per_pixel means nothing to a budgeted render
+    unsigned int max_samples =
+        last_budget_stats.passes > 0 ? last_budget_stats.max_samples : settings.samples_per_pixel;
+    float inv_max = 1.0f / static_cast<float>(std::max(max_samples, 1u));
+    for (size_t i = 0; i < image.pixels.size(); ++i) {
+        float heat      = std::min(1.0f, last_sample_counts[i] * inv_max);
+        image.pixels[i] = glm::mix(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f),
+                                   heat);
+    }
+    return image;
+}
+
+std::vector<RayTracer::PixelEstimate> RayTracer::renderTile(const RayTracerScene& scene,
+                                                            const CameraFrame& frame,
+                                                            const Tile& tile,
+                                                            uint32_t first_sample,
+                                                            unsigned int max_samples,
+                                                            BVHTraversalStats& stats,
+                                                            WavefrontStats& wavefront_stats) const {
+    // Counted locally so workers don't keep writing to neighbouring memory
+    BVHTraversalStats tile_stats;
+
+    const unsigned int tile_width = tile.x1 - tile.x0;
+    std::vector<PixelEstimate> estimates(static_cast<size_t>(tile_width) * (tile.y1 - tile.y0));
+
+    auto sample = [&](unsigned int samples) {
+        addTileSamples(scene, frame, tile, samples, estimates, first_sample, tile_stats,
+                       wavefront_stats);
+    };
+
+    if (!settings.adaptive_sampling) {
+        sample(max_samples);
+    } else {
+        // Every pixel gets a first batch to estimate its variance from, then further batches go to
+        // the pixels whose error is still above the threshold
+        unsigned int batch = std::max(2u, std::min(settings.adaptive_min_samples, max_samples));
+        unsigned int taken = 0;
+        while (taken < max_samples) {
+            if (taken > 0) {
+                bool any_active = false;
+                for (PixelEstimate& estimate : estimates) {
+                    if (!estimate.converged &&
+                        estimate.relativeError() <= settings.adaptive_threshold) {
+                        estimate.converged = true;
+                    }
+                    any_active |= !estimate.converged;
+                }
+                if (!any_active) {
+                    break;
+                }
+            }
+            unsigned int samples = std::min(batch, max_samples - taken);
+            sample(samples);
+            taken += samples;
+        }
+    }
+
+    stats.add(tile_stats);
+    return estimates;
+}
+
+void RayTracer::addTileSamples(const RayTracerScene& scene, const CameraFrame& frame,
+                               const Tile& tile, unsigned int samples,
+                               std::vector<PixelEstimate>& estimates, uint32_t first_sample,
+                               BVHTraversalStats& stats, WavefrontStats& wavefront_stats) const {
+    if (settings.wavefront) {
+        sampleTileWavefront(scene, frame, tile, samples, estimates, first_sample, stats,
+                            wavefront_stats);
+    } else if (settings.packet_primary_rays || settings.packet_shadow_rays) {
+        sampleTilePackets(scene, frame, tile, samples, estimates, first_sample, stats);
+    } else {
+        sampleTile(scene, frame, tile, samples, estimates, first_sample, stats);
+    }
+}
+
+void RayTracer::resolveTile(const Tile& tile, const std::vector<PixelEstimate>& estimates,
+                            Image& image, std::vector<unsigned int>& sample_counts,
+                            FeatureBuffers* features) const {
+    const unsigned int tile_width = tile.x1 - tile.x0;
+    for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+        for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+            const PixelEstimate& estimate =
+                estimates[static_cast<size_t>(y - tile.y0) * tile_width + (x - tile.x0)];
+            float inv_samples = estimate.samples > 0 ? 1.0f / estimate.samples : 0.0f;
+            image.at(x, y)    = estimate.sum * inv_samples;
+            sample_counts[static_cast<size_t>(y) * image.width + x] = estimate.samples;
+
+            if (features) {
+                features->albedo.at(x, y) = estimate.albedo_sum * inv_samples;
+                features->normal.at(x, y) = estimate.normal_sum * inv_samples;
+                features->depth[static_cast<size_t>(y) * image.width + x] =
+                    estimate.depth_sum * inv_samples;
+            }
+        }
+    }
+}
+
+void RayTracer::storeTile(const Tile& tile, const std::vector<PixelEstimate>& estimates,
+                          RenderCheckpoint& checkpoint) {
+    const unsigned int tile_width = tile.x1 - tile.x0;
+    for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+        for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+            const PixelEstimate& estimate =
+                estimates[static_cast<size_t>(y - tile.y0) * tile_width + (x - tile.x0)];
+            size_t pixel = static_cast<size_t>(y) * checkpoint.width + x;
+            checkpoint.sums[pixel]          = estimate.sum;
+            checkpoint.sample_counts[pixel] = estimate.samples;
+            if (checkpoint.has_features) {
+                checkpoint.albedo_sums[pixel] = estimate.albedo_sum;
+                checkpoint.normal_sums[pixel] = estimate.normal_sum;
+                checkpoint.depth_sums[pixel]  = estimate.depth_sum;
+            }
+        }
+    }
+}
+
+std::vector<RayTracer::PixelEstimate> RayTracer::restoreTile(const Tile& tile,
+                                                             const RenderCheckpoint& checkpoint) {
+    const unsigned int tile_width = tile.x1 - tile.x0;
+    std::vector<PixelEstimate> estimates(static_cast<size_t>(tile_width) * (tile.y1 - tile.y0));
+    for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+        for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+            PixelEstimate& estimate =
+                estimates[static_cast<size_t>(y - tile.y0) * tile_width + (x - tile.x0)];
+            size_t pixel     = static_cast<size_t>(y) * checkpoint.width + x;
+            estimate.sum     = checkpoint.sums[pixel];
+            estimate.samples = checkpoint.sample_counts[pixel];
+            if (checkpoint.has_features) {
+                estimate.albedo_sum = checkpoint.albedo_sums[pixel];
+                estimate.normal_sum = checkpoint.normal_sums[pixel];
+                estimate.depth_sum  = checkpoint.depth_sums[pixel];
+            }
+        }
+    }
+    return estimates;
+}
+
+void RayTracer::sampleTile(const RayTracerScene& scene, const CameraFrame& frame,
+                           const Tile& tile, unsigned int samples,
+                           std::vector<PixelEstimate>& estimates, uint32_t first_sample,
+                           BVHTraversalStats& stats) const {
+    const unsigned int tile_width = tile.x1 - tile.x0;
+
+    for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+        for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+            PixelEstimate& estimate =
+                estimates[static_cast<size_t>(y - tile.y0) * tile_width + (x - tile.x0)];
+            if (estimate.converged) {
+                continue;
+            }
+            for (unsigned int s = 0; s < samples; ++s) {
+                PixelSampler sampler = pixelSampler(x, y, first_sample + estimate.samples);
+                Ray ray = frame.generateRay(x + sampler.get(0), y + sampler.get(1));
+                FirstHit first_hit;
+                estimate.addSample(tracePath(scene, ray, sampler, stats, nullptr,
+                                             settings.feature_buffers ? &first_hit : nullptr));
+                if (settings.feature_buffers) {
+                    estimate.addFeatures(first_hit);
+                }
+            }
+        }
+    }
+}
+
+void RayTracer::sampleTilePackets(const RayTracerScene& scene, const CameraFrame& frame,
+                                  const Tile& tile, unsigned int samples,
+                                  std::vector<PixelEstimate>& estimates, uint32_t first_sample,
+                                  BVHTraversalStats& stats) const {
+    const unsigned int tile_width = tile.x1 - tile.x0;
+
+    const unsigned int num_lights = static_cast<unsigned int>(scene.lights.size());
+    // Visibility of every light from every lane's first hit, lane major. Sampled lights differ
+    // from lane to lane, those shadow rays are traced one at a time
+    const bool packet_shadows = settings.packet_shadow_rays && !samplesLights(scene);
+    std::vector<unsigned char> light_visible(
+        packet_shadows ? static_cast<size_t>(num_lights) * RayPacket::size : 0);
+
+    for (unsigned int block_y = tile.y0; block_y < tile.y1; block_y += packet_block_height) {
+        for (unsigned int block_x = tile.x0; block_x < tile.x1; block_x += packet_block_width) {
+            // Pixel of the tile each lane samples, nullptr for lanes outside the tile or whose
+            // pixel has converged
+            PixelEstimate* lane_estimates[RayPacket::size];
+            bool any_lane = false;
+            for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+                unsigned int x       = block_x + lane % packet_block_width;
+                unsigned int y       = block_y + lane / packet_block_width;
+                lane_estimates[lane] = nullptr;
+                if (x < tile.x1 && y < tile.y1) {
+                    PixelEstimate& estimate =
+                        estimates[static_cast<size_t>(y - tile.y0) * tile_width + (x - tile.x0)];
+                    if (!estimate.converged) {
+                        lane_estimates[lane] = &estimate;
+                        any_lane             = true;
+                    }
+                }
+            }
+            if (!any_lane) {
+                continue;
+            }
+
+            for (unsigned int s = 0; s < samples; ++s) {
+                // Camera rays of the block share their origin and point in almost the same
+                // direction, the ideal case for a packet
+                RayPacket primary;
+                Ray rays[RayPacket::size];
+                for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+                    if (!lane_estimates[lane]) {
+                        continue;
+                    }
+                    unsigned int x = block_x + lane % packet_block_width;
+                    unsigned int y = block_y + lane / packet_block_width;
+                    PixelSampler sampler =
+                        pixelSampler(x, y, first_sample + lane_estimates[lane]->samples);
+                    rays[lane] = frame.generateRay(x + sampler.get(0), y + sampler.get(1));
+                    primary.setRay(lane, rays[lane], std::numeric_limits<float>::max());
+                }
+                primary.finalize();
+                const unsigned int lanes = primary.active;
+
+                HitRecord hits[RayPacket::size];
+                unsigned int hit_mask = 0;
+                if (settings.packet_primary_rays) {
+                    hit_mask = scene.intersectPacket(primary, ray_epsilon, hits, &stats);
+                } else {
+                    for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+                        if ((lanes & (1u << lane)) &&
+                            scene.intersect(rays[lane], ray_epsilon,
+                                            std::numeric_limits<float>::max(), hits[lane], -1,
+                                            &stats)) {
+                            hit_mask |= 1u << lane;
+                        }
+                    }
+                }
+
+                // Shadow rays are traced from the light towards the hit points so that they
+                // share an origin. Lanes facing away from the light or hitting a light body do
+                // not need one
+                if (packet_shadows) {
+                    std::fill(light_visible.begin(), light_visible.end(), 1);
+                    for (unsigned int l = 0; l < num_lights; ++l) {
+                        const SceneLight& light = scene.lights[l];
+
+                        RayPacket shadow;
+                        for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+                            if ((hit_mask & (1u << lane)) == 0 ||
+                                scene.primitives[hits[lane].primitive_index].light_index >= 0) {
+                                continue;
+                            }
+                            const HitRecord& hit = hits[lane];
+                            if (glm::dot(hit.normal, light.position - hit.position) <= 0.0f) {
+                                continue;
+                            }
+                            glm::vec3 to_point =
+                                hit.position + hit.normal * ray_epsilon - light.position;
+                            float dist = glm::length(to_point);
+                            shadow.setRay(lane, Ray(light.position, to_point / dist),
+                                          dist - ray_epsilon);
+                        }
+                        shadow.finalize();
+
+                        unsigned int occluded = scene.occludedPacket(
+                            shadow, ray_epsilon, light.primitive_index, &stats);
+                        for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+                            if (occluded & (1u << lane)) {
+                                light_visible[lane * num_lights + l] = 0;
+                            }
+                        }
+                    }
+                }
+
+                // The rest of every path is traced one ray at a time
+                for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+                    if ((lanes & (1u << lane)) == 0) {
+                        continue;
+                    }
+                    unsigned int x = block_x + lane % packet_block_width;
+                    unsigned int y = block_y + lane / packet_block_width;
+                    PixelSampler sampler =
+                        pixelSampler(x, y, first_sample + lane_estimates[lane]->samples);
+                    PrimaryHit primary_hit;
+                    primary_hit.found         = (hit_mask & (1u << lane)) != 0;
+                    primary_hit.hit           = hits[lane];
+                    primary_hit.light_visible =
+                        packet_shadows ? light_visible.data() + lane * num_lights : nullptr;
+                    FirstHit first_hit;
+                    lane_estimates[lane]->addSample(
+                        tracePath(scene, rays[lane], sampler, stats, &primary_hit,
+                                  settings.feature_buffers ? &first_hit : nullptr));
+                    if (settings.feature_buffers) {
+                        lane_estimates[lane]->addFeatures(first_hit);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void RayTracer::trainPathGuide(const RayTracerScene& scene, const CameraFrame& frame,
+                               unsigned int num_threads, const std::atomic<bool>* cancel) {
+    auto start = std::chrono::steady_clock::now();
+
+    glm::vec3 bounds_min(0.0f);
+    glm::vec3 bounds_max(0.0f);
+    if (!scene.bvh.nodes.empty()) {
+        bounds_min = scene.bvh.nodes[0].bounds_min;
+        bounds_max = scene.bvh.nodes[0].bounds_max;
+    }
+    path_guide.reset(bounds_min, bounds_max, settings.guiding_resolution,
+                     static_cast<size_t>(settings.guiding_memory) << 20);
+    // The wavefront integrator would not use it
+    if (settings.wavefront) {
+        return;
+    }
+
+    // Every pass samples the distributions the passes before it learnt and adds its own records
+    // to the guide, in tile order for the guide not to depend on the threads
+    unsigned int passes = 0;
+    for (; passes < settings.guiding_training_passes; ++passes) {
+        if (cancel && cancel->load()) {
+            break;
+        }
+        TileScheduler scheduler(settings.width, settings.height, settings.tile_size, num_threads);
+        const size_t num_tiles = scheduler.getTiles().size();
+        std::vector<std::vector<PathGuideRecord>> tile_records(num_tiles);
+        std::vector<unsigned char> tiles_done(num_tiles, 0);
+        size_t next_tile = 0;
+        std::mutex guide_mutex;
+
+        scheduler.run([&](const Tile& tile, unsigned int) {
+            std::vector<PathGuideRecord> records;
+            if (!cancel || !cancel->load(std::memory_order_relaxed)) {
+                BVHTraversalStats stats;
+                for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+                    for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+                        PixelSampler sampler(settings.sampler, x, y, passes,
+                                             settings.sampler_seed + guide_training_seed);
+                        Ray ray = frame.generateRay(x + sampler.get(0), y + sampler.get(1));
+                        tracePath(scene, ray, sampler, stats, nullptr, nullptr, &records);
+                    }
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(guide_mutex);
+            tile_records[tile.index] = std::move(records);
+            tiles_done[tile.index]   = 1;
+            while (next_tile < num_tiles && tiles_done[next_tile]) {
+                path_guide.addRecords(tile_records[next_tile]);
+                tile_records[next_tile] = std::vector<PathGuideRecord>();
+                next_tile++;
+            }
+        });
+        path_guide.buildDistributions();
+    }
+
+    path_guide.training_passes = passes;
+    path_guide.training_time =
+        std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+PixelSampler RayTracer::pixelSampler(unsigned int x, unsigned int y,
+                                     uint32_t sample_index) const {
+    return PixelSampler(settings.sampler, x, y, sample_index, settings.sampler_seed);
+}
+
+unsigned int RayTracer::bounceDimensions() const {
+    return (bounce_lights + std::max(settings.light_samples, 1u) + 1) & ~1u;
+}
+
+glm::vec3 RayTracer::tracePath(const RayTracerScene& scene, Ray ray, const PixelSampler& sampler,
+                               BVHTraversalStats& stats, const PrimaryHit* primary,
+                               FirstHit* first_hit,
+                               std::vector<PathGuideRecord>* guide_records) const {
+    glm::vec3 radiance(0.0f);
+    glm::vec3 throughput(1.0f);
+    // Throughput the paths would have had with cosine weighted bounces only. Guided bounces towards
+    // bright directions lower the throughput, roulette must not take that as a reason to end them
+    glm::vec3 roulette_throughput(1.0f);
+
+    const float guiding_fraction = std::min(settings.guiding_fraction, 0.95f);
+    const bool guiding =
+        settings.path_guiding && guiding_fraction > 0.0f && path_guide.isTrained();
+    std::vector<GuideVertex> guide_vertices;
+    if (guide_records) {
+        guide_vertices.reserve(settings.max_depth + 1);
+    }
+
+    for (unsigned int depth = 0; depth <= settings.max_depth; ++depth) {
+        HitRecord hit;
+        bool found;
+        if (depth == 0 && primary) {
+            found = primary->found;
+            hit   = primary->hit;
+        } else {
+            found = scene.intersect(ray, ray_epsilon, std::numeric_limits<float>::max(), hit, -1,
+                                    &stats);
+        }
+        if (depth == 0 && first_hit) {
+            first_hit->albedo = found ? scene.primitives[hit.primitive_index].colour
+                                      : glm::vec3(1.0f);
+            first_hit->normal = found ? hit.normal : glm::vec3(0.0f);
+            first_hit->depth  = found ? hit.t : 0.0f;
+        }
+
+        if (!found) {
+            radiance += throughput * settings.background;
+            break;
+        }
+
+        const ScenePrimitive& primitive = scene.primitives[hit.primitive_index];
+
+        // Light bodies are drawn with a flat colour in the raster view, do the same here. Their
+        // contribution to other surfaces is already accounted for by directLighting()
+        if (primitive.light_index >= 0) {
+            if (depth == 0) {
+                radiance += throughput * primitive.colour;
+            }
+            break;
+        }
+
+        const unsigned int dimension = pixel_dimensions + depth * bounceDimensions();
+        const unsigned char* light_visible =
+            depth == 0 && primary ? primary->light_visible : nullptr;
+        radiance += throughput * directLighting(scene, hit, -ray.direction, sampler,
+                                                dimension + bounce_lights, stats, light_visible);
+
+        if (depth == settings.max_depth) {
+            break;
+        }
+
+        // Diffuse bounce for indirect lighting
+        throughput *= primitive.colour;
+        roulette_throughput *= primitive.colour;
+
+        // Russian roulette once the path has had a few bounces
+        if (depth >= 2) {
+            float survival =
+                std::min(0.95f, std::max(roulette_throughput.x,
+                                         std::max(roulette_throughput.y, roulette_throughput.z)));
+            if (sampler.get(dimension + bounce_roulette) >= survival) {
+                break;
+            }
+            throughput /= survival;
+            roulette_throughput /= survival;
+        }
+
+        const float u1 = sampler.get(dimension + bounce_direction);
+        const float u2 = sampler.get(dimension + bounce_direction + 1);
+        const PathGuideCell* cell =
+            guiding ? path_guide.find(hit.position, hit.normal) : nullptr;
+        glm::vec3 direction;
+        float cosine_over_pdf = pi; // The cosine weighted pdf cancels the cosine term
+        if (!cell) {
+            direction = sampleCosineHemisphere(hit.normal, u1, u2);
+        } else {
+            // One sample from the mixture of the guide and the cosine lobe, weighted by the
+            // mixture's pdf whichever of the two it came from
+            direction = u1 < guiding_fraction
+                            ? PathGuide::sample(*cell, u1 / guiding_fraction, u2)
+                            : sampleCosineHemisphere(hit.normal, (u1 - guiding_fraction) /
+                                                                     (1.0f - guiding_fraction),
+                                                     u2);
+            float cosine = glm::dot(direction, hit.normal);
+            if (cosine <= 0.0f) {
+                break;
+            }
+            float pdf = guiding_fraction * PathGuide::pdf(*cell, direction) +
+                        (1.0f - guiding_fraction) * cosine / pi;
+            cosine_over_pdf = cosine / pdf;
+            throughput *= cosine_over_pdf / pi;
+        }
+
+        if (guide_records) {
+            guide_vertices.push_back(
+                {hit.position, hit.normal, direction, radiance, throughput, cosine_over_pdf});
+        }
+
+        ray = Ray(hit.position + hit.normal * ray_epsilon, direction);
+    }
+
+    // Whatever the path gathered after a bounce came in along its direction, scaled by the
+    // throughput up to there
+    if (guide_records) {
+        for (const GuideVertex& vertex : guide_vertices) {
+            glm::vec3 gathered = radiance - vertex.radiance;
+            glm::vec3 incident(0.0f);
+            for (int c = 0; c < 3; ++c) {
+                if (vertex.throughput[c] > 0.0f) {
+                    incident[c] = gathered[c] / vertex.throughput[c];
+                }
+            }
+            guide_records->push_back({vertex.position, vertex.normal, vertex.direction,
+                                      luminance(incident) * vertex.cosine_over_pdf});
+        }
+    }
+
+    return radiance;
+}
+
+bool RayTracer::samplesLights(const RayTracerScene& scene) const {
+    return settings.light_sampling != LightSampling::ALL &&
+           scene.lights.size() > std::max(settings.light_samples, 1u);
+}
+
+glm::vec3 RayTracer::directLighting(const RayTracerScene& scene, const HitRecord& hit,
+                                    const glm::vec3& view_dir, const PixelSampler& sampler,
+                                    unsigned int first_dimension, BVHTraversalStats& stats,
+                                    const unsigned char* light_visible) const {
+    glm::vec3 total(0.0f);
+
+    if (!samplesLights(scene)) {
+        for (unsigned int l = 0; l < scene.lights.size(); ++l) {
+            total += lightContribution(scene, hit, view_dir, l, stats, light_visible);
+        }
+        return total;
+    }
+
+    // Each sampled light's contribution divided by the probability of picking it is an unbiased
+    // estimate of the sum over every light
+    const unsigned int num_samples = std::max(settings.light_samples, 1u);
+    for (unsigned int s = 0; s < num_samples; ++s) {
+        float u = sampler.get(first_dimension + s);
+        LightSample sample =
+            settings.light_sampling == LightSampling::ALIAS_TABLE
+                ? scene.light_sampler.sampleAliasTable(u)
+                : scene.light_sampler.sampleLightBVH(hit.position, hit.normal, u);
+        if (sample.pdf > 0.0f) {
+            total += lightContribution(scene, hit, view_dir, sample.light, stats, nullptr) /
+                     sample.pdf;
+        }
+    }
+    return total / static_cast<float>(num_samples);
+}
+
+glm::vec3 RayTracer::lightContribution(const RayTracerScene& scene, const HitRecord& hit,
+                                       const glm::vec3& view_dir, unsigned int light_index,
+                                       BVHTraversalStats& stats,
+                                       const unsigned char* light_visible) const {
+    LightTerms terms = lightTerms(scene, hit, view_dir, light_index);
+    if (!terms.needs_shadow_ray) {
+        return terms.shadowed;
+    }
+
+    bool visible = light_visible ? light_visible[light_index] != 0
+                                 : !scene.occluded(terms.shadow_ray, ray_epsilon,
+                                                   terms.shadow_distance, terms.light_primitive,
+                                                   &stats);
+    return visible ? terms.lit : terms.shadowed;
+}
+
+RayTracer::LightTerms RayTracer::lightTerms(const RayTracerScene& scene, const HitRecord& hit,
+                                            const glm::vec3& view_dir,
+                                            unsigned int light_index) const {
+    const ScenePrimitive& primitive = scene.primitives[hit.primitive_index];
+    const SceneLight& light         = scene.lights[light_index];
+    glm::vec3 to_light              = light.position - hit.position;
+    float dist                      = glm::length(to_light);
+    glm::vec3 light_direction       = to_light / dist;
+
+    float attenuation =
+        1.0f / (light.constant + light.linear * dist + light.quadratic * dist * dist);
+
+    glm::vec3 ambient = light.ambient * light.colour * primitive.colour;
+
+    LightTerms terms;
+    terms.shadowed         = ambient * attenuation;
+    terms.lit              = terms.shadowed;
+    terms.needs_shadow_ray = false;
+
+    float n_dot_l = glm::dot(hit.normal, light_direction);
+    if (n_dot_l <= 0.0f) {
+        return terms;
+    }
+
+    glm::vec3 diffuse = n_dot_l * light.diffuse * light.colour * primitive.colour;
+
+    glm::vec3 halfway_dir = glm::normalize(view_dir + light_direction);
+    float specular_factor = std::pow(std::max(glm::dot(hit.normal, halfway_dir), 0.0f),
+                                     primitive.shininess);
+    glm::vec3 specular = specular_factor * light.specular * light.colour * primitive.colour;
+
+    // Shadow ray, ignoring the body of the light itself since the light sits inside it
+    terms.lit              = (ambient + diffuse + specular) * attenuation;
+    terms.needs_shadow_ray = true;
+    terms.shadow_ray       = Ray(hit.position + hit.normal * ray_epsilon, light_direction);
+    terms.shadow_distance  = dist;
+    terms.light_primitive  = light.primitive_index;
+    return terms;
+}
+
+glm::vec3 RayTracer::sampleCosineHemisphere(const glm::vec3& normal, float u1, float u2) {
+    float r   = std::sqrt(u1);
+    float phi = 2.0f * pi * u2;
+
+    glm::vec3 tangent = std::abs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f)
+                                                  : glm::vec3(1.0f, 0.0f, 0.0f);
+    tangent             = glm::normalize(glm::cross(tangent, normal));
+    glm::vec3 bitangent = glm::cross(normal, tangent);
+
+    return glm::normalize(r * std::cos(phi) * tangent + r * std::sin(phi) * bitangent +
+                          std::sqrt(std::max(0.0f, 1.0f - u1)) * normal);
+}
@@ -0,0 +1,637 @@
+#include <raytracer_scene.hpp>
+
+#include <algorithm>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <arrow.hpp>
+#include <cube.hpp>
+#include <hollow_cylinder.hpp>
+#include <intersection.hpp>
+#include <sphere.hpp>
+
+namespace {
+// Same model matrix as the draw() functions
+glm::mat4 modelMatrix(const GameObject& object) {
+    glm::mat4 model(1.0f);
+    model = glm::translate(model, object.pos);
+    model = glm::rotate(model, object.orientation.x, glm::vec3(1.0, 0.0, 0.0));
+    model = glm::rotate(model, object.orientation.y, glm::vec3(0.0, 1.0, 0.0));
+    model = glm::rotate(model, object.orientation.z, glm::vec3(0.0, 0.0, 1.0));
+    model = glm::scale(model, object.scale);
+    return model;
+}
+
+void setTransform(ScenePrimitive& primitive, const glm::mat4& model) {
+    primitive.object_to_world = model;
+    primitive.world_to_object = glm::inverse(model);
+}
+
+SceneShape makeShape(PrimitiveType type, const glm::vec3& min, const glm::vec3& max) {
+    return {type, AABB(min.x, max.x, min.y, max.y, min.z, max.z)};
+}
+
+// Indexed by PrimitiveType, with the boxes the shapes' update_bounding_box() transform
+const SceneShape shapes[] = {
+    makeShape(PrimitiveType::CUBE, glm::vec3(-0.5f), glm::vec3(0.5f)),
+    makeShape(PrimitiveType::SPHERE, glm::vec3(-1.0f), glm::vec3(1.0f)),
+    makeShape(PrimitiveType::HOLLOW_CYLINDER, glm::vec3(-1.0f, -1.0f, -0.5f),
+              glm::vec3(1.0f, 1.0f, 0.5f)),
+    makeShape(PrimitiveType::ARROW,
+              glm::vec3(-std::max(Arrow::head_radius, Arrow::tail_radius),
+                        -std::max(Arrow::head_radius, Arrow::tail_radius),
+                        -0.5f * Arrow::tail_height),
+              glm::vec3(std::max(Arrow::head_radius, Arrow::tail_radius),
+                        std::max(Arrow::head_radius, Arrow::tail_radius),
+                        Arrow::head_height + 0.5f * Arrow::tail_height)),
+};
+
+// Everything but the primitive the light is attached to
+void snapshotLight(const GameObject& object, SceneLight& light) {
+    light.position  = object.pos;
+    light.colour    = object.colour;
+    light.ambient   = object.light->ambient;
+    light.diffuse   = object.light->diffuse;
+    light.specular  = object.light->specular;
+    light.constant  = object.light->constant;
+    light.linear    = object.light->linear;
+    light.quadratic = object.light->quadratic;
+}
+} // namespace
+
+const SceneShape& sceneShape(PrimitiveType type) {
+    return shapes[static_cast<int>(type)];
+}
+
+AABB instanceBounds(const SceneShape& shape, const glm::mat4& object_to_world) {
+    // Centre and half extent of the box, the transformed half extent along each world axis is the
+    // sum of the absolute values the matrix scales the object axes by
+    const AABB& box = shape.object_bounds;
+    glm::vec3 centre(0.5f * (box.xmin + box.xmax), 0.5f * (box.ymin + box.ymax),
+                     0.5f * (box.zmin + box.zmax));
+    glm::vec3 half(0.5f * (box.xmax - box.xmin), 0.5f * (box.ymax - box.ymin),
+                   0.5f * (box.zmax - box.zmin));
+
+    glm::vec3 world_centre = glm::vec3(object_to_world * glm::vec4(centre, 1.0f));
+    glm::vec3 world_half(0.0f);
+    for (int axis = 0; axis < 3; ++axis) {
+        world_half += glm::abs(glm::vec3(object_to_world[axis])) * half[axis];
+    }
+
+    glm::vec3 min = world_centre - world_half;
+    glm::vec3 max = world_centre + world_half;
+    return AABB(min.x, max.x, min.y, max.y, min.z, max.z);
+}
+
+const char* sceneAcceleratorName(SceneAccelerator accelerator) {
+    switch (accelerator) {
+    case SceneAccelerator::LINEAR_SCAN:
+        return "Linear scan";
+    case SceneAccelerator::BVH2:
+        return "Binary BVH";
+    case SceneAccelerator::BVH4:
+        return "BVH4";
+    case SceneAccelerator::BVH8:
+        return "BVH8";
+    case SceneAccelerator::BVH4_QUANTIZED:
+        return "BVH4 quantized";
+    case SceneAccelerator::BVH8_QUANTIZED:
+        return "BVH8 quantized";
+    }
+    return "Unknown";
+}
+
+RayTracerScene::RayTracerScene()
+    : accelerator(SceneAccelerator::BVH8) {
+    setSIMDLevel(CPU::detectSIMDLevel());
+}
+
+RayTracerScene::RayTracerScene(const std::vector<std::shared_ptr<GameObject>>& objects,
+                               const BVHBuildSettings& build_settings)
+    : accelerator(SceneAccelerator::BVH8)
+    , build_settings(build_settings) {
+    setSIMDLevel(CPU::detectSIMDLevel());
+    primitives.reserve(objects.size());
+    object_primitives.assign(objects.size(), -1);
+
+    for (size_t object_index = 0; object_index < objects.size(); ++object_index) {
+        const std::shared_ptr<GameObject>& object = objects[object_index];
+        if (!object->visible) {
+            continue;
+        }
+
+        ScenePrimitive primitive;
+
+        if (std::dynamic_pointer_cast<Cube>(object)) {
+            primitive.type = PrimitiveType::CUBE;
+        } else if (std::dynamic_pointer_cast<Sphere>(object)) {
+            primitive.type = PrimitiveType::SPHERE;
+        } else if (std::dynamic_pointer_cast<HollowCylinder>(object)) {
+            primitive.type = PrimitiveType::HOLLOW_CYLINDER;
+        } else if (std::dynamic_pointer_cast<Arrow>(object)) {
+            primitive.type = PrimitiveType::ARROW;
+        } else {
+            std::cout << "Unexpected object type found when building ray tracer scene"
+                      << std::endl;
+            continue;
+        }
+
+        setTransform(primitive, modelMatrix(*object));
+
+        primitive.colour    = object->colour;
+        primitive.shininess = object->shininess;
+
+        primitive.light_index = -1;
+        if (object->light) {
+            SceneLight light;
+            snapshotLight(*object, light);
+            light.primitive_index = static_cast<int>(primitives.size());
+
+            primitive.light_index = static_cast<int>(lights.size());
+            lights.push_back(light);
+        }
+
+        object_primitives[object_index] = static_cast<int>(primitives.size());
+        primitives.push_back(primitive);
+    }
+
+    buildAccelerationStructures();
+    light_sampler.build(lights);
+}
+
+void RayTracerScene::buildAccelerationStructures() {
+    primitive_bounds.clear();
+    primitive_bounds.reserve(primitives.size());
+    for (const ScenePrimitive& primitive : primitives) {
+        primitive_bounds.push_back(
+            instanceBounds(sceneShape(primitive.type), primitive.object_to_world));
+    }
+    bvh.build(primitive_bounds, build_settings);
+
+    // Group the primitives of every leaf by type so they can be tested in batches
+    for (const BVHNode& node : bvh.nodes) {
+        if (node.count > 1) {
+            auto first = bvh.primitive_indices.begin() + node.left_first;
+            std::stable_sort(first, first + node.count, [&](unsigned int a, unsigned int b) {
+                return primitives[a].type < primitives[b].type;
+            });
+        }
+    }
+
+    bvh4.build(bvh);
+    bvh8.build(bvh);
+    quantized_bvh4.build(bvh4);
+    quantized_bvh8.build(bvh8);
+
+    std::vector<PrimitiveType> types;
+    std::vector<glm::mat4> world_to_object;
+    types.reserve(primitives.size());
+    world_to_object.reserve(primitives.size());
+    for (const ScenePrimitive& primitive : primitives) {
+        types.push_back(primitive.type);
+        world_to_object.push_back(primitive.world_to_object);
+    }
+    batches.shape.hollow_cylinder_inner_radius = 1.0f - HollowCylinder::thickness;
+    batches.shape.arrow_tail_radius            = Arrow::tail_radius;
+    batches.shape.arrow_tail_height            = Arrow::tail_height;
+    batches.shape.arrow_head_radius            = Arrow::head_radius;
+    batches.shape.arrow_head_height            = Arrow::head_height;
+    batches.build(bvh.primitive_indices, types, world_to_object);
+
+    primitive_slots.resize(primitives.size());
+    for (unsigned int slot = 0; slot < bvh.primitive_indices.size(); ++slot) {
+        primitive_slots[bvh.primitive_indices[slot]] = slot;
+    }
+}
+
+size_t RayTracerScene::memoryUsage() const {
+    size_t bytes = primitives.capacity() * sizeof(ScenePrimitive) +
+                   primitive_bounds.capacity() * sizeof(AABB) +
+                   primitive_slots.capacity() * sizeof(unsigned int) +
+                   object_primitives.capacity() * sizeof(int);
+    bytes += bvh.nodes.capacity() * sizeof(BVHNode) +
+             bvh.primitive_indices.capacity() * sizeof(unsigned int);
+    bytes += bvh4.nodes.capacity() * sizeof(WideBVHNode<4>) +
+             bvh4.primitive_indices.capacity() * sizeof(unsigned int);
+    bytes += bvh8.nodes.capacity() * sizeof(WideBVHNode<8>) +
+             bvh8.primitive_indices.capacity() * sizeof(unsigned int);
+    bytes += quantized_bvh4.nodes.capacity() * sizeof(QuantizedBVHNode<4>) +
+             quantized_bvh8.nodes.capacity() * sizeof(QuantizedBVHNode<8>);
+    for (const std::vector<float>& row : batches.world_to_object) {
+        bytes += row.capacity() * sizeof(float);
+    }
+    bytes += batches.types.capacity() * sizeof(PrimitiveType);
+    return bytes;
+}
+
+bool RayTracerScene::refitObjects(const std::vector<std::shared_ptr<GameObject>>& objects,
+                                  const std::vector<unsigned int>& changed) {
+    if (objects.size() != object_primitives.size()) {
+        return false;
+    }
+
+    // Check everything first so the scene is left as it was when it has to be made again
+    for (unsigned int object_index : changed) {
+        const GameObject& object = *objects[object_index];
+        int primitive_index      = object_primitives[object_index];
+        if (object.visible != (primitive_index >= 0)) {
+            return false;
+        }
+        if (primitive_index >= 0 &&
+            (object.light != nullptr) != (primitives[primitive_index].light_index >= 0)) {
+            return false;
+        }
+    }
+
+    std::vector<unsigned int> moved;
+    bool lights_changed = false;
+    for (unsigned int object_index : changed) {
+        int primitive_index = object_primitives[object_index];
+        if (primitive_index < 0) {
+            continue;
+        }
+        const std::shared_ptr<GameObject>& object = objects[object_index];
+        ScenePrimitive& primitive                 = primitives[primitive_index];
+
+        glm::mat4 model = modelMatrix(*object);
+        if (model != primitive.object_to_world) {
+            // Only the instance changes, its shape and its bounds in object space stay put
+            setTransform(primitive, model);
+            primitive_bounds[primitive_index] = instanceBounds(sceneShape(primitive.type), model);
+            batches.setTransform(primitive_slots[primitive_index], primitive.world_to_object);
+            moved.push_back(static_cast<unsigned int>(primitive_index));
+        }
+
+        primitive.colour    = object->colour;
+        primitive.shininess = object->shininess;
+
+        if (primitive.light_index >= 0) {
+            snapshotLight(*object, lights[primitive.light_index]);
+            lights_changed = true;
+        }
+    }
+
+    if (!moved.empty()) {
+        std::vector<unsigned int> changed_nodes;
+        bvh.refit(primitive_bounds, moved, &changed_nodes);
+        std::vector<unsigned int> changed_bvh4_nodes;
+        std::vector<unsigned int> changed_bvh8_nodes;
+        bvh4.refit(bvh, changed_nodes, &changed_bvh4_nodes);
+        bvh8.refit(bvh, changed_nodes, &changed_bvh8_nodes);
+        quantized_bvh4.refit(bvh4, changed_bvh4_nodes);
+        quantized_bvh8.refit(bvh8, changed_bvh8_nodes);
+    }
+    if (lights_changed) {
+        light_sampler.build(lights);
+    }
+    return true;
+}
+
+void RayTracerScene::setSIMDLevel(CPU::SIMDLevel level) {
+    simd_level    = std::min(level, CPU::detectSIMDLevel());
+    batch_kernel  = selectPrimitiveBatchKernel(simd_level, batch_width);
+    packet_kernel = selectPacketBoundsKernel(simd_level);
+    bvh4.setSIMDLevel(simd_level);
+    bvh8.setSIMDLevel(simd_level);
+    quantized_bvh4.setSIMDLevel(simd_level);
+    quantized_bvh8.setSIMDLevel(simd_level);
+}
+
+CPU::SIMDLevel RayTracerScene::getSIMDLevel() const {
+    return simd_level;
+}
+
+bool RayTracerScene::intersect(const Ray& ray, float t_min, float t_max, HitRecord& hit,
+                               int skip_primitive, BVHTraversalStats* stats) const {
+    int primitive_index = -1;
+    glm::vec3 object_normal;
+
+    auto intersect_leaf = [&](unsigned int first, unsigned int count, float t_lower,
+                              float& t_upper) {
+        return intersectSlots(ray, first, count, t_lower, t_upper, skip_primitive,
+                              primitive_index, object_normal);
+    };
+
+    switch (accelerator) {
+    case SceneAccelerator::LINEAR_SCAN:
+        intersect_leaf(0, static_cast<unsigned int>(primitives.size()), t_min, t_max);
+        if (stats) {
+            stats->rays++;
+            stats->primitive_tests += primitives.size();
+        }
+        break;
+    case SceneAccelerator::BVH2:
+        bvh.intersect(ray, t_min, t_max, intersect_leaf, stats);
+        break;
+    case SceneAccelerator::BVH4:
+        bvh4.intersect(ray, t_min, t_max, intersect_leaf, stats);
+        break;
+    case SceneAccelerator::BVH8:
+        bvh8.intersect(ray, t_min, t_max, intersect_leaf, stats);
+        break;
+    case SceneAccelerator::BVH4_QUANTIZED:
+        if (quantized_bvh4.nodes.empty()) {
+            bvh4.intersect(ray, t_min, t_max, intersect_leaf, stats);
+        } else {
+            quantized_bvh4.intersect(ray, t_min, t_max, intersect_leaf, stats);
+        }
+        break;
+    case SceneAccelerator::BVH8_QUANTIZED:
+        if (quantized_bvh8.nodes.empty()) {
+            bvh8.intersect(ray, t_min, t_max, intersect_leaf, stats);
+        } else {
+            quantized_bvh8.intersect(ray, t_min, t_max, intersect_leaf, stats);
+        }
+        break;
+    }
+
+    if (primitive_index < 0) {
+        return false;
+    }
+
+    // t_max has been shrunk down to the closest hit
+    hit.t               = t_max;
+    hit.primitive_index = primitive_index;
+    finishHit(ray, object_normal, hit);
+    return true;
+}
+
+bool RayTracerScene::occluded(const Ray& ray, float t_min, float t_max, int skip_primitive,
+                              BVHTraversalStats* stats) const {
+    auto occluded_leaf = [&](unsigned int first, unsigned int count, float t_lower,
+                             float t_upper) {
+        return occludedSlots(ray, first, count, t_lower, t_upper, skip_primitive);
+    };
+
+    switch (accelerator) {
+    case SceneAccelerator::LINEAR_SCAN:
+        if (stats) {
+            stats->rays++;
+            stats->primitive_tests += primitives.size();
+        }
+        return occluded_leaf(0, static_cast<unsigned int>(primitives.size()), t_min, t_max);
+    case SceneAccelerator::BVH2:
+        return bvh.occluded(ray, t_min, t_max, occluded_leaf, stats);
+    case SceneAccelerator::BVH4:
+        return bvh4.occluded(ray, t_min, t_max, occluded_leaf, stats);
+    case SceneAccelerator::BVH8:
+        return bvh8.occluded(ray, t_min, t_max, occluded_leaf, stats);
+    case SceneAccelerator::BVH4_QUANTIZED:
+        if (quantized_bvh4.nodes.empty()) {
+            return bvh4.occluded(ray, t_min, t_max, occluded_leaf, stats);
+        }
+        return quantized_bvh4.occluded(ray, t_min, t_max, occluded_leaf, stats);
+    case SceneAccelerator::BVH8_QUANTIZED:
+        if (quantized_bvh8.nodes.empty()) {
+            return bvh8.occluded(ray, t_min, t_max, occluded_leaf, stats);
+        }
+        return quantized_bvh8.occluded(ray, t_min, t_max, occluded_leaf, stats);
+    }
+    return false;
+}
+
+unsigned int RayTracerScene::intersectPacket(RayPacket& packet, float t_min, HitRecord* hits,
+                                             BVHTraversalStats* stats) const {
+    unsigned int hit_mask = 0;
+
+    if (!packet.coherent || accelerator == SceneAccelerator::LINEAR_SCAN) {
+        for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+            if ((packet.active & (1u << lane)) &&
+                intersect(packet.getRay(lane), t_min, packet.t_max[lane], hits[lane], -1, stats)) {
+                hit_mask |= 1u << lane;
+            }
+        }
+        if (stats && packet.active != 0) {
+            stats->packet_fallbacks++;
+        }
+        return hit_mask;
+    }
+
+    Ray rays[RayPacket::size];
+    glm::vec3 object_normals[RayPacket::size];
+    for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+        if (packet.active & (1u << lane)) {
+            rays[lane] = packet.getRay(lane);
+        }
+    }
+
+    auto intersect_lane = [&](unsigned int lane, unsigned int index, float t_lower,
+                              float& t_upper) {
+        float t;
+        glm::vec3 normal;
+        if (!intersectPrimitive(primitives[index], rays[lane], t_lower, t_upper, t, normal)) {
+            return false;
+        }
+        t_upper                    = t;
+        hits[lane].t               = t;
+        hits[lane].primitive_index = static_cast<int>(index);
+        object_normals[lane]       = normal;
+        hit_mask |= 1u << lane;
+        return true;
+    };
+    ::intersectPacket(bvh, packet, t_min, false, packet_kernel, intersect_lane, stats);
+
+    for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+        if (hit_mask & (1u << lane)) {
+            finishHit(rays[lane], object_normals[lane], hits[lane]);
+        }
+    }
+    return hit_mask;
+}
+
+unsigned int RayTracerScene::occludedPacket(RayPacket& packet, float t_min, int skip_primitive,
+                                            BVHTraversalStats* stats) const {
+    unsigned int occluded = 0;
+
+    if (!packet.coherent || accelerator == SceneAccelerator::LINEAR_SCAN) {
+        for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+            if ((packet.active & (1u << lane)) &&
+                this->occluded(packet.getRay(lane), t_min, packet.t_max[lane], skip_primitive,
+                               stats)) {
+                occluded |= 1u << lane;
+            }
+        }
+        if (stats && packet.active != 0) {
+            stats->packet_fallbacks++;
+        }
+        return occluded;
+    }
+
+    Ray rays[RayPacket::size];
+    for (unsigned int lane = 0; lane < RayPacket::size; ++lane) {
+        if (packet.active & (1u << lane)) {
+            rays[lane] = packet.getRay(lane);
+        }
+    }
+
+    auto intersect_lane = [&](unsigned int lane, unsigned int index, float t_lower,
+                              float& t_upper) {
+        if (static_cast<int>(index) == skip_primitive) {
+            return false;
+        }
+        float t;
+        glm::vec3 normal;
+        if (!intersectPrimitive(primitives[index], rays[lane], t_lower, t_upper, t, normal)) {
+            return false;
+        }
+        occluded |= 1u << lane;
+        return true;
+    };
+    ::intersectPacket(bvh, packet, t_min, true, packet_kernel, intersect_lane, stats);
+
+    return occluded;
+}
+
+bool RayTracerScene::intersectSlots(const Ray& ray, unsigned int first, unsigned int count,
+                                    float t_min, float& t_max, int skip_primitive,
+                                    int& primitive_index, glm::vec3& object_normal) const {
+    bool found = false;
+
+    // Shrinks the interval so that only closer hits are accepted from now on
+    auto intersect_exact = [&](unsigned int slot) {
+        unsigned int index = bvh.primitive_indices[slot];
+        if (static_cast<int>(index) == skip_primitive) {
+            return;
+        }
+        float t;
+        glm::vec3 normal;
+        if (intersectPrimitive(primitives[index], ray, t_min, t_max, t, normal)) {
+            t_max           = t;
+            primitive_index = static_cast<int>(index);
+            object_normal   = normal;
+            found           = true;
+        }
+    };
+
+    const unsigned int end = first + count;
+    unsigned int slot      = first;
+    while (slot < end) {
+        PrimitiveType type = batches.types[slot];
+        unsigned int run   = 1;
+        while (slot + run < end && run < batch_width && batches.types[slot + run] == type) {
+            run++;
+        }
+
+        if (run == 1 || !batch_kernel) {
+            for (unsigned int i = 0; i < run; ++i) {
+                intersect_exact(slot + i);
+            }
+            slot += run;
+            continue;
+        }
+
+        float t_hit[PrimitiveBatches::padding];
+        batch_kernel(batches, slot, run, type, ray, t_min, t_max, t_hit);
+
+        // Most lanes miss. The exact routine, which also gives the normal, only has to run on the
+        // remaining ones, closest first so that the others are usually culled by the new t_max
+        unsigned int candidates[PrimitiveBatches::padding];
+        unsigned int num_candidates = 0;
+        for (unsigned int lane = 0; lane < run; ++lane) {
+            if (t_hit[lane] < t_max) {
+                unsigned int j = num_candidates++;
+                while (j > 0 && t_hit[candidates[j - 1]] > t_hit[lane]) {
+                    candidates[j] = candidates[j - 1];
+                    j--;
+                }
+                candidates[j] = lane;
+            }
+        }
+        for (unsigned int i = 0; i < num_candidates && t_hit[candidates[i]] < t_max; ++i) {
+            intersect_exact(slot + candidates[i]);
+        }
+
+        slot += run;
+    }
+
+    return found;
+}
+
+bool RayTracerScene::occludedSlots(const Ray& ray, unsigned int first, unsigned int count,
+                                   float t_min, float t_max, int skip_primitive) const {
+    auto occluded_exact = [&](unsigned int slot) {
+        unsigned int index = bvh.primitive_indices[slot];
+        if (static_cast<int>(index) == skip_primitive) {
+            return false;
+        }
+        float t;
+        glm::vec3 normal;
+        return intersectPrimitive(primitives[index], ray, t_min, t_max, t, normal);
+    };
+
+    const unsigned int end = first + count;
+    unsigned int slot      = first;
+    while (slot < end) {
+        PrimitiveType type = batches.types[slot];
+        unsigned int run   = 1;
+        while (slot + run < end && run < batch_width && batches.types[slot + run] == type) {
+            run++;
+        }
+
+        if (run == 1 || !batch_kernel) {
+            for (unsigned int i = 0; i < run; ++i) {
+                if (occluded_exact(slot + i)) {
+                    return true;
+                }
+            }
+            slot += run;
+            continue;
+        }
+
+        // Unlike intersectSlots() the candidates are confirmed in lane order, any of them will do
+        float t_hit[PrimitiveBatches::padding];
+        batch_kernel(batches, slot, run, type, ray, t_min, t_max, t_hit);
+        for (unsigned int lane = 0; lane < run; ++lane) {
+            if (t_hit[lane] < t_max && occluded_exact(slot + lane)) {
+                return true;
+            }
+        }
+
+        slot += run;
+    }
+
+    return false;
+}
+
+void RayTracerScene::finishHit(const Ray& ray, const glm::vec3& object_normal,
+                               HitRecord& hit) const {
+    hit.position = ray.at(hit.t);
+
+    // Normals go to world space with the inverse transpose of the object to world transform
+    glm::vec3 world_normal =
+        glm::transpose(glm::mat3(primitives[hit.primitive_index].world_to_object)) * object_normal;
+    if (glm::dot(world_normal, world_normal) < 1e-20f) {
+        // Degenerate normal (e.g. tip of the arrow head), face the ray instead
+        world_normal = -ray.direction;
+    }
+    world_normal = glm::normalize(world_normal);
+
+    // Make the normal face the incoming ray so inside surfaces (tubes) are shaded correctly
+    if (glm::dot(world_normal, ray.direction) > 0.0f) {
+        world_normal = -world_normal;
+    }
+    hit.normal = world_normal;
+}
+
+bool RayTracerScene::intersectPrimitive(const ScenePrimitive& primitive, const Ray& ray,
+                                        float t_min, float t_max, float& t,
+                                        glm::vec3& normal) const {
+    // Transform the ray into object space. The direction is left unnormalised so t is unchanged
+    glm::vec3 origin    = glm::vec3(primitive.world_to_object * glm::vec4(ray.origin, 1.0f));
+    glm::vec3 direction = glm::mat3(primitive.world_to_object) * ray.direction;
+
+    switch (primitive.type) {
+    case PrimitiveType::CUBE:
+        return Intersection::rayUnitCube(origin, direction, t_min, t_max, t, normal);
+    case PrimitiveType::SPHERE:
+        return Intersection::rayUnitSphere(origin, direction, t_min, t_max, t, normal);
+    case PrimitiveType::HOLLOW_CYLINDER:
+        return Intersection::rayHollowCylinder(origin, direction, t_min, t_max,
+                                               1.0f - HollowCylinder::thickness, t, normal);
+    case PrimitiveType::ARROW:
+        return Intersection::rayArrow(origin, direction, t_min, t_max, Arrow::tail_radius,
+                                      Arrow::tail_height, Arrow::head_radius, Arrow::head_height,
+                                      t, normal);
+    }
+    return false;
+}
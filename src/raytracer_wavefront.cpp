@@ -0,0 +1,354 @@
+#include <raytracer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <numeric>
+
+namespace {
+// Rays are binned on a grid of 2^origin_cell_bits cells per axis over the scene's bounds
+constexpr unsigned int origin_cell_bits = 4;
+
+// Paths waiting for their next bounce to be traced. What outlives a bounce, the pixel, the sample
+// and the radiance gathered so far, is kept in arrays indexed by the path's id instead
+struct RayQueue {
+    void clear() {
+        path.clear();
+        origin.clear();
+        direction.clear();
+        throughput.clear();
+    }
+
+    void push(unsigned int path_id, const Ray& ray, const glm::vec3& path_throughput) {
+        path.push_back(path_id);
+        origin.push_back(ray.origin);
+        direction.push_back(ray.direction);
+        throughput.push_back(path_throughput);
+    }
+
+    [[nodiscard]] size_t size() const {
+        return path.size();
+    }
+
+    std::vector<unsigned int> path;
+    std::vector<glm::vec3> origin;
+    std::vector<glm::vec3> direction;
+    std::vector<glm::vec3> throughput;
+};
+
+// Shadow rays of one bounce, along with what they add to their path either way
+struct ShadowQueue {
+    void clear() {
+        path.clear();
+        origin.clear();
+        direction.clear();
+        distance.clear();
+        light_primitive.clear();
+        lit.clear();
+        shadowed.clear();
+    }
+
+    [[nodiscard]] size_t size() const {
+        return path.size();
+    }
+
+    std::vector<unsigned int> path;
+    std::vector<glm::vec3> origin;
+    std::vector<glm::vec3> direction;
+    std::vector<float> distance;
+    std::vector<int> light_primitive;
+    std::vector<glm::vec3> lit;
+    std::vector<glm::vec3> shadowed;
+};
+
+// Spreads the low 10 bits of v out to every third bit
+uint32_t spreadBits(uint32_t v) {
+    v = (v | (v << 16)) & 0x030000ffu;
+    v = (v | (v << 8)) & 0x0300f00fu;
+    v = (v | (v << 4)) & 0x030c30c3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+}
+
+// Stable LSD radix sort, 8 bits per pass, of the indices of keys by the low key_bits bits of the
+// keys. Ties keep their index order, so the result is deterministic
+void sortByKey(const std::vector<uint32_t>& keys, unsigned int key_bits,
+               std::vector<uint32_t>& order, std::vector<uint32_t>& scratch) {
+    const size_t n = keys.size();
+    order.resize(n);
+    scratch.resize(n);
+    std::iota(order.begin(), order.end(), 0);
+
+    for (unsigned int shift = 0; shift < key_bits; shift += 8) {
+        size_t offsets[257] = {};
+        for (size_t i = 0; i < n; ++i) {
+            offsets[((keys[i] >> shift) & 0xffu) + 1]++;
+        }
+        for (unsigned int digit = 1; digit < 257; ++digit) {
+            offsets[digit] += offsets[digit - 1];
+        }
+        for (uint32_t index : order) {
+            scratch[offsets[(keys[index] >> shift) & 0xffu]++] = index;
+        }
+        std::swap(order, scratch);
+    }
+}
+
+// Sorts rays by direction octant, then by the Morton order of the grid cell their origin is in
+class RayBinner {
+public:
+    explicit RayBinner(const BVH& bvh)
+        : bounds_min(0.0f)
+        , cell_scale(0.0f) {
+        if (!bvh.nodes.empty()) {
+            bounds_min     = bvh.nodes[0].bounds_min;
+            glm::vec3 size = glm::max(bvh.nodes[0].bounds_max - bounds_min, glm::vec3(1e-6f));
+            cell_scale     = static_cast<float>(1u << origin_cell_bits) / size;
+        }
+    }
+
+    [[nodiscard]] uint32_t key(const glm::vec3& origin, const glm::vec3& direction) const {
+        const float max_cell = static_cast<float>((1u << origin_cell_bits) - 1);
+        glm::vec3 cell       = glm::clamp((origin - bounds_min) * cell_scale, 0.0f, max_cell);
+
+        uint32_t morton = spreadBits(static_cast<uint32_t>(cell.x)) |
+                          (spreadBits(static_cast<uint32_t>(cell.y)) << 1) |
+                          (spreadBits(static_cast<uint32_t>(cell.z)) << 2);
+        uint32_t octant = (direction.x < 0.0f ? 1u : 0u) | (direction.y < 0.0f ? 2u : 0u) |
+                          (direction.z < 0.0f ? 4u : 0u);
+        return (octant << (3 * origin_cell_bits)) | morton;
+    }
+
+    // Indices of the rays in key order
+    void sort(const std::vector<glm::vec3>& origin, const std::vector<glm::vec3>& direction,
+              std::vector<uint32_t>& keys, std::vector<uint32_t>& order,
+              std::vector<uint32_t>& scratch) const {
+        keys.resize(origin.size());
+        for (size_t i = 0; i < origin.size(); ++i) {
+            keys[i] = key(origin[i], direction[i]);
+        }
+        sortByKey(keys, 3 * origin_cell_bits + 3, order, scratch);
+    }
+
+private:
+    glm::vec3 bounds_min;
+    glm::vec3 cell_scale;
+};
+
+float millisecondsSince(std::chrono::steady_clock::time_point& start) {
+    auto now    = std::chrono::steady_clock::now();
+    float delta = std::chrono::duration<float, std::milli>(now - start).count();
+    start       = now;
+    return delta;
+}
+} // namespace
+
+void RayTracer::sampleTileWavefront(const RayTracerScene& scene, const CameraFrame& frame,
+                                    const Tile& tile, unsigned int samples,
+                                    std::vector<PixelEstimate>& estimates,
+                                    uint32_t first_sample, BVHTraversalStats& stats,
+                                    WavefrontStats& wavefront_stats) const {
+    auto clock = std::chrono::steady_clock::now();
+
+    const unsigned int tile_width = tile.x1 - tile.x0;
+    const RayBinner binner(scene.bvh);
+    const bool sample_lights       = samplesLights(scene);
+    const unsigned int num_samples = std::max(settings.light_samples, 1u);
+
+    // Camera rays of every sample of every pixel that has not converged
+    std::vector<unsigned int> path_pixel; // Index into estimates, by path id
+    std::vector<uint32_t> path_sample;    // Sample index within the pixel
+    std::vector<unsigned int> path_x;
+    std::vector<unsigned int> path_y;
+    std::vector<glm::vec3> path_radiance;
+    std::vector<FirstHit> path_first_hit;
+    RayQueue queue;
+    for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+        for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+            unsigned int pixel = (y - tile.y0) * tile_width + (x - tile.x0);
+            if (estimates[pixel].converged) {
+                continue;
+            }
+            for (unsigned int s = 0; s < samples; ++s) {
+                unsigned int path_id = static_cast<unsigned int>(path_pixel.size());
+                uint32_t sample      = first_sample + estimates[pixel].samples + s;
+                path_pixel.push_back(pixel);
+                path_sample.push_back(sample);
+                path_x.push_back(x);
+                path_y.push_back(y);
+                path_radiance.push_back(glm::vec3(0.0f));
+
+                PixelSampler sampler = pixelSampler(x, y, sample);
+                queue.push(path_id, frame.generateRay(x + sampler.get(0), y + sampler.get(1)),
+                           glm::vec3(1.0f));
+            }
+        }
+    }
+    path_first_hit.resize(settings.feature_buffers ? path_pixel.size() : 0);
+    wavefront_stats.generate_time += millisecondsSince(clock);
+
+    RayQueue next_queue;
+    ShadowQueue shadows;
+    std::vector<HitRecord> hits;
+    std::vector<unsigned char> found;
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> scratch;
+
+    // Shading key: primitive type above the primitive index, misses after every type
+    unsigned int index_bits = 0;
+    while ((static_cast<size_t>(1) << index_bits) < scene.primitives.size()) {
+        index_bits++;
+    }
+    const uint32_t miss_type = static_cast<uint32_t>(PrimitiveType::ARROW) + 1;
+    unsigned int type_bits   = 0;
+    while ((1u << type_bits) <= miss_type) {
+        type_bits++;
+    }
+
+    for (unsigned int depth = 0; depth <= settings.max_depth && queue.size() > 0; ++depth) {
+        // Extend: closest hit of every queued ray, in binned order
+        binner.sort(queue.origin, queue.direction, keys, order, scratch);
+        wavefront_stats.sort_time += millisecondsSince(clock);
+
+        hits.resize(queue.size());
+        found.resize(queue.size());
+        for (uint32_t i : order) {
+            found[i] = scene.intersect(Ray(queue.origin[i], queue.direction[i]), ray_epsilon,
+                                         std::numeric_limits<float>::max(), hits[i], -1, &stats);
+        }
+        wavefront_stats.extension_rays += queue.size();
+        wavefront_stats.extend_time += millisecondsSince(clock);
+
+        // Shade: hits grouped by primitive type, then by primitive, so every primitive's data is
+        // loaded once per bounce. Direct lighting only queues its shadow rays
+        keys.resize(queue.size());
+        for (size_t i = 0; i < queue.size(); ++i) {
+            keys[i] = miss_type << index_bits;
+            if (found[i]) {
+                int primitive = hits[i].primitive_index;
+                keys[i] = (static_cast<uint32_t>(scene.primitives[primitive].type) << index_bits) |
+                          static_cast<uint32_t>(primitive);
+            }
+        }
+        sortByKey(keys, index_bits + type_bits, order, scratch);
+        wavefront_stats.sort_time += millisecondsSince(clock);
+
+        next_queue.clear();
+        shadows.clear();
+        for (uint32_t i : order) {
+            unsigned int path_id       = queue.path[i];
+            glm::vec3 throughput       = queue.throughput[i];
+            glm::vec3& radiance        = path_radiance[path_id];
+            const HitRecord& hit       = hits[i];
+            const glm::vec3& direction = queue.direction[i];
+
+            if (depth == 0 && settings.feature_buffers) {
+                FirstHit& first_hit = path_first_hit[path_id];
+                first_hit.albedo    = found[i] ? scene.primitives[hit.primitive_index].colour
+                                               : glm::vec3(1.0f);
+                first_hit.normal    = found[i] ? hit.normal : glm::vec3(0.0f);
+                first_hit.depth     = found[i] ? hit.t : 0.0f;
+            }
+
+            if (!found[i]) {
+                radiance += throughput * settings.background;
+                continue;
+            }
+
+            const ScenePrimitive& primitive = scene.primitives[hit.primitive_index];
+
+            // Light bodies are drawn with a flat colour, as in tracePath()
+            if (primitive.light_index >= 0) {
+                if (depth == 0) {
+                    radiance += throughput * primitive.colour;
+                }
+                continue;
+            }
+
+            // Same dimensions as tracePath() uses
+            const PixelSampler sampler =
+                pixelSampler(path_x[path_id], path_y[path_id], path_sample[path_id]);
+            const unsigned int dimension = pixel_dimensions + depth * bounceDimensions();
+
+            auto queue_light = [&](unsigned int light_index, const glm::vec3& weight) {
+                LightTerms terms = lightTerms(scene, hit, -direction, light_index);
+                if (!terms.needs_shadow_ray) {
+                    radiance += weight * terms.shadowed;
+                    return;
+                }
+                shadows.path.push_back(path_id);
+                shadows.origin.push_back(terms.shadow_ray.origin);
+                shadows.direction.push_back(terms.shadow_ray.direction);
+                shadows.distance.push_back(terms.shadow_distance);
+                shadows.light_primitive.push_back(terms.light_primitive);
+                shadows.lit.push_back(weight * terms.lit);
+                shadows.shadowed.push_back(weight * terms.shadowed);
+            };
+            if (!sample_lights) {
+                for (unsigned int l = 0; l < scene.lights.size(); ++l) {
+                    queue_light(l, throughput);
+                }
+            } else {
+                for (unsigned int s = 0; s < num_samples; ++s) {
+                    float u = sampler.get(dimension + bounce_lights + s);
+                    LightSample sample =
+                        settings.light_sampling == LightSampling::ALIAS_TABLE
+                            ? scene.light_sampler.sampleAliasTable(u)
+                            : scene.light_sampler.sampleLightBVH(hit.position, hit.normal, u);
+                    if (sample.pdf > 0.0f) {
+                        queue_light(sample.light, throughput / (sample.pdf * num_samples));
+                    }
+                }
+            }
+
+            if (depth == settings.max_depth) {
+                continue;
+            }
+
+            // Diffuse bounce, with Russian roulette once the path has had a few
+            throughput *= primitive.colour;
+            if (depth >= 2) {
+                float survival = std::min(0.95f, std::max(throughput.x, std::max(throughput.y,
+                                                                                 throughput.z)));
+                if (sampler.get(dimension + bounce_roulette) >= survival) {
+                    continue;
+                }
+                throughput /= survival;
+            }
+
+            glm::vec3 next_direction =
+                sampleCosineHemisphere(hit.normal, sampler.get(dimension + bounce_direction),
+                                       sampler.get(dimension + bounce_direction + 1));
+            next_queue.push(path_id, Ray(hit.position + hit.normal * ray_epsilon, next_direction),
+                            throughput);
+        }
+        wavefront_stats.shade_time += millisecondsSince(clock);
+
+        // Shadow: any hit test of every queued shadow ray, in binned order
+        binner.sort(shadows.origin, shadows.direction, keys, order, scratch);
+        wavefront_stats.sort_time += millisecondsSince(clock);
+
+        for (uint32_t i : order) {
+            bool blocked =
+                scene.occluded(Ray(shadows.origin[i], shadows.direction[i]), ray_epsilon,
+                               shadows.distance[i], shadows.light_primitive[i], &stats);
+            path_radiance[shadows.path[i]] += blocked ? shadows.shadowed[i] : shadows.lit[i];
+        }
+        wavefront_stats.shadow_rays += shadows.size();
+        wavefront_stats.shadow_time += millisecondsSince(clock);
+
+        std::swap(queue, next_queue);
+    }
+
+    // Samples are added in the order sampleTile() adds them. A path's shadow rays are binned by
+    // their own keys, so the image does not depend on the tile size or the thread count, but they
+    // add up in another order than sampleTile() adds them and only match it up to float rounding
+    for (unsigned int path_id = 0; path_id < path_pixel.size(); ++path_id) {
+        PixelEstimate& estimate = estimates[path_pixel[path_id]];
+        estimate.addSample(path_radiance[path_id]);
+        if (settings.feature_buffers) {
+            estimate.addFeatures(path_first_hit[path_id]);
+        }
+    }
+}
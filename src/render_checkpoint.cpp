@@ -0,0 +1,309 @@
+#include <render_checkpoint.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <tile_scheduler.hpp>
+
+namespace {
+constexpr char checkpoint_magic[4]    = {'R', 'T', 'C', 'K'};
+constexpr uint32_t checkpoint_version = 1;
+
+// 64 bit FNV-1a over the bytes of every value added
+class Fingerprint {
+public:
+    Fingerprint()
+        : hash(0xcbf29ce484222325ull) {}
+
+    void add(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+    }
+
+    void add(float value) {
+        add(&value, sizeof(value));
+    }
+
+    void add(uint32_t value) {
+        add(&value, sizeof(value));
+    }
+
+    void add(int value) {
+        add(&value, sizeof(value));
+    }
+
+    void add(const glm::vec3& value) {
+        add(value.x);
+        add(value.y);
+        add(value.z);
+    }
+
+    void add(const glm::mat4& value) {
+        for (int column = 0; column < 4; ++column) {
+            for (int row = 0; row < 4; ++row) {
+                add(value[column][row]);
+            }
+        }
+    }
+
+    uint64_t hash;
+};
+
+template <typename T> void writeValue(std::ofstream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T> bool readValue(std::ifstream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+} // namespace
+
+RenderCheckpoint::RenderCheckpoint()
+    : RenderCheckpoint("", 60.0f) {}
+
+RenderCheckpoint::RenderCheckpoint(const std::string& path, float save_interval)
+    : path(path)
+    , save_interval(save_interval)
+    , render_fingerprint(0)
+    , width(0)
+    , height(0)
+    , tile_size(0)
+    , pass(0)
+    , samples_per_pixel(0)
+    , sampler(SamplerType::SOBOL)
+    , sampler_seed(0)
+    , has_features(false) {}
+
+uint64_t RenderCheckpoint::fingerprint(const RayTracerScene& scene, const Camera& camera,
+                                       const RayTracerSettings& settings, unsigned int pass) {
+    Fingerprint hash;
+
+    for (const ScenePrimitive& primitive : scene.primitives) {
+        hash.add(static_cast<uint32_t>(primitive.type));
+        hash.add(primitive.object_to_world);
+        hash.add(primitive.colour);
+        hash.add(primitive.shininess);
+        hash.add(primitive.light_index);
+    }
+    for (const SceneLight& light : scene.lights) {
+        hash.add(light.position);
+        hash.add(light.colour);
+        hash.add(light.ambient);
+        hash.add(light.diffuse);
+        hash.add(light.specular);
+        hash.add(light.constant);
+        hash.add(light.linear);
+        hash.add(light.quadratic);
+        hash.add(light.primitive_index);
+    }
+
+    hash.add(camera.pos);
+    hash.add(camera.front);
+    hash.add(camera.up);
+    hash.add(camera.fov);
+
+    hash.add(settings.width);
+    hash.add(settings.height);
+    hash.add(settings.samples_per_pixel);
+    hash.add(settings.max_depth);
+    hash.add(static_cast<uint32_t>(settings.adaptive_sampling));
+    hash.add(settings.adaptive_threshold);
+    hash.add(settings.adaptive_min_samples);
+    hash.add(static_cast<uint32_t>(settings.feature_buffers));
+    hash.add(static_cast<uint32_t>(settings.packet_primary_rays));
+    hash.add(static_cast<uint32_t>(settings.packet_shadow_rays));
+    hash.add(static_cast<uint32_t>(settings.wavefront));
+    hash.add(static_cast<uint32_t>(settings.light_sampling));
+    hash.add(settings.light_samples);
+    hash.add(static_cast<uint32_t>(settings.path_guiding));
+    hash.add(settings.guiding_training_passes);
+    hash.add(settings.guiding_fraction);
+    hash.add(settings.guiding_resolution);
+    hash.add(settings.guiding_memory);
+    hash.add(static_cast<uint32_t>(settings.sampler));
+    hash.add(settings.sampler_seed);
+    hash.add(settings.background);
+    hash.add(pass);
+
+    return hash.hash;
+}
+
+bool RenderCheckpoint::matches(uint64_t render_fingerprint,
+                               const RayTracerSettings& settings) const {
+    return this->render_fingerprint == render_fingerprint && width == settings.width &&
+           height == settings.height && tile_size == std::max(1u, settings.tile_size) &&
+           has_features == settings.feature_buffers;
+}
+
+void RenderCheckpoint::reset(uint64_t render_fingerprint, const RayTracerSettings& settings,
+                             unsigned int pass) {
+    this->render_fingerprint = render_fingerprint;
+    this->pass               = pass;
+    width                    = settings.width;
+    height                   = settings.height;
+    tile_size                = std::max(1u, settings.tile_size);
+    samples_per_pixel        = settings.samples_per_pixel;
+    sampler                  = settings.sampler;
+    sampler_seed             = settings.sampler_seed;
+    has_features             = settings.feature_buffers;
+    allocate();
+}
+
+void RenderCheckpoint::allocate() {
+    const unsigned int tiles_x = (width + tile_size - 1) / tile_size;
+    const unsigned int tiles_y = (height + tile_size - 1) / tile_size;
+    tiles_done.assign(static_cast<size_t>(tiles_x) * tiles_y, 0);
+
+    const size_t num_pixels = static_cast<size_t>(width) * height;
+    sums.assign(num_pixels, glm::vec3(0.0f));
+    sample_counts.assign(num_pixels, 0);
+    albedo_sums.assign(has_features ? num_pixels : 0, glm::vec3(0.0f));
+    normal_sums.assign(has_features ? num_pixels : 0, glm::vec3(0.0f));
+    depth_sums.assign(has_features ? num_pixels : 0, 0.0f);
+}
+
+bool RenderCheckpoint::save() const {
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary);
+        if (!out.is_open()) {
+            std::cout << "Unable to open " << temp_path << " for writing" << std::endl;
+            return false;
+        }
+
+        out.write(checkpoint_magic, sizeof(checkpoint_magic));
+        writeValue(out, checkpoint_version);
+        writeValue(out, render_fingerprint);
+        writeValue(out, static_cast<uint32_t>(width));
+        writeValue(out, static_cast<uint32_t>(height));
+        writeValue(out, static_cast<uint32_t>(tile_size));
+        writeValue(out, static_cast<uint32_t>(pass));
+        writeValue(out, static_cast<uint32_t>(samples_per_pixel));
+        writeValue(out, static_cast<uint32_t>(sampler));
+        writeValue(out, sampler_seed);
+        writeValue(out, static_cast<uint32_t>(has_features));
+        writeValue(out, static_cast<uint32_t>(tiles_done.size()));
+        out.write(reinterpret_cast<const char*>(tiles_done.data()), tiles_done.size());
+
+        TileScheduler layout(width, height, tile_size, 1);
+        for (const Tile& tile : layout.getTiles()) {
+            if (!tiles_done[tile.index]) {
+                continue;
+            }
+            for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+                for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+                    size_t pixel = static_cast<size_t>(y) * width + x;
+                    writeValue(out, sums[pixel]);
+                    writeValue(out, static_cast<uint32_t>(sample_counts[pixel]));
+                    if (has_features) {
+                        writeValue(out, albedo_sums[pixel]);
+                        writeValue(out, normal_sums[pixel]);
+                        writeValue(out, depth_sums[pixel]);
+                    }
+                }
+            }
+        }
+
+        if (!out.good()) {
+            std::cout << "Failed to write " << temp_path << std::endl;
+            return false;
+        }
+    }
+
+    // rename() does not replace an existing file everywhere
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(path.c_str());
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+            std::cout << "Unable to replace " << path << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RenderCheckpoint::load() {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+
+    char magic[sizeof(checkpoint_magic)];
+    uint32_t version = 0;
+    if (!in.read(magic, sizeof(magic)) ||
+        std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0 || !readValue(in, version) ||
+        version != checkpoint_version) {
+        std::cout << path << " is not a render checkpoint" << std::endl;
+        return false;
+    }
+
+    uint64_t file_fingerprint = 0;
+    uint32_t header[9];
+    if (!readValue(in, file_fingerprint) || !readValue(in, header)) {
+        std::cout << "Checkpoint " << path << " is truncated" << std::endl;
+        return false;
+    }
+
+    RenderCheckpoint loaded(path, save_interval);
+    loaded.render_fingerprint = file_fingerprint;
+    loaded.width              = header[0];
+    loaded.height             = header[1];
+    loaded.tile_size          = std::max(1u, header[2]);
+    loaded.pass               = header[3];
+    loaded.samples_per_pixel  = header[4];
+    loaded.sampler            = static_cast<SamplerType>(header[5]);
+    loaded.sampler_seed       = header[6];
+    loaded.has_features       = header[7] != 0;
+
+    loaded.allocate();
+
+    if (header[8] != loaded.tiles_done.size() ||
+        !in.read(reinterpret_cast<char*>(loaded.tiles_done.data()), loaded.tiles_done.size())) {
+        std::cout << "Checkpoint " << path << " is truncated" << std::endl;
+        return false;
+    }
+
+    TileScheduler layout(loaded.width, loaded.height, loaded.tile_size, 1);
+    for (const Tile& tile : layout.getTiles()) {
+        if (!loaded.tiles_done[tile.index]) {
+            continue;
+        }
+        for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+            for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+                size_t pixel     = static_cast<size_t>(y) * loaded.width + x;
+                uint32_t samples = 0;
+                bool ok          = readValue(in, loaded.sums[pixel]) && readValue(in, samples);
+                if (ok && loaded.has_features) {
+                    ok = readValue(in, loaded.albedo_sums[pixel]) &&
+                         readValue(in, loaded.normal_sums[pixel]) &&
+                         readValue(in, loaded.depth_sums[pixel]);
+                }
+                if (!ok) {
+                    std::cout << "Checkpoint " << path << " is truncated" << std::endl;
+                    return false;
+                }
+                loaded.sample_counts[pixel] = samples;
+            }
+        }
+    }
+
+    *this = std::move(loaded);
+    return true;
+}
+
+void RenderCheckpoint::remove() const {
+    std::remove(path.c_str());
+}
+
+unsigned int RenderCheckpoint::numTilesDone() const {
+    unsigned int count = 0;
+    for (unsigned char done : tiles_done) {
+        count += done;
+    }
+    return count;
+}
@@ -24,8 +24,9 @@ Renderer::Renderer(int window_width, int window_height, const unsigned int max_l
     multisample_texture = 0;
     screen_texture      = 0;
 
-    draw_normals = false;
-    use_pcf      = false;
+    draw_normals       = false;
+    use_pcf            = false;
+    raytraced_viewport = false;
 }
 
 Renderer::~Renderer() {
@@ -52,6 +53,11 @@ void Renderer::init() {
 }
 
 void Renderer::render(const RenderContext& render_context) {
+    if (raytraced_viewport) {
+        renderScreen();
+        return;
+    }
+
     renderPrep(render_context.camera);
 
     // Render scene
@@ -113,9 +119,9 @@ void Renderer::initFramebuffers() {
     glGenTextures(1, &multisample_texture);
     glGenRenderbuffers(1, &multisample_rbo);
 
-    // Colour attachment
+    // Colour attachment, same format as the screen texture since a multisample blit can't convert
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, subsamples, GL_RGB, window_width,
+    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, subsamples, GL_RGB16F, window_width,
                             window_height, GL_TRUE);
     glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -138,12 +144,13 @@ void Renderer::initFramebuffers() {
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    // Now for the intermediate framebuffer and the screen quad texture
+    // Now for the intermediate framebuffer and the screen quad texture. The texture is half float
+    // so that linear ray traced images keep their precision in the dark tones
     glGenFramebuffers(1, &intermediate_fbo);
     glGenTextures(1, &screen_texture);
 
     glBindTexture(GL_TEXTURE_2D, screen_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, window_width, window_height, 0, GL_RGB, GL_UNSIGNED_BYTE,
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, window_width, window_height, 0, GL_RGB, GL_FLOAT,
                  NULL);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -336,7 +343,7 @@ void Renderer::processScreenResize(int new_window_width, int new_window_height)
     window_height = new_window_height;
 
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, multisample_texture);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, subsamples, GL_RGB, window_width,
+    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, subsamples, GL_RGB16F, window_width,
                             window_height, GL_TRUE);
     glBindRenderbuffer(GL_RENDERBUFFER, multisample_rbo);
     glRenderbufferStorageMultisample(GL_RENDERBUFFER, subsamples, GL_DEPTH24_STENCIL8, window_width,
@@ -346,7 +353,7 @@ void Renderer::processScreenResize(int new_window_width, int new_window_height)
 
     // Now for the intermediate framebuffer and the screen quad texture
     glBindTexture(GL_TEXTURE_2D, screen_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, window_width, window_height, 0, GL_RGB, GL_UNSIGNED_BYTE,
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, window_width, window_height, 0, GL_RGB, GL_FLOAT,
                  NULL);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
@@ -535,11 +542,14 @@ void Renderer::renderGizmos(std::unordered_map<std::string, std::shared_ptr<Gizm
 }
 
 void Renderer::renderScreen() {
-    // Blit multisample framebuffer to intermediate framebuffer
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, multisample_fbo);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, intermediate_fbo);
-    glBlitFramebuffer(0, 0, window_width, window_height, 0, 0, window_width, window_height,
-                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    // Blit multisample framebuffer to intermediate framebuffer, unless the screen texture holds
+    // the ray traced image
+    if (!raytraced_viewport) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, multisample_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, intermediate_fbo);
+        glBlitFramebuffer(0, 0, window_width, window_height, 0, 0, window_width, window_height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
@@ -564,3 +574,39 @@ std::unordered_map<std::string, unsigned int>& Renderer::get_skyboxes() {
 void Renderer::setNumLights(unsigned int num_lights) {
     this->num_lights = num_lights;
 }
+
+void Renderer::uploadScreenImage(const Image& image) {
+    if (static_cast<int>(image.width) != window_width ||
+        static_cast<int>(image.height) != window_height) {
+        return;
+    }
+
+    screen_upload.resize(image.pixels.size());
+    for (unsigned int y = 0; y < image.height; ++y) {
+        std::copy(image.pixels.begin() + static_cast<size_t>(y) * image.width,
+                  image.pixels.begin() + static_cast<size_t>(y + 1) * image.width,
+                  screen_upload.begin() + static_cast<size_t>(image.height - 1 - y) * image.width);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, screen_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, window_width, window_height, GL_RGB, GL_FLOAT,
+                    screen_upload.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+Image Renderer::readScreenImage() const {
+    Image image(static_cast<unsigned int>(window_width), static_cast<unsigned int>(window_height));
+    std::vector<glm::vec3> rows(image.pixels.size());
+
+    glBindTexture(GL_TEXTURE_2D, screen_texture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, rows.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // OpenGL's rows start at the bottom
+    for (unsigned int y = 0; y < image.height; ++y) {
+        std::copy(rows.begin() + static_cast<size_t>(image.height - 1 - y) * image.width,
+                  rows.begin() + static_cast<size_t>(image.height - y) * image.width,
+                  image.pixels.begin() + static_cast<size_t>(y) * image.width);
+    }
+    return image;
+}
@@ -0,0 +1,248 @@
+#include <sampler.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+// Width and height of the tiled blue noise mask
+constexpr unsigned int blue_noise_size = 64;
+
+// Largest float below 1
+constexpr float one_minus_epsilon = 0x1.fffffep-1f;
+
+uint32_t hash(uint32_t x) {
+    // lowbias32 by Chris Wellons
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t hashCombine(uint32_t seed, uint32_t v) {
+    return seed ^ (hash(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+uint32_t reverseBits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Owen scrambling as a hash on reversed bits, every bit only depends on the bits above it
+// (Burley 2020, "Practical Hash-based Owen Scrambling")
+uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+// First two dimensions of the Sobol sequence, which together form a (0, 2)-sequence: every
+// power of two prefix has one point in every elementary interval
+uint32_t sobol0(uint32_t index) {
+    return reverseBits(index);
+}
+
+uint32_t sobol1(uint32_t index) {
+    uint32_t result    = 0;
+    uint32_t direction = 0x80000000u;
+    for (; index != 0; index >>= 1) {
+        if (index & 1u) {
+            result ^= direction;
+        }
+        direction ^= direction >> 1;
+    }
+    return result;
+}
+
+float toUnitFloat(uint32_t x) {
+    return std::min(static_cast<float>(x >> 8) * 0x1p-24f, one_minus_epsilon);
+}
+
+// Blue noise threshold mask, built with Ulichney's void and cluster method on a torus
+class BlueNoiseMask {
+public:
+    BlueNoiseMask()
+        : ranks(num_pixels) {
+        // Energy kernel, a Gaussian of the toroidal distance
+        constexpr float sigma = 1.5f;
+        kernel.resize(num_pixels);
+        for (unsigned int y = 0; y < blue_noise_size; ++y) {
+            for (unsigned int x = 0; x < blue_noise_size; ++x) {
+                float dx = static_cast<float>(std::min(x, blue_noise_size - x));
+                float dy = static_cast<float>(std::min(y, blue_noise_size - y));
+                kernel[y * blue_noise_size + x] =
+                    std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+            }
+        }
+
+        // Initial pattern of a tenth of the pixels, picked with a fixed hash so the mask is the
+        // same every run
+        std::vector<unsigned char> pattern(num_pixels, 0);
+        energy.assign(num_pixels, 0.0f);
+        unsigned int num_ones = num_pixels / 10;
+        for (unsigned int i = 0, placed = 0; placed < num_ones; ++i) {
+            unsigned int pixel = hash(i) % num_pixels;
+            if (!pattern[pixel]) {
+                pattern[pixel] = 1;
+                splat(pixel, 1.0f);
+                placed++;
+            }
+        }
+
+        // Move points from the tightest cluster to the largest void until that changes nothing
+        for (unsigned int swaps = 0; swaps < num_pixels; ++swaps) {
+            unsigned int cluster = tightestCluster(pattern);
+            pattern[cluster]     = 0;
+            splat(cluster, -1.0f);
+            unsigned int void_pixel = largestVoid(pattern);
+            pattern[void_pixel]     = 1;
+            splat(void_pixel, 1.0f);
+            if (void_pixel == cluster) {
+                break;
+            }
+        }
+        std::vector<unsigned char> prototype = pattern;
+        std::vector<float> prototype_energy  = energy;
+
+        // Ranks below the initial points, removing the tightest cluster every time
+        for (unsigned int rank = num_ones; rank-- > 0;) {
+            unsigned int cluster = tightestCluster(pattern);
+            pattern[cluster]     = 0;
+            splat(cluster, -1.0f);
+            ranks[cluster] = rank;
+        }
+
+        // Ranks above, filling the largest void every time
+        pattern = std::move(prototype);
+        energy  = std::move(prototype_energy);
+        for (unsigned int rank = num_ones; rank < num_pixels; ++rank) {
+            unsigned int void_pixel = largestVoid(pattern);
+            pattern[void_pixel]     = 1;
+            splat(void_pixel, 1.0f);
+            ranks[void_pixel] = rank;
+        }
+    }
+
+    // In [0, 1), uniformly distributed over the mask
+    [[nodiscard]] float value(unsigned int x, unsigned int y) const {
+        unsigned int rank =
+            ranks[(y % blue_noise_size) * blue_noise_size + (x % blue_noise_size)];
+        return (static_cast<float>(rank) + 0.5f) / static_cast<float>(num_pixels);
+    }
+
+private:
+    static constexpr unsigned int num_pixels = blue_noise_size * blue_noise_size;
+
+    void splat(unsigned int pixel, float sign) {
+        unsigned int px = pixel % blue_noise_size;
+        unsigned int py = pixel / blue_noise_size;
+        for (unsigned int y = 0; y < blue_noise_size; ++y) {
+            unsigned int ky = (y + blue_noise_size - py) % blue_noise_size;
+            for (unsigned int x = 0; x < blue_noise_size; ++x) {
+                unsigned int kx = (x + blue_noise_size - px) % blue_noise_size;
+                energy[y * blue_noise_size + x] += sign * kernel[ky * blue_noise_size + kx];
+            }
+        }
+    }
+
+    unsigned int tightestCluster(const std::vector<unsigned char>& pattern) const {
+        unsigned int best = 0;
+        float best_energy = -1.0f;
+        for (unsigned int i = 0; i < num_pixels; ++i) {
+            if (pattern[i] && energy[i] > best_energy) {
+                best        = i;
+                best_energy = energy[i];
+            }
+        }
+        return best;
+    }
+
+    unsigned int largestVoid(const std::vector<unsigned char>& pattern) const {
+        unsigned int best = 0;
+        float best_energy = 1e30f;
+        for (unsigned int i = 0; i < num_pixels; ++i) {
+            if (!pattern[i] && energy[i] < best_energy) {
+                best        = i;
+                best_energy = energy[i];
+            }
+        }
+        return best;
+    }
+
+    std::vector<unsigned int> ranks;
+    std::vector<float> kernel;
+    std::vector<float> energy;
+};
+
+const BlueNoiseMask& blueNoiseMask() {
+    // Built by the first thread that needs it, about a hundred milliseconds
+    static const BlueNoiseMask mask;
+    return mask;
+}
+} // namespace
+
+const char* samplerTypeName(SamplerType type) {
+    switch (type) {
+    case SamplerType::RANDOM:
+        return "Random";
+    case SamplerType::SOBOL:
+        return "Sobol";
+    case SamplerType::BLUE_NOISE:
+        return "Blue noise Sobol";
+    }
+    return "Unknown";
+}
+
+PixelSampler::PixelSampler(SamplerType type, unsigned int pixel_x, unsigned int pixel_y,
+                           uint32_t sample_index, uint32_t seed)
+    : type(type)
+    , pixel_x(pixel_x)
+    , pixel_y(pixel_y)
+    , sample_index(sample_index)
+    , sequence_seed(hash(seed))
+    , pixel_seed(hashCombine(hashCombine(sequence_seed, pixel_x), pixel_y)) {
+    if (type == SamplerType::BLUE_NOISE) {
+        // Build the mask now rather than part way through a path
+        blueNoiseMask();
+    }
+}
+
+float PixelSampler::get(unsigned int dimension) const {
+    const unsigned int pair      = dimension / 2;
+    const unsigned int component = dimension % 2;
+
+    switch (type) {
+    case SamplerType::RANDOM:
+        return toUnitFloat(hash(hashCombine(hashCombine(pixel_seed, sample_index), dimension)));
+    case SamplerType::SOBOL: {
+        uint32_t pair_seed = hashCombine(pixel_seed, pair);
+        uint32_t index     = nestedUniformScramble(sample_index, pair_seed);
+        uint32_t point     = component == 0 ? sobol0(index) : sobol1(index);
+        return toUnitFloat(nestedUniformScramble(point, hashCombine(pair_seed, component + 1)));
+    }
+    case SamplerType::BLUE_NOISE: {
+        // Same sequence in every pixel, rotated by the mask. Every dimension reads the mask at its
+        // own offset so the rotations of different dimensions are uncorrelated
+        uint32_t pair_seed = hashCombine(sequence_seed, pair);
+        uint32_t index     = nestedUniformScramble(sample_index, pair_seed);
+        uint32_t point     = component == 0 ? sobol0(index) : sobol1(index);
+        float value =
+            toUnitFloat(nestedUniformScramble(point, hashCombine(pair_seed, component + 1)));
+
+        uint32_t shift = hashCombine(sequence_seed, dimension + 0x10000u);
+        value += blueNoiseMask().value(pixel_x + (shift & 0xffffu), pixel_y + (shift >> 16));
+        return std::min(value - std::floor(value), one_minus_epsilon);
+    }
+    }
+    return 0.0f;
+}
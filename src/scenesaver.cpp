@@ -5,13 +5,7 @@ void saveScene(const App& app) {
 
     std::ofstream outfile(RESOURCES_PATH "/save_data/test.txt");
 
-    for (unsigned int i = 0; i < app.game_objects.size(); ++i) {
-
-        // Game object number
-        outfile << std::to_string(i) << " ";
-
-        outfile << app.game_objects[i]->dataToString();
-    }
+    outfile << sceneToString(app.game_objects);
 }
 void loadScene(App& app) {
     // Several assumptions being made in the implementation of this function:
@@ -21,40 +15,22 @@ void loadScene(App& app) {
     // Light class has the following data members: ambient, diffuse, specular,
     // constant, linear and quadratic
 
-    std::vector<std::shared_ptr<GameObject>> new_object_list;
-    unsigned int num_lights = 0;
-
     std::ifstream infile(RESOURCES_PATH "save_data/test.txt");
-    std::string str;
 
     if (infile.is_open()) {
-        while (std::getline(infile, str)) {
-            std::string temp;
-            std::stringstream ss(str);
-
-            ss >> temp; // Get rid of the number
-
-            ss >> temp; // Get object class type
-
-            unsigned int index = new_object_list.size();
-
-            if (temp == "Cube") {
-                new_object_list.push_back(createCubeFromData(str));
-            } else if (temp == "Arrow") {
-                new_object_list.push_back(createArrowFromData(str));
-            } else if (temp == "HollowCylinder") {
-                new_object_list.push_back(createHollowCylinderFromData(str));
-            } else if (temp == "Sphere") {
-                new_object_list.push_back(createSphereFromData(str));
-            } else {
-                std::cout << "Unexpected object type found in save data" << std::endl;
-            }
-            // Check if a light was added
-            if (new_object_list[index]->light) {
+        std::stringstream data;
+        data << infile.rdbuf();
+        infile.close();
+
+        std::vector<std::shared_ptr<GameObject>> new_object_list = sceneFromString(data.str());
+
+        // Check which objects are lights
+        unsigned int num_lights = 0;
+        for (const std::shared_ptr<GameObject>& object : new_object_list) {
+            if (object->light) {
                 num_lights++;
             }
         }
-        infile.close();
 
         app.game_objects = new_object_list;
         app.num_lights   = num_lights;
@@ -65,4 +41,47 @@ void loadScene(App& app) {
         return;
     }
 }
+
+std::string sceneToString(const std::vector<std::shared_ptr<GameObject>>& objects) {
+    std::string data;
+
+    for (unsigned int i = 0; i < objects.size(); ++i) {
+
+        // Game object number
+        data += std::to_string(i) + " ";
+
+        data += objects[i]->dataToString();
+    }
+
+    return data;
+}
+
+std::vector<std::shared_ptr<GameObject>> sceneFromString(const std::string& data) {
+    std::vector<std::shared_ptr<GameObject>> new_object_list;
+
+    std::stringstream lines(data);
+    std::string str;
+    while (std::getline(lines, str)) {
+        std::string temp;
+        std::stringstream ss(str);
+
+        ss >> temp; // Get rid of the number
+
+        ss >> temp; // Get object class type
+
+        if (temp == "Cube") {
+            new_object_list.push_back(createCubeFromData(str));
+        } else if (temp == "Arrow") {
+            new_object_list.push_back(createArrowFromData(str));
+        } else if (temp == "HollowCylinder") {
+            new_object_list.push_back(createHollowCylinderFromData(str));
+        } else if (temp == "Sphere") {
+            new_object_list.push_back(createSphereFromData(str));
+        } else {
+            std::cout << "Unexpected object type found in save data" << std::endl;
+        }
+    }
+
+    return new_object_list;
+}
 } // namespace SceneSaver
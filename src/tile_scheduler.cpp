@@ -0,0 +1,168 @@
+#include <tile_scheduler.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+TileSchedulerStats::TileSchedulerStats()
+    : tile_size(0)
+    , tiles_x(0)
+    , tiles_y(0)
+    , steals(0) {}
+
+Image TileSchedulerStats::timingMap(unsigned int width, unsigned int height) const {
+    Image image(width, height);
+    if (tile_times.empty() || tile_size == 0) {
+        return image;
+    }
+
+    float min_time = *std::min_element(tile_times.begin(), tile_times.end());
+    float max_time = *std::max_element(tile_times.begin(), tile_times.end());
+    float range    = std::max(max_time - min_time, 1e-6f);
+
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            unsigned int tile = std::min(y / tile_size, tiles_y - 1) * tiles_x +
+                                std::min(x / tile_size, tiles_x - 1);
+            float heat     = (tile_times[tile] - min_time) / range;
+            image.at(x, y) = glm::mix(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f),
+                                      heat);
+        }
+    }
+    return image;
+}
+
+TileScheduler::TileScheduler(unsigned int image_width, unsigned int image_height,
+                             unsigned int tile_size, unsigned int num_workers)
+    : num_workers(std::max(1u, num_workers))
+    , tiles_left(0) {
+    tile_size = std::max(1u, tile_size);
+
+    stats.tile_size = tile_size;
+    stats.tiles_x   = (image_width + tile_size - 1) / tile_size;
+    stats.tiles_y   = (image_height + tile_size - 1) / tile_size;
+
+    for (unsigned int ty = 0; ty < stats.tiles_y; ++ty) {
+        for (unsigned int tx = 0; tx < stats.tiles_x; ++tx) {
+            Tile tile;
+            tile.index = static_cast<unsigned int>(tiles.size());
+            tile.x0    = tx * tile_size;
+            tile.y0    = ty * tile_size;
+            tile.x1    = std::min(tile.x0 + tile_size, image_width);
+            tile.y1    = std::min(tile.y0 + tile_size, image_height);
+            tiles.push_back(tile);
+        }
+    }
+
+    stats.tile_times.assign(tiles.size(), 0.0f);
+    stats.tile_workers.assign(tiles.size(), 0);
+    stats.worker_busy_times.assign(this->num_workers, 0.0f);
+
+    // Hand out contiguous blocks of tiles so each worker starts on its own region of the image
+    for (unsigned int i = 0; i < this->num_workers; ++i) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (unsigned int i = 0; i < tiles.size(); ++i) {
+        unsigned int worker = static_cast<unsigned int>(
+            static_cast<unsigned long long>(i) * this->num_workers / tiles.size());
+        queues[worker]->tiles.push_back(i);
+    }
+    tiles_left = static_cast<unsigned int>(tiles.size());
+}
+
+void TileScheduler::run(const std::function<void(const Tile&, unsigned int)>& render_tile) {
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_workers; ++i) {
+        threads.emplace_back(&TileScheduler::workerLoop, this, i, std::cref(render_tile));
+    }
+    workerLoop(0, render_tile);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+const std::vector<Tile>& TileScheduler::getTiles() const {
+    return tiles;
+}
+
+void TileScheduler::workerLoop(unsigned int worker_index,
+                               const std::function<void(const Tile&, unsigned int)>& render_tile) {
+    float busy_time = 0.0f;
+
+    unsigned int tile_index;
+    while (true) {
+        if (!popLocal(worker_index, tile_index) && !steal(worker_index, tile_index)) {
+            // Every queue can look empty while a thief is moving the tiles it stole into its own,
+            // the work is only done once every tile has been taken
+            if (tiles_left.load() == 0) {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        tiles_left--;
+
+        auto start = std::chrono::steady_clock::now();
+
+        render_tile(tiles[tile_index], worker_index);
+
+        float time =
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start)
+                .count();
+        busy_time += time;
+
+        // Every tile is rendered exactly once so these writes never race
+        stats.tile_times[tile_index]   = time;
+        stats.tile_workers[tile_index] = worker_index;
+    }
+
+    stats.worker_busy_times[worker_index] = busy_time;
+}
+
+bool TileScheduler::popLocal(unsigned int worker_index, unsigned int& tile_index) {
+    WorkerQueue& queue = *queues[worker_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tiles.empty()) {
+        return false;
+    }
+    tile_index = queue.tiles.front();
+    queue.tiles.pop_front();
+    return true;
+}
+
+bool TileScheduler::steal(unsigned int worker_index, unsigned int& tile_index) {
+    for (unsigned int offset = 1; offset < num_workers; ++offset) {
+        WorkerQueue& victim = *queues[(worker_index + offset) % num_workers];
+
+        std::vector<unsigned int> stolen;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tiles.empty()) {
+                continue;
+            }
+            // Take half of what is left from the back, the victim keeps working from the front
+            size_t amount = (victim.tiles.size() + 1) / 2;
+            for (size_t i = 0; i < amount; ++i) {
+                stolen.push_back(victim.tiles.back());
+                victim.tiles.pop_back();
+            }
+        }
+
+        tile_index = stolen.back();
+        stolen.pop_back();
+
+        if (!stolen.empty()) {
+            WorkerQueue& own = *queues[worker_index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            // Keep the stolen tiles in image order
+            for (auto it = stolen.rbegin(); it != stolen.rend(); ++it) {
+                own.tiles.push_back(*it);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats.steals++;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,215 @@
+#include <tiled_image_writer.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+// Negative scales mark little endian PFMs
+bool littleEndian() {
+    const uint16_t value = 1;
+    unsigned char first_byte;
+    std::memcpy(&first_byte, &value, 1);
+    return first_byte == 1;
+}
+
+std::string siblingPath(const std::string& path, const std::string& suffix) {
+    const std::string extension = ".pfm";
+    if (path.size() >= extension.size() &&
+        path.compare(path.size() - extension.size(), extension.size(), extension) == 0) {
+        return path.substr(0, path.size() - extension.size()) + suffix;
+    }
+    return path + suffix;
+}
+} // namespace
+
+TiledImageWriter::TiledImageWriter()
+    : width(0)
+    , height(0)
+    , features(false)
+    , opened(false)
+    , failed(false)
+    , tiles_written(0) {}
+
+TiledImageWriter::~TiledImageWriter() {
+    close();
+}
+
+bool TiledImageWriter::open(const std::string& path, unsigned int width, unsigned int height,
+                            bool features) {
+    close();
+
+    this->width    = width;
+    this->height   = height;
+    this->features = features;
+    failed         = false;
+    tiles_written  = 0;
+
+    const std::string albedo_path = siblingPath(path, ".albedo.pfm");
+    const std::string normal_path = siblingPath(path, ".normal.pfm");
+    const std::string depth_path  = siblingPath(path, ".depth.pfm");
+    bool ok                       = openChannel(colour, path, 3);
+    if (ok && features) {
+        ok = openChannel(albedo, albedo_path, 3) && openChannel(normal, normal_path, 3) &&
+             openChannel(depth, depth_path, 1);
+    }
+
+    const std::string index_path = path + ".tiles";
+    if (ok) {
+        index.open(index_path, std::ios::trunc);
+        ok = index.is_open();
+        if (!ok) {
+            std::cout << "Unable to open " << index_path << " for writing" << std::endl;
+        }
+    }
+    if (!ok) {
+        opened = true; // So close() tidies up whatever did open
+        close();
+        return false;
+    }
+
+    index << "image " << width << " " << height << " " << path << "\n";
+    if (features) {
+        index << "aov albedo " << albedo_path << "\n";
+        index << "aov normal " << normal_path << "\n";
+        index << "aov depth " << depth_path << "\n";
+    }
+    index.flush();
+
+    opened = true;
+    return true;
+}
+
+bool TiledImageWriter::openChannel(Channel& channel, const std::string& channel_path,
+                                   unsigned int components) {
+    channel.file.open(channel_path, std::ios::in | std::ios::out | std::ios::binary |
+                                        std::ios::trunc);
+    if (!channel.file.is_open()) {
+        std::cout << "Unable to open " << channel_path << " for writing" << std::endl;
+        return false;
+    }
+    channel.components = components;
+
+    const std::string header = std::string(components == 3 ? "PF" : "Pf") + "\n" +
+                               std::to_string(width) + " " + std::to_string(height) + "\n" +
+                               (littleEndian() ? "-1.0" : "1.0") + "\n";
+    channel.file.write(header.data(), static_cast<std::streamsize>(header.size()));
+    channel.header_size = static_cast<std::streamoff>(header.size());
+
+    // Writing the last byte sizes the file, the rest reads as zero until written, which is black.
+    // Most filesystems do not even allocate it until then
+    const std::streamoff size =
+        channel.header_size + static_cast<std::streamoff>(width) * height * components * 4;
+    if (size > channel.header_size) {
+        channel.file.seekp(size - 1);
+        channel.file.put('\0');
+    }
+    if (!channel.file.good()) {
+        std::cout << "Unable to size " << channel_path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TiledImageWriter::writeTile(const Tile& tile, const Image& colour,
+                                 const FeatureBuffers* features) {
+    const unsigned int tile_width  = tile.x1 - tile.x0;
+    const unsigned int tile_height = tile.y1 - tile.y0;
+    if (!opened || tile.x1 > width || tile.y1 > height || colour.width != tile_width ||
+        colour.height != tile_height) {
+        return false;
+    }
+    if (this->features &&
+        (!features || features->albedo.width != tile_width ||
+         features->albedo.height != tile_height ||
+         features->depth.size() != colour.pixels.size())) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    writeRows(this->colour, tile, &colour.pixels[0].x);
+    if (this->features) {
+        writeRows(albedo, tile, &features->albedo.pixels[0].x);
+        writeRows(normal, tile, &features->normal.pixels[0].x);
+        writeRows(depth, tile, features->depth.data());
+    }
+
+    // The pixels have to be on their way to disk before the index lists the tile, or a crash in
+    // between would resume from a tile that was never written
+    for (Channel* channel : {&this->colour, &albedo, &normal, &depth}) {
+        if (channel->file.is_open()) {
+            channel->file.flush();
+            failed |= !channel->file.good();
+        }
+    }
+    if (failed) {
+        return false;
+    }
+    index << "tile " << tile.x0 << " " << tile.y0 << " " << tile.x1 << " " << tile.y1 << "\n";
+    index.flush();
+    if (!index.good()) {
+        failed = true;
+        return false;
+    }
+    tiles_written++;
+
+    return true;
+}
+
+void TiledImageWriter::writeRows(Channel& channel, const Tile& tile, const float* rows) {
+    const unsigned int tile_width = tile.x1 - tile.x0;
+    const size_t row_floats       = static_cast<size_t>(tile_width) * channel.components;
+    for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+        // Rows are stored bottom up
+        std::streamoff pixel = static_cast<std::streamoff>(height - 1 - y) * width + tile.x0;
+        channel.file.seekp(channel.header_size + pixel * channel.components * 4);
+        channel.file.write(reinterpret_cast<const char*>(rows + (y - tile.y0) * row_floats),
+                           static_cast<std::streamsize>(row_floats * sizeof(float)));
+    }
+    if (!channel.file.good()) {
+        failed = true;
+    }
+}
+
+bool TiledImageWriter::close() {
+    if (!opened) {
+        return true;
+    }
+    for (Channel* channel : {&colour, &albedo, &normal, &depth}) {
+        if (channel->file.is_open()) {
+            channel->file.flush();
+            failed |= !channel->file.good();
+            channel->file.close();
+        }
+    }
+    if (index.is_open()) {
+        index.close();
+    }
+    opened = false;
+
+    if (failed) {
+        std::cout << "Failed to write every tile of the image" << std::endl;
+    }
+    return !failed;
+}
+
+bool TiledImageWriter::isOpen() const {
+    return opened;
+}
+
+unsigned int TiledImageWriter::getWidth() const {
+    return width;
+}
+
+unsigned int TiledImageWriter::getHeight() const {
+    return height;
+}
+
+bool TiledImageWriter::hasFeatures() const {
+    return features;
+}
+
+unsigned int TiledImageWriter::numTilesWritten() const {
+    return tiles_written;
+}
@@ -0,0 +1,301 @@
+#include <wide_bvh.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+float nodeArea(const BVHNode& node) {
+    glm::vec3 extent = node.bounds_max - node.bounds_min;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+// Binary node that still needs to be turned into a wide node
+struct CollapseTask {
+    unsigned int wide_index;
+    unsigned int binary_index;
+    unsigned int depth;
+};
+
+template <unsigned int N>
+unsigned int laneMask(const WideBVHNode<N>& node) {
+    return (1u << node.num_children) - 1u;
+}
+
+template <unsigned int N>
+unsigned int testChildrenScalar(const WideBVHNode<N>& node, const WideRay& ray, float t_min,
+                                float t_max, float* t_entry) {
+    unsigned int mask = 0;
+    for (unsigned int lane = 0; lane < node.num_children; ++lane) {
+        float t_near = t_min;
+        float t_far  = t_max;
+        for (int axis = 0; axis < 3; ++axis) {
+            float t0 = (node.bounds_min[axis][lane] - ray.origin[axis]) * ray.inv_direction[axis];
+            float t1 = (node.bounds_max[axis][lane] - ray.origin[axis]) * ray.inv_direction[axis];
+            t_near   = std::max(t_near, std::min(t0, t1));
+            t_far    = std::min(t_far, std::max(t0, t1));
+        }
+        t_entry[lane] = t_near;
+        if (t_near <= t_far) {
+            mask |= 1u << lane;
+        }
+    }
+    return mask;
+}
+
+#if CPU_X86
+// 4 boxes per instruction, 8 wide nodes are tested in two halves
+template <unsigned int N>
+TARGET_SSE42 unsigned int testChildrenSSE42(const WideBVHNode<N>& node, const WideRay& ray,
+                                            float t_min, float t_max, float* t_entry) {
+    __m128 origin_x = _mm_set1_ps(ray.origin[0]);
+    __m128 origin_y = _mm_set1_ps(ray.origin[1]);
+    __m128 origin_z = _mm_set1_ps(ray.origin[2]);
+    __m128 inv_x    = _mm_set1_ps(ray.inv_direction[0]);
+    __m128 inv_y    = _mm_set1_ps(ray.inv_direction[1]);
+    __m128 inv_z    = _mm_set1_ps(ray.inv_direction[2]);
+    __m128 lower    = _mm_set1_ps(t_min);
+    __m128 upper    = _mm_set1_ps(t_max);
+
+    unsigned int mask = 0;
+    for (unsigned int base = 0; base < N; base += 4) {
+        __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds_min[0][base]), origin_x), inv_x);
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds_max[0][base]), origin_x), inv_x);
+        __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds_min[1][base]), origin_y), inv_y);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds_max[1][base]), origin_y), inv_y);
+        __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds_min[2][base]), origin_z), inv_z);
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds_max[2][base]), origin_z), inv_z);
+
+        __m128 t_near = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+                                   _mm_max_ps(_mm_min_ps(tz0, tz1), lower));
+        __m128 t_far  = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+                                   _mm_min_ps(_mm_max_ps(tz0, tz1), upper));
+
+        _mm_store_ps(t_entry + base, t_near);
+        mask |= static_cast<unsigned int>(_mm_movemask_ps(_mm_cmple_ps(t_near, t_far))) << base;
+    }
+    return mask & laneMask(node);
+}
+
+TARGET_AVX2 unsigned int testChildrenAVX2(const WideBVHNode<8>& node, const WideRay& ray,
+                                          float t_min, float t_max, float* t_entry) {
+    __m256 origin_x = _mm256_set1_ps(ray.origin[0]);
+    __m256 origin_y = _mm256_set1_ps(ray.origin[1]);
+    __m256 origin_z = _mm256_set1_ps(ray.origin[2]);
+    __m256 inv_x    = _mm256_set1_ps(ray.inv_direction[0]);
+    __m256 inv_y    = _mm256_set1_ps(ray.inv_direction[1]);
+    __m256 inv_z    = _mm256_set1_ps(ray.inv_direction[2]);
+
+    __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds_min[0]), origin_x), inv_x);
+    __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds_max[0]), origin_x), inv_x);
+    __m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds_min[1]), origin_y), inv_y);
+    __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds_max[1]), origin_y), inv_y);
+    __m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds_min[2]), origin_z), inv_z);
+    __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds_max[2]), origin_z), inv_z);
+
+    __m256 t_near =
+        _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+                      _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_set1_ps(t_min)));
+    __m256 t_far =
+        _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)),
+                      _mm256_min_ps(_mm256_max_ps(tz0, tz1), _mm256_set1_ps(t_max)));
+
+    _mm256_store_ps(t_entry, t_near);
+    unsigned int mask = static_cast<unsigned int>(
+        _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ)));
+    return mask & laneMask(node);
+}
+#endif
+
+template <unsigned int N>
+WideNodeKernel<N> selectKernel(CPU::SIMDLevel level);
+
+template <>
+WideNodeKernel<4> selectKernel<4>(CPU::SIMDLevel level) {
+#if CPU_X86
+    // A 4 wide node fills an SSE register, AVX2 has nothing more to offer
+    if (level >= CPU::SIMDLevel::SSE42) {
+        return testChildrenSSE42<4>;
+    }
+#endif
+    (void)level;
+    return testChildrenScalar<4>;
+}
+
+template <>
+WideNodeKernel<8> selectKernel<8>(CPU::SIMDLevel level) {
+#if CPU_X86
+    if (level >= CPU::SIMDLevel::AVX2) {
+        return testChildrenAVX2;
+    }
+    if (level >= CPU::SIMDLevel::SSE42) {
+        return testChildrenSSE42<8>;
+    }
+#endif
+    (void)level;
+    return testChildrenScalar<8>;
+}
+} // namespace
+
+WideRay::WideRay(const Ray& ray) {
+    for (int axis = 0; axis < 3; ++axis) {
+        origin[axis]        = ray.origin[axis];
+        inv_direction[axis] = 1.0f / ray.direction[axis];
+    }
+}
+
+template <unsigned int N>
+WideBVH<N>::WideBVH() {
+    setSIMDLevel(CPU::detectSIMDLevel());
+}
+
+template <unsigned int N>
+void WideBVH<N>::setSIMDLevel(CPU::SIMDLevel level) {
+    simd_level    = std::min(level, CPU::detectSIMDLevel());
+    test_children = selectKernel<N>(simd_level);
+}
+
+template <unsigned int N>
+CPU::SIMDLevel WideBVH<N>::getSIMDLevel() const {
+    return simd_level;
+}
+
+template <unsigned int N>
+void WideBVH<N>::build(const BVH& binary_bvh) {
+    auto start = std::chrono::steady_clock::now();
+
+    nodes.clear();
+    primitive_indices = binary_bvh.primitive_indices;
+    binary_lanes.assign(binary_bvh.nodes.size(), no_lane);
+
+    build_stats                = BVHBuildStats();
+    build_stats.num_primitives = static_cast<unsigned int>(primitive_indices.size());
+
+    if (binary_bvh.nodes.empty()) {
+        return;
+    }
+
+    const std::vector<BVHNode>& binary_nodes = binary_bvh.nodes;
+    float root_area                          = nodeArea(binary_nodes[0]);
+
+    nodes.reserve(binary_nodes.size() / (N - 1) + 1);
+    nodes.push_back(WideBVHNode<N>());
+
+    std::vector<CollapseTask> tasks;
+    tasks.push_back({0, 0, 0});
+
+    float cost = 0.0f;
+
+    while (!tasks.empty()) {
+        CollapseTask task = tasks.back();
+        tasks.pop_back();
+
+        build_stats.max_depth = std::max(build_stats.max_depth, task.depth);
+        if (root_area > 0.0f) {
+            cost += nodeArea(binary_nodes[task.binary_index]) / root_area;
+        }
+
+        // Start from the binary node's two children and keep opening up the interior child with
+        // the largest surface area, the one most likely to be hit, until the node is full
+        unsigned int children[N];
+        unsigned int num_children = 0;
+
+        const BVHNode& binary_node = binary_nodes[task.binary_index];
+        if (binary_node.count > 0) {
+            // Only happens for a root that is a leaf
+            children[num_children++] = task.binary_index;
+        } else {
+            children[num_children++] = binary_node.left_first;
+            children[num_children++] = binary_node.left_first + 1;
+        }
+
+        while (num_children < N) {
+            int largest       = -1;
+            float largest_area = -1.0f;
+            for (unsigned int i = 0; i < num_children; ++i) {
+                const BVHNode& child = binary_nodes[children[i]];
+                if (child.count == 0 && nodeArea(child) > largest_area) {
+                    largest      = static_cast<int>(i);
+                    largest_area = nodeArea(child);
+                }
+            }
+            if (largest == -1) {
+                break;
+            }
+            unsigned int opened       = children[largest];
+            children[largest]         = binary_nodes[opened].left_first;
+            children[num_children++] = binary_nodes[opened].left_first + 1;
+        }
+
+        WideBVHNode<N> node;
+        node.num_children = num_children;
+        for (unsigned int lane = 0; lane < N; ++lane) {
+            if (lane >= num_children) {
+                // Unused lanes are masked out by every kernel, give them an empty box anyway
+                for (int axis = 0; axis < 3; ++axis) {
+                    node.bounds_min[axis][lane] = std::numeric_limits<float>::max();
+                    node.bounds_max[axis][lane] = -std::numeric_limits<float>::max();
+                }
+                node.child[lane] = 0;
+                node.count[lane] = 0;
+                continue;
+            }
+
+            const BVHNode& child         = binary_nodes[children[lane]];
+            binary_lanes[children[lane]] = task.wide_index * N + lane;
+            for (int axis = 0; axis < 3; ++axis) {
+                node.bounds_min[axis][lane] = child.bounds_min[axis];
+                node.bounds_max[axis][lane] = child.bounds_max[axis];
+            }
+
+            if (child.count > 0) {
+                node.child[lane] = child.left_first;
+                node.count[lane] = child.count;
+                build_stats.num_leaves++;
+                if (root_area > 0.0f) {
+                    cost += nodeArea(child) / root_area * static_cast<float>(child.count);
+                }
+            } else {
+                node.child[lane] = static_cast<unsigned int>(nodes.size());
+                node.count[lane] = 0;
+                nodes.push_back(WideBVHNode<N>());
+                tasks.push_back({node.child[lane], children[lane], task.depth + 1});
+            }
+        }
+        nodes[task.wide_index] = node;
+    }
+
+    build_stats.num_nodes = static_cast<unsigned int>(nodes.size());
+    build_stats.sah_cost  = root_area > 0.0f ? cost : static_cast<float>(primitive_indices.size());
+    build_stats.build_time =
+        std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <unsigned int N>
+void WideBVH<N>::refit(const BVH& binary_bvh, const std::vector<unsigned int>& changed_nodes,
+                       std::vector<unsigned int>* changed_wide_nodes) {
+    for (unsigned int binary_index : changed_nodes) {
+        unsigned int lane_index = binary_lanes[binary_index];
+        if (lane_index == no_lane) {
+            continue;
+        }
+        WideBVHNode<N>& node = nodes[lane_index / N];
+        unsigned int lane    = lane_index % N;
+
+        const BVHNode& child = binary_bvh.nodes[binary_index];
+        for (int axis = 0; axis < 3; ++axis) {
+            node.bounds_min[axis][lane] = child.bounds_min[axis];
+            node.bounds_max[axis][lane] = child.bounds_max[axis];
+        }
+        if (changed_wide_nodes) {
+            changed_wide_nodes->push_back(lane_index / N);
+        }
+    }
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;